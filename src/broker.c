@@ -0,0 +1,2121 @@
+//broker.c//
+//------------//
+//This file contains psserver's broker: the topic registry, subscriber sets
+//and fan-out, and the handling of socket clients' commands. It is linked
+//into psserver and into libpsbroker (see broker.h).
+//------------//
+
+//our own source files
+#include "broker.h"
+#include "credit.h"
+#include "shared.h"
+#include "lock.h"
+#include "handoff.h"
+#include "pool.h"
+#include "timerwheel.h"
+
+//normal libraries
+// #include "csse2310a4.h"
+#include "csse2310a3.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <limits.h>
+#include <errno.h>
+
+//useful constants
+#define SPACE ' '
+#define NAME_CMD "name"
+#define SUB_CMD "sub"
+#define UNSUB_CMD "unsub"
+#define PUB_CMD "pub"
+#define ACKMODE_CMD "ackmode"
+#define ACK_CMD "ack"
+#define CREDIT_CMD "credit"
+#define PEER_CMD "peer"
+#define FOLLOW_CMD "follow"
+#define FETCH_CMD "fetch"
+#define PING_CMD "ping"
+#define PONG_CMD "pong"
+#define PING_MSG ":ping\n"
+#define PONG_MSG ":pong\n"
+#define BUSY_MSG ":busy\n"
+#define REDIRECT_MSG ":redirect %s\n"
+#define INVALID_MSG ":invalid\n"
+#define MAX_CMD_FIELDS 3
+#define EMPTY_STRING ""
+#define RETAIN_OPT "retain"
+#define RETAIN_ON "1"
+#define KEY_OPT "key"
+#define GROUP_OPT "group"
+#define BALANCE_OPT "balance"
+#define SHM_OPT "shm"
+#define SHM_ON "1"
+#define PENDING_OPT "pending"
+#define ROUND_ROBIN "rr"
+#define LEAST_QUEUED "least"
+//name in-process subscribers are given (see broker_subscribe())
+#define IN_PROCESS_NAME "(in-process)"
+//where replies to commands replayed by broker_restore_client() go
+#define DISCARD_PATH "/dev/null"
+//number of subscribers a topic needs before its fan-out is split between
+//the worker pool (see publish_message()), unless set otherwise
+#define DEFAULT_FANOUT_THRESHOLD 1024
+//number of subscribers in each chunk of a parallel fan-out
+#define FANOUT_CHUNK 64
+//max number of bytes read (and thrown away) from a client that is turned 
+//away (see reject_client())
+#define MAX_REJECT_DISCARD (4 * BUFSIZ)
+//max number of a connection's commands waiting for (or being run by) the
+//worker pool, beyond which the connection isn't read from
+#define MAX_QUEUED_COMMANDS 64
+//max number of a connection's commands a worker runs in a row before 
+//letting other tasks in
+#define COMMAND_BATCH 16
+//how long (ms) to wait before retrying a ping that couldn't be sent (eg:
+//as something else was being written to the client)
+#define PING_RETRY_MS 100
+
+/* Defines the PubOptions structure which holds the options that may prefix
+ * the value of a 'pub' command:
+ *
+ *      retain - true iff "retain=1" was given, ie: the value is to be kept
+ *               as the topic's retained value
+ *      key - value of "key=<key>" if given (NULL otherwise). Keyed values 
+ *            are always retained, and replace the value previously retained
+ *            under the same key
+ * */
+typedef struct {
+    bool retain;
+    char* key;
+} PubOptions;
+
+/* Defines the SubOptions structure which holds the options that may follow
+ * the topic of a 'sub' or 'unsub' command:
+ *
+ *      group - value of "group=<group>" if given (NULL otherwise), ie: the
+ *              consumer group to join/leave (see topic.h). Must be free()'d
+ *      balance - one of the BalanceCodes (see topic.h), given by 
+ *                "balance=rr" or "balance=least" (round robin by default).
+ *                Only used by the 'sub' that creates the group.
+ *      shm - true iff "shm=1" was given, ie: the client reads the topic 
+ *            from its shared memory ring (see shmring.h) instead
+ * */
+typedef struct {
+    char* group;
+    int balance;
+    bool shm;
+} SubOptions;
+
+
+/* Defines the Message structure which holds a message being published. 
+ * Socket clients are sent the message's frame (ie: "name:topic:value\n"), 
+ * while in-process subscribers (see broker_subscribe()) are given its parts,
+ * so each form is only made if it's needed:
+ *
+ *      name - name of the publisher (NULL until split out of the frame)
+ *      topic - topic published to
+ *      value - value published (NULL until split out of the frame)
+ *      frame - message frame (NULL until built from the parts)
+ *      buffer - memory made by message_frame() or message_parts(), free'd
+ *               by free_message()
+ * */
+typedef struct {
+    char* name;
+    char* topic;
+    char* value;
+    char* frame;
+    char* buffer;
+} Message;
+
+/* Defines the FanOut structure which holds a message being delivered to a
+ * large topic's subscribers in chunks, by the publisher and the worker pool
+ * at once (see fan_out_parallel()):
+ *
+ *      chunks - first list item of each chunk of FANOUT_CHUNK subscribers
+ *      numChunks - number of chunks
+ *      nextChunk - next chunk to be claimed
+ *      numDone - number of chunks delivered
+ *      finished - posted once every chunk has been delivered
+ *      refs - number of threads (the publisher and its helper tasks) still
+ *             using the structure, the last of which frees it
+ *      msg - message to deliver (only valid until finished is posted)
+ *      credit - credit of the publisher (NULL if they have none)
+ *      isFromPeer - true iff the message was forwarded by a linked peer
+ * */
+typedef struct {
+    ClientListItem** chunks;
+    int numChunks;
+    int nextChunk;
+    int numDone;
+    sem_t finished;
+    int refs;
+    Message* msg;
+    Credit* credit;
+    bool isFromPeer;
+} FanOut;
+
+/* Defines the Publish structure which holds a publish waiting its turn in 
+ * its topic's sequencer (see publish_message()). It's dynamically 
+ * allocated, as the publisher doesn't wait for it to be delivered:
+ *
+ *      item - the publish's place in the sequencer's queue
+ *      pool - worker pool (see ClientThreadArgs in broker.h)
+ *      fanoutThreshold - see ClientThreadArgs in broker.h
+ *      pending - publishes not yet delivered, this one included
+ *      entry - topic published to
+ *      msg - message to publish (its parts are copies, see new_publish())
+ *      parts - memory the message's parts were copied into
+ *      credit - credit of the publisher (NULL if they have none), charged
+ *               for the frame until it's delivered
+ *      isFromPeer - true iff the message was forwarded by a linked peer
+ * */
+typedef struct {
+    SequencedItem item;
+    WorkPool* pool;
+    int fanoutThreshold;
+    PendingPublishes* pending;
+    TopicEntry* entry;
+    Message msg;
+    char* parts;
+    Credit* credit;
+    bool isFromPeer;
+} Publish;
+
+/* Defines the SequenceTask structure which holds a topic's sequence that a
+ * publisher has handed to the worker pool to carry on delivering (see 
+ * deliver_sequence_task()). It only refers to state shared by every client
+ * thread, as the publisher may have disconnected by the time it runs:
+ *
+ *      pool - worker pool delivering it
+ *      stringMapLock - lock for the string map of topics
+ *      entry - topic whose sequence it is
+ * */
+typedef struct {
+    WorkPool* pool;
+    RwLock* stringMapLock;
+    TopicEntry* entry;
+} SequenceTask;
+
+/* Defines the CommandQueue structure which holds a connection's commands
+ * waiting to be run by the worker pool. The commands are run one at a time,
+ * in the order they were read, by whichever worker holds the queue's task
+ * (see run_commands()):
+ *
+ *      client - client the commands came from
+ *      cta - arguments given to the client's thread
+ *      commands - circular buffer of tokenised commands
+ *      head - index of the oldest command
+ *      numQueued - number of commands in the buffer
+ *      numPending - number of commands queued or being run
+ *      isScheduled - true iff the queue's task is in the pool (queued or
+ *                    running)
+ *      isDraining - true iff the client thread is waiting for the pending
+ *                   commands to finish (see drain_commands())
+ *      lock - lock protecting the above
+ *      room - counts how many more commands may be queued
+ *      drained - posted once the pending commands finish while isDraining
+ * */
+typedef struct {
+    Client* client;
+    ClientThreadArgs* cta;
+    char** commands[MAX_QUEUED_COMMANDS];
+    int head;
+    int numQueued;
+    int numPending;
+    bool isScheduled;
+    bool isDraining;
+    Mutex lock;
+    sem_t room;
+    sem_t drained;
+} CommandQueue;
+
+/* Defines the Liveness structure, which tracks whether a socket client is
+ * still there (see check_liveness()):
+ *
+ *      timer - the client's timer on the broker's timer wheel
+ *      client - client being tracked
+ *      cta - arguments given to the client's thread
+ *      fd - client's socket
+ *      lastActive - wheel time (see timer_wheel_now()) the client last sent
+ *                   a command at. Only the client's thread writes it, and 
+ *                   only the wheel's thread reads it.
+ *      lastPinged - wheel time the client was last pinged at
+ *      numWritten - number of frames written to the client (see Outbound in
+ *                   session.h) when it was last checked
+ *      lastRead - wheel time the client was last seen reading what's 
+ *                 written to it (ie: numWritten moved on)
+ * */
+typedef struct {
+    Timer timer;
+    Client* client;
+    ClientThreadArgs* cta;
+    int fd;
+    long lastActive;
+    long lastPinged;
+    long numWritten;
+    long lastRead;
+} Liveness;
+
+/* message_frame
+ * -------------
+ * Returns the given message's frame, building it from the message's parts
+ * if it hasn't been already.
+ * */
+char* message_frame(Message* msg) {
+    if (!msg->frame) {
+        msg->frame = build_message_frame(msg->name, msg->topic, msg->value);
+        msg->buffer = msg->frame;
+    }
+    return msg->frame;
+}
+
+/* message_parts
+ * -------------
+ * Splits the given message's frame into its name, topic and value, if that
+ * hasn't been done already (names and topics never contain colons).
+ * */
+void message_parts(Message* msg) {
+    if (msg->value) {
+        return;
+    }
+    msg->buffer = strdup(msg->frame);
+    msg->name = msg->buffer;
+    char* topic = strchr(msg->name, ':');
+    *topic++ = '\0';
+    char* value = strchr(topic, ':');
+    *value++ = '\0';
+    value[strcspn(value, "\n")] = '\0';
+    msg->topic = topic;
+    msg->value = value;
+}
+
+/* free_message
+ * ------------
+ * Frees whatever memory was made for the given message (but not the parts
+ * or frame it was created with).
+ * */
+void free_message(Message* msg) {
+    free(msg->buffer);
+}
+
+/* deliver_message
+ * ---------------
+ * Delivers a message to a single client: in-process subscribers are called
+ * back with its parts, and socket clients are sent its frame.
+ *
+ * client - client to deliver to
+ * msg - message to deliver
+ * credit - credit of the publisher (NULL if they have none)
+ *
+ * */
+void deliver_message(Client* client, Message* msg, Credit* credit) {
+    if (client->deliver) {
+        message_parts(msg);
+        client->deliver(client->deliverArg, msg->name, msg->topic, 
+                msg->value);
+    } else {
+        send_frame(client, message_frame(msg), credit);
+    }
+}
+
+/* handle_name_cmd
+ * ---------------
+ * Handles psserver receiving a 'name' command from a client.
+ *
+ * client - client who sent the command
+ * name - name client has assigned with the command
+ *
+ * NOTE: all error checking completed in handle_client_msg() (see below)
+ *
+ * */
+void handle_name_cmd(Client* client, char* name) { 
+    //ignore duplicate name
+    if (client->name) {
+        return; 
+    } 
+    client->name = name;
+    return;
+}
+
+/* update_interest
+ * ---------------
+ * Tells this node's peers (see federation.h) whether it still has local 
+ * subscribers for the given topic, after a local client has subscribed to
+ * or unsubscribed from it.
+ *
+ * NOTE: the check and the update happen under the same hold of the string
+ * map lock, so concurrent updates can't leave the peers with a stale view
+ *
+ * cta - ClientThreadArgs structure passed to the client thread
+ * entry - topic subscribed to/unsubscribed from
+ * topic - name of the topic
+ *
+ * */
+void update_interest(ClientThreadArgs* cta, TopicEntry* entry, char* topic) {
+    //nothing to do if not peered
+    if (!cta->federation->links) {
+        return;
+    }
+    take_write_lock(cta->stringMapLock);
+    advertise_interest(cta->federation, topic, has_local_subscribers(entry));
+    release_write_lock(cta->stringMapLock);
+}
+
+/* parse_sub_options
+ * -----------------
+ * Parses the options (see SubOptions above) given after the topic of a 
+ * 'sub' or 'unsub' command.
+ *
+ * optString - space separated options (NULL if none were given)
+ * opts - SubOptions structure to populate
+ *
+ * Returns:
+ *      true iff the options are validly configured, false otherwise (in 
+ *      which case there is nothing to free)
+ *
+ * */
+bool parse_sub_options(char* optString, SubOptions* opts) {
+    memset(opts, 0, sizeof(SubOptions));
+    opts->balance = BALANCE_ROUND_ROBIN;
+    if (!optString) {
+        return true;
+    }
+    char* optCopy = strdup(optString);
+    char** optToks = split_line(optCopy, SPACE);
+    char* optValue;
+    bool isValid = true;
+    for (int i = 0; optToks[i] && isValid; i++) {
+        if ((optValue = option_value(optToks[i], GROUP_OPT))) {
+            free(opts->group);
+            opts->group = strdup(optValue);
+            isValid = !has_space_colon_newline(optValue);
+        } else if ((optValue = option_value(optToks[i], BALANCE_OPT))) {
+            isValid = !strcmp(optValue, ROUND_ROBIN) || 
+                    !strcmp(optValue, LEAST_QUEUED);
+            opts->balance = strcmp(optValue, LEAST_QUEUED) ? 
+                    BALANCE_ROUND_ROBIN : BALANCE_LEAST_QUEUED;
+        } else if ((optValue = option_value(optToks[i], SHM_OPT))) {
+            opts->shm = !strcmp(optValue, SHM_ON);
+            isValid = opts->shm;
+        } else {
+            isValid = false;
+        }
+    }
+    free(optToks);
+    free(optCopy);
+    //a ring can't be shared out between a group
+    if (!isValid || (opts->shm && opts->group)) {
+        free(opts->group);
+        opts->group = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* send_retained
+ * -------------
+ * Sends the given topic's retained values (if it has any) to a client who
+ * has just subscribed to it, one frame at a time.
+ *
+ * client - client who subscribed
+ * entry - topic subscribed to
+ *
+ * */
+void send_retained(Client* client, TopicEntry* entry) {
+    char* retained = get_retained_value(entry);
+    char* frame = retained;
+    char* frameEnd;
+    while (frame && (frameEnd = strchr(frame, '\n'))) {
+        char endChar = frameEnd[1];
+        frameEnd[1] = '\0';
+        Message msg = {.frame = frame};
+        deliver_message(client, &msg, NULL);
+        free_message(&msg);
+        frameEnd[1] = endChar;
+        frame = frameEnd + 1;
+    }
+    free(retained);
+}
+
+/* handle_ring_sub
+ * ---------------
+ * Helper function for handle_sub_cmd() that subscribes a client to the 
+ * given topic's shared memory ring (see shmring.h), creating it if need be.
+ * The client is replied to with ":shm <topic> <path>", where <path> is 
+ * what the client opens the ring by, followed by the topic's retained 
+ * values (over the socket, as usual).
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * entry - topic which the client wishes to subscribe to
+ * topic - name of the topic
+ *
+ * Returns:
+ *      true iff client is successfully subscribed, false otherwise
+ *
+ * */
+bool handle_ring_sub(Client* client, ClientThreadArgs* cta, 
+        TopicEntry* entry, char* topic) {
+    take_write_lock(cta->stringMapLock);
+    if (!entry->ring) {
+        entry->ring = ring_create(topic);
+    }
+    ShmRing* ring = entry->ring;
+    release_write_lock(cta->stringMapLock);
+    if (!ring) {
+        return false;
+    }
+    char* reply = malloc(strlen(topic) + strlen(ring->path) + 
+            strlen(":shm  \n") + 1);
+    sprintf(reply, ":shm %s %s\n", topic, ring->path);
+    send_reply(client, reply);
+    free(reply);
+    update_stat(cta->stats, INC_SUB, cta->statsLock); 
+    update_interest(cta, entry, topic);
+    send_retained(client, entry);
+    return true;
+}
+
+/* handle_sub_cmd
+ * --------------
+ * Handles psserver receiving a 'sub' command from a client. If the topic 
+ * has a retained value, it is sent to the client straight away.
+ *
+ * If a group is given (see SubOptions above), the client instead joins that
+ * consumer group of the topic, and each message published to the topic goes
+ * to exactly one member of the group. Joining a group only takes the group's
+ * own lock, not the string map lock.
+ *
+ * NOTE: the retained value is read after the client is added to the topic,
+ * so a value published in between may be seen twice, but never missed.
+ * Consumer group members aren't sent retained values.
+ *
+ * If "shm=1" is given, the client instead reads the topic from its shared
+ * memory ring (see handle_ring_sub()).
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * topic - topic which the client wishes to subscribe to
+ * opts - options given with the command
+ *
+ * Returns:
+ *      true iff client is successfully subscribed, false otherwise
+ *
+ * */
+bool handle_sub_cmd(Client* client, ClientThreadArgs* cta, char* topic,
+        SubOptions* opts) { 
+    //ignore if client not named already
+    if (!client->name) {
+        return false;
+    }
+    TopicEntry* entry = find_or_add_topic(cta->stringMap, cta->stringMapLock,
+            topic);
+
+    //read from the topic's shared memory ring
+    if (opts->shm) {
+        return handle_ring_sub(client, cta, entry, topic);
+    }
+
+    //join consumer group
+    if (opts->group) {
+        ConsumerGroup* group = find_or_add_group(entry, opts->group,
+                opts->balance);
+        if (!join_group(group, client)) {
+            return false;
+        }
+        update_stat(cta->stats, INC_SUB, cta->statsLock); 
+        update_interest(cta, entry, topic);
+        return true;
+    }
+
+    take_write_lock(cta->stringMapLock);
+    //ignore request if client already subbed
+    if (search(entry->subscribers, client)) {
+        release_write_lock(cta->stringMapLock);
+        return false;
+    }
+    //add client to list of clients subbed to given topic
+    add_client(entry->subscribers, client);            
+    entry->numSubscribers++;
+    release_write_lock(cta->stringMapLock);
+    //log a successful sub request
+    update_stat(cta->stats, INC_SUB, cta->statsLock); 
+    if (!client->isPeer) {
+        update_interest(cta, entry, topic);
+    }
+
+    send_retained(client, entry);
+    return true;
+}
+
+/* handle_unsub_cmd
+ * ----------------
+ * Handles psserver receiving an 'unsub' command from a client.
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure that was passed to the client thread
+ * topic - topic which the client wishes to unsubscribe from
+ * group - consumer group to leave instead (NULL if just unsubscribing)
+ * isDisconnecting - true iff client is unsubscribing because they are 
+ *                   disconnecting, false if they are just normally 
+ *                   unsubscribing
+ * Returns: 
+ *      true iff client is successfully unsubscribed, false otherwise
+ *
+ * */
+bool handle_unsub_cmd(Client* client, ClientThreadArgs* cta, char* topic, 
+        char* group, bool isDisconnecting) { 
+
+    //ignore if client not named already
+    if (!client->name) {
+        return false;
+    }
+
+    //leave consumer group
+    if (group) {
+        take_read_lock(cta->stringMapLock);
+        TopicEntry* entry = stringmap_search(cta->stringMap, topic);
+        release_read_lock(cta->stringMapLock);
+        ConsumerGroup* consumerGroup = entry ? find_group(entry, group) : NULL;
+        if (!consumerGroup || !leave_group(consumerGroup, client)) {
+            return false;
+        }
+        update_interest(cta, entry, topic);
+        if (!isDisconnecting) {
+            update_stat(cta->stats, INC_UNSUB, cta->statsLock);
+        }
+        return true;
+    }
+
+    take_write_lock(cta->stringMapLock);
+
+    //find the given topic and remove the client from the linked list of 
+    //clients subscribed to it
+    TopicEntry* entry = stringmap_search(cta->stringMap, topic);
+    if (entry) {
+        //remove the client (returns new linked list of clients)
+        ClientListItem* newHead = remove_client(entry->subscribers, client);
+        if (newHead) {
+            //replace linked list of clients with new version
+            entry->subscribers = newHead; 
+            entry->numSubscribers--;
+        }
+        release_write_lock(cta->stringMapLock);
+
+        //log a successful sub request
+        //successful if: not disconnecting and client was in the list
+        if (!isDisconnecting && newHead) {
+            update_stat(cta->stats, INC_UNSUB, cta->statsLock);
+        }
+        if (newHead && !client->isPeer) {
+            update_interest(cta, entry, topic);
+        }
+        return newHead;
+    }
+    release_write_lock(cta->stringMapLock);
+    //topic doesn't exist
+    return false;
+}
+
+/* handle_ring_unsub
+ * -----------------
+ * Handles psserver receiving an 'unsub <topic> shm=1' command, telling the
+ * client (with ":unshm <topic>") to stop reading the topic's shared memory
+ * ring. Readers aren't tracked by psserver, so this is only a control 
+ * message for the client.
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure that was passed to the client thread
+ * topic - topic which the client wishes to unsubscribe from
+ *
+ * Returns: 
+ *      true iff the topic has a ring, false otherwise
+ *
+ * */
+bool handle_ring_unsub(Client* client, ClientThreadArgs* cta, char* topic) {
+    if (!client->name) {
+        return false;
+    }
+    take_read_lock(cta->stringMapLock);
+    TopicEntry* entry = stringmap_search(cta->stringMap, topic);
+    bool hasRing = entry && entry->ring;
+    release_read_lock(cta->stringMapLock);
+    if (!hasRing) {
+        return false;
+    }
+    char* reply = malloc(strlen(topic) + strlen(":unshm \n") + 1);
+    sprintf(reply, ":unshm %s\n", topic);
+    send_reply(client, reply);
+    free(reply);
+    update_stat(cta->stats, INC_UNSUB, cta->statsLock);
+    return true;
+}
+
+/* parse_pub_options
+ * -----------------
+ * Pops any options (see PubOptions above) off the front of the value given
+ * in a 'pub' command. Options may be given in any order.
+ *
+ * value - pointer to the value being published (modified in place)
+ * opts - PubOptions structure to populate
+ *
+ * Returns:
+ *      true iff the options are validly configured, false otherwise
+ *
+ * */
+bool parse_pub_options(char** value, PubOptions* opts) {
+    memset(opts, 0, sizeof(PubOptions));
+    char* optValue;
+    while (true) {
+        if ((optValue = pop_option(value, RETAIN_OPT))) {
+            opts->retain = !strcmp(optValue, RETAIN_ON);
+            free(optValue);
+            if (!opts->retain) {
+                return false;
+            }
+        } else if ((optValue = pop_option(value, KEY_OPT))) {
+            free(opts->key);
+            opts->key = optValue;
+            if (has_space_colon_newline(opts->key)) {
+                return false;
+            }
+        } else {
+            //no more options
+            return true;
+        }
+    }
+}
+
+/* unsub_all
+ * ---------
+ * Unsubscribes a disconnecting client from every topic and consumer group,
+ * so that nothing is published to them after they've gone.
+ *
+ * client - client who is disconnecting
+ * cta - ClientThreadArgs structure that was passed to the client thread
+ *
+ * */
+void unsub_all(Client* client, ClientThreadArgs* cta) {
+    StringMapItem* currItem = NULL;
+    take_write_lock(cta->stringMapLock);
+    while ((currItem = stringmap_iterate(cta->stringMap, currItem))) {
+        TopicEntry* entry = currItem->item;
+        ClientListItem* newHead = remove_client(entry->subscribers, client);
+        if (newHead) {
+            entry->subscribers = newHead;
+            entry->numSubscribers--;
+        }
+        leave_all_groups(entry, client);
+        //tell our peers if that was the topic's last local subscriber
+        if (cta->federation->links && !client->isPeer) {
+            advertise_interest(cta->federation, currItem->key,
+                    has_local_subscribers(entry));
+        }
+    }
+    release_write_lock(cta->stringMapLock);
+}
+
+/* deliver_to_subscribers
+ * ----------------------
+ * Delivers the given message to up to the given number of subscribers of a
+ * topic, starting from the given item of its list.
+ *
+ * clientItem - first item of the topic's list of subscribers to deliver to
+ * maxClients - max number of list items to go through
+ * msg - message to deliver
+ * credit - credit of the publisher (NULL if they have none)
+ * isFromPeer - true iff the message was forwarded by a linked peer, in 
+ *              which case it isn't sent back to peers
+ *
+ * */
+void deliver_to_subscribers(ClientListItem* clientItem, int maxClients,
+        Message* msg, Credit* credit, bool isFromPeer) {
+    //loop through the linked list of clients subed to the topic
+    Client* currClient;
+    for (int i = 0; clientItem && i < maxClients; i++) {
+        currClient = clientItem->client;
+        //NOTE: a topic with no clients is represented by a placeholder
+        //client, which is just the head of an otherwise-empty list
+        if (!clientItem->isPlaceholder && 
+                !(isFromPeer && currClient->isPeer)) { 
+            deliver_message(currClient, msg, credit);
+        }
+        clientItem = clientItem->next;
+    }
+}
+
+/* run_fan_out
+ * -----------
+ * Claims and delivers chunks of the given fan-out until there are none 
+ * left, posting its finished lock if the last chunk delivered was ours.
+ * */
+void run_fan_out(FanOut* fanOut) {
+    int chunk;
+    //NOTE: nothing else is touched until a chunk is claimed, as the message
+    //may be gone once every chunk has been
+    while ((chunk = __atomic_fetch_add(&fanOut->nextChunk, 1, 
+            __ATOMIC_RELAXED)) < fanOut->numChunks) {
+        deliver_to_subscribers(fanOut->chunks[chunk], FANOUT_CHUNK,
+                fanOut->msg, fanOut->credit, fanOut->isFromPeer);
+        if (__atomic_add_fetch(&fanOut->numDone, 1, __ATOMIC_ACQ_REL) ==
+                fanOut->numChunks) {
+            sem_post(&fanOut->finished);
+        }
+    }
+}
+
+/* release_fan_out
+ * ---------------
+ * Drops the calling thread's reference to the given fan-out, freeing it if
+ * that was the last one.
+ * */
+void release_fan_out(FanOut* fanOut) {
+    if (__atomic_sub_fetch(&fanOut->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        sem_destroy(&fanOut->finished);
+        free(fanOut->chunks);
+        free(fanOut);
+    }
+}
+
+/* fan_out_task
+ * ------------
+ * Worker pool task helping the publisher with a fan-out (see 
+ * fan_out_parallel()).
+ *
+ * arg - FanOut structure (void*)
+ *
+ * */
+void fan_out_task(void* arg) {
+    FanOut* fanOut = (FanOut*)arg;
+    run_fan_out(fanOut);
+    release_fan_out(fanOut);
+}
+
+/* fan_out_parallel
+ * ----------------
+ * Delivers the given message to every subscriber of a large topic by 
+ * splitting them into chunks, which the publisher and the worker pool 
+ * claim one at a time. Helpers blocked on (or just slower to reach) a busy
+ * socket simply claim fewer chunks, and the publisher does any chunks no 
+ * worker got to, so this never waits on a task that hasn't started. Returns
+ * once every subscriber has been delivered to.
+ *
+ * NOTE: the caller holds the string map lock (for reading) throughout, so 
+ * the list of subscribers can't change underneath the helpers
+ *
+ * pool - worker pool to split the fan-out between
+ * subscribers - topic's list of subscribers
+ * msg - message to deliver
+ * credit - credit of the publisher (NULL if they have none)
+ * isFromPeer - true iff the message was forwarded by a linked peer
+ *
+ * */
+void fan_out_parallel(WorkPool* pool, ClientListItem* subscribers,
+        Message* msg, Credit* credit, bool isFromPeer) {
+    FanOut* fanOut = calloc(1, sizeof(FanOut));
+    int maxChunks = 1;
+    fanOut->chunks = malloc(sizeof(ClientListItem*) * maxChunks);
+    //find the head of each chunk, and which forms of the message are needed
+    bool hasSocketClient = false;
+    bool hasInProcessClient = false;
+    int i = 0;
+    for (ClientListItem* item = subscribers; item; item = item->next, i++) {
+        if (i % FANOUT_CHUNK == 0) {
+            if (fanOut->numChunks == maxChunks) {
+                maxChunks *= 2;
+                fanOut->chunks = realloc(fanOut->chunks, 
+                        sizeof(ClientListItem*) * maxChunks);
+            }
+            fanOut->chunks[fanOut->numChunks++] = item;
+        }
+        hasInProcessClient |= item->client && item->client->deliver;
+        hasSocketClient |= item->client && !item->client->deliver;
+    }
+    //build them now, so the helpers only ever read the message
+    if (hasInProcessClient) {
+        message_parts(msg);
+    }
+    if (hasSocketClient) {
+        message_frame(msg);
+    }
+    fanOut->msg = msg;
+    fanOut->credit = credit;
+    fanOut->isFromPeer = isFromPeer;
+    sem_init(&fanOut->finished, 0, 0);
+    int numHelpers = fanOut->numChunks - 1 < pool->numWorkers ?
+            fanOut->numChunks - 1 : pool->numWorkers;
+    fanOut->refs = numHelpers + 1;
+    for (int j = 0; j < numHelpers; j++) {
+        pool_submit(pool, fan_out_task, fanOut);
+    }
+    run_fan_out(fanOut);
+    //wait for any chunks the helpers are still delivering
+    sem_wait(&fanOut->finished);
+    release_fan_out(fanOut);
+}
+
+/* deliver_publish
+ * ---------------
+ * Delivers a publish to every client subscribed to its topic, one member 
+ * of each of the topic's consumer groups and the topic's shared memory 
+ * ring (if it has one), then frees it. Called in the topic's sequence (see
+ * deliver_sequence()), so the topic's subscribers all see publishes in the
+ * same order.
+ *
+ * arg - Publish structure (void*)
+ *
+ * */
+void deliver_publish(void* arg) {
+    Publish* publish = (Publish*)arg;
+    TopicEntry* entry = publish->entry;
+    Message* msg = &publish->msg;
+    PendingPublishes* pending = publish->pending;
+    if (publish->pool && publish->fanoutThreshold && 
+            entry->numSubscribers >= publish->fanoutThreshold) {
+        fan_out_parallel(publish->pool, entry->subscribers, msg, 
+                publish->credit, publish->isFromPeer);
+    } else {
+        deliver_to_subscribers(entry->subscribers, INT_MAX, msg, 
+                publish->credit, publish->isFromPeer);
+    }
+    //(a group created while this runs just misses this message)
+    if (entry->groups) {
+        publish_to_groups(entry, message_frame(msg), publish->credit);
+    }
+    if (entry->ring) {
+        ring_write(entry->ring, message_frame(msg));
+    }
+    if (publish->credit) {
+        refund_credit(publish->credit, strlen(msg->frame));
+    }
+    free_message(msg);
+    free(publish->parts);
+    free(publish);
+
+    //wake anyone waiting for every publish to be delivered
+    if (!__atomic_sub_fetch(&pending->count, 1, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&pending->numWaiters, __ATOMIC_SEQ_CST)) {
+        futex_wake(&pending->count, INT_MAX);
+    }
+}
+
+bool wait_for_publishes(Broker* broker, struct timespec* deadline) {
+    PendingPublishes* pending = broker->pending;
+    __atomic_add_fetch(&pending->numWaiters, 1, __ATOMIC_SEQ_CST);
+    int count;
+    while ((count = __atomic_load_n(&pending->count, __ATOMIC_SEQ_CST)) &&
+            !(futex_wait(&pending->count, count, deadline) && 
+            errno == ETIMEDOUT)) {
+    }
+    __atomic_sub_fetch(&pending->numWaiters, 1, __ATOMIC_SEQ_CST);
+    return !__atomic_load_n(&pending->count, __ATOMIC_SEQ_CST);
+}
+
+/* copy_part
+ * ---------
+ * Helper function for new_publish() that copies the given part of a message
+ * (if it has it) to the given place, returning where the copy is (NULL if
+ * the message doesn't have the part) and moving the place along past it.
+ * */
+char* copy_part(char* part, char** place) {
+    if (!part) {
+        return NULL;
+    }
+    char* copy = *place;
+    *place = stpcpy(copy, part) + 1;
+    return copy;
+}
+
+/* new_publish
+ * -----------
+ * Returns a newly allocated Publish of the given message, holding its own
+ * copy of the message's parts (as the publisher doesn't wait for it to be 
+ * delivered). The publisher's credit (if they have any) is charged for the
+ * frame until it's delivered, so a publisher can't queue up more than 
+ * their credit in a topic's sequence.
+ *
+ * cta - arguments given to the publishing thread
+ * entry - topic published to
+ * msg - message to publish
+ * credit - credit of the publisher (NULL if they have none)
+ * isFromPeer - true iff the message was forwarded by a linked peer
+ *
+ * */
+Publish* new_publish(ClientThreadArgs* cta, TopicEntry* entry, Message* msg,
+        Credit* credit, bool isFromPeer) {
+    Publish* publish = calloc(1, sizeof(Publish));
+    publish->item.item = publish;
+    publish->pool = cta->pool;
+    publish->fanoutThreshold = cta->fanoutThreshold;
+    publish->pending = cta->pending;
+    publish->entry = entry;
+    publish->credit = credit;
+    publish->isFromPeer = isFromPeer;
+    char* parts[] = {msg->name, msg->topic, msg->value, msg->frame};
+    size_t length = 0;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(char*); i++) {
+        length += parts[i] ? strlen(parts[i]) + 1 : 0;
+    }
+    publish->parts = malloc(sizeof(char) * length);
+    char* place = publish->parts;
+    publish->msg.name = copy_part(msg->name, &place);
+    publish->msg.topic = copy_part(msg->topic, &place);
+    publish->msg.value = copy_part(msg->value, &place);
+    publish->msg.frame = copy_part(msg->frame, &place);
+    if (credit) {
+        charge_credit(credit, strlen(message_frame(&publish->msg)));
+    }
+    return publish;
+}
+
+/* deliver_sequence_task
+ * ---------------------
+ * Worker pool task carrying on delivering a topic's sequence (see 
+ * SequenceTask above), a batch at a time, until nothing is left queued in 
+ * it. Requeued between batches, so a busy topic can't keep a worker to 
+ * itself.
+ * */
+void deliver_sequence_task(void* arg) {
+    SequenceTask* task = (SequenceTask*)arg;
+    take_read_lock(task->stringMapLock);
+    bool isQueued = deliver_sequence(&task->entry->sequencer, 
+            deliver_publish);
+    release_read_lock(task->stringMapLock);
+    if (isQueued) {
+        pool_submit(task->pool, deliver_sequence_task, task);
+    } else {
+        free(task);
+    }
+}
+
+/* run_sequence
+ * ------------
+ * Delivers a batch of the given topic's sequence, which the caller has just
+ * taken ownership of (see queue_in_sequence()), handing the rest (if any) 
+ * to the worker pool rather than delivering it all.
+ *
+ * NOTE: the caller holds the string map lock (for reading)
+ *
+ * cta - arguments given to the publishing thread
+ * entry - topic published to
+ *
+ * */
+void run_sequence(ClientThreadArgs* cta, TopicEntry* entry) {
+    if (!deliver_sequence(&entry->sequencer, deliver_publish)) {
+        return;
+    }
+    if (!cta->pool) {
+        while (deliver_sequence(&entry->sequencer, deliver_publish)) {
+        }
+        return;
+    }
+    SequenceTask* task = malloc(sizeof(SequenceTask));
+    task->pool = cta->pool;
+    task->stringMapLock = cta->stringMapLock;
+    task->entry = entry;
+    pool_submit(cta->pool, deliver_sequence_task, task);
+}
+
+/* publish_message
+ * ---------------
+ * Publishes the given message to every client subscribed to its topic, and
+ * to one member of each of the topic's consumer groups. The message's frame
+ * is also written (once) into the topic's shared memory ring, if it has 
+ * one. Topics with at least the broker's fan-out threshold of subscribers
+ * are delivered to in parallel (see fan_out_parallel()), while smaller ones
+ * are delivered to by one thread alone.
+ *
+ * Concurrent publishes to the same topic are put into a single order by the
+ * topic's sequencer (see queue_in_sequence()), so every subscriber (and the
+ * ring) sees them in the same order. The publisher never waits for anyone
+ * else's publish: if the sequencer is idle they deliver a batch themself,
+ * handing any more that has queued up to the worker pool, and otherwise 
+ * they just queue the publish and return (so the message may still be being
+ * delivered). Publishes to different topics don't wait for each other.
+ *
+ * A retained publish is retained and appended to the replication log as 
+ * it's queued, under the sequencer's lock, so the topic's retained value, 
+ * its followers' log and its subscribers all see publishes in the same 
+ * order. In semi-synchronous mode the publisher then waits (up to 
+ * SYNC_TIMEOUT) for a follower to have it, once out of the string map lock,
+ * so neither other publishes nor subscribes are held up by the replication
+ * round trip.
+ *
+ * cta - arguments given to the thread
+ * msg - message to publish
+ * credit - credit of the publisher (NULL if they have none)
+ * retainKey - key to retain the message under (NO_KEY for a plain retained
+ *             value), NULL if it isn't retained
+ * isFromPeer - true iff the message was forwarded by a linked peer, in 
+ *              which case it is only sent to local subscribers
+ *
+ * Returns:
+ *      true iff the topic exists, false otherwise
+ *
+ * */
+bool publish_message(ClientThreadArgs* cta, Message* msg, Credit* credit,
+        char* retainKey, bool isFromPeer) {
+    long offset = 0;
+    take_read_lock(cta->stringMapLock);
+    TopicEntry* entry = stringmap_search(cta->stringMap, msg->topic);
+    if (entry) {
+        Publish* publish = new_publish(cta, entry, msg, credit, isFromPeer);
+        __atomic_add_fetch(&cta->pending->count, 1, __ATOMIC_SEQ_CST);
+        Sequencer* sequencer = &entry->sequencer;
+        bool isOwner;
+        if (retainKey) {
+            take_mutex(&sequencer->lock);
+            offset = retain_and_replicate(cta->replication, entry, 
+                    retainKey, message_frame(&publish->msg));
+            isOwner = queue_in_sequence(sequencer, &publish->item);
+            release_mutex(&sequencer->lock);
+        } else {
+            isOwner = queue_in_sequence(sequencer, &publish->item);
+        }
+        if (isOwner) {
+            run_sequence(cta, entry);
+        }
+    }
+    release_read_lock(cta->stringMapLock);
+    if (entry && retainKey) {
+        wait_for_followers(cta->replication, offset);
+    }
+    return entry;
+}
+
+/* deliver_from_peer
+ * -----------------
+ * Publishes a message forwarded by a linked peer to this node's local
+ * subscribers (see federation.h).
+ *
+ * arg - ClientThreadArgs structure (void*)
+ * topic - topic published to
+ * frame - message frame forwarded by the peer
+ *
+ * */
+void deliver_from_peer(void* arg, char* topic, char* frame) {
+    Message msg = {.topic = topic, .frame = frame};
+    publish_message((ClientThreadArgs*)arg, &msg, NULL, NULL, true);
+    free_message(&msg);
+}
+
+/* handle_pub_cmd
+ * --------------
+ * Handles psserver receiving a publish request from a client.
+ *
+ * If the value is prefixed with the "retain=1" option, it is also stored as
+ * the topic's retained value (creating the topic if need be), which is then
+ * delivered to every client that subscribes to the topic later on. If it is
+ * prefixed with "key=<key>", it replaces the value retained under that key,
+ * so the topic only ever retains the newest value per key. Retained values
+ * are replicated to this node's followers (see replication.h); in 
+ * semi-synchronous mode the command doesn't finish (so the client's next 
+ * command isn't run) until a follower has the value.
+ *
+ * Besides every subscriber, the value is also sent to one member of each of 
+ * the topic's consumer groups. Linked peers (see federation.h) subscribe to
+ * the topics they have local subscribers for, so the value is forwarded to
+ * exactly the peers that want it.
+ *
+ * client - structure representing client who sent the command
+ * cta - arguments given to the thread 
+ * toks - tokenised form of the sent command
+ *
+ * Returns:
+ *      true iff successful, false otherwise
+ *      NOTE: fails if the topic specified doesn't exist (and the value 
+ *      isn't retained), or the options are malformed
+ * */
+bool handle_pub_cmd(Client* client, ClientThreadArgs* cta, char** toks) {
+
+    //ignore if client not named already 
+    if (!client->name) {
+        return false;
+    }
+    
+    char* topic = toks[1]; //topic to publish to 
+    char* value = toks[2]; //value/msg to publish
+
+    //check whether the value is to be retained
+    PubOptions opts;
+    if (!parse_pub_options(&value, &opts)) {
+        free(opts.key);
+        return false;
+    }
+
+    //log successful pub command
+    update_stat(cta->stats, INC_PUB, cta->statsLock);
+
+    //build the frame outside of the string map lock
+    char* frame = build_message_frame(client->name, topic, value);
+    char* retainKey = NULL;
+    if (opts.retain || opts.key) {
+        //(retained in the topic's sequence, see deliver_publish())
+        find_or_add_topic(cta->stringMap, cta->stringMapLock, topic);
+        retainKey = opts.key ? opts.key : NO_KEY;
+    }
+
+    Message msg = {client->name, topic, value, frame};
+    bool isPublished = publish_message(cta, &msg, client->credit, retainKey,
+            false);
+    free(opts.key);
+    free(frame);
+    //fails iff topic doesn't exist
+    return isPublished;
+}
+
+/* parse_ackmode_options
+ * ---------------------
+ * Parses what's given after the window of an 'ackmode' command: the 
+ * redelivery timeout (if given) followed by "pending=<n>", the max number 
+ * of messages held back for room in the window (see send_frame() in 
+ * session.h).
+ *
+ * optString - space separated options (NULL if none were given)
+ * timeout - set to the timeout (ms) given, or DEFAULT_ACK_TIMEOUT
+ * maxPending - set to the max number given, or DEFAULT_MAX_PENDING
+ *
+ * Returns:
+ *      true iff the options are valid, false otherwise
+ *
+ * */
+bool parse_ackmode_options(char* optString, int* timeout, int* maxPending) {
+    *timeout = DEFAULT_ACK_TIMEOUT;
+    *maxPending = DEFAULT_MAX_PENDING;
+    if (!optString) {
+        return true;
+    }
+    char* optCopy = strdup(optString);
+    char** optToks = split_line(optCopy, SPACE);
+    char* optValue;
+    bool isValid = true;
+    for (int i = 0; optToks[i] && isValid; i++) {
+        if ((optValue = option_value(optToks[i], PENDING_OPT))) {
+            *maxPending = string_to_int(optValue);
+            isValid = *maxPending > 0;
+        } else if (!i) {
+            *timeout = string_to_int(optToks[i]);
+            isValid = *timeout > 0;
+        } else {
+            isValid = false;
+        }
+    }
+    free(optToks);
+    free(optCopy);
+    return isValid;
+}
+
+/* handle_ackmode_cmd
+ * ------------------
+ * Handles psserver receiving an 'ackmode' command from a client, which puts
+ * the client into acknowledged (at-least-once) mode. From then on, every 
+ * message sent to the client is prefixed with a delivery ID 
+ * (ie: "id:name:topic:value") and is resent until the client replies with 
+ * "ack <id>" (see session.h).
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * toks - tokenised form of the sent command, ie: 
+ *        "ackmode <window> [<timeout>] [pending=<n>]"
+ *
+ * Returns:
+ *      true iff the client is now in acknowledged mode, false otherwise
+ *
+ * */
+bool handle_ackmode_cmd(Client* client, ClientThreadArgs* cta, char** toks) {
+    //ignore if client not named already (sessions are found by name)
+    if (!client->name) {
+        return false;
+    }
+    int window = string_to_int(toks[1]);
+    int timeout, maxPending;
+    if (window <= 0 || 
+            !parse_ackmode_options(toks[2], &timeout, &maxPending)) {
+        return false;
+    }
+    return attach_session(cta->sessions, client, window, timeout, 
+            maxPending);
+}
+
+/* handle_credit_cmd
+ * -----------------
+ * Handles psserver receiving a 'credit' command from a client, which turns
+ * on flow control for the messages they publish. The client may then have
+ * at most the given number of bytes queued inside psserver (see credit.h);
+ * beyond that, psserver stops reading from them until the queues drain.
+ *
+ * client - client who sent the command
+ * limit - string form of the max number of bytes the client may have queued
+ *
+ * Returns:
+ *      true iff flow control is now on, false otherwise
+ *
+ * */
+bool handle_credit_cmd(Client* client, char* limit) {
+    int numBytes = string_to_int(limit);
+    //ignore if already on
+    if (numBytes <= 0 || client->credit) {
+        return false;
+    }
+    client->credit = credit_init(numBytes);
+    return true;
+}
+
+/* handle_peer_cmd
+ * ---------------
+ * Handles psserver receiving a 'peer' command, which marks the client as 
+ * another psserver node linking to this one (see federation.h). The client 
+ * is named after the ID the node gives.
+ *
+ * NOTE: must be the first command the node sends
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * id - ID the node gives itself
+ *
+ * Returns:
+ *      true iff the client is now a linked peer, false otherwise
+ *
+ * */
+bool handle_peer_cmd(Client* client, ClientThreadArgs* cta, char* id) {
+    //ignore if already named (ie: not the first command)
+    if (client->name) {
+        return false;
+    }
+    client->name = id;
+    //the peer's frames go straight to its stream from now on (see 
+    //send_frame())
+    flush_outbound(client, NULL);
+    register_peer(cta->federation, client);
+    return true;
+}
+
+/* handle_follow_cmd
+ * -----------------
+ * Handles psserver receiving a 'follow' command, which marks the client as
+ * another psserver node replicating this one's retained state (see 
+ * replication.h). The client is named after the ID the node gives.
+ *
+ * NOTE: must be the first command the node sends
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * id - ID the node gives itself
+ *
+ * Returns:
+ *      true iff the client is now a follower, false otherwise
+ *
+ * */
+bool handle_follow_cmd(Client* client, ClientThreadArgs* cta, char* id) {
+    //ignore if already named (ie: not the first command)
+    if (client->name || !register_follower(cta->replication, client, id)) {
+        return false;
+    }
+    client->name = id;
+    return true;
+}
+
+/* handle_fetch_cmd
+ * ----------------
+ * Handles psserver receiving a 'fetch' command from a follower, replying
+ * with the updates to its retained state from the given offset onwards
+ * (see replication.h).
+ *
+ * client - client who sent the command
+ * cta - ClientThreadArgs structure passed to the client thread
+ * offsetString - string form of the offset to fetch from
+ *
+ * Returns:
+ *      true iff the fetch was replied to, false otherwise
+ *
+ * */
+bool handle_fetch_cmd(Client* client, ClientThreadArgs* cta, 
+        char* offsetString) {
+    char* end;
+    long offset = strtol(offsetString, &end, 10);
+    if (!client->follower || *end || offset < 0 || !isdigit(*offsetString)) {
+        return false;
+    }
+    //batches are written straight to the follower's socket
+    flush_outbound(client, NULL);
+    send_fetch_batch(cta->replication, client, offset);
+    return true;
+}
+
+/* parse_command
+ * -------------
+ * Splits a command sent by a client into (at most) three tokens: the 
+ * command, its first argument and the rest of the line.
+ *
+ * Returns:
+ *      the malloc'd, NULL-terminated array of tokens
+ *
+ * */
+char** parse_command(char* msg) {
+    //tokenised form of given message
+    char** rawToks = split_line(strdup(msg), SPACE);
+    //tokenised form with maximum three strings
+    return split_line_max(rawToks, MAX_CMD_FIELDS);
+}
+
+/* is_pool_command
+ * ---------------
+ * Returns true iff the given (tokenised) command is one run by the worker 
+ * pool, ie: 'name', 'sub', 'unsub' or 'pub'. The rest change how the 
+ * connection itself is handled (eg: 'ackmode'/'peer'), so are run by its
+ * own thread.
+ * */
+bool is_pool_command(char** toks) {
+    return toks[0] && (!strcmp(toks[0], NAME_CMD) || 
+            !strcmp(toks[0], SUB_CMD) || !strcmp(toks[0], UNSUB_CMD) || 
+            !strcmp(toks[0], PUB_CMD));
+}
+
+/* run_command
+ * -----------
+ * Runs the given (tokenised) command sent by a client.
+ *
+ * toks - tokenised command (see parse_command())
+ * client - structure representing client who sent the command
+ * cta - arguments given to the client thread
+ *
+ * */
+void run_command(char** toks, Client* client, ClientThreadArgs* cta) {
+    int toksLen = string_array_length(toks);
+
+    //keepalives (see check_liveness()), which are just one word
+    if (toksLen == 1 && !strcmp(toks[0], PONG_CMD)) {
+        return;
+    }
+    if (toksLen == 1 && !strcmp(toks[0], PING_CMD)) {
+        send_reply(client, PONG_MSG);
+        return;
+    }
+
+    //invalid number of fields
+    if (toksLen < 2) {
+        send_reply(client, INVALID_MSG);
+        return;
+    }
+
+    //handle each of the command types
+    char* cmd = toks[0];
+    //options given with a sub/unsub command
+    SubOptions subOpts;
+    //name 
+    if (!strcmp(cmd, NAME_CMD) && toksLen == 2 &&
+            !has_space_colon_newline(toks[1])) {
+
+        handle_name_cmd(client, toks[1]);
+    //sub
+    } else if (!strcmp(cmd, SUB_CMD) && 
+            !has_space_colon_newline(toks[1]) &&
+            parse_sub_options(toks[2], &subOpts)) {
+
+        handle_sub_cmd(client, cta, toks[1], &subOpts);
+        free(subOpts.group);
+
+    //unsub
+    } else if (!strcmp(cmd, UNSUB_CMD) && 
+            !has_space_colon_newline(toks[1]) &&
+            parse_sub_options(toks[2], &subOpts)) {
+
+        if (subOpts.shm) {
+            handle_ring_unsub(client, cta, toks[1]);
+        } else {
+            handle_unsub_cmd(client, cta, toks[1], subOpts.group, false);
+        }
+        free(subOpts.group);
+
+    //pub
+    } else if (!strcmp(cmd, PUB_CMD) && toksLen >= 3 && 
+            !has_space_colon_newline(toks[1]) && 
+            strcmp(toks[2], EMPTY_STRING)) {
+
+        handle_pub_cmd(client, cta, toks);
+
+    //ackmode
+    } else if (!strcmp(cmd, ACKMODE_CMD)) {
+
+        handle_ackmode_cmd(client, cta, toks);
+
+    //ack
+    } else if (!strcmp(cmd, ACK_CMD) && toksLen == 2) {
+
+        ack_delivery(client, string_to_int(toks[1]));
+
+    //credit
+    } else if (!strcmp(cmd, CREDIT_CMD) && toksLen == 2) {
+
+        handle_credit_cmd(client, toks[1]);
+
+    //peer
+    } else if (!strcmp(cmd, PEER_CMD) && toksLen == 2 &&
+            !has_space_colon_newline(toks[1])) {
+
+        handle_peer_cmd(client, cta, toks[1]);
+
+    //follow
+    } else if (!strcmp(cmd, FOLLOW_CMD) && toksLen == 2 &&
+            !has_space_colon_newline(toks[1])) {
+
+        handle_follow_cmd(client, cta, toks[1]);
+
+    //fetch (invalid unless from a follower)
+    } else if (!strcmp(cmd, FETCH_CMD) && toksLen == 2 &&
+            handle_fetch_cmd(client, cta, toks[1])) {
+
+        //batch already sent
+
+    //invalid command type
+    } else {
+        send_reply(client, INVALID_MSG);
+    }
+}
+
+/* handle_client_msg
+ * -----------------
+ * Processes the user-given command and handles it accordingly (on the 
+ * calling thread).
+ *
+ * msg - command sent by user
+ * client - structure representing client who sent the command
+ * cta - arguments given to the client thread
+ *
+ * */
+void handle_client_msg(char* msg, Client* client, ClientThreadArgs* cta) {
+    run_command(parse_command(msg), client, cta);
+}
+
+/* run_commands
+ * ------------
+ * Worker pool task running the commands in a connection's queue, in order,
+ * until it's empty. After COMMAND_BATCH commands the task is requeued, so 
+ * a busy connection can't keep a worker to itself.
+ *
+ * arg - CommandQueue structure (void*)
+ *
+ * */
+void run_commands(void* arg) {
+    CommandQueue* queue = (CommandQueue*)arg;
+    for (int i = 0; i < COMMAND_BATCH; i++) {
+        take_mutex(&queue->lock);
+        char** toks = queue->commands[queue->head];
+        queue->head = (queue->head + 1) % MAX_QUEUED_COMMANDS;
+        queue->numQueued--;
+        release_mutex(&queue->lock);
+
+        run_command(toks, queue->client, queue->cta);
+
+        take_mutex(&queue->lock);
+        queue->numPending--;
+        bool isIdle = !queue->numPending;
+        bool isDrained = isIdle && queue->isDraining;
+        if (isIdle) {
+            queue->isScheduled = false;
+            queue->isDraining = false;
+        }
+        release_mutex(&queue->lock);
+        release_lock(&queue->room);
+        //NOTE: the queue may be gone once the client thread is woken
+        if (isDrained) {
+            release_lock(&queue->drained);
+        }
+        if (isIdle) {
+            return;
+        }
+    }
+    pool_submit(queue->cta->pool, run_commands, queue);
+}
+
+/* queue_command
+ * -------------
+ * Queues the given (tokenised) command to be run by the worker pool after 
+ * the connection's earlier commands, blocking while the connection already
+ * has MAX_QUEUED_COMMANDS pending.
+ * */
+void queue_command(CommandQueue* queue, char** toks) {
+    take_lock(&queue->room);
+    take_mutex(&queue->lock);
+    queue->commands[(queue->head + queue->numQueued) % 
+            MAX_QUEUED_COMMANDS] = toks;
+    queue->numQueued++;
+    queue->numPending++;
+    bool isScheduled = queue->isScheduled;
+    queue->isScheduled = true;
+    release_mutex(&queue->lock);
+    if (!isScheduled) {
+        pool_submit(queue->cta->pool, run_commands, queue);
+    }
+}
+
+/* drain_commands
+ * --------------
+ * Waits for every command the connection has queued (see queue_command())
+ * to finish running.
+ * */
+void drain_commands(CommandQueue* queue) {
+    take_mutex(&queue->lock);
+    bool isBusy = queue->numPending > 0;
+    queue->isDraining = isBusy;
+    release_mutex(&queue->lock);
+    if (isBusy) {
+        take_lock(&queue->drained);
+    }
+}
+
+/* init_client_thread_args
+ * -----------------------
+ * Initialises a ClientThreadArgs structure to pass to a client thread.
+ *
+ * stringMap - psserver's string map
+ * stats - psserver's statistics
+ * numAllowed - max number of connections allowed (as specified on command
+ *              line)
+ * 
+ * Returns:
+ *      the newly created ClientThreadArgs structure
+ *
+ * */
+ClientThreadArgs* init_client_thread_args(StringMap* stringMap, Stats* stats, 
+        int numAllowed) {
+
+    ClientThreadArgs* cta = malloc(sizeof(ClientThreadArgs));
+    memset(cta, 0, sizeof(ClientThreadArgs));
+    cta->stringMap = stringMap;
+    cta->stats = stats;
+
+    //stringMap lock
+    RwLock* smLock = malloc(sizeof(RwLock));
+    init_rwlock(smLock, "stringMapLock");
+    cta->stringMapLock = smLock;
+
+    //stats lock
+    Mutex* statsLock = malloc(sizeof(Mutex));
+    init_mutex(statsLock, "statsLock");
+    cta->statsLock = statsLock;
+
+    //access lock
+    Semaphore* accessLock = malloc(sizeof(Semaphore));
+    if (numAllowed == 0) {
+        init_semaphore(accessLock, INT_MAX, "accessLock");
+    } else {
+        init_semaphore(accessLock, numAllowed, "accessLock");
+    }
+
+    cta->accessLock = accessLock;
+
+    //acknowledged delivery sessions
+    cta->sessions = session_table_init();
+    cta->pending = calloc(1, sizeof(PendingPublishes));
+    cta->fanoutThreshold = DEFAULT_FANOUT_THRESHOLD;
+    return cta;
+}
+
+/* drop_client
+ * -----------
+ * Removes a socket client from the broker (its subscriptions, session,
+ * credit and any peer/follower registration), closes its socket and frees
+ * it.
+ *
+ * client - client to drop
+ * cta - arguments given to the client thread
+ *
+ * */
+void drop_client(Client* client, ClientThreadArgs* cta) {
+    //stop publishing to the client before closing their socket
+    unsub_all(client, cta);
+    detach_session(client);
+    drop_credit(client->credit);
+    unregister_peer(cta->federation, client);
+    unregister_follower(cta->replication, client);
+    //(no one can be sending to the client once it's unsubscribed)
+    close_outbound(client);
+    fclose(client->clientToServer);
+    fclose(client->serverToClient);
+    free(client);
+}
+
+/* send_ping
+ * ---------
+ * Sends ":ping" to the given client (through its outbound queue, so this 
+ * never blocks - it's called by the timer wheel's thread). The ping is only
+ * sent between frames: if anything is waiting to be written to the client,
+ * it isn't sent.
+ *
+ * client - client to ping
+ *
+ * Returns:
+ *      true iff the ping was sent
+ *
+ * */
+bool send_ping(Client* client) {
+    if (client->outbound && __atomic_load_n(&client->outbound->numQueued, 
+            __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    send_reply(client, PING_MSG);
+    return true;
+}
+
+/* check_liveness
+ * --------------
+ * Fire function of a socket client's timer (see timerwheel.h). A client 
+ * is active while it sends commands, or reads what's written to it (so a 
+ * subscriber that only listens isn't mistaken for idle while it's kept 
+ * busy, even though pings wait for a gap in its traffic). A client that has
+ * been inactive for the broker's idle timeout is disconnected: its socket
+ * is shut down, so its thread reads EOF and drops it as usual (freeing its
+ * connection). A client that has been inactive for the keepalive interval 
+ * is pinged (once per interval). Otherwise nothing is done, so a busy 
+ * client costs nothing more than recording the time of each command.
+ *
+ * arg - Liveness structure (void*)
+ *
+ * Returns:
+ *      how long (ms) until the client needs checking again, or TIMER_DONE
+ *      once it's been disconnected
+ *
+ * */
+long check_liveness(void* arg) {
+    Liveness* liveness = (Liveness*)arg;
+    ClientThreadArgs* cta = liveness->cta;
+    Client* client = liveness->client;
+    //links to other psserver nodes carry their own traffic (and reconnect 
+    //themselves), so are left alone
+    if (client->isPeer || client->follower) {
+        return TIMER_DONE;
+    }
+    long now = timer_wheel_now(cta->timers);
+    if (client->outbound) {
+        long numWritten = __atomic_load_n(&client->outbound->numWritten, 
+                __ATOMIC_RELAXED);
+        if (numWritten != liveness->numWritten) {
+            liveness->numWritten = numWritten;
+            liveness->lastRead = now;
+        }
+    }
+    long lastActive = __atomic_load_n(&liveness->lastActive, 
+            __ATOMIC_RELAXED);
+    if (liveness->lastRead > lastActive) {
+        lastActive = liveness->lastRead;
+    }
+    long quietFor = now - lastActive;
+    if (cta->idleMs && quietFor >= cta->idleMs) {
+        shutdown(liveness->fd, SHUT_RDWR);
+        update_stat(cta->stats, INC_IDLE_DROPPED, cta->statsLock);
+        return TIMER_DONE;
+    }
+    long nextCheck = cta->idleMs ? cta->idleMs - quietFor : LONG_MAX;
+    if (cta->keepaliveMs) {
+        if (quietFor >= cta->keepaliveMs && 
+                now - liveness->lastPinged >= cta->keepaliveMs &&
+                send_ping(client)) {
+            liveness->lastPinged = now;
+            //the ping being written doesn't show the client is reading
+            liveness->numWritten++;
+        }
+        long lastHeard = lastActive > liveness->lastPinged ? lastActive :
+                liveness->lastPinged;
+        long nextPing = lastHeard + cta->keepaliveMs - now;
+        if (nextPing <= 0) {
+            nextPing = PING_RETRY_MS;
+        }
+        nextCheck = nextPing < nextCheck ? nextPing : nextCheck;
+    }
+    return nextCheck;
+}
+
+/* track_liveness
+ * --------------
+ * Starts checking whether the given socket client is still there (see 
+ * check_liveness()), if the broker pings or disconnects idle clients.
+ *
+ * client - client to track
+ * cta - arguments given to the client's thread
+ *
+ * Returns:
+ *      the client's Liveness structure, or NULL if idle clients are left 
+ *      alone
+ *
+ * */
+Liveness* track_liveness(Client* client, ClientThreadArgs* cta) {
+    if (!cta->idleMs && !cta->keepaliveMs) {
+        return NULL;
+    }
+    Liveness* liveness = malloc(sizeof(Liveness));
+    liveness->client = client;
+    liveness->cta = cta;
+    liveness->fd = fileno(client->clientToServer);
+    liveness->lastActive = timer_wheel_now(cta->timers);
+    liveness->lastPinged = liveness->lastActive;
+    liveness->numWritten = 0;
+    liveness->lastRead = liveness->lastActive;
+    init_timer(&liveness->timer, check_liveness, liveness);
+    //whichever of the ping and the disconnect comes first
+    int firstCheck = cta->keepaliveMs && (!cta->idleMs || 
+            cta->keepaliveMs < cta->idleMs) ? cta->keepaliveMs : cta->idleMs;
+    arm_timer(cta->timers, &liveness->timer, firstCheck);
+    return liveness;
+}
+
+/* handle_client_thread
+ * --------------------
+ * Every time a new client joins, we spawn off a new thread which calls this
+ * function. Here, we handle commands sent by the client and update the 
+ * universal stats depending on what they give us.
+ *
+ * arg - ClientThreadArgs structure 
+ *
+ * Exits:
+ *      -when EOF read from the client (client disconnects)
+ *
+ * */
+void* handle_client_thread(void* arg) {
+    //our own copy of the shared arguments (see spawn_client_thread())
+    ClientThreadArgs* cta = (ClientThreadArgs*)arg;
+    //log a connected client
+    update_stat(cta->stats, INC_CLIENTS_CURR, cta->statsLock);
+    
+    int fd = cta->fd;
+    //clients handed over by a hot restart come with their state restored
+    Client* client = cta->client;
+    if (!client) {
+        client = create_client(NULL, fdopen(fd, "r"), fdopen(dup(fd), "w"));
+        client->outbound = outbound_init(cta->outboundWriter, fd);
+    }
+    FILE* clientToServer = client->clientToServer;
+    //commands run by the worker pool (see queue_command())
+    CommandQueue* commands = calloc(1, sizeof(CommandQueue));
+    commands->client = client;
+    commands->cta = cta;
+    init_mutex(&commands->lock, NULL);
+    init_lock(&commands->room, MAX_QUEUED_COMMANDS);
+    init_lock(&commands->drained, 0);
+    //pings/disconnects the client if it goes quiet
+    Liveness* liveness = track_liveness(client, cta);
+
+    char* line;
+    char** toks;
+    while (true) {
+        //stop reading while the client's publishing credit is used up
+        wait_for_credit(client->credit);
+        //a hot restart may only take the client over between commands (so
+        //the queued ones must finish first)
+        if (cta->handoff && !has_buffered_input(clientToServer)) {
+            drain_commands(commands);
+            handoff_wait(cta->handoff, fd, client);
+        }
+        if (!(line = read_line(clientToServer))) {
+            break;
+        }
+        if (liveness) {
+            __atomic_store_n(&liveness->lastActive, 
+                    timer_wheel_now(cta->timers), __ATOMIC_RELAXED);
+        }
+        //name/sub/unsub/pub are run by the worker pool, and the rest here
+        //once the connection's earlier commands have finished
+        toks = parse_command(line);
+        if (is_pool_command(toks)) {
+            queue_command(commands, toks);
+        } else {
+            drain_commands(commands);
+            run_command(toks, client, cta);
+        }
+    }
+    //(once cancelled, the timer can't be touching the client)
+    if (liveness) {
+        cancel_timer(cta->timers, &liveness->timer);
+        free(liveness);
+    }
+    drain_commands(commands);
+    sem_destroy(&commands->room);
+    sem_destroy(&commands->drained);
+    free(commands);
+
+    drop_client(client, cta);
+
+    //decrement number of current clients
+    update_stat(cta->stats, DEC_CLIENTS_CURR, cta->statsLock); 
+    //increment number of total clients ever connected
+    update_stat(cta->stats, INC_CLIENTS_ALL, cta->statsLock); 
+
+    //allows another waiting client to connect
+    release_semaphore(cta->accessLock);
+    handoff_unregister(cta->handoff);
+
+    fflush(stdout);
+    free(cta);
+    pthread_exit(NULL);
+}
+
+/* spawn_client_thread
+ * -------------------
+ * Spawns a new client thread (see handle_client_thread()) to deal with the
+ * client connected on the given socket.
+ *
+ * NOTE: the caller must already hold one of the broker's connections (ie:
+ * have taken the access lock)
+ *
+ * cta - ClientThreadArgs structure to pass to client threads
+ * fd - client's socket
+ * client - client restored by a hot restart (NULL for a new client)
+ *
+ * */
+void spawn_client_thread(ClientThreadArgs* cta, int fd, Client* client) {
+    //set new thread's network socket fd
+    ClientThreadArgs* clientArgs = malloc(sizeof(ClientThreadArgs));
+    *clientArgs = *cta;
+    clientArgs->fd = fd;
+    clientArgs->client = client;
+    //counted before it starts, so a hot restart waits for it to park
+    handoff_register(cta->handoff);
+
+    //spawn new thread
+    pthread_t threadId;
+
+    pthread_create(&threadId, NULL, handle_client_thread, clientArgs);
+
+    //ensures thread will give resouces back once terminated
+    pthread_detach(threadId);
+}
+
+/* take_connection
+ * ---------------
+ * Takes one of the broker's connections for a client of the given class,
+ * without blocking. A PRIORITY_NORMAL client may not take any of the last
+ * reservedConnections.
+ *
+ * cta - broker's ClientThreadArgs
+ * priority - one of the PriorityClasses
+ *
+ * Returns:
+ *      true iff a connection was taken (and must be released when the 
+ *      client disconnects)
+ *
+ * */
+bool take_connection(ClientThreadArgs* cta, int priority) {
+    if (!try_take_semaphore(cta->accessLock)) {
+        return false;
+    }
+    int numLeft;
+    if (priority == PRIORITY_NORMAL && cta->reservedConnections &&
+            !sem_getvalue(&cta->accessLock->sem, &numLeft) &&
+            numLeft < cta->reservedConnections) {
+        release_semaphore(cta->accessLock);
+        return false;
+    }
+    return true;
+}
+
+/* reject_client
+ * -------------
+ * Turns away the client connected on the given socket: tells it the broker
+ * is busy (or where to go instead) and closes the socket. The reply is 
+ * sent without blocking, and at most MAX_REJECT_DISCARD bytes the client 
+ * sent are read, so a client that isn't reading (or keeps sending) can't 
+ * hold up the listener.
+ *
+ * cta - broker's ClientThreadArgs
+ * fd - client's socket
+ * priority - one of the PriorityClasses
+ *
+ * */
+void reject_client(ClientThreadArgs* cta, int fd, int priority) {
+    char* reply = BUSY_MSG;
+    char* redirectReply = NULL;
+    if (cta->redirect) {
+        redirectReply = malloc(strlen(REDIRECT_MSG) + strlen(cta->redirect));
+        sprintf(redirectReply, REDIRECT_MSG, cta->redirect);
+        reply = redirectReply;
+    }
+    send(fd, reply, strlen(reply), MSG_DONTWAIT | MSG_NOSIGNAL);
+    free(redirectReply);
+    //throw away what the client already sent, so closing the socket 
+    //doesn't reset it (and lose the reply) before the client reads it. Only
+    //so much is thrown away, so a client that keeps sending can't hold up
+    //the listener (it may lose the reply instead).
+    shutdown(fd, SHUT_WR);
+    char discard[BUFSIZ];
+    ssize_t numRead;
+    for (size_t numDiscarded = 0; numDiscarded < MAX_REJECT_DISCARD &&
+            (numRead = recv(fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0;
+            numDiscarded += numRead) {
+    }
+    close(fd);
+    update_stat(cta->stats, priority == PRIORITY_HIGH ? 
+            INC_REJECTED_PRIORITY : INC_REJECTED, cta->statsLock);
+}
+
+/* connection_priority
+ * -------------------
+ * Works out the class of a client from the address it connected from.
+ *
+ * cta - broker's ClientThreadArgs
+ * addr - client's address (as given by accept())
+ *
+ * Returns:
+ *      PRIORITY_HIGH for Unix domain socket clients and clients from the
+ *      broker's priority hosts, PRIORITY_NORMAL otherwise
+ *
+ * */
+int connection_priority(ClientThreadArgs* cta, struct sockaddr* addr) {
+    if (addr->sa_family == AF_UNIX) {
+        return PRIORITY_HIGH;
+    }
+    if (!cta->priorityHosts) {
+        return PRIORITY_NORMAL;
+    }
+    char host[INET6_ADDRSTRLEN];
+    void* hostAddr = addr->sa_family == AF_INET ?
+            (void*)&((struct sockaddr_in*)addr)->sin_addr :
+            (void*)&((struct sockaddr_in6*)addr)->sin6_addr;
+    if (!inet_ntop(addr->sa_family, hostAddr, host, sizeof(host))) {
+        return PRIORITY_NORMAL;
+    }
+    for (int i = 0; cta->priorityHosts[i]; i++) {
+        if (!strcmp(cta->priorityHosts[i], host)) {
+            return PRIORITY_HIGH;
+        }
+    }
+    return PRIORITY_NORMAL;
+}
+
+void server_infinite_loop(int listenFd, ClientThreadArgs* cta) {
+    while (true) {
+        //park here during a hot restart (see handoff.h)
+        handoff_wait(cta->handoff, listenFd, NULL);
+
+        //Block waiting for a new connection (accepted even when the broker
+        //is full, so it can be turned away at once rather than left 
+        //waiting in the backlog)
+        struct sockaddr_storage addr;
+        socklen_t addrLen = sizeof(addr);
+        int fd = accept(listenFd, (struct sockaddr*)&addr, &addrLen);
+        if (fd < 0) {
+            continue;
+        }
+        broker_admit_client(cta, fd, 
+                connection_priority(cta, (struct sockaddr*)&addr));
+    }
+}
+
+void broker_add_client(Broker* broker, int fd) {
+    take_semaphore(broker->accessLock);
+    spawn_client_thread(broker, fd, NULL);
+}
+
+bool broker_admit_client(Broker* broker, int fd, int priority) {
+    if (!take_connection(broker, priority)) {
+        reject_client(broker, fd, priority);
+        return false;
+    }
+    spawn_client_thread(broker, fd, NULL);
+    return true;
+}
+
+Client* broker_restore_client(Broker* broker, int fd, char* replay) {
+    Client* client = create_client(NULL, fdopen(fd, "r"), 
+            fdopen(dup(fd), "w"));
+    FILE* serverToClient = client->serverToClient;
+    client->serverToClient = fopen(DISCARD_PATH, "w");
+    char* command = replay;
+    char* commandEnd;
+    while ((commandEnd = strchr(command, '\n'))) {
+        *commandEnd = '\0';
+        handle_client_msg(command, client, broker);
+        command = commandEnd + 1;
+    }
+    fclose(client->serverToClient);
+    client->serverToClient = serverToClient;
+    //(frames published during the replay went to the discarded replies)
+    client->outbound = outbound_init(broker->outboundWriter, fd);
+    return client;
+}
+
+bool broker_serve_client(Broker* broker, Client* client) {
+    if (!try_take_semaphore(broker->accessLock)) {
+        drop_client(client, broker);
+        return false;
+    }
+    spawn_client_thread(broker, fileno(client->clientToServer), client);
+    return true;
+}
+
+Broker* broker_init(int maxConnections, char* id, bool isSemiSync) {
+    //initialise shared string map and statistics
+    ClientThreadArgs* cta = init_client_thread_args(stringmap_init(),
+            stats_init(), maxConnections);
+    //initialise replication of retained state (see replication.h)
+    cta->replication = replication_init(id, isSemiSync, cta->stringMap,
+            cta->stringMapLock);
+    //links to other psserver nodes are added by the caller (if any)
+    cta->federation = federation_init(id, deliver_from_peer, cta);
+    //workers the fan-out of large topics is split between
+    cta->pool = pool_init(default_pool_size());
+    //writes clients' outbound queues (with the pool)
+    cta->outboundWriter = outbound_writer_init(cta->pool, cta->stats,
+            cta->statsLock);
+    //checks on idle clients (only turned if they're pinged/disconnected)
+    cta->timers = timer_wheel_init();
+    return cta;
+}
+
+void broker_start(Broker* broker) {
+    //start thread resending unacknowledged deliveries
+    start_redelivery_thread(broker->sessions);
+    //start workers (see publish_message())
+    start_pool(broker->pool);
+    //start waiting on full client sockets (see session.h)
+    start_outbound_writer(broker->outboundWriter);
+    //start checking on idle clients (see check_liveness())
+    if (broker->idleMs || broker->keepaliveMs) {
+        start_timer_wheel(broker->timers);
+    }
+    //link to other psserver nodes
+    start_peer_links(broker->federation);
+}
+
+Client* broker_subscribe(Broker* broker, char* topic, BrokerCallback callback,
+        void* arg) {
+    if (has_space_colon_newline(topic) || !strcmp(topic, EMPTY_STRING)) {
+        return NULL;
+    }
+    Client* client = create_client(IN_PROCESS_NAME, NULL, NULL);
+    client->deliver = callback;
+    client->deliverArg = arg;
+    SubOptions opts;
+    parse_sub_options(NULL, &opts);
+    handle_sub_cmd(client, broker, topic, &opts);
+    return client;
+}
+
+void broker_unsubscribe(Broker* broker, char* topic, Client* subscription) {
+    //once out of the topic's subscribers (under the string map lock), the
+    //callback can't be in progress or called again
+    handle_unsub_cmd(subscription, broker, topic, NULL, false);
+    free(subscription);
+}
+
+bool broker_publish(Broker* broker, char* name, char* topic, char* value) {
+    if (has_space_colon_newline(name) || has_space_colon_newline(topic) ||
+            !strcmp(value, EMPTY_STRING) || strchr(value, '\n')) {
+        return false;
+    }
+    update_stat(broker->stats, INC_PUB, broker->statsLock);
+    //the frame is only built if something needs it (see deliver_message())
+    Message msg = {name, topic, value, NULL};
+    bool isPublished = publish_message(broker, &msg, NULL, NULL, false);
+    free_message(&msg);
+    return isPublished;
+}
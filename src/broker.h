@@ -0,0 +1,317 @@
+//broker.h//
+//----------------------//
+//broker.c is psserver's broker: the topic registry, subscriber sets and
+//fan-out, along with the handling of socket clients. It is built into
+//psserver, and into libpsbroker for embedding in other programs.
+//----------------------//
+
+#ifndef BROKER
+#define BROKER
+
+#include "clientList.h"
+#include "topic.h"
+#include "session.h"
+#include "federation.h"
+#include "replication.h"
+#include "stringmap.h"
+#include "stats.h"
+#include "lock.h"
+#include "pool.h"
+#include "timerwheel.h"
+#include <semaphore.h>
+
+struct Handoff;
+
+/* Each of these constants encodes a class of connection, which decides how
+ * close to its max number of connections the broker still accepts it (see
+ * broker_admit_client()):
+ *
+ *      PRIORITY_NORMAL - turned away once only the reserved connections 
+ *                        are left
+ *      PRIORITY_HIGH - turned away only once there are no connections left
+ *                      at all (eg: Unix domain socket clients and clients 
+ *                      from the broker's priority hosts)
+ * */
+enum PriorityClasses {
+    PRIORITY_NORMAL,
+    PRIORITY_HIGH
+};
+
+/* Defines the PendingPublishes structure, shared by every client thread, 
+ * which counts the publishes queued in topics' sequencers but not yet 
+ * delivered (see publish_message() in broker.c), so a hot restart can wait 
+ * for them (see wait_for_publishes()):
+ *
+ *      count - number of publishes not yet delivered (a futex word)
+ *      numWaiters - number of threads waiting for count to reach 0
+ * */
+typedef struct {
+    int count;
+    int numWaiters;
+} PendingPublishes;
+
+/* Defines the ClientThreadArgs structure which holds all arguments we
+ * wish to pass to a client thread. The arguments are as follows:
+ *
+ *      fd - network socket (each client thread is given its own copy of the
+ *           structure, see broker_add_client())
+ *      stringMap - stringMap storing mappings from topic keys to TopicEntry
+ *                  structures (see topic.h), which hold the linked list of
+ *                  clients subscribing to the topic
+ *      stringMapLock - reader-writer lock for the stringMap (which is shared
+ *                      between threads). Publishes only read it, so they
+ *                      share the lock
+ *      stats - Stats structure storing psserver's statistics (see Stats.h)
+ *      statsLock - lock for the stats data (which is shared between threads)
+ *      accessLock - connection-limiting lock
+ *      sessions - acknowledged delivery sessions (see session.h)
+ *      federation - links to other psserver nodes (see federation.h)
+ *      replication - replication of retained state to/from other psserver
+ *                    nodes (see replication.h)
+ *      handoff - psserver's side of hot restarts (see handoff.h), NULL 
+ *                unless enabled
+ *      client - client restored by a hot restart (see 
+ *               broker_restore_client()), NULL for a newly connected one
+ *      pool - worker pool the fan-out of large topics is split between 
+ *             (see pool.h)
+ *      outboundWriter - writer of socket clients' outbound queues (see 
+ *                       session.h)
+ *      fanoutThreshold - number of subscribers a topic needs for its 
+ *                        fan-out to be split between the pool (0 to never
+ *                        split it)
+ *      timers - timer wheel checking for idle connections (see 
+ *               timerwheel.h)
+ *      idleMs - time (ms) a socket client may send nothing for before it's
+ *               disconnected (0 to never disconnect idle clients)
+ *      keepaliveMs - time (ms) a socket client may send nothing for before
+ *                    it's sent ":ping" (0 to never ping). A "pong" (or any
+ *                    other command) shows it's still there.
+ *      reservedConnections - number of connections only PRIORITY_HIGH 
+ *                            clients may take
+ *      priorityHosts - NULL-terminated list of the (numeric) addresses
+ *                      whose clients are PRIORITY_HIGH
+ *      redirect - address ([host:]port) turned away clients are pointed
+ *                 to, NULL to just tell them the broker's busy
+ *      pending - publishes not yet delivered (see PendingPublishes above)
+ * */
+typedef struct {
+    int fd;
+    StringMap* stringMap;
+    RwLock* stringMapLock;
+    Stats* stats;
+    Mutex* statsLock;
+    Semaphore* accessLock;
+    SessionTable* sessions;
+    Federation* federation;
+    Replication* replication;
+    struct Handoff* handoff;
+    Client* client;
+    WorkPool* pool;
+    OutboundWriter* outboundWriter;
+    int fanoutThreshold;
+    TimerWheel* timers;
+    int idleMs;
+    int keepaliveMs;
+    int reservedConnections;
+    char** priorityHosts;
+    char* redirect;
+    PendingPublishes* pending;
+} ClientThreadArgs;
+
+/* A broker is the (shared) ClientThreadArgs structure every client thread
+ * is given a copy of. Programs embedding the broker only deal with it
+ * through the functions below.
+ * */
+typedef ClientThreadArgs Broker;
+
+/* Defines the callback an in-process subscriber (see broker_subscribe()) is
+ * given each message published to its topic by:
+ *
+ *      arg - argument given to broker_subscribe()
+ *      name - name of the publisher
+ *      topic - topic published to
+ *      value - value published
+ *
+ * NOTE: callbacks are made while the broker's topics are locked (for
+ * reading), so they mustn't call back into the broker (eg: to publish). A
+ * topic's messages are handed over one at a time, in the same order every
+ * subscriber sees, but callbacks for different topics (or, for large 
+ * topics, different subscribers) may be made by several threads at once
+ * */
+typedef void (*BrokerCallback)(void* arg, char* name, char* topic,
+        char* value);
+
+/* broker_init
+ * -----------
+ * Initialises a broker with no topics or clients, and a worker pool of one
+ * thread per core. No threads are started until broker_start() is called.
+ *
+ * maxConnections - max number of socket clients at once (0 for no limit)
+ * id - ID the broker gives other psserver nodes (see federation.h and
+ *      replication.h)
+ * isSemiSync - true iff retained publishes are to wait for a follower
+ *              (see replication.h)
+ *
+ * Returns:
+ *      the newly created broker
+ *
+ * */
+Broker* broker_init(int maxConnections, char* id, bool isSemiSync);
+
+/* broker_start
+ * ------------
+ * Starts the broker's background threads (redelivery of unacknowledged
+ * messages, its worker pool, its timer wheel if idle clients are to be 
+ * pinged or disconnected, and links to any peers added with 
+ * add_peer_link()).
+ *
+ * broker - broker to start
+ *
+ * */
+void broker_start(Broker* broker);
+
+/* broker_subscribe
+ * ----------------
+ * Subscribes an in-process consumer to the given topic. Each message
+ * published to the topic (by socket clients, in-process publishers or
+ * linked peers) is handed to the callback as plain strings, and any
+ * retained values are handed over straight away.
+ *
+ * broker - broker to subscribe to
+ * topic - topic to subscribe to
+ * callback - function called with each message
+ * arg - first argument to give callback
+ *
+ * Returns:
+ *      handle on the subscription (see broker_unsubscribe()), or NULL if
+ *      the topic is invalid
+ *
+ * */
+Client* broker_subscribe(Broker* broker, char* topic, BrokerCallback callback,
+        void* arg);
+
+/* broker_unsubscribe
+ * ------------------
+ * Ends an in-process subscription. The callback is not called again once
+ * this returns.
+ *
+ * broker - broker subscribed to
+ * topic - topic subscribed to
+ * subscription - handle returned by broker_subscribe() (free()'d)
+ *
+ * */
+void broker_unsubscribe(Broker* broker, char* topic, Client* subscription);
+
+/* broker_publish
+ * --------------
+ * Publishes a value from an in-process publisher. No socket is involved:
+ * in-process subscribers are called back with copies of the strings, and 
+ * the wire frame (ie: "name:topic:value\n") is only built if there are 
+ * socket clients, consumer groups, shared memory rings or peers to send it
+ * to. Like any publish it's queued in the topic's order, so it may still be
+ * being delivered once this returns.
+ *
+ * broker - broker to publish to
+ * name - name to publish under
+ * topic - topic to publish to
+ * value - value to publish
+ *
+ * Returns:
+ *      true iff the topic exists and the message is valid, false otherwise
+ *
+ * */
+bool broker_publish(Broker* broker, char* name, char* topic, char* value);
+
+/* wait_for_publishes
+ * ------------------
+ * Waits until every publish made so far has been delivered (publishes are
+ * queued in their topic's sequence, and may still be being delivered once
+ * the publisher has moved on).
+ *
+ * broker - broker to wait on
+ * deadline - time (CLOCK_REALTIME) to give up at
+ *
+ * Returns:
+ *      true iff nothing was left to deliver before the deadline
+ *
+ * */
+bool wait_for_publishes(Broker* broker, struct timespec* deadline);
+
+/* broker_add_client
+ * -----------------
+ * Hands a connected socket over to the broker, which spawns a thread
+ * speaking psserver's protocol to it (blocking while the broker already
+ * has its max number of connections).
+ *
+ * broker - broker to add the client to
+ * fd - connected socket
+ *
+ * */
+void broker_add_client(Broker* broker, int fd);
+
+/* broker_admit_client
+ * -------------------
+ * Hands a connected socket over to the broker if it has a connection free
+ * for a client of the given class, like broker_add_client(). Otherwise the
+ * client is turned away straight away: it's sent ":busy" (or 
+ * ":redirect <address>" if the broker has somewhere to send it), its 
+ * socket is closed and the rejection is counted in the broker's stats.
+ * This never blocks.
+ *
+ * broker - broker to add the client to
+ * fd - connected socket
+ * priority - one of the PriorityClasses
+ *
+ * Returns:
+ *      true iff the client was admitted
+ *
+ * */
+bool broker_admit_client(Broker* broker, int fd, int priority);
+
+/* broker_restore_client
+ * ---------------------
+ * Rebuilds the state of a client whose socket was handed over by a hot
+ * restart (see handoff.h) by running the given commands for it, throwing 
+ * away any replies (eg: retained values the client already has). The client
+ * isn't served until broker_serve_client() is called, so no messages are 
+ * lost to the discarded replies.
+ *
+ * broker - broker to restore the client into
+ * fd - client's socket
+ * replay - newline-terminated commands rebuilding the client's state
+ *
+ * Returns:
+ *      the restored client
+ *
+ * */
+Client* broker_restore_client(Broker* broker, int fd, char* replay);
+
+/* broker_serve_client
+ * -------------------
+ * Spawns the thread serving a client restored by broker_restore_client().
+ * Unlike broker_add_client(), this never blocks: a client beyond the max 
+ * number of connections is disconnected instead.
+ *
+ * broker - broker the client was restored into
+ * client - restored client
+ *
+ * Returns:
+ *      true iff the client is being served
+ *
+ * */
+bool broker_serve_client(Broker* broker, Client* client);
+
+/* server_infinite_loop
+ * --------------------
+ * Accepts clients on the given listening socket forever, handing each to
+ * the broker or turning it away if the broker is full (see 
+ * broker_admit_client()). Clients on a Unix domain socket, and those from 
+ * the broker's priority hosts, are PRIORITY_HIGH.
+ *
+ * listenFd - socket on which to listen for new client connections
+ * cta - broker to hand clients to
+ *
+ * */
+void server_infinite_loop(int listenFd, ClientThreadArgs* cta);
+
+#endif //BROKER
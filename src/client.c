@@ -4,8 +4,9 @@
 //-----------//
 
 #include "shared.h"
+#include "shmring.h"
 // #include "csse2310a4.h"
-// #include "csse2310a3.h"
+#include "csse2310a3.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -13,8 +14,13 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 //helpful constants
 #define PORT_NUM_INDEX 1
@@ -26,22 +32,121 @@
 #define NODE "localhost"
 #define TCP 0
 #define DEFAULT 0
+#define PATH_SEPARATOR '/'
+#define SHM_REPLY ":shm "
+#define UNSHM_REPLY ":unshm "
+#define PING_REPLY ":ping"
+#define PONG_CMD "pong\n"
+#define BUSY_REPLY ":busy"
+#define REDIRECT_REPLY ":redirect "
+#define BATCH_OPT "batch"
+#define FLUSH_OPT "flushms"
+//how long (ms) batched commands may wait to be sent by default
+#define DEFAULT_FLUSH_MS 10
+//number of bytes read from stdin at a time in batched mode
+#define READ_BLOCK_SIZE 65536
+#define BUFFERED_OPT "buffered"
+#define OUT_OPT "out"
+#define FORMAT_OPT "format"
+#define COUNT_OPT "count"
+#define OPT_ON "1"
+#define TEXT_FORMAT "text"
+#define LENGTH_FORMAT "len"
+//number of bytes read from the socket at a time in buffered mode
+#define RECV_BLOCK_SIZE (1 << 20)
+//size of the output buffer in buffered mode
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define NS_PER_SEC 1000000000L
 
 /* Defines the Parameters structure which holds the following command line
  * arguments given to psclient:
  *
- *      service - service name/string version of the port number
+ *      service - service name/string version of the port number, or the
+ *                path of psserver's Unix domain socket (if it contains a 
+ *                '/', eg: "./psserver.sock")
  *      portnum - port to connect to that psserver is listening on
  *      clientName - name to be associated with the client
  *      topics - list of topics client wishes to subsribe to (optional)
+ *      batchSize - number of bytes of commands to batch up before sending
+ *                  them, given by the "batch=<bytes>" option (0 to send 
+ *                  each line as soon as it's read)
+ *      flushMs - longest time (ms) a batched command waits to be sent, 
+ *                given by the "flushms=<ms>" option
+ *      isBuffered - true iff messages are to be received in buffered mode
+ *                   (see receive_buffered_loop()), given by "buffered=1" or
+ *                   implied by any of the options below
+ *      outPath - file to write messages to instead of stdout, given by 
+ *                "out=<path>" (NULL if not given)
+ *      format - one of the OutputFormats (see below), given by 
+ *               "format=text" or "format=len"
+ *      isCountOnly - true iff messages are only to be counted, given by
+ *                    "count=1"
  * */
 typedef struct {
     char* service;
     int portnum;
     char* clientName;
     char** topics;
+    int batchSize;
+    int flushMs;
+    bool isBuffered;
+    char* outPath;
+    int format;
+    bool isCountOnly;
 } Parameters;
 
+/* Each of these constants encodes a format messages are output in:
+ *
+ *      OUTPUT_TEXT - one message per line, ie: "name:topic:value\n"
+ *      OUTPUT_LENGTH_PREFIXED - each message ("name:topic:value") preceded
+ *                               by its length in bytes, as a 4 byte 
+ *                               big-endian integer, for downstream tools
+ * */
+enum OutputFormats {
+    OUTPUT_TEXT,
+    OUTPUT_LENGTH_PREFIXED
+};
+
+/* Defines the Sink structure, which is where received messages are output
+ * to (from the socket and any shared memory rings):
+ *
+ *      out - stream written to (stdout or the "out=" file)
+ *      isBuffered - true iff out is only flushed once there's nothing left
+ *                   to read (on the socket, or on the ring being read), 
+ *                   rather than after every message
+ *      format - one of the OutputFormats
+ *      isCountOnly - true iff messages are only counted, not output
+ *      numMessages - number of messages received
+ *      numBytes - number of bytes of messages received
+ *      firstAt - time (ns) the first message was received
+ *      lastAt - time (ns) the last message was received
+ * */
+typedef struct {
+    FILE* out;
+    bool isBuffered;
+    int format;
+    bool isCountOnly;
+    long numMessages;
+    long numBytes;
+    long firstAt;
+    long lastAt;
+} Sink;
+
+/* Defines the SenderArgs structure passed to the thread sending stdin to
+ * psserver:
+ *
+ *      clientToServer - write end of the socket
+ *      batchSize - see Parameters above
+ *      flushMs - see Parameters above
+ * */
+typedef struct {
+    FILE* clientToServer;
+    int batchSize;
+    int flushMs;
+} SenderArgs;
+
 /* Defines the SocketEnds structure which holds the read and write ends of 
  * the socket connecting the client to the server:
  *
@@ -53,6 +158,24 @@ typedef struct {
     FILE* clientToServer;
 } SocketEnds;
 
+/* Defines the RingSubscription structure, which represents a topic the
+ * client reads from psserver's shared memory ring for it (see shmring.h):
+ *
+ *      topic - topic the ring belongs to
+ *      reader - client's handle on the ring
+ *      isStopped - true once the client has unsubscribed (the thread reading
+ *                  the ring exits after its next frame)
+ *      sink - where the ring's messages are output to
+ *      next - next subscription
+ * */
+typedef struct RingSubscription {
+    char* topic;
+    RingReader* reader;
+    bool isStopped;
+    Sink* sink;
+    struct RingSubscription* next;
+} RingSubscription;
+
 //client error codes
 enum ExitCodes {
     SUCCESS,
@@ -60,7 +183,9 @@ enum ExitCodes {
     NAME_OR_TOPICS_ERROR,
     PORT_ERROR,
     CONNECTION_CLOSED,
-    ADDRESS_ERROR
+    ADDRESS_ERROR,
+    OUTPUT_ERROR,
+    SERVER_BUSY
 };
 
 /* general_error
@@ -80,7 +205,9 @@ void general_error(int errorCode, char* extraInfo, int nameOrTopics) {
     switch (errorCode) {
         //insufficient command line args
         case NUM_ARGS_ERROR:
-            fprintf(stderr, "Usage: psclient portnum name [topic] ...\n");
+            fprintf(stderr, "Usage: psclient portnum name [topic] ... "
+                    "[batch=bytes] [flushms=ms] [buffered=1] [out=path] "
+                    "[format=text|len] [count=1]\n");
             exit(NUM_ARGS_ERROR);
         case NAME_OR_TOPICS_ERROR:
             //invalid name argument
@@ -101,16 +228,82 @@ void general_error(int errorCode, char* extraInfo, int nameOrTopics) {
         case CONNECTION_CLOSED:
             fprintf(stderr, "psclient: server connection terminated\n");
             exit(CONNECTION_CLOSED);
+        //unable to open the "out=" file
+        case OUTPUT_ERROR:
+            fprintf(stderr, "psclient: unable to open %s\n", extraInfo);
+            exit(OUTPUT_ERROR);
+        //server turned us away (possibly pointing us elsewhere)
+        case SERVER_BUSY:
+            if (extraInfo) {
+                fprintf(stderr, "psclient: server busy, try %s\n", 
+                        extraInfo);
+            } else {
+                fprintf(stderr, "psclient: server busy\n");
+            }
+            exit(SERVER_BUSY);
     }
     return;
 }
 
+/* parse_option
+ * ------------
+ * Helper function for parse_command_line() that checks whether the given
+ * argument is one of psclient's options (see Parameters above), and if so,
+ * records it.
+ *
+ * arg - command line argument
+ * cmdArgs - Parameters structure to record the option in
+ *
+ * Returns:
+ *      true iff the argument is an option, false otherwise
+ *
+ * Exits with:
+ *      1 - the option's value is invalid
+ *
+ * */
+bool parse_option(char* arg, Parameters* cmdArgs) {
+    char* optValue;
+    bool isValid = true;
+    if ((optValue = option_value(arg, BATCH_OPT))) {
+        cmdArgs->batchSize = string_to_int(optValue);
+        isValid = cmdArgs->batchSize > 0;
+    } else if ((optValue = option_value(arg, FLUSH_OPT))) {
+        cmdArgs->flushMs = string_to_int(optValue);
+        isValid = cmdArgs->flushMs >= 0;
+    } else if ((optValue = option_value(arg, BUFFERED_OPT))) {
+        isValid = !strcmp(optValue, OPT_ON);
+    } else if ((optValue = option_value(arg, OUT_OPT))) {
+        cmdArgs->outPath = optValue;
+        isValid = strlen(optValue) > 0;
+    } else if ((optValue = option_value(arg, FORMAT_OPT))) {
+        isValid = !strcmp(optValue, TEXT_FORMAT) ||
+                !strcmp(optValue, LENGTH_FORMAT);
+        cmdArgs->format = strcmp(optValue, LENGTH_FORMAT) ? OUTPUT_TEXT :
+                OUTPUT_LENGTH_PREFIXED;
+    } else if ((optValue = option_value(arg, COUNT_OPT))) {
+        cmdArgs->isCountOnly = !strcmp(optValue, OPT_ON);
+        isValid = cmdArgs->isCountOnly;
+    } else {
+        return false;
+    }
+    if (!isValid) {
+        general_error(NUM_ARGS_ERROR, NULL, DEFAULT);
+    }
+    //all of the receive options are handled in buffered mode
+    if (!option_value(arg, BATCH_OPT) && !option_value(arg, FLUSH_OPT)) {
+        cmdArgs->isBuffered = true;
+    }
+    return true;
+}
+
 /* parse_command_line
  * ------------------
  * Retreives the command line arguments given to psclient and populates a 
  * Parameters structure with said arguments.
  *
- * NOTE: validity of all arguments is checked for 
+ * NOTE: validity of all arguments is checked for. Options (see Parameters
+ * above) may be given amongst the topics; arguments that aren't one of the
+ * options are taken to be topics.
  *
  * argc - number of command line arguments
  * argv - array of command line arguments
@@ -131,16 +324,23 @@ Parameters parse_command_line(int argc, char** argv) {
     }
 
     //retreive arguments from argv
+    Parameters cmdArgs;
+    memset(&cmdArgs, 0, sizeof(Parameters));
+    cmdArgs.flushMs = DEFAULT_FLUSH_MS;
     char* service = argv[PORT_NUM_INDEX];
     char* name = argv[NAME_INDEX];
     char** topics = calloc((argc - NUM_NON_TOPIC_ARGS) + 1, sizeof(char*));
+    int numTopics = 0;
 
     //check all topics are validly configured (if so, add to topics array)
     for (int i = TOPICS_INDEX; i < argc; i++) {
+        if (parse_option(argv[i], &cmdArgs)) {
+            continue;
+        }
         if (has_space_colon_newline(argv[i])){
             general_error(NAME_OR_TOPICS_ERROR, NULL, TOPICS_ERROR);
         }
-        topics[i - TOPICS_INDEX] = argv[i]; 
+        topics[numTopics++] = argv[i]; 
     }
 
     //check name arg is validly configured
@@ -150,30 +350,27 @@ Parameters parse_command_line(int argc, char** argv) {
 
     //if this point is reached, args are validly configured
     //NOTE: haven't checked whether port/service can be conneceted to 
-    Parameters cmdArgs;
-    memset(&cmdArgs, 0, sizeof(Parameters));
     cmdArgs.service = service; 
     cmdArgs.clientName = name;
     cmdArgs.topics = topics;
     return cmdArgs;
 }
 
-/* connect_to_server
- * -----------------
- * Connects the client socket to the given node/address on the given 
- * port/service. The method populates a structure holding the read and write
- * ends of the socket.
+/* connect_to_tcp_socket
+ * ---------------------
+ * Helper function for connect_to_server() that connects to psserver over
+ * TCP.
  *
  * node - address of node to connect to
  * service - port number in our case
  *
  * Returns:
- *      a SocketEnds structure holding the read and write ends of the socket
+ *      the connected socket
  *
  * Exits with:
  *      3 - if the client is unable to connect to the given port/service
  * */
-SocketEnds connect_to_server(char* node, char* service) {
+int connect_to_tcp_socket(char* node, char* service) {
     //get address info struct
     struct addrinfo* ai = 0;
     struct addrinfo hints;
@@ -192,6 +389,61 @@ SocketEnds connect_to_server(char* node, char* service) {
 
         general_error(PORT_ERROR, service, DEFAULT); // exits here
     }
+    return fd;
+}
+
+/* connect_to_unix_socket
+ * ----------------------
+ * Helper function for connect_to_server() that connects to psserver's Unix
+ * domain socket at the given path (see the "unix=" option of psserver).
+ *
+ * path - path of the socket
+ *
+ * Returns:
+ *      the connected socket
+ *
+ * Exits with:
+ *      3 - if the client is unable to connect to the given socket
+ * */
+int connect_to_unix_socket(char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        general_error(PORT_ERROR, path, DEFAULT); //exits here
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_un))) {
+        general_error(PORT_ERROR, path, DEFAULT); //exits here
+    }
+    return fd;
+}
+
+/* connect_to_server
+ * -----------------
+ * Connects the client socket to the given node/address on the given 
+ * port/service. The method populates a structure holding the read and write
+ * ends of the socket. Services containing a '/' are instead taken to be the
+ * path of psserver's Unix domain socket, which skips the TCP/IP stack for
+ * clients on the same host.
+ *
+ * node - address of node to connect to
+ * service - port number in our case (or Unix domain socket path)
+ *
+ * Returns:
+ *      a SocketEnds structure holding the read and write ends of the socket
+ *
+ * Exits with:
+ *      3 - if the client is unable to connect to the given port/service
+ * */
+SocketEnds connect_to_server(char* node, char* service) {
+    int fd;
+    if (strchr(service, PATH_SEPARATOR)) {
+        fd = connect_to_unix_socket(service);
+    } else {
+        fd = connect_to_tcp_socket(node, service);
+    }
     //now socket is connected to server, separate read and write streams
     int fd2 = dup(fd);
     FILE* serverToClient = fdopen(fd, "r");
@@ -281,60 +533,507 @@ void send_starting_msgs(SocketEnds fds, Parameters cmdArgs) {
     fflush(fds.clientToServer);
 }
 
+/* now_ns
+ * ------
+ * Returns the current (monotonic) time in nanoseconds.
+ * */
+long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+//sink whose count is printed when psclient exits (see print_count())
+static Sink* countedSink = NULL;
+
+/* print_count
+ * -----------
+ * Prints the number of messages counted in "count=1" mode, and the rate
+ * they arrived at, as key=value pairs. Registered with atexit(), since 
+ * psclient exits from whichever thread sees its input end.
+ * */
+void print_count(void) {
+    Sink* sink = countedSink;
+    long numMessages = __atomic_load_n(&sink->numMessages, __ATOMIC_SEQ_CST);
+    long numBytes = __atomic_load_n(&sink->numBytes, __ATOMIC_SEQ_CST);
+    double secs = (double)(sink->lastAt - sink->firstAt) / NS_PER_SEC;
+    printf("messages=%ld bytes=%ld secs=%.3f msgs_per_sec=%.0f\n",
+            numMessages, numBytes, secs, secs > 0 ? numMessages / secs : 0);
+    fflush(stdout);
+}
+
+/* init_sink
+ * ---------
+ * Creates the sink received messages are output to, as configured on the
+ * command line.
+ *
+ * cmdArgs - Parameters structure holding the given command line arguments
+ *
+ * Returns:
+ *      the newly created sink
+ *
+ * Exits with:
+ *      6 - the "out=" file can't be opened
+ *
+ * */
+Sink* init_sink(Parameters cmdArgs) {
+    Sink* sink = calloc(1, sizeof(Sink));
+    sink->out = stdout;
+    sink->isBuffered = cmdArgs.isBuffered;
+    sink->format = cmdArgs.format;
+    sink->isCountOnly = cmdArgs.isCountOnly;
+    if (cmdArgs.outPath && !(sink->out = fopen(cmdArgs.outPath, "w"))) {
+        general_error(OUTPUT_ERROR, cmdArgs.outPath, DEFAULT);
+    }
+    if (sink->isBuffered) {
+        setvbuf(sink->out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+    if (sink->isCountOnly) {
+        countedSink = sink;
+        atexit(print_count);
+    }
+    return sink;
+}
+
+/* emit_message
+ * ------------
+ * Outputs a received message to the given sink in the sink's format (or 
+ * just counts it). Safe to call from several threads at once, as stdio
+ * locks the stream.
+ *
+ * sink - where to output the message
+ * msg - message (ie: "name:topic:value", not necessarily terminated)
+ * msgLen - length of the message
+ *
+ * */
+void emit_message(Sink* sink, char* msg, size_t msgLen) {
+    if (sink->isCountOnly) {
+        long now = now_ns();
+        if (!__atomic_fetch_add(&sink->numMessages, 1, __ATOMIC_SEQ_CST)) {
+            sink->firstAt = now;
+        }
+        __atomic_add_fetch(&sink->numBytes, msgLen, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&sink->lastAt, now, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if (sink->format == OUTPUT_LENGTH_PREFIXED) {
+        uint32_t length = htonl((uint32_t)msgLen);
+        flockfile(sink->out);
+        fwrite(&length, sizeof(uint32_t), 1, sink->out);
+        fwrite(msg, sizeof(char), msgLen, sink->out);
+        funlockfile(sink->out);
+    } else {
+        flockfile(sink->out);
+        fwrite(msg, sizeof(char), msgLen, sink->out);
+        putc_unlocked('\n', sink->out);
+        funlockfile(sink->out);
+    }
+    if (!sink->isBuffered) {
+        fflush(sink->out);
+    }
+}
+
+/* ring_reader_thread
+ * ------------------
+ * A thread that reads frames from a topic's shared memory ring and outputs
+ * them to stdout, exactly as if they'd been received over the socket.
+ *
+ * arg - RingSubscription structure
+ *
+ * */
+void* ring_reader_thread(void* arg) {
+    RingSubscription* sub = (RingSubscription*)arg;
+    uint64_t numSkipped;
+    while (true) {
+        int result = ring_read(sub->reader, &numSkipped);
+        if (__atomic_load_n(&sub->isStopped, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (result == RING_FRAME) {
+            //frames end with a newline, which the sink adds back if need be
+            emit_message(sub->sink, sub->reader->frame, 
+                    strlen(sub->reader->frame) - 1);
+            //a buffered sink is flushed once the ring has been caught up on
+            if (sub->sink->isBuffered && !ring_has_frame(sub->reader)) {
+                fflush(sub->sink->out);
+            }
+        } else if (result == RING_LAGGED) {
+            fprintf(stderr, "psclient: fell behind on topic %s, skipped "
+                    "%lu bytes\n", sub->topic, (unsigned long)numSkipped);
+        } else {
+            fprintf(stderr, "psclient: message on topic %s too large for "
+                    "shared memory\n", sub->topic);
+        }
+    }
+    ring_detach(sub->reader);
+    free(sub->topic);
+    free(sub);
+    return NULL;
+}
+
+/* handle_ring_reply
+ * -----------------
+ * Handles psserver's reply to a "sub <topic> shm=1" (ie: 
+ * ":shm <topic> <path>") by mapping the topic's ring and spawning a thread
+ * to read it, or to an "unsub <topic> shm=1" (ie: ":unshm <topic>") by 
+ * stopping that thread.
+ *
+ * line - line received from psserver
+ * subs - pointer to the list of ring subscriptions
+ * sink - where the ring's messages are to be output to
+ *
+ * Returns:
+ *      true iff the line was a ring reply, false otherwise
+ *
+ * */
+bool handle_ring_reply(char* line, RingSubscription** subs, Sink* sink) {
+    if (!strncmp(line, SHM_REPLY, strlen(SHM_REPLY))) {
+        char* topic = line + strlen(SHM_REPLY);
+        char* path = strchr(topic, ' ');
+        if (!path) {
+            return false;
+        }
+        *path++ = '\0';
+        RingReader* reader = ring_attach(path);
+        if (!reader) {
+            fprintf(stderr, "psclient: unable to open shared memory for "
+                    "topic %s\n", topic);
+            return true;
+        }
+        RingSubscription* sub = calloc(1, sizeof(RingSubscription));
+        sub->topic = strdup(topic);
+        sub->reader = reader;
+        sub->sink = sink;
+        sub->next = *subs;
+        *subs = sub;
+        pthread_t threadId;
+        pthread_create(&threadId, NULL, ring_reader_thread, sub);
+        pthread_detach(threadId);
+        return true;
+    }
+    if (!strncmp(line, UNSHM_REPLY, strlen(UNSHM_REPLY))) {
+        char* topic = line + strlen(UNSHM_REPLY);
+        //unlink the subscription - its thread frees it
+        RingSubscription** curr = subs;
+        while (*curr && strcmp((*curr)->topic, topic)) {
+            curr = &(*curr)->next;
+        }
+        if (*curr) {
+            RingSubscription* sub = *curr;
+            *curr = sub->next;
+            __atomic_store_n(&sub->isStopped, true, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* answer_ping
+ * -----------
+ * Answers psserver's keepalive ping (ie: ":ping") with "pong", so a client
+ * that only listens isn't disconnected as idle.
+ *
+ * NOTE: written under the stream's lock like every other command, so it 
+ * never lands in the middle of one
+ *
+ * line - line received from psserver
+ * clientToServer - write end of the socket
+ *
+ * Returns:
+ *      true iff the line was a ping, false otherwise
+ *
+ * */
+bool answer_ping(char* line, FILE* clientToServer) {
+    if (strcmp(line, PING_REPLY)) {
+        return false;
+    }
+    flockfile(clientToServer);
+    fputs(PONG_CMD, clientToServer);
+    fflush(clientToServer);
+    funlockfile(clientToServer);
+    return true;
+}
+
+/* check_rejection
+ * ---------------
+ * Exits if the given line is psserver turning the client away as it's full
+ * (ie: ":busy" or ":redirect <address>").
+ *
+ * line - line received from psserver
+ *
+ * Exits with:
+ *      7 - if the client was turned away
+ * */
+void check_rejection(char* line) {
+    if (!strcmp(line, BUSY_REPLY)) {
+        general_error(SERVER_BUSY, NULL, DEFAULT);
+    }
+    if (!strncmp(line, REDIRECT_REPLY, strlen(REDIRECT_REPLY))) {
+        general_error(SERVER_BUSY, line + strlen(REDIRECT_REPLY), DEFAULT);
+    }
+}
+
 /* print_lines_loop
  * ----------------
  * Reads from the given network socket and outputs what it receives to 
- * stdout.
+ * stdout. Topics subscribed to with "shm=1" are read from psserver's shared
+ * memory rings instead (see handle_ring_reply()). Pings are answered (see 
+ * answer_ping()) rather than output.
  *
- * serverToClient - network socket to listen on 
+ * fds - read and write ends of the network socket
+ * sink - where to output messages
  *
  * */
-void print_lines_loop(FILE* serverToClient) {
+void print_lines_loop(SocketEnds fds, Sink* sink) {
+    FILE* serverToClient = fds.serverToClient;
     char* line;
+    RingSubscription* ringSubs = NULL;
     //keeps reading from the network socket until EOF is detected (server
     //disconnects)
     while ((line = read_line(serverToClient))) {
-        printf("%s\n", line);
-        fflush(stdout);
-        fflush(serverToClient);
+        check_rejection(line);
+        if (handle_ring_reply(line, &ringSubs, sink) || 
+                answer_ping(line, fds.clientToServer)) {
+            free(line);
+            continue;
+        }
+        emit_message(sink, line, strlen(line));
+        free(line);
     }
     general_error(CONNECTION_CLOSED, NULL, DEFAULT);
 }
 
+/* is_drained
+ * ----------
+ * Helper function for receive_buffered_loop() that returns true iff there is
+ * nothing waiting to be read on the given socket right now.
+ * */
+bool is_drained(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) <= 0;
+}
+
+/* receive_buffered_loop
+ * ---------------------
+ * Like print_lines_loop(), but built for high message rates: the socket is
+ * read in large chunks, messages are split out of the chunk in place 
+ * (without copying or allocating), and the output is only flushed once the
+ * socket has been drained (see is_drained()) rather than after every 
+ * message.
+ *
+ * fds - read and write ends of the network socket
+ * sink - where to output messages
+ *
+ * */
+void receive_buffered_loop(SocketEnds fds, Sink* sink) {
+    int fd = fileno(fds.serverToClient);
+    size_t capacity = RECV_BLOCK_SIZE;
+    char* buffer = malloc(sizeof(char) * capacity);
+    //bytes of an incomplete message left over from the last chunk
+    size_t bufferLen = 0;
+    RingSubscription* ringSubs = NULL;
+    ssize_t numRead;
+    while ((numRead = read(fd, buffer + bufferLen, 
+            capacity - bufferLen)) > 0) {
+        bufferLen += numRead;
+        char* line = buffer;
+        char* end = buffer + bufferLen;
+        char* newline;
+        while ((newline = memchr(line, '\n', end - line))) {
+            //replies from psserver start with a colon, messages never do
+            *newline = '\0';
+            if (line[0] == ':') {
+                check_rejection(line);
+            }
+            if (line[0] != ':' || (!handle_ring_reply(line, &ringSubs, 
+                    sink) && !answer_ping(line, fds.clientToServer))) {
+                emit_message(sink, line, newline - line);
+            }
+            line = newline + 1;
+        }
+        //keep the incomplete message for the next chunk
+        bufferLen = end - line;
+        memmove(buffer, line, bufferLen);
+        if (bufferLen == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, sizeof(char) * capacity);
+        }
+        if (is_drained(fd)) {
+            fflush(sink->out);
+        }
+    }
+    fflush(sink->out);
+    free(buffer);
+    general_error(CONNECTION_CLOSED, NULL, DEFAULT);
+}
+
 /* send_lines_loop
  * ---------------
  * A thread that reads a line from stdin and sends what it receives to the 
  * given network socket.
  *
- * arg - void* version of a network socket
+ * arg - SenderArgs structure
  *
  * */
 void* send_lines_loop(void* arg) {
 
-    FILE* clientToServer = (FILE*)arg;
+    FILE* clientToServer = ((SenderArgs*)arg)->clientToServer;
     char* line;
     char* lineToSend;
     while ((line = read_line(stdin))) {
         lineToSend = add_new_line(line);
-        fprintf(clientToServer, lineToSend);
+        //NOTE: never the format string, as lines may contain '%'
+        fputs(lineToSend, clientToServer);
         fflush(clientToServer);
+        free(lineToSend);
+        free(line);
     }
     //EOF detected on STDIN
     exit(0);
     pthread_exit(NULL);
 }
 
+/* now_ms
+ * ------
+ * Returns the current (monotonic) time in milliseconds.
+ * */
+long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * MS_PER_SEC + now.tv_nsec / NS_PER_MS;
+}
+
+/* write_all
+ * ---------
+ * Writes all of the given bytes to the given socket.
+ *
+ * fd - socket to write to
+ * bytes - bytes to write
+ * numBytes - number of bytes to write
+ *
+ * Returns:
+ *      true iff everything was written, false if the socket was closed
+ *
+ * */
+bool write_all(int fd, char* bytes, size_t numBytes) {
+    while (numBytes) {
+        ssize_t numWritten = write(fd, bytes, numBytes);
+        if (numWritten <= 0) {
+            return false;
+        }
+        bytes += numWritten;
+        numBytes -= numWritten;
+    }
+    return true;
+}
+
+/* last_newline
+ * ------------
+ * Returns a pointer to the last newline in the given bytes, or NULL if
+ * there isn't one.
+ * */
+char* last_newline(char* bytes, size_t numBytes) {
+    while (numBytes) {
+        if (bytes[--numBytes] == '\n') {
+            return bytes + numBytes;
+        }
+    }
+    return NULL;
+}
+
+/* send_batched_loop
+ * -----------------
+ * A thread that reads stdin in large blocks and sends the complete lines
+ * (ie: commands) in them to the given network socket in batches, with one
+ * write() per batch rather than per line. A batch is sent once it holds at 
+ * least batchSize bytes, or once its oldest command has waited flushMs.
+ * Lines are never split across batches.
+ *
+ * arg - SenderArgs structure
+ *
+ * */
+void* send_batched_loop(void* arg) {
+    SenderArgs* args = (SenderArgs*)arg;
+    int fd = fileno(args->clientToServer);
+    size_t capacity = args->batchSize + READ_BLOCK_SIZE;
+    char* batch = malloc(sizeof(char) * capacity);
+    //bytes read so far, and how many of them make up complete lines
+    size_t batchLen = 0;
+    size_t completeLen = 0;
+    //time the batch's oldest complete line must be sent by
+    long flushAt = 0;
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+
+    while (true) {
+        //with complete lines waiting, only wait for more input until the
+        //batch is due to be sent
+        if (completeLen) {
+            long wait = flushAt - now_ms();
+            if (wait <= 0 || !poll(&input, 1, wait)) {
+                //(under the stream's lock, as pongs go through it)
+                flockfile(args->clientToServer);
+                bool isWritten = write_all(fd, batch, completeLen);
+                funlockfile(args->clientToServer);
+                if (!isWritten) {
+                    break;
+                }
+                memmove(batch, batch + completeLen, batchLen - completeLen);
+                batchLen -= completeLen;
+                completeLen = 0;
+                continue;
+            }
+        }
+        //make room for a line longer than the buffer
+        if (batchLen + READ_BLOCK_SIZE > capacity) {
+            capacity *= 2;
+            batch = realloc(batch, sizeof(char) * capacity);
+        }
+        ssize_t numRead = read(STDIN_FILENO, batch + batchLen, 
+                READ_BLOCK_SIZE);
+        if (numRead <= 0) {
+            //EOF detected on STDIN - send what's left, ending any partial
+            //last line
+            if (batchLen > completeLen) {
+                batch[batchLen++] = '\n';
+            }
+            flockfile(args->clientToServer);
+            write_all(fd, batch, batchLen);
+            exit(0);
+        }
+        char* newline = last_newline(batch + batchLen, numRead);
+        batchLen += numRead;
+        if (newline) {
+            if (!completeLen) {
+                flushAt = now_ms() + args->flushMs;
+            }
+            completeLen = newline - batch + 1;
+        }
+        //full batches are sent straight away
+        if (completeLen >= (size_t)args->batchSize) {
+            flushAt = 0;
+        }
+    }
+    free(batch);
+    pthread_exit(NULL);
+}
+
 /* spawn_thread
  * ------------
  * Spawns the client thread that continously reads lines from stdin and sends
- * them to the server
+ * them to the server (in batches if "batch=" was given)
  *
- * serverToClient - network socket
+ * clientToServer - network socket
+ * cmdArgs - Parameters structure holding the given command line arguments
  *
  * */
-pthread_t spawn_thread(FILE* serverToClient) {
+pthread_t spawn_thread(FILE* clientToServer, Parameters cmdArgs) {
+    SenderArgs* args = malloc(sizeof(SenderArgs));
+    args->clientToServer = clientToServer;
+    args->batchSize = cmdArgs.batchSize;
+    args->flushMs = cmdArgs.flushMs;
     pthread_t threadId;
-    pthread_create(&threadId, NULL, send_lines_loop, serverToClient);
+    pthread_create(&threadId, NULL, 
+            args->batchSize ? send_batched_loop : send_lines_loop, args);
     pthread_detach(threadId);
     return threadId;
 }
@@ -346,10 +1045,16 @@ int main(int argc, char** argv) {
     SocketEnds fds = connect_to_server(NODE, cmdArgs.service);
     //send initial name and sub messages
     send_starting_msgs(fds, cmdArgs);
+    //where received messages are output to
+    Sink* sink = init_sink(cmdArgs);
     //start 'send lines' thread
-    pthread_t t = spawn_thread(fds.clientToServer);
+    pthread_t t = spawn_thread(fds.clientToServer, cmdArgs);
     //start 'print lines' loop
-    print_lines_loop(fds.serverToClient);
+    if (cmdArgs.isBuffered) {
+        receive_buffered_loop(fds, sink);
+    } else {
+        print_lines_loop(fds, sink);
+    }
     //clean up
     pthread_join(t, NULL);
     free(cmdArgs.topics);
@@ -15,6 +15,14 @@ Client* create_client(char* name, FILE* clientToServer, FILE* serverToClient) {
     client->name = name;
     client->clientToServer = clientToServer;
     client->serverToClient = serverToClient;
+    client->topics = NULL;
+    client->session = NULL;
+    client->credit = NULL;
+    client->isPeer = false;
+    client->follower = NULL;
+    client->deliver = NULL;
+    client->deliverArg = NULL;
+    client->outbound = NULL;
     return client;
 }
 
@@ -23,7 +31,7 @@ void print_client(Client* client) {
 }
 
 ClientListItem* init_client_list(Client* client, bool isPlaceholder) {
-    ClientListItem* head = malloc(sizeof(ClientListItem));
+    ClientListItem* head = calloc(1, sizeof(ClientListItem));
     head->isPlaceholder = isPlaceholder;
     head->client = client;
     return head;
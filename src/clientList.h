@@ -12,6 +12,11 @@
 #ifndef CLIENT_LIST
 #define CLIENT_LIST
 
+struct Session;
+struct Credit;
+struct Follower;
+struct Outbound;
+
 /* Defines the Client structure which holds all relevant information about
  * a client. Client structures are stored in linked lists with other Client's
  * depending on their topics. 
@@ -20,6 +25,20 @@
  *      clientToServer - read end (from server's point of view) of socket
  *      serverToClient - write end (from client's point of view) of socket
  *      topics - string array holding the topics the client has specified
+ *      session - acknowledged delivery session (see session.h), NULL unless
+ *                the client is in acknowledged mode
+ *      credit - publishing credit (see credit.h), NULL unless the client
+ *               has asked for flow control
+ *      isPeer - true iff the client is another psserver node linked to 
+ *               this one (see federation.h)
+ *      follower - leader's record of the client (see replication.h), NULL
+ *                 unless the client is a follower of this node
+ *      deliver - callback messages are handed to instead of being written
+ *                to a socket, NULL unless the client is an in-process 
+ *                subscriber (see broker_subscribe() in broker.h)
+ *      deliverArg - first argument given to deliver
+ *      outbound - frames waiting to be written to the client's socket (see
+ *                 session.h), NULL for in-process subscribers
  *      isPlaceholder - (explained in init_client_list() below)
  *      next - pointer to the next client in the linked list
  *
@@ -30,6 +49,13 @@ typedef struct Client {
     FILE* clientToServer;
     FILE* serverToClient;
     char** topics;
+    struct Session* session;
+    struct Credit* credit;
+    bool isPeer;
+    struct Follower* follower;
+    void (*deliver)(void* arg, char* name, char* topic, char* value);
+    void* deliverArg;
+    struct Outbound* outbound;
 } Client;
 
 /* create_client
@@ -0,0 +1,70 @@
+//credit.c//
+//----------------------//
+//This file abstracts away the credit based flow control psserver applies to
+//publishers
+//----------------------//
+
+#include "credit.h"
+#include "lock.h"
+#include <stdlib.h>
+
+Credit* credit_init(int limit) {
+    Credit* credit = calloc(1, sizeof(Credit));
+    credit->limit = limit;
+    credit->refs = 1;
+    init_mutex(&credit->lock, NULL);
+    init_lock(&credit->replenished, 0);
+    return credit;
+}
+
+void wait_for_credit(Credit* credit) {
+    if (!credit) {
+        return;
+    }
+    take_mutex(&credit->lock);
+    while (credit->used >= credit->limit) {
+        //NOTE: only the publisher's own thread ever waits
+        credit->isWaiting = true;
+        release_mutex(&credit->lock);
+        take_lock(&credit->replenished);
+        take_mutex(&credit->lock);
+    }
+    release_mutex(&credit->lock);
+}
+
+void charge_credit(Credit* credit, int numBytes) {
+    if (!credit) {
+        return;
+    }
+    take_mutex(&credit->lock);
+    credit->used += numBytes;
+    credit->refs++;
+    release_mutex(&credit->lock);
+}
+
+void refund_credit(Credit* credit, int numBytes) {
+    if (!credit) {
+        return;
+    }
+    take_mutex(&credit->lock);
+    credit->used -= numBytes;
+    if (credit->isWaiting && credit->used < credit->limit) {
+        credit->isWaiting = false;
+        release_lock(&credit->replenished);
+    }
+    release_mutex(&credit->lock);
+    drop_credit(credit);
+}
+
+void drop_credit(Credit* credit) {
+    if (!credit) {
+        return;
+    }
+    take_mutex(&credit->lock);
+    bool isUnreferenced = --credit->refs == 0;
+    release_mutex(&credit->lock);
+    if (isUnreferenced) {
+        sem_destroy(&credit->replenished);
+        free(credit);
+    }
+}
@@ -0,0 +1,92 @@
+//credit.h//
+//----------------------//
+//credit.c abstracts away the credit based flow control psserver applies to
+//publishers
+//----------------------//
+
+#ifndef CREDIT
+#define CREDIT
+
+#include "lock.h"
+#include <semaphore.h>
+#include <stdbool.h>
+
+/* Defines the Credit structure, which limits how many bytes a publisher may
+ * have queued inside psserver (ie: published but not yet written to a
+ * subscriber's socket). Once a publisher's credit is used up, psserver stops
+ * reading from them until their queued messages drain. It holds the
+ * following:
+ *
+ *      limit - max number of bytes the publisher may have queued
+ *      used - number of bytes the publisher currently has queued
+ *      refs - number of references to the structure (the publisher plus
+ *             each queued message charged to it)
+ *      isWaiting - true iff the publisher is waiting for credit
+ *      lock - lock protecting the structure
+ *      replenished - lock the publisher waits on for credit
+ * */
+typedef struct Credit {
+    int limit;
+    int used;
+    int refs;
+    bool isWaiting;
+    Mutex lock;
+    sem_t replenished;
+} Credit;
+
+/* credit_init
+ * -----------
+ * Initialises a Credit structure with the given limit, referenced once (by
+ * the publisher).
+ *
+ * limit - max number of bytes the publisher may have queued
+ *
+ * Returns:
+ *      the newly created Credit structure
+ *
+ * */
+Credit* credit_init(int limit);
+
+/* wait_for_credit
+ * ---------------
+ * Blocks until the given publisher credit isn't used up.
+ *
+ * credit - publisher's credit (does nothing if NULL)
+ *
+ * */
+void wait_for_credit(Credit* credit);
+
+/* charge_credit
+ * -------------
+ * Charges the given number of queued bytes to the given publisher credit,
+ * which takes a reference to it (see refund_credit()).
+ *
+ * credit - publisher's credit (does nothing if NULL)
+ * numBytes - number of bytes queued
+ *
+ * */
+void charge_credit(Credit* credit, int numBytes);
+
+/* refund_credit
+ * -------------
+ * Refunds the given number of bytes (charged by charge_credit()) once they
+ * leave psserver's queues, waking the publisher if they were waiting. Drops
+ * the reference taken by charge_credit().
+ *
+ * credit - publisher's credit (does nothing if NULL)
+ * numBytes - number of bytes no longer queued
+ *
+ * */
+void refund_credit(Credit* credit, int numBytes);
+
+/* drop_credit
+ * -----------
+ * Drops a reference to the given credit, free()ing it once it is no longer
+ * referenced. Publishers drop their reference when they disconnect.
+ *
+ * credit - credit to drop (does nothing if NULL)
+ *
+ * */
+void drop_credit(Credit* credit);
+
+#endif //CREDIT
@@ -0,0 +1,284 @@
+//federation.c//
+//----------------------//
+//This file abstracts away the links between peered psserver nodes
+//----------------------//
+
+#include "federation.h"
+#include "topic.h"
+#include "lock.h"
+#include "shared.h"
+#include "csse2310a3.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LOCALHOST "localhost"
+//how long (us) to wait before retrying to connect to a peer
+#define RETRY_INTERVAL 200000
+//how often (us) batched frames are flushed out to linked peers
+#define FLUSH_INTERVAL 1000
+//size of the write buffer frames to a linked peer are batched up in
+#define PEER_BUFFER_SIZE 65536
+
+Federation* federation_init(char* id,
+        void (*deliver)(void* arg, char* topic, char* frame),
+        void* deliverArg) {
+    Federation* federation = calloc(1, sizeof(Federation));
+    federation->id = id;
+    federation->interest = stringmap_init();
+    init_mutex(&federation->interestLock, "interestLock");
+    federation->peers = init_client_list(NULL, true);
+    init_mutex(&federation->peersLock, "peersLock");
+    federation->deliver = deliver;
+    federation->deliverArg = deliverArg;
+    return federation;
+}
+
+void add_peer_link(Federation* federation, char* address) {
+    PeerLink* link = calloc(1, sizeof(PeerLink));
+    char* colon = strrchr(address, ':');
+    link->host = colon ? strndup(address, colon - address) : LOCALHOST;
+    link->service = colon ? colon + 1 : address;
+    init_mutex(&link->lock, NULL);
+    link->federation = federation;
+    link->next = federation->links;
+    federation->links = link;
+}
+
+/* send_interest
+ * -------------
+ * Helper function for peer_link_thread() that sends the node's whole
+ * interest set to a newly connected peer.
+ *
+ * link - link to the peer (connected, with its lock held)
+ *
+ * */
+void send_interest(PeerLink* link) {
+    Federation* federation = link->federation;
+    StringMapItem* currItem = NULL;
+    take_mutex(&federation->interestLock);
+    while ((currItem = stringmap_iterate(federation->interest, currItem))) {
+        if (((Interest*)currItem->item)->isInterested) {
+            fprintf(link->toPeer, "sub %s\n", currItem->key);
+        }
+    }
+    release_mutex(&federation->interestLock);
+    fflush(link->toPeer);
+}
+
+/* deliver_peer_frame
+ * ------------------
+ * Helper function for peer_link_thread() that hands a message forwarded by
+ * a peer (ie: "name:topic:value") over to be published locally.
+ *
+ * federation - this node's federation
+ * line - line read from the peer
+ *
+ * */
+void deliver_peer_frame(Federation* federation, char* line) {
+    char* topic = get_frame_topic(line);
+    if (!topic) {
+        return;
+    }
+    int lineLen = strlen(line);
+    char* frame = malloc(sizeof(char) * (lineLen + 2));
+    sprintf(frame, "%s\n", line);
+    federation->deliver(federation->deliverArg, topic, frame);
+    free(frame);
+    free(topic);
+}
+
+/* peer_link_thread
+ * ----------------
+ * The thread spawned for each link by start_peer_links() (see
+ * federation.h).
+ *
+ * arg - PeerLink structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* peer_link_thread(void* arg) {
+    PeerLink* link = (PeerLink*)arg;
+    Federation* federation = link->federation;
+    while (true) {
+        int fd = connect_to_host(link->host, link->service);
+        if (fd < 0) {
+            usleep(RETRY_INTERVAL);
+            continue;
+        }
+        FILE* fromPeer = fdopen(fd, "r");
+
+        //introduce ourself and advertise our interest set
+        take_mutex(&link->lock);
+        link->toPeer = fdopen(dup(fd), "w");
+        fprintf(link->toPeer, "peer %s\n", federation->id);
+        send_interest(link);
+        release_mutex(&link->lock);
+
+        char* line;
+        while ((line = read_line(fromPeer))) {
+            deliver_peer_frame(federation, line);
+            free(line);
+        }
+
+        //peer went away - reconnect
+        take_mutex(&link->lock);
+        fclose(link->toPeer);
+        link->toPeer = NULL;
+        release_mutex(&link->lock);
+        fclose(fromPeer);
+        usleep(RETRY_INTERVAL);
+    }
+}
+
+/* take_interest_changes
+ * ---------------------
+ * Helper function for send_interest_changes() that empties the changed list
+ * of the interest set, writing a "sub"/"unsub" command for each topic in it
+ * the peers haven't been told about to a dynamically allocated string.
+ *
+ * federation - this node's federation
+ *
+ * Returns:
+ *      the commands (must be free()'d, may be empty), or NULL if nothing 
+ *      has changed
+ *
+ * */
+char* take_interest_changes(Federation* federation) {
+    char* commands = NULL;
+    size_t length = 0;
+    FILE* out = NULL;
+    take_mutex(&federation->interestLock);
+    if (federation->changed) {
+        out = open_memstream(&commands, &length);
+    }
+    while (federation->changed) {
+        Interest* interest = federation->changed;
+        //skip topics that have changed back again
+        if (interest->isInterested != interest->isAdvertised) {
+            fprintf(out, "%s %s\n", interest->isInterested ? "sub" : "unsub",
+                    interest->topic);
+            interest->isAdvertised = interest->isInterested;
+        }
+        interest->isChanged = false;
+        federation->changed = interest->nextChanged;
+    }
+    release_mutex(&federation->interestLock);
+    if (out) {
+        fclose(out);
+    }
+    return commands;
+}
+
+/* send_interest_changes
+ * ---------------------
+ * Helper function for peer_flush_thread() that tells every connected peer
+ * about the topics this node has gained/lost interest in since last time.
+ *
+ * federation - this node's federation
+ *
+ * */
+void send_interest_changes(Federation* federation) {
+    char* commands = take_interest_changes(federation);
+    if (!commands) {
+        return;
+    }
+    PeerLink* link = federation->links;
+    while (link) {
+        take_mutex(&link->lock);
+        if (link->toPeer) {
+            fputs(commands, link->toPeer);
+            fflush(link->toPeer);
+        }
+        release_mutex(&link->lock);
+        link = link->next;
+    }
+    free(commands);
+}
+
+/* peer_flush_thread
+ * -----------------
+ * The thread spawned by start_peer_links() that periodically flushes the
+ * frames batched up for each linked peer, and sends changes to this node's
+ * interest set to the peers it is linked to.
+ *
+ * arg - Federation structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* peer_flush_thread(void* arg) {
+    Federation* federation = (Federation*)arg;
+    while (true) {
+        usleep(FLUSH_INTERVAL);
+        send_interest_changes(federation);
+        take_mutex(&federation->peersLock);
+        ClientListItem* currItem = federation->peers;
+        while (currItem) {
+            if (!currItem->isPlaceholder) {
+                fflush(currItem->client->serverToClient);
+            }
+            currItem = currItem->next;
+        }
+        release_mutex(&federation->peersLock);
+    }
+}
+
+void start_peer_links(Federation* federation) {
+    pthread_t threadId;
+    PeerLink* link = federation->links;
+    while (link) {
+        pthread_create(&threadId, NULL, peer_link_thread, link);
+        pthread_detach(threadId);
+        link = link->next;
+    }
+    pthread_create(&threadId, NULL, peer_flush_thread, federation);
+    pthread_detach(threadId);
+}
+
+void advertise_interest(Federation* federation, char* topic,
+        bool isInterested) {
+    take_mutex(&federation->interestLock);
+    Interest* interest = stringmap_search(federation->interest, topic);
+    if (!interest) {
+        interest = calloc(1, sizeof(Interest));
+        interest->topic = strdup(topic);
+        stringmap_add(federation->interest, topic, interest);
+    }
+    //queue the topic to be sent if its interest has changed (once, however
+    //many times it changes before it's sent)
+    if (interest->isInterested != isInterested) {
+        interest->isInterested = isInterested;
+        if (!interest->isChanged) {
+            interest->isChanged = true;
+            interest->nextChanged = federation->changed;
+            federation->changed = interest;
+        }
+    }
+    release_mutex(&federation->interestLock);
+}
+
+void register_peer(Federation* federation, Client* client) {
+    setvbuf(client->serverToClient, NULL, _IOFBF, PEER_BUFFER_SIZE);
+    client->isPeer = true;
+    take_mutex(&federation->peersLock);
+    add_client(federation->peers, client);
+    release_mutex(&federation->peersLock);
+}
+
+void unregister_peer(Federation* federation, Client* client) {
+    if (!client->isPeer) {
+        return;
+    }
+    take_mutex(&federation->peersLock);
+    ClientListItem* newHead = remove_client(federation->peers, client);
+    if (newHead) {
+        federation->peers = newHead;
+    }
+    release_mutex(&federation->peersLock);
+}
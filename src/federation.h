@@ -0,0 +1,172 @@
+//federation.h//
+//----------------------//
+//federation.c abstracts away the links between peered psserver nodes
+//----------------------//
+
+#ifndef FEDERATION
+#define FEDERATION
+
+#include "clientList.h"
+#include "stringmap.h"
+#include "lock.h"
+
+/* How federation works:
+ *
+ * Each node opens a link to every peer given on its command line. Over the
+ * link, the node behaves like an ordinary client of the peer: it sends
+ * "peer <id>" and then "sub <topic>" for each topic it has local subscribers
+ * for (its interest set), keeping the peer up to date with "sub"/"unsub" as
+ * local subscriptions come and go. The peer therefore only forwards
+ * messages for topics the node is interested in, which the node then
+ * publishes to its local subscribers.
+ *
+ * Messages received from a peer are never forwarded on to other peers, so
+ * nodes are expected to be peered in a full mesh (each node listing every
+ * other node).
+ * */
+
+/* Defines the PeerLink structure, which represents this node's link to one
+ * of its peers:
+ *
+ *      host - host the peer is on
+ *      service - port the peer is listening on
+ *      toPeer - write end of the link (NULL while not connected)
+ *      lock - lock protecting the write end
+ *      federation - federation the link belongs to
+ *      next - next link
+ * */
+typedef struct PeerLink {
+    char* host;
+    char* service;
+    FILE* toPeer;
+    Mutex lock;
+    struct Federation* federation;
+    struct PeerLink* next;
+} PeerLink;
+
+/* Defines the Interest structure, which holds this node's interest in one
+ * topic:
+ *
+ *      topic - name of the topic
+ *      isInterested - true iff the node has local subscribers for the topic
+ *      isAdvertised - true iff the peers were last told the node is
+ *                     interested in the topic
+ *      isChanged - true iff the topic is in the federation's changed list
+ *      nextChanged - next topic in the changed list
+ * */
+typedef struct Interest {
+    char* topic;
+    bool isInterested;
+    bool isAdvertised;
+    bool isChanged;
+    struct Interest* nextChanged;
+} Interest;
+
+/* Defines the Federation structure, which holds everything to do with this
+ * node's peers:
+ *
+ *      id - ID this node gives itself when linking to peers
+ *      links - list of this node's links to its peers
+ *      interest - string map of topics (keys) this node has had local
+ *                 subscribers for (item is an Interest*)
+ *      changed - list of topics whose interest has changed since it was
+ *                last sent to the peers
+ *      interestLock - lock protecting the interest set and changed list
+ *      peers - list of peers linked to this node (ie: clients who sent
+ *              "peer"), whose forwarded frames are batched
+ *      peersLock - lock protecting the list of peers
+ *      deliver - function that publishes a message received from a peer to
+ *                this node's local subscribers
+ *      deliverArg - first argument given to deliver
+ * */
+typedef struct Federation {
+    char* id;
+    PeerLink* links;
+    StringMap* interest;
+    struct Interest* changed;
+    Mutex interestLock;
+    ClientListItem* peers;
+    Mutex peersLock;
+    void (*deliver)(void* arg, char* topic, char* frame);
+    void* deliverArg;
+} Federation;
+
+/* federation_init
+ * ---------------
+ * Initialises a Federation structure with no peers.
+ *
+ * id - ID this node gives itself when linking to peers
+ * deliver - function that publishes a message (frame) received from a peer
+ *           to this node's local subscribers of the given topic
+ * deliverArg - first argument to give deliver
+ *
+ * Returns:
+ *      the newly created Federation structure
+ *
+ * */
+Federation* federation_init(char* id,
+        void (*deliver)(void* arg, char* topic, char* frame),
+        void* deliverArg);
+
+/* add_peer_link
+ * -------------
+ * Adds a link to the peer at the given address to the federation.
+ *
+ * federation - this node's federation
+ * address - "<host>:<port>" or just "<port>" (on localhost)
+ *
+ * */
+void add_peer_link(Federation* federation, char* address);
+
+/* start_peer_links
+ * ----------------
+ * Spawns a thread for each of the federation's links, which connects to the
+ * peer (retrying until it's up), advertises this node's interest set and
+ * then delivers each message the peer forwards. Also spawns the thread that
+ * flushes batched frames out to linked peers and sends them changes to the
+ * interest set.
+ *
+ * federation - this node's federation
+ *
+ * */
+void start_peer_links(Federation* federation);
+
+/* advertise_interest
+ * ------------------
+ * Updates this node's interest in the given topic. If it has changed, the
+ * topic is queued for the peer flush thread (see start_peer_links()) to tell
+ * every peer, so the caller never waits on a peer's socket.
+ *
+ * federation - this node's federation
+ * topic - topic the node has gained/lost local subscribers for
+ * isInterested - true iff the node now has local subscribers for the topic
+ *
+ * */
+void advertise_interest(Federation* federation, char* topic,
+        bool isInterested);
+
+/* register_peer
+ * -------------
+ * Marks the given client as a linked peer. Frames sent to them are then
+ * batched up and flushed periodically, rather than flushed one by one.
+ *
+ * NOTE: must be done before anything is written to the client
+ *
+ * federation - this node's federation
+ * client - client who sent "peer"
+ *
+ * */
+void register_peer(Federation* federation, Client* client);
+
+/* unregister_peer
+ * ---------------
+ * Stops batching frames to the given (disconnecting) peer. Does nothing if
+ * the client isn't a peer.
+ *
+ * federation - this node's federation
+ * client - client who is disconnecting
+ *
+ * */
+void unregister_peer(Federation* federation, Client* client);
+
+#endif //FEDERATION
@@ -0,0 +1,711 @@
+//handoff.c//
+//----------------------//
+//This file abstracts away hot restarts, where a newly started psserver
+//takes over the sockets and state of the one already running
+//----------------------//
+
+#include "handoff.h"
+#include "credit.h"
+#include "topic.h"
+#include "lock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define NS_PER_SEC 1000000000
+//records sent from the predecessor to the successor, and the reply
+#define LISTEN_RECORD "listen"
+#define UNIX_RECORD "unix"
+#define RETAIN_RECORD "retain "
+#define RING_RECORD "ring "
+#define CLIENT_RECORD "client\n"
+#define DONE_RECORD "done"
+#define OK_RECORD "ok"
+//separates a retained frame's key from the frame in a retain record
+#define KEY_SEPARATOR ':'
+#define BALANCE_NAMES {"rr", "least"}
+
+/* Defines the RecordHeader structure, which is sent (with any descriptor
+ * being passed) ahead of each record's text:
+ *
+ *      length - length of the record's text
+ *      hasFd - 1 iff a descriptor is passed with the record
+ * */
+typedef struct {
+    uint32_t length;
+    uint32_t hasFd;
+} RecordHeader;
+
+Handoff* handoff_init(char* path, int listenFd, int unixFd) {
+    Handoff* handoff = calloc(1, sizeof(Handoff));
+    handoff->path = path;
+    handoff->listenFd = listenFd;
+    handoff->unixFd = unixFd;
+    //the accept loops (see server_infinite_loop()) park too
+    handoff->numActive = unixFd < 0 ? 1 : 2;
+    pipe(handoff->wakeFds);
+    init_lock(&handoff->parkedSignal, 0);
+    init_lock(&handoff->resumeSignal, 0);
+    init_mutex(&handoff->lock, NULL);
+    return handoff;
+}
+
+void handoff_register(Handoff* handoff) {
+    if (!handoff) {
+        return;
+    }
+    take_mutex(&handoff->lock);
+    handoff->numActive++;
+    release_mutex(&handoff->lock);
+}
+
+void handoff_unregister(Handoff* handoff) {
+    if (!handoff) {
+        return;
+    }
+    take_mutex(&handoff->lock);
+    handoff->numActive--;
+    release_mutex(&handoff->lock);
+    //a hot restart may have been waiting on this thread
+    release_lock(&handoff->parkedSignal);
+}
+
+/* park
+ * ----
+ * Parks the calling client thread (or accept loop) for the hot restart in
+ * progress, until the hot restart fails.
+ *
+ * handoff - psserver's side of hot restarts
+ * fd - socket the caller reads from
+ * client - client the socket belongs to (NULL for an accept loop)
+ *
+ * */
+void park(Handoff* handoff, int fd, Client* client) {
+    ParkedClient* parked = calloc(1, sizeof(ParkedClient));
+    parked->client = client;
+    parked->fd = fd;
+    take_mutex(&handoff->lock);
+    parked->next = handoff->parked;
+    handoff->parked = parked;
+    handoff->numParked++;
+    release_mutex(&handoff->lock);
+    release_lock(&handoff->parkedSignal);
+    take_lock(&handoff->resumeSignal);
+}
+
+void handoff_wait(Handoff* handoff, int fd, Client* client) {
+    if (!handoff) {
+        return;
+    }
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, 
+            {handoff->wakeFds[0], POLLIN, 0}};
+    while (true) {
+        while (poll(fds, 2, -1) < 0 && errno == EINTR) {
+        }
+        //NOTE: input waiting is left in the socket for the successor
+        if (!(fds[1].revents & POLLIN)) {
+            return;
+        }
+        park(handoff, fd, client);
+    }
+}
+
+/* handoff_deadline
+ * ----------------
+ * Returns the (absolute) time HANDOFF_TIMEOUT from now, in the form
+ * sem_timedwait() takes.
+ * */
+struct timespec handoff_deadline(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += HANDOFF_TIMEOUT / MS_PER_SEC;
+    deadline.tv_nsec += (long)(HANDOFF_TIMEOUT % MS_PER_SEC) * NS_PER_MS;
+    if (deadline.tv_nsec >= NS_PER_SEC) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NS_PER_SEC;
+    }
+    return deadline;
+}
+
+/* take_lock_by
+ * ------------
+ * Takes the given lock, unless the given deadline passes first.
+ *
+ * Returns:
+ *      true iff the lock was taken
+ *
+ * */
+bool take_lock_by(sem_t* lock, struct timespec* deadline) {
+    int result;
+    while ((result = sem_timedwait(lock, deadline)) && errno == EINTR) {
+    }
+    return !result;
+}
+
+/* wait_until_parked
+ * -----------------
+ * Waits until every client thread and accept loop is parked.
+ *
+ * handoff - psserver's side of hot restarts
+ * deadline - time to give up at
+ *
+ * Returns:
+ *      true iff everything parked before the deadline
+ *
+ * */
+bool wait_until_parked(Handoff* handoff, struct timespec* deadline) {
+    take_mutex(&handoff->lock);
+    while (handoff->numParked < handoff->numActive) {
+        release_mutex(&handoff->lock);
+        if (!take_lock_by(&handoff->parkedSignal, deadline)) {
+            return false;
+        }
+        take_mutex(&handoff->lock);
+    }
+    release_mutex(&handoff->lock);
+    return true;
+}
+
+/* resume_parked
+ * -------------
+ * Resumes every parked client thread and accept loop after a failed hot
+ * restart.
+ * */
+void resume_parked(Handoff* handoff) {
+    char wake;
+    read(handoff->wakeFds[0], &wake, 1);
+    take_mutex(&handoff->lock);
+    int numParked = handoff->numParked;
+    ParkedClient* parked = handoff->parked;
+    while (parked) {
+        ParkedClient* next = parked->next;
+        free(parked->replay);
+        free(parked);
+        parked = next;
+    }
+    handoff->parked = NULL;
+    handoff->numParked = 0;
+    release_mutex(&handoff->lock);
+    for (int i = 0; i < numParked; i++) {
+        release_lock(&handoff->resumeSignal);
+    }
+}
+
+/* send_record
+ * -----------
+ * Sends a record (and the given descriptor, if any) over the hand over
+ * connection.
+ *
+ * fd - connection to the other psserver
+ * text - text of the record
+ * length - length of the text
+ * passFd - descriptor to pass with the record (-1 for none)
+ *
+ * Returns:
+ *      true iff the record was sent
+ *
+ * */
+bool send_record(int fd, char* text, size_t length, int passFd) {
+    RecordHeader header = {length, passFd >= 0};
+    struct iovec iov = {&header, sizeof(RecordHeader)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (passFd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(RecordHeader)) {
+        return false;
+    }
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t numSent = send(fd, text + sent, length - sent, MSG_NOSIGNAL);
+        if (numSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numSent <= 0) {
+            return false;
+        }
+        sent += numSent;
+    }
+    return true;
+}
+
+/* receive_record
+ * --------------
+ * Receives a record (and any descriptor passed with it) over the hand over
+ * connection.
+ *
+ * fd - connection to the other psserver
+ * passedFd - set to the descriptor passed with the record (-1 if none)
+ *
+ * Returns:
+ *      the malloc'd text of the record, or NULL if the connection failed
+ *
+ * */
+char* receive_record(int fd, int* passedFd) {
+    RecordHeader header;
+    struct iovec iov = {&header, sizeof(RecordHeader)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    *passedFd = -1;
+    ssize_t numRead;
+    while ((numRead = recvmsg(fd, &msg, MSG_WAITALL)) < 0 && errno == EINTR) {
+    }
+    if (numRead != sizeof(RecordHeader)) {
+        return NULL;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (header.hasFd && cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(passedFd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    char* text = malloc(header.length + 1);
+    size_t received = 0;
+    while (received < header.length) {
+        numRead = recv(fd, text + received, header.length - received, 0);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            free(text);
+            return NULL;
+        }
+        received += numRead;
+    }
+    text[header.length] = '\0';
+    return text;
+}
+
+/* send_text_record
+ * ----------------
+ * Sends a record whose text is a string (see send_record()).
+ * */
+bool send_text_record(int fd, char* text, int passFd) {
+    return send_record(fd, text, strlen(text), passFd);
+}
+
+/* compare_parked
+ * --------------
+ * Orders parked clients by the address of their Client (for qsort() and
+ * bsearch()).
+ * */
+int compare_parked(const void* a, const void* b) {
+    uintptr_t clientA = (uintptr_t)(*(ParkedClient**)a)->client;
+    uintptr_t clientB = (uintptr_t)(*(ParkedClient**)b)->client;
+    return (clientA > clientB) - (clientA < clientB);
+}
+
+/* find_parked
+ * -----------
+ * Finds the parked client the given Client belongs to.
+ *
+ * byClient - parked clients sorted by compare_parked()
+ * numClients - number of parked clients
+ * client - client to find
+ *
+ * Returns:
+ *      the parked client, or NULL if the client isn't being handed over
+ *
+ * */
+ParkedClient* find_parked(ParkedClient** byClient, int numClients,
+        Client* client) {
+    ParkedClient key = {.client = client};
+    ParkedClient* keyPtr = &key;
+    ParkedClient** found = bsearch(&keyPtr, byClient, numClients,
+            sizeof(ParkedClient*), compare_parked);
+    return found ? *found : NULL;
+}
+
+/* record_subscriptions
+ * --------------------
+ * Writes a 'sub' command into the replay of each parked client subscribed
+ * to the given topic (or a member of one of its consumer groups).
+ *
+ * NOTE: the string map lock must be held by the caller
+ *
+ * entry - topic to record the subscribers of
+ * topic - name of the topic
+ * byClient - parked clients sorted by compare_parked()
+ * numClients - number of parked clients
+ *
+ * */
+void record_subscriptions(TopicEntry* entry, char* topic,
+        ParkedClient** byClient, int numClients) {
+    ParkedClient* parked;
+    for (ClientListItem* item = entry->subscribers; item; item = item->next) {
+        if (!item->isPlaceholder && (parked = find_parked(byClient,
+                numClients, item->client))) {
+            fprintf(parked->replayStream, "sub %s\n", topic);
+        }
+    }
+    char* balanceNames[] = BALANCE_NAMES;
+    take_mutex(&entry->groupsLock);
+    for (ConsumerGroup* group = entry->groups; group; group = group->next) {
+        take_mutex(&group->lock);
+        for (ClientListItem* item = group->members; item;
+                item = item->next) {
+            if (!item->isPlaceholder && (parked = find_parked(byClient,
+                    numClients, item->client))) {
+                fprintf(parked->replayStream, "sub %s group=%s balance=%s\n",
+                        topic, group->name, balanceNames[group->balance]);
+            }
+        }
+        release_mutex(&group->lock);
+    }
+    release_mutex(&entry->groupsLock);
+}
+
+/* send_topics
+ * -----------
+ * Sends the successor every topic's retained values and shared memory ring,
+ * and records each parked client's subscriptions to it.
+ *
+ * NOTE: the string map lock must be held by the caller
+ *
+ * handoff - psserver's side of hot restarts
+ * fd - connection to the successor
+ * byClient - parked clients sorted by compare_parked()
+ * numClients - number of parked clients
+ *
+ * Returns:
+ *      true iff everything was sent
+ *
+ * */
+bool send_topics(Handoff* handoff, int fd, ParkedClient** byClient,
+        int numClients) {
+    StringMapItem* topicItem = NULL;
+    bool isSent = true;
+    while (isSent && (topicItem = stringmap_iterate(
+            handoff->broker->stringMap, topicItem))) {
+        TopicEntry* entry = topicItem->item;
+        //retained values, as "retain <key>:<frame>"
+        StringMapItem* keyItem = NULL;
+        take_mutex(&entry->retainedLock);
+        while (isSent &&
+                (keyItem = stringmap_iterate(entry->retained, keyItem))) {
+            char* record;
+            size_t length;
+            FILE* stream = open_memstream(&record, &length);
+            fprintf(stream, "%s%s%c%s", RETAIN_RECORD, keyItem->key,
+                    KEY_SEPARATOR, (char*)keyItem->item);
+            fclose(stream);
+            isSent = send_record(fd, record, length, -1);
+            free(record);
+        }
+        release_mutex(&entry->retainedLock);
+        //shared memory ring, as "ring <topic>" (with the ring's memfd)
+        if (isSent && entry->ring) {
+            char* record = malloc(strlen(RING_RECORD) +
+                    strlen(topicItem->key) + 1);
+            sprintf(record, "%s%s", RING_RECORD, topicItem->key);
+            isSent = send_text_record(fd, record, entry->ring->fd);
+            free(record);
+        }
+        record_subscriptions(entry, topicItem->key, byClient, numClients);
+    }
+    return isSent;
+}
+
+/* send_snapshot
+ * -------------
+ * Sends the successor the listening sockets, topics and clients (see
+ * handoff.h).
+ *
+ * NOTE: everything must be parked, and the string map lock held, by the
+ * caller
+ *
+ * handoff - psserver's side of hot restarts
+ * fd - connection to the successor
+ *
+ * Returns:
+ *      true iff everything was sent
+ *
+ * */
+bool send_snapshot(Handoff* handoff, int fd) {
+    bool isSent = send_text_record(fd, LISTEN_RECORD, handoff->listenFd) &&
+            (handoff->unixFd < 0 ||
+            send_text_record(fd, UNIX_RECORD, handoff->unixFd));
+
+    //the clients that can be handed over, with their replays begun
+    ParkedClient** byClient = calloc(handoff->numParked + 1,
+            sizeof(ParkedClient*));
+    int numClients = 0;
+    for (ParkedClient* parked = handoff->parked; parked;
+            parked = parked->next) {
+        Client* client = parked->client;
+        if (!client || client->session || client->isPeer ||
+                client->follower) {
+            continue;
+        }
+        parked->replayStream = open_memstream(&parked->replay,
+                &parked->replayLen);
+        fputs(CLIENT_RECORD, parked->replayStream);
+        if (client->name) {
+            fprintf(parked->replayStream, "name %s\n", client->name);
+        }
+        if (client->credit) {
+            fprintf(parked->replayStream, "credit %d\n",
+                    client->credit->limit);
+        }
+        byClient[numClients++] = parked;
+    }
+    qsort(byClient, numClients, sizeof(ParkedClient*), compare_parked);
+
+    isSent = isSent && send_topics(handoff, fd, byClient, numClients);
+    for (int i = 0; i < numClients; i++) {
+        fclose(byClient[i]->replayStream);
+        isSent = isSent && send_record(fd, byClient[i]->replay,
+                byClient[i]->replayLen, byClient[i]->fd);
+    }
+    free(byClient);
+    return isSent && send_text_record(fd, DONE_RECORD, -1);
+}
+
+/* flush_parked
+ * ------------
+ * Waits for everything queued for the parked clients to be written to 
+ * them, so the successor takes over their sockets between frames.
+ *
+ * handoff - psserver's side of hot restarts
+ * deadline - time to give up at
+ *
+ * Returns:
+ *      true iff everything was written before the deadline
+ *
+ * */
+bool flush_parked(Handoff* handoff, struct timespec* deadline) {
+    for (ParkedClient* parked = handoff->parked; parked;
+            parked = parked->next) {
+        if (parked->client && !flush_outbound(parked->client, deadline)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* hand_over
+ * ---------
+ * Hands psserver over to the successor connected on the given socket (see
+ * handoff.h). Only returns if the hand over fails, in which case psserver
+ * carries on serving.
+ *
+ * handoff - psserver's side of hot restarts
+ * fd - connection to the successor
+ *
+ * */
+void hand_over(Handoff* handoff, int fd) {
+    struct timespec deadline = handoff_deadline();
+    //wake everything waiting for input so that it parks
+    write(handoff->wakeFds[1], "", 1);
+    bool isParked = wait_until_parked(handoff, &deadline) &&
+            wait_for_publishes(handoff->broker, &deadline);
+    //stop anything else (eg: peers) publishing while the snapshot is taken
+    bool isLocked = isParked &&
+            take_write_lock_by(handoff->broker->stringMapLock, &deadline);
+    //a publish queued before the lock was taken can't be delivered under it
+    struct timespec passed = {0};
+    int passedFd;
+    char* reply = NULL;
+    if (isLocked && wait_for_publishes(handoff->broker, &passed) &&
+            flush_parked(handoff, &deadline) && send_snapshot(handoff, fd)) {
+        reply = receive_record(fd, &passedFd);
+    }
+    if (reply && !strcmp(reply, OK_RECORD)) {
+        //the successor has everything: connections that weren't handed
+        //over are closed as we exit
+        exit(0);
+    }
+    free(reply);
+    fprintf(stderr, "psserver: hot restart failed\n");
+    if (isLocked) {
+        release_write_lock(handoff->broker->stringMapLock);
+    }
+    resume_parked(handoff);
+}
+
+/* handoff_listener_thread
+ * -----------------------
+ * The thread spawned by start_handoff_listener() which waits for successors
+ * to connect and hands over to them.
+ *
+ * arg - Handoff structure (void*)
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* handoff_listener_thread(void* arg) {
+    Handoff* handoff = (Handoff*)arg;
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, handoff->path);
+    unlink(handoff->path);
+    if (bind(listenFd, (struct sockaddr*)&addr, sizeof(struct sockaddr_un)) ||
+            listen(listenFd, 1) < 0) {
+        fprintf(stderr, "psserver: unable to listen for hot restarts\n");
+        return NULL;
+    }
+    while (true) {
+        int fd = accept(listenFd, 0, 0);
+        if (fd < 0) {
+            continue;
+        }
+        hand_over(handoff, fd);
+        close(fd);
+    }
+}
+
+bool start_handoff_listener(Handoff* handoff, Broker* broker) {
+    struct sockaddr_un addr;
+    if (strlen(handoff->path) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    handoff->broker = broker;
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, handoff_listener_thread, handoff);
+    pthread_detach(threadId);
+    return true;
+}
+
+Takeover* take_over(char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_un))) {
+        //no psserver running (or a stale socket left by one that exited)
+        close(fd);
+        return NULL;
+    }
+
+    Takeover* takeover = calloc(1, sizeof(Takeover));
+    takeover->fd = fd;
+    takeover->listenFd = takeover->unixFd = -1;
+    char* record;
+    int passedFd;
+    while ((record = receive_record(fd, &passedFd)) &&
+            strcmp(record, DONE_RECORD)) {
+        if (!strcmp(record, LISTEN_RECORD)) {
+            takeover->listenFd = passedFd;
+            free(record);
+        } else if (!strcmp(record, UNIX_RECORD)) {
+            takeover->unixFd = passedFd;
+            free(record);
+        } else {
+            takeover->records = realloc(takeover->records,
+                    sizeof(char*) * (takeover->numRecords + 1));
+            takeover->fds = realloc(takeover->fds,
+                    sizeof(int) * (takeover->numRecords + 1));
+            takeover->records[takeover->numRecords] = record;
+            takeover->fds[takeover->numRecords++] = passedFd;
+        }
+    }
+    if (!record || takeover->listenFd < 0) {
+        //the predecessor gave up (and carries on serving)
+        for (int i = 0; i < takeover->numRecords; i++) {
+            if (takeover->fds[i] >= 0) {
+                close(takeover->fds[i]);
+            }
+            free(takeover->records[i]);
+        }
+        close(takeover->listenFd);
+        close(takeover->unixFd);
+        close(fd);
+        free(takeover->records);
+        free(takeover->fds);
+        memset(takeover, 0, sizeof(Takeover));
+        takeover->listenFd = -1;
+    }
+    free(record);
+    return takeover;
+}
+
+/* restore_retained
+ * ----------------
+ * Restores a retained value sent as "retain <key>:<frame>".
+ *
+ * broker - broker to restore into
+ * record - text of the record (after "retain ")
+ *
+ * */
+void restore_retained(Broker* broker, char* record) {
+    char* frame = strchr(record, KEY_SEPARATOR);
+    char* topic = frame ? get_frame_topic(frame + 1) : NULL;
+    if (!topic) {
+        return;
+    }
+    *frame++ = '\0';
+    TopicEntry* entry = find_or_add_topic(broker->stringMap,
+            broker->stringMapLock, topic);
+    retain_and_replicate(broker->replication, entry, record, frame);
+    free(topic);
+}
+
+void finish_take_over(Takeover* takeover, Broker* broker) {
+    Client** clients = calloc(takeover->numRecords, sizeof(Client*));
+    int numClients = 0;
+    for (int i = 0; i < takeover->numRecords; i++) {
+        char* record = takeover->records[i];
+        int fd = takeover->fds[i];
+        if (!strncmp(record, RETAIN_RECORD, strlen(RETAIN_RECORD))) {
+            restore_retained(broker, record + strlen(RETAIN_RECORD));
+        } else if (!strncmp(record, RING_RECORD, strlen(RING_RECORD)) &&
+                fd >= 0) {
+            TopicEntry* entry = find_or_add_topic(broker->stringMap,
+                    broker->stringMapLock, record + strlen(RING_RECORD));
+            if (!(entry->ring = ring_adopt(fd))) {
+                close(fd);
+            }
+        } else if (!strncmp(record, CLIENT_RECORD, strlen(CLIENT_RECORD)) &&
+                fd >= 0) {
+            //every client's state is rebuilt before any is served, so none
+            //is published to while its replies are being thrown away
+            clients[numClients++] = broker_restore_client(broker, fd,
+                    record + strlen(CLIENT_RECORD));
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        free(record);
+    }
+    for (int i = 0; i < numClients; i++) {
+        broker_serve_client(broker, clients[i]);
+    }
+    //the predecessor can now exit
+    send_text_record(takeover->fd, OK_RECORD, -1);
+    close(takeover->fd);
+    free(clients);
+    free(takeover->records);
+    free(takeover->fds);
+    free(takeover);
+}
@@ -0,0 +1,206 @@
+//handoff.h//
+//----------------------//
+//handoff.c abstracts away hot restarts, where a newly started psserver
+//takes over the sockets and state of the one already running
+//----------------------//
+
+#ifndef HANDOFF
+#define HANDOFF
+
+#include "broker.h"
+#include "lock.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <semaphore.h>
+
+/* How hot restarts work:
+ *
+ * psserver given "handoff=<path>" listens for a successor on a Unix domain
+ * socket at <path>. A new psserver started with the same option connects to
+ * it and the running one (the predecessor):
+ *
+ *      1. stops its accept loops and client threads. Each one parks itself
+ *         the next time it would block waiting for input, so no client has
+ *         a half-read command or half-written message.
+ *      2. sends the successor (over SCM_RIGHTS) its listening sockets, the
+ *         sockets of its clients and its topics' shared memory rings, along
+ *         with a snapshot of its retained values and each client's state
+ *         (its name, subscriptions, consumer groups and credit) in the form
+ *         of the commands that rebuild it.
+ *      3. exits once the successor confirms it has restored everything.
+ *
+ * The successor replays each client's commands (with any replies, eg:
+ * retained values, thrown away), then serves the client as usual, so
+ * clients don't notice the restart. Connections that can't be carried over
+ * this way (acknowledged mode sessions, linked peers and followers) are
+ * closed when the predecessor exits, and reconnect as they would after a
+ * crash. Clients connecting during the restart wait in the listening
+ * socket's backlog.
+ *
+ * If everything can't be parked within HANDOFF_TIMEOUT, or the successor
+ * fails, the predecessor gives up and carries on serving.
+ * */
+
+//how long (ms) a hot restart may take before the predecessor gives up
+#define HANDOFF_TIMEOUT 5000
+
+/* Defines the ParkedClient structure, which holds a client (or accept
+ * loop) parked for a hot restart:
+ *
+ *      client - client parked (NULL for an accept loop)
+ *      fd - socket the client thread (or accept loop) reads from
+ *      replay - commands rebuilding the client's state (built while the
+ *               snapshot is taken)
+ *      replayLen - length of replay
+ *      replayStream - stream writing replay
+ *      next - next parked client
+ * */
+typedef struct ParkedClient {
+    Client* client;
+    int fd;
+    char* replay;
+    size_t replayLen;
+    FILE* replayStream;
+    struct ParkedClient* next;
+} ParkedClient;
+
+/* Defines the Handoff structure, which holds a psserver's side of hot
+ * restarts:
+ *
+ *      path - path of the Unix domain socket successors connect to
+ *      listenFd - TCP socket psserver accepts clients on
+ *      unixFd - Unix domain socket psserver accepts clients on (-1 if none)
+ *      wakeFds - pipe whose read end is readable while a hot restart is in
+ *                progress (threads waiting for input poll it)
+ *      numActive - number of client threads and accept loops running
+ *      numParked - number of them parked
+ *      parked - list of those parked
+ *      parkedSignal - posted whenever one is parked or exits
+ *      resumeSignal - posted once for each parked thread to resume after a
+ *                     failed hot restart
+ *      lock - lock protecting the above counts and list
+ *      broker - broker whose state is handed over
+ * */
+typedef struct Handoff {
+    char* path;
+    int listenFd;
+    int unixFd;
+    int wakeFds[2];
+    int numActive;
+    int numParked;
+    ParkedClient* parked;
+    sem_t parkedSignal;
+    sem_t resumeSignal;
+    Mutex lock;
+    Broker* broker;
+} Handoff;
+
+/* Defines the Takeover structure, which holds what a successor received
+ * from its predecessor:
+ *
+ *      listenFd - predecessor's TCP listening socket
+ *      unixFd - predecessor's Unix domain listening socket (-1 if none)
+ *      records - every other record received (retained values, rings and
+ *                clients), in order
+ *      fds - socket/ring passed with each record (-1 if none)
+ *      numRecords - number of records
+ *      fd - connection to the predecessor
+ * */
+typedef struct {
+    int listenFd;
+    int unixFd;
+    char** records;
+    int* fds;
+    int numRecords;
+    int fd;
+} Takeover;
+
+/* handoff_init
+ * ------------
+ * Initialises a psserver's side of hot restarts. Nothing is listened for
+ * until start_handoff_listener() is called.
+ *
+ * path - path of the Unix domain socket successors connect to
+ * listenFd - TCP socket psserver accepts clients on
+ * unixFd - Unix domain socket psserver accepts clients on (-1 if none)
+ *
+ * Returns:
+ *      the newly created Handoff structure
+ *
+ * */
+Handoff* handoff_init(char* path, int listenFd, int unixFd);
+
+/* start_handoff_listener
+ * ----------------------
+ * Starts a thread waiting for a successor to connect (replacing any stale
+ * socket at the path), which then hands it the broker's sockets and state.
+ *
+ * handoff - psserver's side of hot restarts
+ * broker - broker whose state is handed over
+ *
+ * Returns:
+ *      false if the path can't be listened on, true otherwise
+ *
+ * */
+bool start_handoff_listener(Handoff* handoff, Broker* broker);
+
+/* handoff_register
+ * ----------------
+ * Counts a newly started client thread or accept loop, which will park
+ * itself (see handoff_wait()) for a hot restart. Does nothing if the
+ * handoff is NULL (hot restarts not enabled).
+ * */
+void handoff_register(Handoff* handoff);
+
+/* handoff_unregister
+ * ------------------
+ * Stops counting a client thread that is exiting. Does nothing if the
+ * handoff is NULL.
+ * */
+void handoff_unregister(Handoff* handoff);
+
+/* handoff_wait
+ * ------------
+ * Blocks until there is input to read on the given socket. If a hot
+ * restart starts in the meantime, the caller is parked until it fails (if
+ * it succeeds, psserver exits). Returns straight away if the handoff is
+ * NULL.
+ *
+ * NOTE: client threads only call this with nothing left in their read
+ * buffer, so no input is stranded in the predecessor
+ *
+ * handoff - psserver's side of hot restarts
+ * fd - socket to wait on
+ * client - client the socket belongs to (NULL for an accept loop)
+ *
+ * */
+void handoff_wait(Handoff* handoff, int fd, Client* client);
+
+/* take_over
+ * ---------
+ * Connects to the psserver listening for a successor at the given path, if
+ * there is one, and receives its sockets and state.
+ *
+ * path - path of the Unix domain socket to connect to
+ *
+ * Returns:
+ *      what was received, or NULL if no psserver is listening at the path.
+ *      If the hand over fails (eg: the running psserver gives up), its
+ *      listenFd is -1.
+ *
+ * */
+Takeover* take_over(char* path);
+
+/* finish_take_over
+ * ----------------
+ * Restores the retained values, rings and clients received from the
+ * predecessor into the given broker, starts serving the clients and tells
+ * the predecessor it can exit.
+ *
+ * takeover - what was received from the predecessor
+ * broker - broker to restore into
+ *
+ * */
+void finish_take_over(Takeover* takeover, Broker* broker);
+
+#endif //HANDOFF
@@ -0,0 +1,671 @@
+//libpsclient.c//
+//----------------------//
+//This file implements libpsclient, a non-blocking client library for
+//psserver which reconnects, resubscribes and resumes by itself
+//----------------------//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "libpsclient.h"
+#include "shared.h"
+
+#define PATH_SEPARATOR '/'
+#define NEW_LINE '\n'
+#define COLON ':'
+#define REPLY_PREFIX ':'
+#define PING_REPLY ":ping"
+#define PONG_CMD "pong"
+#define REDIRECT_REPLY ":redirect "
+#define BUSY_REPLY ":busy"
+//reply to 'ackmode' when psserver has no session to resume (eg: it has
+//restarted), so delivery IDs start again
+#define SESSION_NEW_REPLY ":session new"
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+//number of bytes read from the socket at a time
+#define READ_SIZE (64 * 1024)
+//initial capacity of a buffer
+#define INITIAL_CAPACITY 4096
+
+/* Defines the Buffer structure, a growable byte buffer:
+ *
+ *      data - bytes in the buffer
+ *      len - number of bytes in the buffer
+ *      capacity - number of bytes allocated
+ * */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+/* Defines the PsClient structure, which holds the following:
+ *
+ *      host - host psserver is on
+ *      service - port (or Unix socket path) psserver is listening on
+ *      name - name of the client
+ *      fd - socket connected to psserver (-1 while disconnected)
+ *      state - one of the PsStates
+ *      topics - topics subscribed to (replayed on reconnect)
+ *      numTopics - number of topics subscribed to
+ *      ackWindow - window given to 'ackmode' (0 if not in acknowledged mode)
+ *      lastId - ID of the last delivery handed out in acknowledged mode
+ *      hasLastId - whether lastId is set (cleared when psserver starts a
+ *                  new session, see handle_line())
+ *      in - bytes received but not yet parsed
+ *      out - commands queued to be sent
+ *      replayLeft - number of bytes at the start of out that are state
+ *                   being replayed (dropped if the connection drops again)
+ *      isMidCommand - whether a command in out has been partly sent
+ *      backoff - current reconnect backoff (ms)
+ *      busyBackoff - backoff as it was before the last connect succeeded,
+ *                    which is gone back to if psserver turns the client
+ *                    away as busy (so a full psserver is retried less and
+ *                    less often)
+ *      reconnectAt - time (ms) of the next reconnect attempt
+ *      seed - state of the jitter's random number generator
+ *      onMessage - called with each message received
+ *      onState - called when the connection changes state (may be NULL)
+ *      arg - first argument given to the callbacks
+ * */
+struct PsClient {
+    char* host;
+    char* service;
+    char* name;
+    int fd;
+    int state;
+    char** topics;
+    int numTopics;
+    int ackWindow;
+    int lastId;
+    bool hasLastId;
+    Buffer in;
+    Buffer out;
+    size_t replayLeft;
+    bool isMidCommand;
+    int backoff;
+    int busyBackoff;
+    long reconnectAt;
+    unsigned int seed;
+    PsMessageCallback onMessage;
+    PsStateCallback onState;
+    void* arg;
+};
+
+/* now_ms
+ * ------
+ * Returns the current monotonic time in ms.
+ * */
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * MS_PER_SEC + ts.tv_nsec / NS_PER_MS;
+}
+
+/* reserve
+ * -------
+ * Makes sure the given buffer has room for the given number of extra bytes.
+ * */
+static void reserve(Buffer* buf, size_t extra) {
+    if (buf->len + extra <= buf->capacity) {
+        return;
+    }
+    size_t capacity = buf->capacity ? buf->capacity : INITIAL_CAPACITY;
+    while (capacity < buf->len + extra) {
+        capacity *= 2;
+    }
+    buf->data = realloc(buf->data, capacity);
+    buf->capacity = capacity;
+}
+
+/* consume
+ * -------
+ * Removes the first len bytes from the given buffer.
+ * */
+static void consume(Buffer* buf, size_t len) {
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+/* queue_command
+ * -------------
+ * Queues the given command (the given parts joined by spaces, plus a
+ * newline) to be sent to psserver.
+ *
+ * client - client to queue the command for
+ * parts - parts of the command
+ * numParts - number of parts
+ *
+ * Returns:
+ *      true iff queued, false if the queue is full
+ *
+ * */
+static bool queue_command(PsClient* client, const char** parts,
+        int numParts) {
+    size_t len = 0;
+    for (int i = 0; i < numParts; i++) {
+        len += strlen(parts[i]) + 1; //space or newline
+    }
+    if (client->out.len + len > PS_MAX_QUEUED) {
+        return false;
+    }
+    reserve(&client->out, len);
+    for (int i = 0; i < numParts; i++) {
+        size_t partLen = strlen(parts[i]);
+        memcpy(client->out.data + client->out.len, parts[i], partLen);
+        client->out.len += partLen;
+        client->out.data[client->out.len++] =
+                (i == numParts - 1) ? NEW_LINE : ' ';
+    }
+    return true;
+}
+
+/* set_state
+ * ---------
+ * Changes the client's connection state, telling the state callback.
+ * */
+static void set_state(PsClient* client, int state) {
+    client->state = state;
+    if (client->onState) {
+        client->onState(client->arg, state);
+    }
+}
+
+/* schedule_reconnect
+ * ------------------
+ * Schedules the client's next reconnect attempt a random time between half
+ * and all of its current backoff from now (so clients dropped together
+ * spread out), then doubles the backoff (up to PS_MAX_BACKOFF).
+ * */
+static void schedule_reconnect(PsClient* client) {
+    int half = client->backoff / 2;
+    client->reconnectAt = now_ms() + half + rand_r(&client->seed) %
+            (client->backoff - half + 1);
+    client->backoff = client->backoff * 2 > PS_MAX_BACKOFF ?
+            PS_MAX_BACKOFF : client->backoff * 2;
+}
+
+/* disconnect
+ * ----------
+ * Closes the client's connection and schedules a reconnect. Any state
+ * still being replayed is dropped (it's replayed again on reconnect), as is
+ * the rest of a partly sent command (which psserver never got all of).
+ * Other queued commands are kept to be sent after reconnecting.
+ * */
+static void disconnect(PsClient* client) {
+    close(client->fd);
+    client->fd = -1;
+    consume(&client->out, client->replayLeft);
+    if (!client->replayLeft && client->isMidCommand) {
+        char* end = memchr(client->out.data, NEW_LINE, client->out.len);
+        consume(&client->out, end - client->out.data + 1);
+    }
+    client->replayLeft = 0;
+    client->isMidCommand = false;
+    client->in.len = 0;
+    schedule_reconnect(client);
+    set_state(client, PS_DISCONNECTED);
+}
+
+/* replay_state
+ * ------------
+ * Puts the client's state (name, acknowledged mode and subscriptions) at
+ * the front of its queue, ahead of any commands queued while disconnected.
+ * */
+static void replay_state(PsClient* client) {
+    Buffer pending = client->out;
+    memset(&client->out, 0, sizeof(Buffer));
+    const char* nameCmd[] = {"name", client->name};
+    queue_command(client, nameCmd, 2);
+    if (client->ackWindow) {
+        char window[sizeof(int) * 3 + 1];
+        sprintf(window, "%d", client->ackWindow);
+        const char* ackCmd[] = {"ackmode", window};
+        queue_command(client, ackCmd, 2);
+    }
+    for (int i = 0; i < client->numTopics; i++) {
+        const char* subCmd[] = {"sub", client->topics[i]};
+        queue_command(client, subCmd, 2);
+    }
+    client->replayLeft = client->out.len;
+    if (pending.len) {
+        reserve(&client->out, pending.len);
+        memcpy(client->out.data + client->out.len, pending.data,
+                pending.len);
+        client->out.len += pending.len;
+    }
+    free(pending.data);
+}
+
+/* open_socket
+ * -----------
+ * Creates a non-blocking socket and starts connecting it to psserver (over
+ * a Unix domain socket if the service contains a '/', otherwise TCP).
+ *
+ * Returns:
+ *      the socket, or -1 if connecting failed straight away
+ *
+ * */
+static int open_socket(PsClient* client) {
+    struct addrinfo* ai = NULL;
+    struct sockaddr_un addr;
+    struct sockaddr* sa;
+    socklen_t saLen;
+    int family;
+    if (strchr(client->service, PATH_SEPARATOR)) {
+        memset(&addr, 0, sizeof(struct sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, client->service, sizeof(addr.sun_path) - 1);
+        family = AF_UNIX;
+        sa = (struct sockaddr*)&addr;
+        saLen = sizeof(struct sockaddr_un);
+    } else {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_INET; //IPv4
+        hints.ai_socktype = SOCK_STREAM; //byte stream (TCP)
+        if (getaddrinfo(client->host, client->service, &hints, &ai)) {
+            return -1;
+        }
+        family = AF_INET;
+        sa = ai->ai_addr;
+        saLen = ai->ai_addrlen;
+    }
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (connect(fd, sa, saLen) && errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (ai) {
+        freeaddrinfo(ai);
+    }
+    return fd;
+}
+
+/* start_connect
+ * -------------
+ * Starts (re)connecting the client to psserver.
+ * */
+static void start_connect(PsClient* client) {
+    client->fd = open_socket(client);
+    if (client->fd < 0) {
+        schedule_reconnect(client);
+        return;
+    }
+    set_state(client, PS_CONNECTING);
+}
+
+/* finish_connect
+ * --------------
+ * Checks whether the client's connection in progress succeeded, and if so
+ * replays its state.
+ * */
+static void finish_connect(PsClient* client) {
+    int error = 0;
+    socklen_t len = sizeof(int);
+    getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error) {
+        disconnect(client);
+        return;
+    }
+    client->busyBackoff = client->backoff;
+    client->backoff = PS_MIN_BACKOFF;
+    replay_state(client);
+    set_state(client, PS_CONNECTED);
+}
+
+/* send_queued
+ * -----------
+ * Sends as much of the client's queue as the socket will take.
+ *
+ * Returns:
+ *      false if the connection dropped, true otherwise
+ *
+ * */
+static bool send_queued(PsClient* client) {
+    size_t sent = 0;
+    bool isConnected = true;
+    while (sent < client->out.len) {
+        ssize_t numSent = send(client->fd, client->out.data + sent,
+                client->out.len - sent, MSG_NOSIGNAL);
+        if (numSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numSent < 0) {
+            isConnected = errno == EAGAIN || errno == EWOULDBLOCK;
+            break;
+        }
+        sent += numSent;
+    }
+    if (sent) {
+        client->replayLeft -= sent < client->replayLeft ?
+                sent : client->replayLeft;
+        client->isMidCommand = client->out.data[sent - 1] != NEW_LINE;
+        consume(&client->out, sent);
+    }
+    return isConnected;
+}
+
+/* is_duplicate
+ * ------------
+ * Determines whether the given delivery ID has already been handed out
+ * (psserver redelivers messages it sent but didn't get acknowledgements
+ * for before the connection dropped). IDs only increase, wrapping back
+ * around to 1 after INT_MAX.
+ * */
+static bool is_duplicate(PsClient* client, int id) {
+    if (!client->hasLastId) {
+        return false;
+    }
+    unsigned int behind = (unsigned int)client->lastId - (unsigned int)id;
+    return behind < (unsigned int)INT_MAX / 2;
+}
+
+/* follow_redirect
+ * ---------------
+ * Points the client's reconnects at the address psserver turned it away 
+ * to (ie: "[host:]port" from ":redirect <address>"). psserver closes the
+ * connection straight after, and the client reconnects there as usual.
+ *
+ * client - client turned away
+ * address - address to reconnect to
+ *
+ * */
+static void follow_redirect(PsClient* client, char* address) {
+    char* portStart = strrchr(address, COLON);
+    if (portStart) {
+        free(client->host);
+        client->host = strndup(address, portStart - address);
+        address = portStart + 1;
+    }
+    free(client->service);
+    client->service = strdup(address);
+}
+
+/* handle_line
+ * -----------
+ * Handles a line received from psserver: hands messages to the message
+ * callback (acknowledging them in acknowledged mode) and ignores replies
+ * (other than pings, which are answered, rejections, see 
+ * follow_redirect(), and the start of a new session).
+ * The line is split up in place, so the message is a view of the buffer.
+ *
+ * client - client that received the line
+ * line - line received (newline replaced with '\0')
+ * len - length of the line
+ *
+ * */
+static void handle_line(PsClient* client, char* line, size_t len) {
+    //answer keepalives, so a client that only listens isn't disconnected 
+    //as idle
+    if (!strcmp(line, PING_REPLY)) {
+        const char* pongCmd[] = {PONG_CMD};
+        queue_command(client, pongCmd, 1);
+        return;
+    }
+    //turned away - psserver closes the connection straight after
+    if (!strcmp(line, BUSY_REPLY)) {
+        client->backoff = client->busyBackoff;
+        return;
+    }
+    if (!strncmp(line, REDIRECT_REPLY, strlen(REDIRECT_REPLY))) {
+        follow_redirect(client, line + strlen(REDIRECT_REPLY));
+        return;
+    }
+    //IDs seen on the old session say nothing about the new one's
+    if (!strcmp(line, SESSION_NEW_REPLY)) {
+        client->hasLastId = false;
+        return;
+    }
+    if (!len || line[0] == REPLY_PREFIX) {
+        return;
+    }
+    PsMessage msg;
+    msg.id = 0;
+    char* rest = line;
+    if (client->ackWindow) {
+        char* idEnd = memchr(rest, COLON, len);
+        if (!idEnd) {
+            return;
+        }
+        *idEnd = '\0';
+        msg.id = atoi(rest);
+        rest = idEnd + 1;
+    }
+    char* nameEnd = strchr(rest, COLON);
+    char* topicEnd = nameEnd ? strchr(nameEnd + 1, COLON) : NULL;
+    if (!topicEnd) {
+        return;
+    }
+    *nameEnd = '\0';
+    *topicEnd = '\0';
+    msg.name = rest;
+    msg.topic = nameEnd + 1;
+    msg.value = topicEnd + 1;
+    msg.valueLen = line + len - (topicEnd + 1);
+    if (!client->ackWindow) {
+        client->onMessage(client->arg, &msg);
+        return;
+    }
+    if (!is_duplicate(client, msg.id)) {
+        client->lastId = msg.id;
+        client->hasLastId = true;
+        client->onMessage(client->arg, &msg);
+    }
+    char id[sizeof(int) * 3 + 1];
+    sprintf(id, "%d", msg.id);
+    const char* ackCmd[] = {"ack", id};
+    queue_command(client, ackCmd, 2);
+}
+
+/* receive
+ * -------
+ * Reads whatever the socket has and handles each complete line.
+ *
+ * Returns:
+ *      false if the connection dropped, true otherwise
+ *
+ * */
+static bool receive(PsClient* client) {
+    while (true) {
+        reserve(&client->in, READ_SIZE);
+        ssize_t numRead = recv(client->fd, client->in.data + client->in.len,
+                client->in.capacity - client->in.len, 0);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (numRead <= 0) {
+            return false;
+        }
+        size_t start = 0;
+        size_t scanFrom = client->in.len;
+        client->in.len += numRead;
+        char* end;
+        while ((end = memchr(client->in.data + scanFrom, NEW_LINE,
+                client->in.len - scanFrom))) {
+            *end = '\0';
+            handle_line(client, client->in.data + start,
+                    end - (client->in.data + start));
+            start = scanFrom = end - client->in.data + 1;
+        }
+        consume(&client->in, start);
+    }
+    return true;
+}
+
+PsClient* psclient_create(char* host, char* service, char* name,
+        PsMessageCallback onMessage, PsStateCallback onState, void* arg) {
+    if (!name[0] || has_space_colon_newline(name)) {
+        return NULL;
+    }
+    PsClient* client = calloc(1, sizeof(PsClient));
+    client->host = strdup(host);
+    client->service = strdup(service);
+    client->name = strdup(name);
+    client->fd = -1;
+    client->state = PS_DISCONNECTED;
+    client->backoff = PS_MIN_BACKOFF;
+    client->seed = (unsigned int)(now_ms() ^ getpid() ^ (long)client);
+    client->onMessage = onMessage;
+    client->onState = onState;
+    client->arg = arg;
+    start_connect(client);
+    return client;
+}
+
+void psclient_destroy(PsClient* client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    for (int i = 0; i < client->numTopics; i++) {
+        free(client->topics[i]);
+    }
+    free(client->topics);
+    free(client->in.data);
+    free(client->out.data);
+    free(client->host);
+    free(client->service);
+    free(client->name);
+    free(client);
+}
+
+bool psclient_ackmode(PsClient* client, int window) {
+    if (window <= 0) {
+        return false;
+    }
+    char windowStr[sizeof(int) * 3 + 1];
+    sprintf(windowStr, "%d", window);
+    const char* ackCmd[] = {"ackmode", windowStr};
+    if (client->state == PS_CONNECTED && !queue_command(client, ackCmd, 2)) {
+        return false;
+    }
+    client->ackWindow = window;
+    return true;
+}
+
+bool psclient_subscribe(PsClient* client, char* topic) {
+    if (!topic[0] || has_space_colon_newline(topic)) {
+        return false;
+    }
+    for (int i = 0; i < client->numTopics; i++) {
+        if (!strcmp(client->topics[i], topic)) {
+            return true;
+        }
+    }
+    const char* subCmd[] = {"sub", topic};
+    if (client->state == PS_CONNECTED && !queue_command(client, subCmd, 2)) {
+        return false;
+    }
+    client->topics = realloc(client->topics,
+            sizeof(char*) * (client->numTopics + 1));
+    client->topics[client->numTopics++] = strdup(topic);
+    return true;
+}
+
+bool psclient_unsubscribe(PsClient* client, char* topic) {
+    for (int i = 0; i < client->numTopics; i++) {
+        if (strcmp(client->topics[i], topic)) {
+            continue;
+        }
+        const char* unsubCmd[] = {"unsub", topic};
+        if (client->state == PS_CONNECTED &&
+                !queue_command(client, unsubCmd, 2)) {
+            return false;
+        }
+        free(client->topics[i]);
+        client->topics[i] = client->topics[--client->numTopics];
+        return true;
+    }
+    return false;
+}
+
+bool psclient_publish(PsClient* client, char* topic, char* value) {
+    if (!topic[0] || has_space_colon_newline(topic) ||
+            strchr(value, NEW_LINE)) {
+        return false;
+    }
+    const char* pubCmd[] = {"pub", topic, value};
+    return queue_command(client, pubCmd, 3);
+}
+
+int psclient_state(PsClient* client) {
+    return client->state;
+}
+
+int psclient_fd(PsClient* client) {
+    return client->fd;
+}
+
+short psclient_events(PsClient* client) {
+    if (client->state == PS_CONNECTING) {
+        return POLLOUT;
+    }
+    if (client->state == PS_CONNECTED) {
+        return POLLIN | (client->out.len ? POLLOUT : 0);
+    }
+    return 0;
+}
+
+int psclient_timeout(PsClient* client) {
+    if (client->state != PS_DISCONNECTED) {
+        return -1;
+    }
+    long wait = client->reconnectAt - now_ms();
+    return wait > 0 ? (int)wait : 0;
+}
+
+void psclient_process(PsClient* client, short revents) {
+    if (client->state == PS_DISCONNECTED) {
+        if (now_ms() >= client->reconnectAt) {
+            start_connect(client);
+        }
+        return;
+    }
+    if (client->state == PS_CONNECTING) {
+        if (!revents) {
+            return;
+        }
+        finish_connect(client);
+        if (client->state != PS_CONNECTED) {
+            return;
+        }
+        revents = POLLOUT;
+    }
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive(client)) {
+        disconnect(client);
+        return;
+    }
+    //also sends acknowledgements queued while receiving
+    if (client->out.len && !send_queued(client)) {
+        disconnect(client);
+    }
+}
+
+void psclient_run_once(PsClient* client, int timeoutMs) {
+    int wait = psclient_timeout(client);
+    if (wait < 0 || (timeoutMs >= 0 && timeoutMs < wait)) {
+        wait = timeoutMs;
+    }
+    struct pollfd pfd = {client->fd, psclient_events(client), 0};
+    int numReady = poll(&pfd, client->fd >= 0 ? 1 : 0, wait);
+    psclient_process(client, numReady > 0 ? pfd.revents : 0);
+}
@@ -0,0 +1,214 @@
+//libpsclient.h//
+//----------------------//
+//libpsclient.c is a non-blocking client library for psserver, for
+//programs that want to publish/subscribe without running psclient
+//----------------------//
+
+#ifndef LIB_PS_CLIENT
+#define LIB_PS_CLIENT
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* How the library works:
+ *
+ * A PsClient never blocks (apart from resolving psserver's address). It is
+ * driven by an event loop - either the caller's own (see psclient_fd(),
+ * psclient_events(), psclient_timeout() and psclient_process()) or
+ * psclient_run_once(). Publishes and subscribes are queued and sent as the
+ * socket allows.
+ *
+ * If the connection drops, the client reconnects by itself, backing off
+ * exponentially (with jitter, so clients dropped together don't all
+ * reconnect at once), and replays its state: its name, its acknowledged
+ * mode and the topics it's subscribed to. Commands queued while
+ * disconnected are sent once reconnected. If psserver turns the client 
+ * away as it's full (":busy"), the backoff keeps growing rather than 
+ * starting again, and if it points the client elsewhere 
+ * (":redirect [host:]port") the client reconnects there instead.
+ *
+ * In acknowledged mode (see psclient_ackmode()), psserver keeps the
+ * client's unacknowledged messages in its session while the client is
+ * disconnected and resends them when it comes back under the same name, so
+ * messages psserver had already sent aren't lost across a reconnect. The
+ * client acknowledges each message once its callback returns, and skips any
+ * redelivered message whose delivery ID it has already seen. If psserver 
+ * has no session to resume (eg: it restarted), it says so and IDs start 
+ * again, so the client forgets the IDs it has seen. (Subscriptions
+ * don't outlive the connection, so messages published while the client is
+ * disconnected still aren't delivered.)
+ * */
+
+//longest (ms) the client waits between reconnect attempts
+#define PS_MAX_BACKOFF 5000
+//shortest (ms) the client waits before a reconnect attempt
+#define PS_MIN_BACKOFF 50
+//max number of bytes of commands queued (eg: while disconnected)
+#define PS_MAX_QUEUED (16 * 1024 * 1024)
+
+typedef struct PsClient PsClient;
+
+/* Defines the PsMessage structure, which is a view of a message received
+ * from psserver. The strings point straight into the client's receive
+ * buffer (nothing is copied), so they're only valid during the callback
+ * they're given to:
+ *
+ *      name - name of the publisher
+ *      topic - topic published to
+ *      value - value published
+ *      valueLen - length of the value
+ *      id - delivery ID in acknowledged mode (0 otherwise)
+ * */
+typedef struct {
+    const char* name;
+    const char* topic;
+    const char* value;
+    size_t valueLen;
+    int id;
+} PsMessage;
+
+/* Each of these constants encodes the state of a client's connection:
+ *
+ *      PS_DISCONNECTED - waiting to (re)connect
+ *      PS_CONNECTING - connection in progress
+ *      PS_CONNECTED - connected (and state replayed)
+ * */
+enum PsStates {
+    PS_DISCONNECTED,
+    PS_CONNECTING,
+    PS_CONNECTED
+};
+
+/* Defines the callback a client hands each message it receives to:
+ *
+ *      arg - argument given to psclient_create()
+ *      msg - message received
+ * */
+typedef void (*PsMessageCallback)(void* arg, PsMessage* msg);
+
+/* Defines the callback a client reports changes of connection state to:
+ *
+ *      arg - argument given to psclient_create()
+ *      state - one of the PsStates
+ * */
+typedef void (*PsStateCallback)(void* arg, int state);
+
+/* psclient_create
+ * ---------------
+ * Creates a client, which starts connecting to psserver straight away.
+ *
+ * host - host psserver is on
+ * service - port psserver is listening on, or the path of its Unix domain
+ *           socket (if it contains a '/')
+ * name - name to give the client (no spaces, colons or newlines)
+ * onMessage - called with each message received
+ * onState - called whenever the connection changes state (may be NULL)
+ * arg - first argument given to the callbacks
+ *
+ * Returns:
+ *      the newly created client, or NULL if the name is invalid
+ *
+ * */
+PsClient* psclient_create(char* host, char* service, char* name,
+        PsMessageCallback onMessage, PsStateCallback onState, void* arg);
+
+/* psclient_destroy
+ * ----------------
+ * Closes the client's connection (dropping anything still queued) and
+ * frees it.
+ * */
+void psclient_destroy(PsClient* client);
+
+/* psclient_ackmode
+ * ----------------
+ * Puts the client into acknowledged mode (see above), now and after every
+ * reconnect.
+ *
+ * client - client to put into acknowledged mode
+ * window - max number of unacknowledged messages psserver sends at once
+ *
+ * Returns:
+ *      true iff queued, false if the window is invalid or the queue is full
+ *
+ * */
+bool psclient_ackmode(PsClient* client, int window);
+
+/* psclient_subscribe
+ * ------------------
+ * Subscribes the client to the given topic, now and after every reconnect.
+ *
+ * Returns:
+ *      true iff queued, false if the topic is invalid or the queue is full
+ * */
+bool psclient_subscribe(PsClient* client, char* topic);
+
+/* psclient_unsubscribe
+ * --------------------
+ * Unsubscribes the client from the given topic.
+ *
+ * Returns:
+ *      true iff queued, false if not subscribed or the queue is full
+ * */
+bool psclient_unsubscribe(PsClient* client, char* topic);
+
+/* psclient_publish
+ * ----------------
+ * Queues the given value to be published to the given topic.
+ *
+ * Returns:
+ *      true iff queued, false if the topic/value is invalid or the queue is
+ *      full (eg: after being disconnected for a long time)
+ * */
+bool psclient_publish(PsClient* client, char* topic, char* value);
+
+/* psclient_state
+ * --------------
+ * Returns the client's connection state (one of the PsStates).
+ * */
+int psclient_state(PsClient* client);
+
+/* psclient_fd
+ * -----------
+ * Returns the client's socket (to wait on in the caller's event loop), or
+ * -1 while disconnected. The socket changes when the client reconnects.
+ * */
+int psclient_fd(PsClient* client);
+
+/* psclient_events
+ * ---------------
+ * Returns the poll() events to wait for on the client's socket.
+ * */
+short psclient_events(PsClient* client);
+
+/* psclient_timeout
+ * ----------------
+ * Returns how long (ms) the caller's event loop may wait before calling
+ * psclient_process() (ie: until the next reconnect attempt), or -1 if it
+ * may wait indefinitely for events on the socket.
+ * */
+int psclient_timeout(PsClient* client);
+
+/* psclient_process
+ * ----------------
+ * Handles the given events on the client's socket (0 if none) and any
+ * timers that are due: sends queued commands, receives and hands out
+ * messages, and reconnects.
+ *
+ * client - client to process
+ * revents - events poll() returned for the client's socket
+ *
+ * */
+void psclient_process(PsClient* client, short revents);
+
+/* psclient_run_once
+ * -----------------
+ * Waits up to the given time for something to happen on the client, then
+ * handles it (see psclient_process()).
+ *
+ * client - client to run
+ * timeoutMs - longest time (ms) to wait (-1 for no limit)
+ *
+ * */
+void psclient_run_once(PsClient* client, int timeoutMs);
+
+#endif //LIB_PS_CLIENT
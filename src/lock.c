@@ -1,9 +1,213 @@
 //lock.c//
 //-------------//
-//lock.c abstracts away locking functionality (semaphores)
+//lock.c abstracts away locking functionality (semaphores, mutexes,
+//reader-writer locks and ticket locks)
 //-------------//
 
 #include "lock.h"
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define NS_PER_SEC 1000000000L
+#define NS_PER_US 1000
+//bounds on how long (in spins) a mutex taker spins before sleeping
+#define MIN_MUTEX_SPINS 10
+#define MAX_MUTEX_SPINS 1000
+//how much of each new wait a mutex's running average of spins takes in
+#define SPIN_AVERAGE_WEIGHT 8
+//how long (in spins) the next taker in line of a ticket lock spins
+#define TICKET_SPINS 1000
+//number of bits in a futex bitset
+#define TICKET_BITS 32
+//mutex states
+#define FREE 0
+#define HELD 1
+#define HELD_WITH_SLEEPERS 2
+
+//tells the CPU we're spinning (easing off the lock's cache line)
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+//profiled locks (see add_lock_profile())
+LockProfile lockProfiles[MAX_NAMED_LOCKS];
+int numLockProfiles = 0;
+//lock protecting the adding of profiled locks
+sem_t lockProfilesLock;
+pthread_once_t lockProfilesOnce = PTHREAD_ONCE_INIT;
+
+/* lock_clock_ns
+ * -------------
+ * Returns the current time (ns) on the monotonic clock.
+ * */
+long lock_clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* futex_wait_bits
+ * ---------------
+ * Sleeps on the given futex word while it still holds the given value,
+ * until woken by a wake (see futex_wake_bits()) sharing a bit with the
+ * given bitset, interrupted or the given deadline (on CLOCK_REALTIME, NULL
+ * for none) passes.
+ *
+ * Returns:
+ *      0 if woken (or the word had already changed), otherwise -1 with
+ *      errno set (ETIMEDOUT once the deadline has passed)
+ *
+ * */
+int futex_wait_bits(int* word, int value, struct timespec* deadline,
+        int bits) {
+    int result = syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE |
+            (deadline ? FUTEX_CLOCK_REALTIME : 0), value, deadline, NULL,
+            bits);
+    return result && errno == EAGAIN ? 0 : result;
+}
+
+int futex_wait(int* word, int value, struct timespec* deadline) {
+    return futex_wait_bits(word, value, deadline, FUTEX_BITSET_MATCH_ANY);
+}
+
+void futex_wake(int* word, int numToWake) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, numToWake, NULL, NULL, 0);
+}
+
+/* futex_wake_bits
+ * ---------------
+ * Wakes every thread sleeping on the given futex word with a bitset sharing
+ * a bit with the given one.
+ * */
+void futex_wake_bits(int* word, int bits) {
+    syscall(SYS_futex, word, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, NULL,
+            bits);
+}
+
+/* ticket_bits
+ * -----------
+ * Returns the futex bitset the taker holding the given ticket sleeps with,
+ * so a release only wakes the next in line (and anyone a multiple of 32
+ * tickets behind them) rather than everyone.
+ * */
+int ticket_bits(unsigned int ticket) {
+    return (int)(1u << (ticket % TICKET_BITS));
+}
+
+/* record_max
+ * ----------
+ * Raises the given maximum to the given value, if it's larger.
+ * */
+void record_max(long* max, long value) {
+    long currMax = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > currMax && !__atomic_compare_exchange_n(max, &currMax,
+            value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* init_lock_profiles
+ * ------------------
+ * Initialises the lock protecting the adding of profiled locks (once).
+ * */
+void init_lock_profiles(void) {
+    sem_init(&lockProfilesLock, 0, 1);
+}
+
+/* add_lock_profile
+ * ----------------
+ * Starts profiling the given lock under the given name.
+ *
+ * l - lock to profile
+ * name - name printed with its figures (NULL if it isn't profiled)
+ * isMutex - true iff the lock has one holder at a time
+ *
+ * Returns:
+ *      the lock's profile, or NULL if it isn't named or MAX_NAMED_LOCKS are
+ *      already profiled
+ *
+ * */
+LockProfile* add_lock_profile(void* l, char* name, bool isMutex) {
+    if (!name) {
+        return NULL;
+    }
+    pthread_once(&lockProfilesOnce, init_lock_profiles);
+    sem_wait(&lockProfilesLock);
+    LockProfile* profile = NULL;
+    if (numLockProfiles < MAX_NAMED_LOCKS) {
+        profile = &lockProfiles[numLockProfiles];
+        profile->lock = l;
+        profile->name = name;
+        profile->isMutex = isMutex;
+        //published only once filled in
+        __atomic_store_n(&numLockProfiles, numLockProfiles + 1,
+                __ATOMIC_RELEASE);
+    }
+    sem_post(&lockProfilesLock);
+    return profile;
+}
+
+/* profile_wait
+ * ------------
+ * Records a contended acquisition of a lock, whose taker started waiting at
+ * the given time (ns). Does nothing if the profile is NULL.
+ * */
+void profile_wait(LockProfile* profile, long waitStart) {
+    if (!profile) {
+        return;
+    }
+    long waitNs = lock_clock_ns() - waitStart;
+    __atomic_fetch_add(&profile->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->waitNs, waitNs, __ATOMIC_RELAXED);
+    record_max(&profile->maxWaitNs, waitNs);
+}
+
+/* profile_taken
+ * -------------
+ * Records an acquisition of a lock, and (if it has one holder at a time)
+ * when it was taken. Does nothing if the profile is NULL.
+ * */
+void profile_taken(LockProfile* profile) {
+    if (!profile) {
+        return;
+    }
+    __atomic_fetch_add(&profile->acquired, 1, __ATOMIC_RELAXED);
+    if (profile->isMutex) {
+        profile->takenAt = lock_clock_ns();
+    }
+}
+
+/* profile_released
+ * ----------------
+ * Records how long a lock with one holder at a time was held, just before
+ * it's released. Does nothing if the profile is NULL.
+ * */
+void profile_released(LockProfile* profile) {
+    //still held, so takenAt is the current holder's
+    if (profile && profile->isMutex) {
+        long holdNs = lock_clock_ns() - profile->takenAt;
+        __atomic_fetch_add(&profile->holdNs, holdNs, __ATOMIC_RELAXED);
+        record_max(&profile->maxHoldNs, holdNs);
+    }
+}
+
+/* wait_start
+ * ----------
+ * Returns the time (ns) a taker of a lock with the given profile started
+ * waiting, or 0 if the lock isn't profiled (so unprofiled locks never read
+ * the clock).
+ * */
+long wait_start(LockProfile* profile) {
+    return profile ? lock_clock_ns() : 0;
+}
 
 void init_lock(sem_t* l, int numAllowed) {
     sem_init(l, 0, numAllowed);
@@ -13,7 +217,298 @@ void take_lock(sem_t* l) {
     sem_wait(l);
 }
 
+bool try_take_lock(sem_t* l) {
+    int result;
+    while ((result = sem_trywait(l)) && errno == EINTR) {
+    }
+    return !result;
+}
+
 void release_lock(sem_t* l) {
     sem_post(l);
 }
 
+void init_semaphore(Semaphore* semaphore, int numAllowed, char* name) {
+    init_lock(&semaphore->sem, numAllowed);
+    semaphore->profile = add_lock_profile(semaphore, name, numAllowed == 1);
+}
+
+void take_semaphore(Semaphore* semaphore) {
+    LockProfile* profile = semaphore->profile;
+    if (!profile) {
+        sem_wait(&semaphore->sem);
+        return;
+    }
+    //only time the wait if there is one
+    if (sem_trywait(&semaphore->sem)) {
+        long waitStart = lock_clock_ns();
+        sem_wait(&semaphore->sem);
+        profile_wait(profile, waitStart);
+    }
+    profile_taken(profile);
+}
+
+bool try_take_semaphore(Semaphore* semaphore) {
+    bool isTaken = try_take_lock(&semaphore->sem);
+    if (isTaken) {
+        profile_taken(semaphore->profile);
+    }
+    return isTaken;
+}
+
+void release_semaphore(Semaphore* semaphore) {
+    profile_released(semaphore->profile);
+    sem_post(&semaphore->sem);
+}
+
+void init_mutex(Mutex* mutex, char* name) {
+    mutex->state = FREE;
+    mutex->spins = MIN_MUTEX_SPINS;
+    mutex->profile = add_lock_profile(mutex, name, true);
+}
+
+void take_mutex(Mutex* mutex) {
+    int state = FREE;
+    if (__atomic_compare_exchange_n(&mutex->state, &state, HELD, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        profile_taken(mutex->profile);
+        return;
+    }
+    long waitStart = wait_start(mutex->profile);
+    //spin for up to twice as long as takers have recently had to
+    int maxSpins = __atomic_load_n(&mutex->spins, __ATOMIC_RELAXED) * 2 +
+            MIN_MUTEX_SPINS;
+    maxSpins = maxSpins > MAX_MUTEX_SPINS ? MAX_MUTEX_SPINS : maxSpins;
+    int numSpins = 0;
+    bool isTaken = false;
+    while (!isTaken && numSpins < maxSpins) {
+        CPU_RELAX();
+        numSpins++;
+        state = FREE;
+        isTaken = __atomic_load_n(&mutex->state, __ATOMIC_RELAXED) == FREE &&
+                __atomic_compare_exchange_n(&mutex->state, &state, HELD,
+                false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    //then sleep, marking the mutex so its holder knows to wake us
+    if (!isTaken) {
+        while (__atomic_exchange_n(&mutex->state, HELD_WITH_SLEEPERS,
+                __ATOMIC_ACQUIRE) != FREE) {
+            futex_wait(&mutex->state, HELD_WITH_SLEEPERS, NULL);
+        }
+    }
+    //spinning that ended in sleep was wasted, so it counts as none (held
+    //now, so the average is only read, racily, as a hint by other takers)
+    numSpins = isTaken ? numSpins : 0;
+    __atomic_store_n(&mutex->spins, mutex->spins +
+            (numSpins - mutex->spins) / SPIN_AVERAGE_WEIGHT,
+            __ATOMIC_RELAXED);
+    profile_wait(mutex->profile, waitStart);
+    profile_taken(mutex->profile);
+}
+
+void release_mutex(Mutex* mutex) {
+    profile_released(mutex->profile);
+    if (__atomic_exchange_n(&mutex->state, FREE, __ATOMIC_RELEASE) ==
+            HELD_WITH_SLEEPERS) {
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+void init_rwlock(RwLock* rwlock, char* name) {
+    rwlock->state = 0;
+    rwlock->numWritersWaiting = 0;
+    rwlock->numSleeping = 0;
+    rwlock->readerSeq = 0;
+    rwlock->writerSeq = 0;
+    rwlock->profile = add_lock_profile(rwlock, name, true);
+}
+
+/* sleep_on
+ * --------
+ * Sleeps on one of the given reader-writer lock's futex words, unless it
+ * has changed from the given value (which the caller read before checking
+ * whether the lock was free, so a release in between isn't missed).
+ *
+ * Returns:
+ *      true iff the given deadline (NULL for none) passed
+ *
+ * */
+bool sleep_on(RwLock* rwlock, int* seq, int value,
+        struct timespec* deadline) {
+    __atomic_fetch_add(&rwlock->numSleeping, 1, __ATOMIC_SEQ_CST);
+    bool isTimedOut = futex_wait(seq, value, deadline) && errno == ETIMEDOUT;
+    __atomic_fetch_sub(&rwlock->numSleeping, 1, __ATOMIC_SEQ_CST);
+    return isTimedOut;
+}
+
+/* wake_rwlock_waiters
+ * -------------------
+ * Wakes whoever should take the given reader-writer lock next, now that it
+ * may be free: one waiting writer if there is one, otherwise every waiting
+ * reader.
+ * */
+void wake_rwlock_waiters(RwLock* rwlock) {
+    bool isWriterNext = __atomic_load_n(&rwlock->numWritersWaiting,
+            __ATOMIC_SEQ_CST);
+    int* seq = isWriterNext ? &rwlock->writerSeq : &rwlock->readerSeq;
+    __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rwlock->numSleeping, __ATOMIC_SEQ_CST)) {
+        futex_wake(seq, isWriterNext ? 1 : INT_MAX);
+    }
+}
+
+void take_read_lock(RwLock* rwlock) {
+    long waitStart = 0;
+    bool isContended = false;
+    while (true) {
+        int seq = __atomic_load_n(&rwlock->readerSeq, __ATOMIC_SEQ_CST);
+        int state = __atomic_load_n(&rwlock->state, __ATOMIC_SEQ_CST);
+        //waiting writers go first
+        if (!(state & RW_WRITER) && !__atomic_load_n(
+                &rwlock->numWritersWaiting, __ATOMIC_SEQ_CST)) {
+            if (__atomic_compare_exchange_n(&rwlock->state, &state,
+                    state + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            //another reader got in first, try again straight away
+            continue;
+        }
+        if (!isContended) {
+            waitStart = wait_start(rwlock->profile);
+            isContended = true;
+        }
+        sleep_on(rwlock, &rwlock->readerSeq, seq, NULL);
+    }
+    if (isContended) {
+        profile_wait(rwlock->profile, waitStart);
+    }
+    if (rwlock->profile) {
+        __atomic_fetch_add(&rwlock->profile->acquired, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void release_read_lock(RwLock* rwlock) {
+    //the last reader out lets in a waiting writer
+    if (__atomic_sub_fetch(&rwlock->state, 1, __ATOMIC_SEQ_CST) == 0 &&
+            __atomic_load_n(&rwlock->numWritersWaiting, __ATOMIC_SEQ_CST)) {
+        wake_rwlock_waiters(rwlock);
+    }
+}
+
+void take_write_lock(RwLock* rwlock) {
+    take_write_lock_by(rwlock, NULL);
+}
+
+bool take_write_lock_by(RwLock* rwlock, struct timespec* deadline) {
+    long waitStart = 0;
+    bool isContended = false;
+    __atomic_fetch_add(&rwlock->numWritersWaiting, 1, __ATOMIC_SEQ_CST);
+    while (true) {
+        int seq = __atomic_load_n(&rwlock->writerSeq, __ATOMIC_SEQ_CST);
+        int state = 0;
+        if (__atomic_compare_exchange_n(&rwlock->state, &state, RW_WRITER,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        if (!isContended) {
+            waitStart = wait_start(rwlock->profile);
+            isContended = true;
+        }
+        //give up, unless it became free just as the deadline passed (its
+        //holder wakes someone else when it releases it)
+        if (sleep_on(rwlock, &rwlock->writerSeq, seq, deadline) &&
+                __atomic_load_n(&rwlock->state, __ATOMIC_SEQ_CST)) {
+            //let in the readers we were holding off
+            if (__atomic_sub_fetch(&rwlock->numWritersWaiting, 1,
+                    __ATOMIC_SEQ_CST) == 0) {
+                wake_rwlock_waiters(rwlock);
+            }
+            return false;
+        }
+    }
+    __atomic_fetch_sub(&rwlock->numWritersWaiting, 1, __ATOMIC_SEQ_CST);
+    if (isContended) {
+        profile_wait(rwlock->profile, waitStart);
+    }
+    profile_taken(rwlock->profile);
+    return true;
+}
+
+void release_write_lock(RwLock* rwlock) {
+    profile_released(rwlock->profile);
+    __atomic_store_n(&rwlock->state, 0, __ATOMIC_SEQ_CST);
+    wake_rwlock_waiters(rwlock);
+}
+
+void init_ticket_lock(TicketLock* ticketLock, char* name) {
+    ticketLock->next = 0;
+    ticketLock->serving = 0;
+    ticketLock->numSleeping = 0;
+    ticketLock->profile = add_lock_profile(ticketLock, name, true);
+}
+
+void take_ticket_lock(TicketLock* ticketLock) {
+    unsigned int ticket = __atomic_fetch_add(&ticketLock->next, 1,
+            __ATOMIC_RELAXED);
+    unsigned int serving = __atomic_load_n(&ticketLock->serving,
+            __ATOMIC_ACQUIRE);
+    if (serving == ticket) {
+        profile_taken(ticketLock->profile);
+        return;
+    }
+    long waitStart = wait_start(ticketLock->profile);
+    //only the next in line spins, everyone further back sleeps straight
+    //away
+    for (int i = 0; i < TICKET_SPINS && serving != ticket &&
+            ticket - serving == 1; i++) {
+        CPU_RELAX();
+        serving = __atomic_load_n(&ticketLock->serving, __ATOMIC_ACQUIRE);
+    }
+    while (serving != ticket) {
+        //counted as sleeping before serving is checked again, so a release
+        //in between either is seen here or sees us (and wakes us)
+        __atomic_fetch_add(&ticketLock->numSleeping, 1, __ATOMIC_SEQ_CST);
+        serving = __atomic_load_n(&ticketLock->serving, __ATOMIC_SEQ_CST);
+        if (serving != ticket) {
+            futex_wait_bits((int*)&ticketLock->serving, serving, NULL,
+                    ticket_bits(ticket));
+            serving = __atomic_load_n(&ticketLock->serving,
+                    __ATOMIC_ACQUIRE);
+        }
+        __atomic_fetch_sub(&ticketLock->numSleeping, 1, __ATOMIC_RELAXED);
+    }
+    profile_wait(ticketLock->profile, waitStart);
+    profile_taken(ticketLock->profile);
+}
+
+void release_ticket_lock(TicketLock* ticketLock) {
+    profile_released(ticketLock->profile);
+    unsigned int serving = __atomic_add_fetch(&ticketLock->serving, 1,
+            __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ticketLock->numSleeping, __ATOMIC_SEQ_CST)) {
+        futex_wake_bits((int*)&ticketLock->serving, ticket_bits(serving));
+    }
+}
+
+void print_lock_profiles(FILE* out) {
+    int numProfiles = __atomic_load_n(&numLockProfiles, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < numProfiles; i++) {
+        LockProfile* profile = &lockProfiles[i];
+        fprintf(out, "Lock %s: acquired:%ld contended:%ld wait_us:%ld "
+                "max_wait_us:%ld", profile->name,
+                __atomic_load_n(&profile->acquired, __ATOMIC_RELAXED),
+                __atomic_load_n(&profile->contended, __ATOMIC_RELAXED),
+                __atomic_load_n(&profile->waitNs, __ATOMIC_RELAXED) /
+                NS_PER_US,
+                __atomic_load_n(&profile->maxWaitNs, __ATOMIC_RELAXED) /
+                NS_PER_US);
+        if (profile->isMutex) {
+            fprintf(out, " hold_us:%ld max_hold_us:%ld",
+                    __atomic_load_n(&profile->holdNs, __ATOMIC_RELAXED) /
+                    NS_PER_US,
+                    __atomic_load_n(&profile->maxHoldNs, __ATOMIC_RELAXED) /
+                    NS_PER_US);
+        }
+        fprintf(out, "\n");
+    }
+}
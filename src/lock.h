@@ -1,12 +1,148 @@
 //lock.h//
 //-------------//
-//lock.c abstracts away locking functionality (semaphores)
+//lock.c abstracts away locking functionality (semaphores, mutexes,
+//reader-writer locks and ticket locks)
 //-------------//
 
 #ifndef LOCK
 #define LOCK
 
 #include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Which lock to use:
+ *
+ *      sem_t - counting semaphores, and signals posted by one thread for
+ *              another to take (eg: the access lock limiting connections)
+ *      Mutex - short critical sections. Spins briefly before sleeping on a
+ *              futex, adapting how long it spins to how long it has taken
+ *              to become free before, so an uncontended lock/unlock is a
+ *              pair of atomic operations (no system call)
+ *      RwLock - structures read far more often than they're changed (eg:
+ *               the string map of topics, read by every publish). Readers
+ *               share the lock; waiting writers hold off new readers, so a
+ *               stream of publishes can't starve a subscribe
+ *      TicketLock - critical sections where fairness matters more than
+ *                   throughput (eg: a session's acks competing with the
+ *                   publishers to it): takers are served strictly in the
+ *                   order they arrived. With more runnable threads than
+ *                   cores every hand over can cost a context switch, so
+ *                   keep it off heavily contended paths
+ * */
+
+/* How lock profiling works:
+ *
+ * Semaphores given a name when initialised (see init_semaphore()) are 
+ * profiled: every take_semaphore() and release_semaphore() on them records
+ * how often the semaphore is taken, how often
+ * it's already held (ie: the taker has to wait), how long takers wait and
+ * (for locks allowing one holder) how long it's held. Waits are only timed
+ * when the lock is contended, so an uncontended take costs one extra
+ * sem_trywait(). Each profiled lock's figures are printed with psserver's
+ * statistics on SIGHUP (see print_lock_profiles()).
+ *
+ * Mutexes, RwLocks and TicketLocks given a name when initialised are
+ * profiled the same way (an RwLock's hold time is that of its writers).
+ * Locks initialised with init_lock() aren't profiled, so taking and 
+ * releasing them is just the semaphore operation.
+ * */
+
+//max number of locks that can be profiled
+#define MAX_NAMED_LOCKS 32
+//bit of an RwLock's state set while a writer holds it
+#define RW_WRITER (1 << 30)
+
+/* Defines the LockProfile structure, which holds the figures recorded for a
+ * profiled lock:
+ *
+ *      lock - lock profiled (a Semaphore, Mutex, RwLock or TicketLock)
+ *      name - name printed with its figures
+ *      isMutex - true iff the lock has one holder at a time (so its hold
+ *                time can be recorded)
+ *      acquired - number of times the lock was taken
+ *      contended - number of those times it had to be waited for
+ *      waitNs - total time (ns) spent waiting for the lock
+ *      maxWaitNs - longest time (ns) spent waiting for the lock
+ *      holdNs - total time (ns) the lock was held
+ *      maxHoldNs - longest time (ns) the lock was held
+ *      takenAt - when (ns) the current holder took the lock
+ * */
+typedef struct {
+    void* lock;
+    char* name;
+    bool isMutex;
+    long acquired;
+    long contended;
+    long waitNs;
+    long maxWaitNs;
+    long holdNs;
+    long maxHoldNs;
+    long takenAt;
+} LockProfile;
+
+/* Defines the Semaphore structure, a counting semaphore that can be
+ * profiled:
+ *
+ *      sem - the semaphore
+ *      profile - semaphore's profile (NULL if it isn't named)
+ * */
+typedef struct {
+    sem_t sem;
+    LockProfile* profile;
+} Semaphore;
+
+/* Defines the Mutex structure, an adaptive spin-then-futex mutex:
+ *
+ *      state - 0 if free, 1 if held, 2 if held and others may be sleeping
+ *      spins - running average of how long (in spins) takers have spun
+ *              before getting it (0 for those that gave up and slept),
+ *              which sets how long they spin before sleeping
+ *      profile - lock's profile (NULL if it isn't named)
+ * */
+typedef struct {
+    int state;
+    int spins;
+    LockProfile* profile;
+} Mutex;
+
+/* Defines the RwLock structure, a writer-preferring reader-writer lock:
+ *
+ *      state - number of readers holding the lock, plus RW_WRITER if a
+ *              writer holds it
+ *      numWritersWaiting - number of writers waiting for the lock (new
+ *                          readers wait while this is non-zero)
+ *      numSleeping - number of readers and writers sleeping on readerSeq
+ *                    and writerSeq (so releases only make a system call
+ *                    when someone needs waking)
+ *      readerSeq - futex word readers sleep on (bumped to wake them)
+ *      writerSeq - futex word writers sleep on (bumped to wake one)
+ *      profile - lock's profile (NULL if it isn't named)
+ * */
+typedef struct {
+    int state;
+    int numWritersWaiting;
+    int numSleeping;
+    int readerSeq;
+    int writerSeq;
+    LockProfile* profile;
+} RwLock;
+
+/* Defines the TicketLock structure, a first come first served lock:
+ *
+ *      next - ticket the next taker draws
+ *      serving - ticket allowed to hold the lock (futex word takers sleep
+ *                on)
+ *      numSleeping - number of takers sleeping on serving
+ *      profile - lock's profile (NULL if it isn't named)
+ * */
+typedef struct {
+    unsigned int next;
+    unsigned int serving;
+    int numSleeping;
+    LockProfile* profile;
+} TicketLock;
 
 /* init_lock
  * ---------
@@ -28,6 +164,18 @@ void init_lock(sem_t* l, int numAllowed);
  * */
 void take_lock(sem_t* l);
 
+/* try_take_lock
+ * -------------
+ * Takes the given lock if its counter is non-zero, without blocking.
+ *
+ * l - lock to take
+ *
+ * Returns:
+ *      true iff the lock was taken, false if its counter was 0
+ *
+ * */
+bool try_take_lock(sem_t* l);
+
 /* release_lock
  * ------------
  * Releases the given lock by incrementing the lock counter by 1.
@@ -37,5 +185,173 @@ void take_lock(sem_t* l);
  * */
 void release_lock(sem_t* l);
 
+/* init_semaphore
+ * --------------
+ * Initialises the given semaphore with the given increment limit, profiling
+ * it under the given name (unless MAX_NAMED_LOCKS are already profiled).
+ *
+ * semaphore - semaphore to initialise
+ * numAllowed - increment limit
+ * name - name printed with the semaphore's figures (NULL to not profile 
+ *        it)
+ *
+ * */
+void init_semaphore(Semaphore* semaphore, int numAllowed, char* name);
+
+/* take_semaphore
+ * --------------
+ * Takes the given semaphore as take_lock() does, recording it in the
+ * semaphore's profile (if it has one).
+ * */
+void take_semaphore(Semaphore* semaphore);
+
+/* try_take_semaphore
+ * ------------------
+ * Takes the given semaphore as try_take_lock() does, recording it in the
+ * semaphore's profile (if it has one).
+ *
+ * Returns:
+ *      true iff the semaphore was taken, false if its counter was 0
+ *
+ * */
+bool try_take_semaphore(Semaphore* semaphore);
+
+/* release_semaphore
+ * -----------------
+ * Releases the given semaphore as release_lock() does, recording how long
+ * it was held in its profile (if it has one, and allows one holder).
+ * */
+void release_semaphore(Semaphore* semaphore);
+
+/* init_mutex
+ * ----------
+ * Initialises the given mutex (free).
+ *
+ * mutex - mutex to initialise
+ * name - name to profile it under (NULL if it isn't profiled)
+ *
+ * */
+void init_mutex(Mutex* mutex, char* name);
+
+/* take_mutex
+ * ----------
+ * Takes the given mutex, spinning briefly and then sleeping until it's
+ * free.
+ * */
+void take_mutex(Mutex* mutex);
+
+/* release_mutex
+ * -------------
+ * Releases the given mutex, waking a sleeping taker (if any).
+ * */
+void release_mutex(Mutex* mutex);
+
+/* init_rwlock
+ * -----------
+ * Initialises the given reader-writer lock (free).
+ *
+ * rwlock - lock to initialise
+ * name - name to profile it under (NULL if it isn't profiled)
+ *
+ * */
+void init_rwlock(RwLock* rwlock, char* name);
+
+/* take_read_lock
+ * --------------
+ * Takes the given lock for reading, waiting while a writer holds it or is
+ * waiting for it.
+ * */
+void take_read_lock(RwLock* rwlock);
+
+/* release_read_lock
+ * -----------------
+ * Releases the given lock taken for reading.
+ * */
+void release_read_lock(RwLock* rwlock);
+
+/* take_write_lock
+ * ---------------
+ * Takes the given lock for writing, waiting until no one else holds it.
+ * */
+void take_write_lock(RwLock* rwlock);
+
+/* take_write_lock_by
+ * ------------------
+ * Takes the given lock for writing, unless the given deadline passes first.
+ *
+ * rwlock - lock to take
+ * deadline - time (on CLOCK_REALTIME, as sem_timedwait() takes) to give up
+ *            at
+ *
+ * Returns:
+ *      true iff the lock was taken
+ *
+ * */
+bool take_write_lock_by(RwLock* rwlock, struct timespec* deadline);
+
+/* release_write_lock
+ * ------------------
+ * Releases the given lock taken for writing, handing it to the next waiting
+ * writer if there is one, otherwise to every waiting reader.
+ * */
+void release_write_lock(RwLock* rwlock);
+
+/* init_ticket_lock
+ * ----------------
+ * Initialises the given ticket lock (free).
+ *
+ * ticketLock - lock to initialise
+ * name - name to profile it under (NULL if it isn't profiled)
+ *
+ * */
+void init_ticket_lock(TicketLock* ticketLock, char* name);
+
+/* take_ticket_lock
+ * ----------------
+ * Takes the given ticket lock once everyone who tried to take it earlier
+ * has held it.
+ * */
+void take_ticket_lock(TicketLock* ticketLock);
+
+/* release_ticket_lock
+ * -------------------
+ * Releases the given ticket lock to the next taker in line.
+ * */
+void release_ticket_lock(TicketLock* ticketLock);
+
+/* print_lock_profiles
+ * -------------------
+ * Prints the figures recorded for each profiled lock, one line per lock, to
+ * the given stream.
+ *
+ * out - stream to print to
+ *
+ * */
+void print_lock_profiles(FILE* out);
+
+/* futex_wait
+ * ----------
+ * Sleeps on the given futex word while it still holds the given value, 
+ * until woken (see futex_wake()), interrupted or the given deadline passes.
+ * For waiting on a counter bumped by another thread, where none of the 
+ * locks above fit.
+ *
+ * word - futex word
+ * value - value the word held when the caller decided to sleep
+ * deadline - time (CLOCK_REALTIME) to give up at, NULL for none
+ *
+ * Returns:
+ *      0 if woken (or the word had already changed), otherwise -1 with
+ *      errno set (ETIMEDOUT once the deadline has passed)
+ *
+ * */
+int futex_wait(int* word, int value, struct timespec* deadline);
+
+/* futex_wake
+ * ----------
+ * Wakes up to the given number of threads sleeping on the given futex word.
+ * */
+void futex_wake(int* word, int numToWake);
+
 #endif //LOCK
 
@@ -0,0 +1,801 @@
+//microbench.c//
+//-----------//
+//This file microbenchmarks the data structures and parsing helpers on
+//psserver's hot path: the StringMap of topics, the ClientList of a topic's
+//subscribers, the command parsing helpers in shared.c, the locks in lock.c
+//and the queues in mpsc.c
+//-----------//
+
+#include "stringmap.h"
+#include "clientList.h"
+#include "shared.h"
+#include "lock.h"
+#include "mpsc.h"
+#include "csse2310a3.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define USAGE "Usage: microbench [maxkeys=n] [parseops=n] [lockops=n] " \
+        "[queueops=n] [threads=n]\n"
+#define MAX_KEYS_OPT "maxkeys"
+#define PARSE_OPS_OPT "parseops"
+#define LOCK_OPS_OPT "lockops"
+#define QUEUE_OPS_OPT "queueops"
+#define THREADS_OPT "threads"
+//the StringMap and ClientList are linked lists, so building (and tearing
+//down) one of n entries is O(n^2) - sizes beyond this take minutes
+#define DEFAULT_MAX_KEYS 10000
+#define DEFAULT_PARSE_OPS 1000000
+#define DEFAULT_LOCK_OPS 1000000
+#define DEFAULT_QUEUE_OPS 1000000
+//max number of nodes the queue benchmarks' consumer takes at once
+#define QUEUE_BATCH 64
+#define DEFAULT_THREADS 4
+//share of the operations that only read (out of 100) in the read-mostly
+//lock benchmarks, roughly psserver's publishes vs subscribes
+#define READ_MOSTLY_PERCENT 90
+#define PERCENT 100
+#define MIN_KEYS 10
+#define SIZE_STEP 10
+//number of key comparisons a search benchmark is allowed (roughly)
+#define SEARCH_BUDGET 100000000L
+#define MIN_SEARCHES 10
+#define MAX_KEY_LEN 32
+#define MAX_CMD_FIELDS 3
+#define SPACE ' '
+#define NS_PER_SEC 1000000000L
+#define RANDOM_SEED 2310
+
+//libc's own allocator, which the wrappers below count calls to
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t num, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+//number of allocations made (by anything in the process) so far
+static long numAllocs = 0;
+
+/* malloc, calloc, realloc
+ * -----------------------
+ * Count every allocation made (including from inside libc, eg: strdup())
+ * before handing it to libc's allocator, so benchmarks can report
+ * allocations per operation.
+ * */
+void* malloc(size_t size) {
+    numAllocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+    numAllocs++;
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    numAllocs++;
+    return __libc_realloc(ptr, size);
+}
+
+/* Each of these constants encodes a kind of lock benchmarked by
+ * bench_locks():
+ *
+ *      SEM_LOCK - sem_t (see take_lock())
+ *      MUTEX_LOCK - Mutex
+ *      RW_LOCK - RwLock (readers share it)
+ *      TICKET_LOCK - TicketLock
+ * */
+enum LockKinds {
+    SEM_LOCK,
+    MUTEX_LOCK,
+    RW_LOCK,
+    TICKET_LOCK
+};
+
+/* Defines the LockWorker structure which holds what each thread of a lock
+ * benchmark is given:
+ *
+ *      kind - one of the LockKinds
+ *      lock - lock the threads share
+ *      numOps - number of times this thread takes the lock
+ *      readPercent - share of those (out of 100) that only read
+ *      counter - counter the lock protects, incremented by each write
+ * */
+typedef struct {
+    int kind;
+    void* lock;
+    long numOps;
+    int readPercent;
+    long* counter;
+} LockWorker;
+
+/* Each of these constants encodes a kind of queue benchmarked by
+ * bench_queues():
+ *
+ *      MPSC_QUEUE - MpscQueue (see mpsc.h)
+ *      MUTEX_QUEUE - linked list protected by a Mutex
+ * */
+enum QueueKinds {
+    MPSC_QUEUE,
+    MUTEX_QUEUE
+};
+
+/* Defines the QueueNode structure, which is what the queue benchmarks' 
+ * producers queue:
+ *
+ *      node - links the node into an MpscQueue
+ *      next - links the node into a MutexQueue
+ *      producer - index of the thread that queued it
+ *      seq - how many nodes that thread had queued before it
+ * */
+typedef struct QueueNode {
+    MpscNode node;
+    struct QueueNode* next;
+    int producer;
+    long seq;
+} QueueNode;
+
+/* Defines the MutexQueue structure, which is the queue the MpscQueue is 
+ * benchmarked against:
+ *
+ *      head - oldest node
+ *      tail - newest node
+ *      lock - lock protecting the list
+ * */
+typedef struct {
+    QueueNode* head;
+    QueueNode* tail;
+    Mutex lock;
+} MutexQueue;
+
+/* Defines the QueueWorker structure which holds what each producer of a 
+ * queue benchmark is given:
+ *
+ *      kind - one of the QueueKinds
+ *      queue - queue the producers share
+ *      nodes - this producer's nodes, queued in order
+ *      numOps - number of nodes
+ * */
+typedef struct {
+    int kind;
+    void* queue;
+    QueueNode* nodes;
+    long numOps;
+} QueueWorker;
+
+/* Defines the Measurement structure which holds the counters read at the
+ * start of a benchmark:
+ *
+ *      startNs - time (ns) the benchmark started
+ *      startAllocs - number of allocations made before it started
+ * */
+typedef struct {
+    long startNs;
+    long startAllocs;
+} Measurement;
+
+//hardware cache miss counter (-1 if the kernel/hardware won't give us one)
+static int cacheMissFd = -1;
+
+/* now_ns
+ * ------
+ * Returns the current (monotonic) time in nanoseconds.
+ * */
+long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* open_cache_miss_counter
+ * -----------------------
+ * Opens a hardware counter of this thread's last level cache misses. Cache
+ * misses are only an estimate of memory stalls, and are reported as "na"
+ * where they can't be counted (eg: in VMs/containers without perf access).
+ * */
+void open_cache_miss_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(struct perf_event_attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(struct perf_event_attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cacheMissFd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* start_measurement
+ * -----------------
+ * Starts measuring a benchmark (time, allocations and cache misses).
+ * */
+Measurement start_measurement(void) {
+    if (cacheMissFd >= 0) {
+        ioctl(cacheMissFd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(cacheMissFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    Measurement measurement = {0, numAllocs};
+    measurement.startNs = now_ns();
+    return measurement;
+}
+
+/* report
+ * ------
+ * Finishes measuring a benchmark and prints its results as a single line
+ * of key=value pairs (so runs can be compared by scripts).
+ *
+ * measurement - counters read at the start of the benchmark
+ * name - name of the benchmark
+ * size - number of entries in the structure benchmarked (0 if none)
+ * numOps - number of operations the benchmark performed
+ *
+ * */
+void report(Measurement measurement, char* name, long size, long numOps) {
+    long elapsed = now_ns() - measurement.startNs;
+    long allocs = numAllocs - measurement.startAllocs;
+    long long misses = -1;
+    if (cacheMissFd >= 0) {
+        ioctl(cacheMissFd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(cacheMissFd, &misses, sizeof(long long)) !=
+                sizeof(long long)) {
+            misses = -1;
+        }
+    }
+    printf("bench=%s n=%ld ops=%ld ns_per_op=%.1f allocs_per_op=%.2f ",
+            name, size, numOps, (double)elapsed / numOps,
+            (double)allocs / numOps);
+    if (misses < 0) {
+        printf("cache_misses_per_op=na\n");
+    } else {
+        printf("cache_misses_per_op=%.2f\n", (double)misses / numOps);
+    }
+    fflush(stdout);
+}
+
+/* shuffle
+ * -------
+ * Shuffles the given array of n pointers into a random order.
+ * */
+void shuffle(void** items, long n) {
+    for (long i = n - 1; i > 0; i--) {
+        long j = rand() % (i + 1);
+        void* temp = items[i];
+        items[i] = items[j];
+        items[j] = temp;
+    }
+}
+
+/* make_keys
+ * ---------
+ * Returns n distinct topic-like keys (eg: "topic/000123"), in a shuffled
+ * order.
+ * */
+char** make_keys(long n) {
+    char** keys = malloc(sizeof(char*) * n);
+    for (long i = 0; i < n; i++) {
+        keys[i] = malloc(sizeof(char) * MAX_KEY_LEN);
+        snprintf(keys[i], MAX_KEY_LEN, "topic/%06ld", i);
+    }
+    shuffle((void**)keys, n);
+    return keys;
+}
+
+/* num_searches
+ * ------------
+ * Returns how many searches to time in a structure of n entries, keeping
+ * the total work roughly the same whatever n is.
+ * */
+long num_searches(long n) {
+    long numSearches = SEARCH_BUDGET / n;
+    return numSearches < MIN_SEARCHES ? MIN_SEARCHES : numSearches;
+}
+
+/* bench_stringmap
+ * ---------------
+ * Benchmarks stringmap_add(), stringmap_search(), stringmap_iterate() and
+ * stringmap_remove() on a StringMap of n keys.
+ * */
+void bench_stringmap(long n) {
+    char** keys = make_keys(n);
+    StringMap* sm = stringmap_init();
+
+    Measurement m = start_measurement();
+    for (long i = 0; i < n; i++) {
+        stringmap_add(sm, keys[i], keys[i]);
+    }
+    report(m, "stringmap_add", n, n);
+
+    long numSearches = num_searches(n);
+    long numFound = 0;
+    m = start_measurement();
+    for (long i = 0; i < numSearches; i++) {
+        numFound += stringmap_search(sm, keys[rand() % n]) != NULL;
+    }
+    report(m, "stringmap_search", n, numSearches);
+
+    long numItems = 0;
+    StringMapItem* item = NULL;
+    m = start_measurement();
+    while ((item = stringmap_iterate(sm, item))) {
+        numItems++;
+    }
+    report(m, "stringmap_iterate", n, numItems ? numItems : 1);
+
+    //remove topics in a different order to the one they were added in
+    shuffle((void**)keys, n);
+    m = start_measurement();
+    for (long i = 0; i < n; i++) {
+        stringmap_remove(sm, keys[i]);
+    }
+    report(m, "stringmap_remove", n, n);
+
+    if (numFound != numSearches || numItems != n) {
+        fprintf(stderr, "microbench: StringMap lost keys (n=%ld)\n", n);
+    }
+    stringmap_free(sm);
+    for (long i = 0; i < n; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+/* bench_client_list
+ * -----------------
+ * Benchmarks add_client(), search() and remove_client() on a topic's list
+ * of n subscribers.
+ * */
+void bench_client_list(long n) {
+    Client** clients = malloc(sizeof(Client*) * n);
+    for (long i = 0; i < n; i++) {
+        clients[i] = create_client(NULL, NULL, NULL);
+    }
+    //a topic's list starts out as a placeholder (see init_topic_entry())
+    ClientListItem* head = init_client_list(NULL, true);
+
+    Measurement m = start_measurement();
+    for (long i = 0; i < n; i++) {
+        add_client(head, clients[i]);
+    }
+    report(m, "add_client", n, n);
+
+    long numSearches = num_searches(n);
+    long numFound = 0;
+    m = start_measurement();
+    for (long i = 0; i < numSearches; i++) {
+        numFound += search(head, clients[rand() % n]) != NULL;
+    }
+    report(m, "client_search", n, numSearches);
+
+    //remove subscribers in a random order, as they'd disconnect
+    shuffle((void**)clients, n);
+    m = start_measurement();
+    for (long i = 0; i < n; i++) {
+        ClientListItem* newHead = remove_client(head, clients[i]);
+        if (newHead) {
+            head = newHead;
+        }
+    }
+    report(m, "remove_client", n, n);
+
+    if (numFound != numSearches) {
+        fprintf(stderr, "microbench: ClientList lost clients (n=%ld)\n", n);
+    }
+    for (long i = 0; i < n; i++) {
+        free(clients[i]);
+    }
+    free(clients);
+}
+
+/* bench_parsing
+ * -------------
+ * Benchmarks tokenising realistic commands the way psserver does (see
+ * handle_client_msg()), ie: split_line() then split_line_max(), and
+ * validating their names/topics with has_space_colon_newline().
+ *
+ * numOps - number of commands to parse
+ *
+ * */
+void bench_parsing(long numOps) {
+    char* commands[] = {
+        "name client42",
+        "sub sensors/kitchen/temperature",
+        "sub orders group=workers balance=least",
+        "pub sensors/kitchen/temperature 21.5",
+        "pub orders retain=1 key=order-1234 widget x 3 shipped to brisbane",
+        "pub chat the quick brown fox jumps over the lazy dog again and again"
+    };
+    int numCommands = sizeof(commands) / sizeof(commands[0]);
+
+    Measurement m = start_measurement();
+    for (long i = 0; i < numOps; i++) {
+        char* msg = strdup(commands[i % numCommands]);
+        char** toks = split_line_max(split_line(msg, SPACE), MAX_CMD_FIELDS);
+        for (int j = 0; toks[j]; j++) {
+            free(toks[j]);
+        }
+        free(toks);
+        free(msg);
+    }
+    report(m, "split_line_max", 0, numOps);
+
+    //the names/topics of the commands above
+    char fields[sizeof(commands) / sizeof(commands[0])][MAX_KEY_LEN * 2];
+    for (int i = 0; i < numCommands; i++) {
+        char* arg = strchr(commands[i], ' ') + 1;
+        snprintf(fields[i], sizeof(fields[i]), "%.*s", (int)strcspn(arg, " "),
+                arg);
+    }
+    long numValid = 0;
+    m = start_measurement();
+    for (long i = 0; i < numOps; i++) {
+        numValid += !has_space_colon_newline(fields[i % numCommands]);
+    }
+    report(m, "has_space_colon_newline", 0, numOps);
+    if (numValid != numOps) {
+        fprintf(stderr, "microbench: unexpected invalid field\n");
+    }
+}
+
+/* take_any_lock
+ * -------------
+ * Takes the given lock of the given kind (for reading, if isRead and it's
+ * an RwLock).
+ * */
+void take_any_lock(int kind, void* lock, bool isRead) {
+    switch (kind) {
+        case SEM_LOCK:
+            take_lock(lock);
+            break;
+        case MUTEX_LOCK:
+            take_mutex(lock);
+            break;
+        case RW_LOCK:
+            if (isRead) {
+                take_read_lock(lock);
+            } else {
+                take_write_lock(lock);
+            }
+            break;
+        case TICKET_LOCK:
+            take_ticket_lock(lock);
+            break;
+    }
+}
+
+/* release_any_lock
+ * ----------------
+ * Releases the given lock of the given kind, taken by take_any_lock().
+ * */
+void release_any_lock(int kind, void* lock, bool isRead) {
+    switch (kind) {
+        case SEM_LOCK:
+            release_lock(lock);
+            break;
+        case MUTEX_LOCK:
+            release_mutex(lock);
+            break;
+        case RW_LOCK:
+            if (isRead) {
+                release_read_lock(lock);
+            } else {
+                release_write_lock(lock);
+            }
+            break;
+        case TICKET_LOCK:
+            release_ticket_lock(lock);
+            break;
+    }
+}
+
+/* lock_worker
+ * -----------
+ * Thread of a lock benchmark, which takes the shared lock numOps times,
+ * reading or incrementing the counter it protects each time.
+ *
+ * arg - LockWorker structure (void*)
+ *
+ * Returns:
+ *      the sum of the counter values read (so the reads aren't optimised
+ *      away)
+ *
+ * */
+void* lock_worker(void* arg) {
+    LockWorker* worker = (LockWorker*)arg;
+    long sum = 0;
+    for (long i = 0; i < worker->numOps; i++) {
+        bool isRead = i % PERCENT < worker->readPercent;
+        take_any_lock(worker->kind, worker->lock, isRead);
+        if (isRead) {
+            sum += *(volatile long*)worker->counter;
+        } else {
+            (*worker->counter)++;
+        }
+        release_any_lock(worker->kind, worker->lock, isRead);
+    }
+    return (void*)sum;
+}
+
+/* run_lock_bench
+ * --------------
+ * Times numThreads threads sharing the given lock, numOps operations in
+ * total, and checks that no write was lost.
+ *
+ * name - name of the benchmark
+ * kind - one of the LockKinds
+ * lock - lock to share
+ * numThreads - number of threads
+ * numOps - total number of times the lock is taken
+ * readPercent - share of those (out of 100) that only read
+ *
+ * */
+void run_lock_bench(char* name, int kind, void* lock, int numThreads,
+        long numOps, int readPercent) {
+    long counter = 0;
+    LockWorker* workers = malloc(sizeof(LockWorker) * numThreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * numThreads);
+    long opsPerThread = numOps / numThreads;
+    for (int i = 0; i < numThreads; i++) {
+        workers[i] = (LockWorker){kind, lock, opsPerThread, readPercent,
+                &counter};
+    }
+
+    Measurement m = start_measurement();
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, lock_worker, &workers[i]);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(m, name, numThreads, opsPerThread * numThreads);
+
+    //as many writes as each thread made, times the number of threads
+    long numWrites = 0;
+    for (long i = 0; i < opsPerThread; i++) {
+        numWrites += i % PERCENT >= readPercent;
+    }
+    if (counter != numWrites * numThreads) {
+        fprintf(stderr, "microbench: %s lost writes\n", name);
+    }
+    free(threads);
+    free(workers);
+}
+
+/* bench_locks
+ * -----------
+ * Benchmarks the Mutex, RwLock and TicketLock in lock.h against the sem_t
+ * psserver used to use everywhere: taking and releasing each one on its own
+ * (uncontended), then from numThreads threads at once (contended), then
+ * with mostly reads (where the RwLock's readers share it). n is the number
+ * of threads in each benchmark.
+ *
+ * numOps - number of times the lock is taken in each benchmark
+ * numThreads - number of threads in the contended benchmarks
+ *
+ * */
+void bench_locks(long numOps, int numThreads) {
+    sem_t sem;
+    Mutex mutex;
+    RwLock rwlock;
+    TicketLock ticketLock;
+    init_lock(&sem, 1);
+    init_mutex(&mutex, NULL);
+    init_rwlock(&rwlock, NULL);
+    init_ticket_lock(&ticketLock, NULL);
+
+    //indexed by LockKinds (an RwLock is only written to until the
+    //read-mostly benchmarks)
+    void* locks[] = {&sem, &mutex, &rwlock, &ticketLock};
+    char* names[] = {"sem", "mutex", "rwlock", "ticket_lock"};
+    char name[MAX_KEY_LEN];
+    for (int kind = SEM_LOCK; kind <= TICKET_LOCK; kind++) {
+        run_lock_bench(names[kind], kind, locks[kind], 1, numOps, 0);
+    }
+    for (int kind = SEM_LOCK; kind <= TICKET_LOCK; kind++) {
+        snprintf(name, MAX_KEY_LEN, "%s_contended", names[kind]);
+        run_lock_bench(name, kind, locks[kind], numThreads, numOps, 0);
+    }
+    for (int kind = SEM_LOCK; kind <= RW_LOCK; kind++) {
+        snprintf(name, MAX_KEY_LEN, "%s_read_mostly", names[kind]);
+        run_lock_bench(name, kind, locks[kind], numThreads, numOps,
+                READ_MOSTLY_PERCENT);
+    }
+    sem_destroy(&sem);
+}
+
+/* queue_worker
+ * ------------
+ * Producer thread of a queue benchmark, which queues each of its nodes in
+ * turn.
+ *
+ * arg - QueueWorker structure (void*)
+ *
+ * */
+void* queue_worker(void* arg) {
+    QueueWorker* worker = (QueueWorker*)arg;
+    for (long i = 0; i < worker->numOps; i++) {
+        QueueNode* node = &worker->nodes[i];
+        if (worker->kind == MPSC_QUEUE) {
+            mpsc_push(worker->queue, &node->node);
+            continue;
+        }
+        MutexQueue* queue = worker->queue;
+        node->next = NULL;
+        take_mutex(&queue->lock);
+        if (queue->tail) {
+            queue->tail->next = node;
+        } else {
+            queue->head = node;
+        }
+        queue->tail = node;
+        release_mutex(&queue->lock);
+    }
+    return NULL;
+}
+
+/* take_queued
+ * -----------
+ * Takes up to QUEUE_BATCH of the oldest nodes off the given queue of the 
+ * given kind.
+ *
+ * Returns:
+ *      the number of nodes taken
+ *
+ * */
+int take_queued(int kind, void* queue, QueueNode** nodes) {
+    if (kind == MPSC_QUEUE) {
+        //QueueNode starts with its MpscNode
+        return mpsc_pop_batch(queue, (MpscNode**)nodes, QUEUE_BATCH);
+    }
+    MutexQueue* mutexQueue = queue;
+    int numNodes = 0;
+    take_mutex(&mutexQueue->lock);
+    while (numNodes < QUEUE_BATCH && mutexQueue->head) {
+        nodes[numNodes++] = mutexQueue->head;
+        mutexQueue->head = mutexQueue->head->next;
+    }
+    if (!mutexQueue->head) {
+        mutexQueue->tail = NULL;
+    }
+    release_mutex(&mutexQueue->lock);
+    return numNodes;
+}
+
+/* run_queue_bench
+ * ---------------
+ * Times numThreads producers handing numOps nodes (in total) to this 
+ * thread through the given queue, and checks that every node arrived once,
+ * in the order its producer queued it.
+ *
+ * name - name of the benchmark
+ * kind - one of the QueueKinds
+ * queue - queue to share
+ * numThreads - number of producers
+ * numOps - total number of nodes queued
+ *
+ * */
+void run_queue_bench(char* name, int kind, void* queue, int numThreads,
+        long numOps) {
+    QueueWorker* workers = malloc(sizeof(QueueWorker) * numThreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * numThreads);
+    long* nextSeq = calloc(numThreads, sizeof(long));
+    long opsPerThread = numOps / numThreads;
+    for (int i = 0; i < numThreads; i++) {
+        workers[i] = (QueueWorker){kind, queue, 
+                malloc(sizeof(QueueNode) * opsPerThread), opsPerThread};
+        for (long j = 0; j < opsPerThread; j++) {
+            workers[i].nodes[j].producer = i;
+            workers[i].nodes[j].seq = j;
+        }
+    }
+
+    QueueNode* nodes[QUEUE_BATCH];
+    bool isOrdered = true;
+    Measurement m = start_measurement();
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, queue_worker, &workers[i]);
+    }
+    for (long numTaken = 0; numTaken < opsPerThread * numThreads; ) {
+        int numNodes = take_queued(kind, queue, nodes);
+        if (!numNodes) {
+            //let the producers run (if they share our core)
+            sched_yield();
+        }
+        for (int i = 0; i < numNodes; i++) {
+            isOrdered &= nodes[i]->seq == nextSeq[nodes[i]->producer]++;
+        }
+        numTaken += numNodes;
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(m, name, numThreads, opsPerThread * numThreads);
+
+    if (!isOrdered) {
+        fprintf(stderr, "microbench: %s reordered nodes\n", name);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        free(workers[i].nodes);
+    }
+    free(nextSeq);
+    free(threads);
+    free(workers);
+}
+
+/* bench_queues
+ * ------------
+ * Benchmarks the lock-free MpscQueue in mpsc.h against a Mutex-protected
+ * linked list, handing nodes from one producer to a consumer, then from 
+ * numThreads producers at once. The consumer takes nodes in batches from 
+ * both. n is the number of producers in each benchmark.
+ *
+ * numOps - number of nodes handed over in each benchmark
+ * numThreads - number of producers in the contended benchmarks
+ *
+ * */
+void bench_queues(long numOps, int numThreads) {
+    MpscQueue mpscQueue;
+    MutexQueue mutexQueue = {NULL, NULL};
+    mpsc_init(&mpscQueue);
+    init_mutex(&mutexQueue.lock, NULL);
+
+    //indexed by QueueKinds
+    void* queues[] = {&mpscQueue, &mutexQueue};
+    char* names[] = {"mpsc_queue", "mutex_queue"};
+    char name[MAX_KEY_LEN];
+    for (int kind = MPSC_QUEUE; kind <= MUTEX_QUEUE; kind++) {
+        run_queue_bench(names[kind], kind, queues[kind], 1, numOps);
+    }
+    for (int kind = MPSC_QUEUE; kind <= MUTEX_QUEUE; kind++) {
+        snprintf(name, MAX_KEY_LEN, "%s_contended", names[kind]);
+        run_queue_bench(name, kind, queues[kind], numThreads, numOps);
+    }
+}
+
+int main(int argc, char** argv) {
+    long maxKeys = DEFAULT_MAX_KEYS;
+    long parseOps = DEFAULT_PARSE_OPS;
+    long lockOps = DEFAULT_LOCK_OPS;
+    long queueOps = DEFAULT_QUEUE_OPS;
+    int numThreads = DEFAULT_THREADS;
+    for (int i = 1; i < argc; i++) {
+        char* optValue;
+        if ((optValue = option_value(argv[i], MAX_KEYS_OPT))) {
+            maxKeys = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], PARSE_OPS_OPT))) {
+            parseOps = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], LOCK_OPS_OPT))) {
+            lockOps = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], QUEUE_OPS_OPT))) {
+            queueOps = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], THREADS_OPT))) {
+            numThreads = string_to_int(optValue);
+        } else {
+            maxKeys = -1;
+        }
+        if (maxKeys < MIN_KEYS || parseOps <= 0 || lockOps <= 0 ||
+                queueOps <= 0 || numThreads <= 0) {
+            fprintf(stderr, USAGE);
+            exit(1);
+        }
+    }
+    srand(RANDOM_SEED);
+    open_cache_miss_counter();
+
+    for (long n = MIN_KEYS; n <= maxKeys; n *= SIZE_STEP) {
+        bench_stringmap(n);
+    }
+    for (long n = MIN_KEYS; n <= maxKeys; n *= SIZE_STEP) {
+        bench_client_list(n);
+    }
+    bench_parsing(parseOps);
+    bench_locks(lockOps, numThreads);
+    bench_queues(queueOps, numThreads);
+    return 0;
+}
@@ -0,0 +1,73 @@
+//mpsc.c//
+//----------------------//
+//This file abstracts away the lock-free multi-producer, single-consumer
+//queues psserver hands work between threads with (see mpsc.h)
+//----------------------//
+
+#include "mpsc.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+void mpsc_init(MpscQueue* queue) {
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    __atomic_store_n(&queue->tail, &queue->stub, __ATOMIC_RELEASE);
+}
+
+void* mpsc_alloc(size_t size) {
+    void* memory;
+    if (posix_memalign(&memory, CACHE_LINE, size)) {
+        return NULL;
+    }
+    memset(memory, 0, size);
+    return memory;
+}
+
+void mpsc_push(MpscQueue* queue, MpscNode* node) {
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    MpscNode* prev = __atomic_exchange_n(&queue->tail, node,
+            __ATOMIC_ACQ_REL);
+    //NOTE: until this store, the consumer can't reach node (or anything
+    //pushed after it)
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+MpscNode* mpsc_pop(MpscQueue* queue) {
+    MpscNode* head = queue->head;
+    MpscNode* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    //skip over the stub
+    if (head == &queue->stub) {
+        if (!next) {
+            return NULL;
+        }
+        queue->head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+    //head is the last node reachable - unless it's also the tail, a
+    //producer is part way through linking a newer node onto it
+    if (head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    //put the stub back behind head so head can be taken off the end
+    mpsc_push(queue, &queue->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+int mpsc_pop_batch(MpscQueue* queue, MpscNode** nodes, int maxNodes) {
+    int numNodes = 0;
+    while (numNodes < maxNodes && (nodes[numNodes] = mpsc_pop(queue))) {
+        numNodes++;
+    }
+    return numNodes;
+}
@@ -0,0 +1,111 @@
+//mpsc.h//
+//----------------------//
+//mpsc.c abstracts away the lock-free multi-producer, single-consumer queues
+//psserver hands work between threads with
+//----------------------//
+
+#ifndef MPSC
+#define MPSC
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//size of a cache line, which the queue's ends are kept on separate ones of
+#define CACHE_LINE 64
+
+/* How the queue works:
+ *
+ * The queue is intrusive: whatever is queued embeds an MpscNode (usually as
+ * its first field) and the queue just links the nodes together, so pushing
+ * never allocates. Any number of threads may push at once, each with a
+ * single atomic exchange on the queue's tail (no retries, so no producer
+ * can be starved). Only one thread at a time may pop, walking from the
+ * head without any atomic read-modify-writes at all. The tail (written by
+ * producers) and head (written by the consumer) are on separate cache
+ * lines, so producers and the consumer don't bounce a line between them.
+ *
+ * A producer that has swapped itself in as the tail but not yet linked
+ * itself to the previous node leaves a momentary gap: the consumer sees the
+ * queue as empty at that point until the link is made (see mpsc_pop()).
+ * Callers that know a node is coming (eg: from a count) should retry.
+ * */
+
+/* Defines the MpscNode structure, which is embedded in anything queued:
+ *
+ *      next - next (newer) node in the queue
+ * */
+typedef struct MpscNode {
+    struct MpscNode* next;
+} MpscNode;
+
+/* Defines the MpscQueue structure, which is a lock-free multi-producer,
+ * single-consumer queue of MpscNodes:
+ *
+ *      tail - newest node, swapped in by producers
+ *      head - oldest node, only touched by the consumer (the stub when the
+ *             oldest node has been popped)
+ *      stub - placeholder node keeping the queue non-empty, so producers
+ *             never have to touch the head
+ * */
+typedef struct {
+    MpscNode* tail __attribute__((aligned(CACHE_LINE)));
+    MpscNode* head __attribute__((aligned(CACHE_LINE)));
+    MpscNode stub;
+} MpscQueue;
+
+/* mpsc_init
+ * ---------
+ * Initialises the given (empty) queue.
+ * */
+void mpsc_init(MpscQueue* queue);
+
+/* mpsc_alloc
+ * ----------
+ * Allocates zeroed memory of the given size, aligned to a cache line, for
+ * a structure holding an MpscQueue. malloc() and calloc() only align to 16
+ * bytes, which would put the queue's ends on cache lines shared with the 
+ * structure's other fields.
+ *
+ * NOTE: memory is dynamically allocated and thus must be free()'d
+ * */
+void* mpsc_alloc(size_t size);
+
+/* mpsc_push
+ * ---------
+ * Adds the given node to the tail of the given queue. May be called by any
+ * number of threads at once.
+ *
+ * queue - queue to push to
+ * node - node to push (not in any queue)
+ *
+ * */
+void mpsc_push(MpscQueue* queue, MpscNode* node);
+
+/* mpsc_pop
+ * --------
+ * Removes the oldest node from the given queue. Only one thread may pop
+ * from a queue at a time.
+ *
+ * Returns:
+ *      the node, or NULL if the queue is empty (or the oldest node's
+ *      producer is still part way through pushing it)
+ *
+ * */
+MpscNode* mpsc_pop(MpscQueue* queue);
+
+/* mpsc_pop_batch
+ * --------------
+ * Removes up to the given number of the oldest nodes from the given queue,
+ * as mpsc_pop() does.
+ *
+ * queue - queue to pop from
+ * nodes - array to fill with the nodes popped (oldest first)
+ * maxNodes - size of nodes
+ *
+ * Returns:
+ *      the number of nodes popped
+ *
+ * */
+int mpsc_pop_batch(MpscQueue* queue, MpscNode** nodes, int maxNodes);
+
+#endif //MPSC
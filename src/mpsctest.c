@@ -0,0 +1,152 @@
+//mpsctest.c//
+//-----------//
+//Stress test of the lock-free queue in mpsc.c: many producers push at once
+//while a single consumer pops (one at a time and in batches), checking
+//that every node arrives exactly once and in its producer's order.
+//eg: ./mpsctest [producers] [nodes per producer] [rounds]
+//-----------//
+
+#include "mpsc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define DEFAULT_PRODUCERS 8
+#define DEFAULT_NODES 200000
+#define DEFAULT_ROUNDS 5
+#define BATCH 32
+
+/* Defines the TestNode structure, which is what the producers push:
+ *
+ *      node - links the node into the queue
+ *      producer - index of the producer that pushed it
+ *      seq - how many nodes that producer pushed before it
+ * */
+typedef struct {
+    MpscNode node;
+    int producer;
+    long seq;
+} TestNode;
+
+/* Defines the Producer structure, which holds what each producer thread is
+ * given:
+ *
+ *      queue - queue to push to
+ *      nodes - nodes to push, in order
+ *      numNodes - number of nodes
+ *      start - flag the producers spin on, so they all start at once
+ * */
+typedef struct {
+    MpscQueue* queue;
+    TestNode* nodes;
+    long numNodes;
+    int* start;
+} Producer;
+
+/* producer_thread
+ * ---------------
+ * Pushes each of the producer's nodes in turn, yielding now and then so
+ * pushes are interleaved (even on a single core).
+ *
+ * arg - Producer structure (void*)
+ *
+ * */
+void* producer_thread(void* arg) {
+    Producer* producer = (Producer*)arg;
+    while (!__atomic_load_n(producer->start, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    for (long i = 0; i < producer->numNodes; i++) {
+        mpsc_push(producer->queue, &producer->nodes[i].node);
+        if (i % BATCH == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* run_round
+ * ---------
+ * Runs one round of the stress test, popping in batches if isBatched.
+ *
+ * Returns:
+ *      true iff every node arrived exactly once, in order
+ *
+ * */
+bool run_round(int numProducers, long numNodes, bool isBatched) {
+    MpscQueue queue;
+    mpsc_init(&queue);
+    int start = 0;
+    Producer* producers = malloc(sizeof(Producer) * numProducers);
+    pthread_t* threads = malloc(sizeof(pthread_t) * numProducers);
+    long* nextSeq = calloc(numProducers, sizeof(long));
+    for (int i = 0; i < numProducers; i++) {
+        producers[i] = (Producer){&queue,
+                malloc(sizeof(TestNode) * numNodes), numNodes, &start};
+        for (long j = 0; j < numNodes; j++) {
+            producers[i].nodes[j].producer = i;
+            producers[i].nodes[j].seq = j;
+        }
+        pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+    }
+    __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+
+    bool isOk = true;
+    MpscNode* nodes[BATCH];
+    for (long numPopped = 0; numPopped < numNodes * numProducers; ) {
+        int numTaken = isBatched ? mpsc_pop_batch(&queue, nodes, BATCH) :
+                (nodes[0] = mpsc_pop(&queue)) != NULL;
+        if (!numTaken) {
+            sched_yield();
+        }
+        for (int i = 0; i < numTaken; i++) {
+            TestNode* node = (TestNode*)nodes[i];
+            if (node->seq != nextSeq[node->producer]++) {
+                isOk = false;
+            }
+        }
+        numPopped += numTaken;
+    }
+    for (int i = 0; i < numProducers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    //nothing left over
+    if (mpsc_pop(&queue)) {
+        isOk = false;
+    }
+    for (int i = 0; i < numProducers; i++) {
+        isOk &= nextSeq[i] == numNodes;
+        free(producers[i].nodes);
+    }
+    free(nextSeq);
+    free(threads);
+    free(producers);
+    return isOk;
+}
+
+int main(int argc, char** argv) {
+    int numProducers = argc > 1 ? atoi(argv[1]) : DEFAULT_PRODUCERS;
+    long numNodes = argc > 2 ? atol(argv[2]) : DEFAULT_NODES;
+    int numRounds = argc > 3 ? atoi(argv[3]) : DEFAULT_ROUNDS;
+    if (numProducers <= 0 || numNodes <= 0 || numRounds <= 0) {
+        fprintf(stderr, "Usage: mpsctest [producers] [nodes] [rounds]\n");
+        exit(1);
+    }
+
+    bool isOk = true;
+    for (int round = 0; round < numRounds; round++) {
+        bool isBatched = round % 2;
+        if (run_round(numProducers, numNodes, isBatched)) {
+            printf("PASS: round %d (%s), %d producers x %ld nodes\n", round,
+                    isBatched ? "batched" : "single", numProducers,
+                    numNodes);
+        } else {
+            printf("ERROR: round %d (%s) lost or reordered nodes\n", round,
+                    isBatched ? "batched" : "single");
+            isOk = false;
+        }
+    }
+    return isOk ? 0 : 1;
+}
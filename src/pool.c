@@ -0,0 +1,168 @@
+//pool.c//
+//----------------------//
+//This file abstracts away psserver's pool of worker threads, which share out
+//work by stealing it from each other
+//----------------------//
+
+#include "pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define INITIAL_QUEUE_CAPACITY 64
+
+/* Defines the WorkerArgs structure, which is given to each worker thread:
+ *
+ *      pool - pool the worker belongs to
+ *      index - index of the worker's queue
+ * */
+typedef struct {
+    WorkPool* pool;
+    int index;
+} WorkerArgs;
+
+//pool the calling thread is a worker of (NULL if it isn't a worker)
+__thread WorkPool* currentPool = NULL;
+//index of the calling worker's queue
+__thread int currentWorker = 0;
+
+int default_pool_size(void) {
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    return numCores > 0 ? numCores : 1;
+}
+
+WorkPool* pool_init(int numWorkers) {
+    WorkPool* pool = calloc(1, sizeof(WorkPool));
+    pool->numWorkers = numWorkers;
+    pool->queues = calloc(numWorkers, sizeof(TaskQueue));
+    for (int i = 0; i < numWorkers; i++) {
+        pool->queues[i].capacity = INITIAL_QUEUE_CAPACITY;
+        pool->queues[i].tasks = malloc(sizeof(PoolTask) *
+                INITIAL_QUEUE_CAPACITY);
+        init_mutex(&pool->queues[i].lock, NULL);
+    }
+    init_lock(&pool->available, 0);
+    return pool;
+}
+
+/* push_task
+ * ---------
+ * Adds the given task to the newest end of the given queue, growing it if
+ * it's full.
+ * */
+void push_task(TaskQueue* queue, PoolTask task) {
+    take_mutex(&queue->lock);
+    if (queue->numTasks == queue->capacity) {
+        //unwrap the tasks into a buffer twice the size
+        PoolTask* tasks = malloc(sizeof(PoolTask) * queue->capacity * 2);
+        for (int i = 0; i < queue->numTasks; i++) {
+            tasks[i] = queue->tasks[(queue->head + i) % queue->capacity];
+        }
+        free(queue->tasks);
+        queue->tasks = tasks;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+    queue->tasks[(queue->head + queue->numTasks) % queue->capacity] = task;
+    queue->numTasks++;
+    release_mutex(&queue->lock);
+}
+
+/* pop_task
+ * --------
+ * Takes a task from the given queue: the newest if isOwner (the queue's own
+ * worker), otherwise the oldest.
+ *
+ * Returns:
+ *      true iff there was a task to take
+ *
+ * */
+bool pop_task(TaskQueue* queue, bool isOwner, PoolTask* task) {
+    take_mutex(&queue->lock);
+    bool hasTask = queue->numTasks > 0;
+    if (hasTask && isOwner) {
+        *task = queue->tasks[(queue->head + queue->numTasks - 1) %
+                queue->capacity];
+        queue->numTasks--;
+    } else if (hasTask) {
+        *task = queue->tasks[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->numTasks--;
+    }
+    release_mutex(&queue->lock);
+    return hasTask;
+}
+
+void pool_submit(WorkPool* pool, void (*run)(void* arg), void* arg) {
+    PoolTask task = {run, arg};
+    int index = currentPool == pool ? currentWorker :
+            __atomic_fetch_add(&pool->nextQueue, 1, __ATOMIC_RELAXED) %
+            pool->numWorkers;
+    push_task(&pool->queues[index], task);
+    long numQueued = __atomic_add_fetch(&pool->numQueued, 1, 
+            __ATOMIC_RELAXED);
+    long maxQueued = __atomic_load_n(&pool->maxQueued, __ATOMIC_RELAXED);
+    while (numQueued > maxQueued && !__atomic_compare_exchange_n(
+            &pool->maxQueued, &maxQueued, numQueued, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
+    }
+    release_lock(&pool->available);
+}
+
+/* worker_thread
+ * -------------
+ * The thread of each of a pool's workers (see start_pool()), which runs
+ * tasks from its own queue, stealing from the others' once it's empty.
+ *
+ * arg - WorkerArgs structure (void*)
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* worker_thread(void* arg) {
+    WorkerArgs* args = (WorkerArgs*)arg;
+    WorkPool* pool = args->pool;
+    currentPool = pool;
+    currentWorker = args->index;
+    free(args);
+    while (true) {
+        //there's a task queued for each post, though not necessarily ours
+        take_lock(&pool->available);
+        PoolTask task;
+        bool isStolen = false;
+        if (!pop_task(&pool->queues[currentWorker], true, &task)) {
+            isStolen = true;
+            //start from the next worker's, so thieves spread out
+            for (int i = 1; !pop_task(&pool->queues[(currentWorker + i) %
+                    pool->numWorkers], false, &task); i++) {
+            }
+        }
+        __atomic_fetch_sub(&pool->numQueued, 1, __ATOMIC_RELAXED);
+        task.run(task.arg);
+        __atomic_fetch_add(&pool->numRun, 1, __ATOMIC_RELAXED);
+        if (isStolen) {
+            __atomic_fetch_add(&pool->numSteals, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void start_pool(WorkPool* pool) {
+    for (int i = 0; i < pool->numWorkers; i++) {
+        WorkerArgs* args = malloc(sizeof(WorkerArgs));
+        args->pool = pool;
+        args->index = i;
+        pthread_t threadId;
+        pthread_create(&threadId, NULL, worker_thread, args);
+        pthread_detach(threadId);
+    }
+}
+
+void print_pool_stats(WorkPool* pool, FILE* out) {
+    fprintf(out, "Worker pool workers:%d queued:%ld max_queued:%ld run:%ld "
+            "steals:%ld\n", pool->numWorkers,
+            __atomic_load_n(&pool->numQueued, __ATOMIC_RELAXED),
+            __atomic_load_n(&pool->maxQueued, __ATOMIC_RELAXED),
+            __atomic_load_n(&pool->numRun, __ATOMIC_RELAXED),
+            __atomic_load_n(&pool->numSteals, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,134 @@
+//pool.h//
+//----------------------//
+//pool.c abstracts away psserver's pool of worker threads, which share out
+//work by stealing it from each other
+//----------------------//
+
+#ifndef POOL
+#define POOL
+
+#include "lock.h"
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* How the pool works:
+ *
+ * Each worker has its own queue of tasks. A task submitted by a worker (eg:
+ * a task splitting itself up) goes on that worker's queue, and one submitted
+ * by any other thread goes on the next queue round robin. Workers take
+ * their own newest task first (its data is most likely still in cache), and
+ * once their queue is empty steal the oldest task from another worker's, so
+ * a worker stuck on a slow task (eg: writing to a full socket) doesn't hold
+ * up the rest of its queue.
+ *
+ * Tasks may block, but nothing may wait for a task that hasn't started yet
+ * (every worker could be blocked). Callers that need a result should do the
+ * work themselves if no worker has picked it up (see fan_out_parallel() in
+ * broker.c).
+ * */
+
+/* Defines the PoolTask structure, which is a unit of work:
+ *
+ *      run - function to run
+ *      arg - argument to give it
+ * */
+typedef struct {
+    void (*run)(void* arg);
+    void* arg;
+} PoolTask;
+
+/* Defines the TaskQueue structure, which is a worker's queue of tasks (a
+ * growable circular buffer):
+ *
+ *      tasks - buffer of tasks
+ *      capacity - size of the buffer
+ *      head - index of the oldest task (taken by thieves)
+ *      numTasks - number of tasks queued (the newest is taken by the owner)
+ *      lock - lock protecting the queue
+ * */
+typedef struct {
+    PoolTask* tasks;
+    int capacity;
+    int head;
+    int numTasks;
+    Mutex lock;
+} TaskQueue;
+
+/* Defines the WorkPool structure, which holds a pool of worker threads:
+ *
+ *      numWorkers - number of worker threads
+ *      queues - each worker's queue of tasks
+ *      available - posted once for each task queued, so idle workers sleep
+ *                  until there's a task to take
+ *      nextQueue - queue the next task submitted from outside the pool goes
+ *                  on (round robin)
+ *      numQueued - number of tasks queued (but not yet started)
+ *      maxQueued - most tasks that have been queued at once
+ *      numRun - number of tasks run
+ *      numSteals - number of tasks run by a worker other than the one whose
+ *                  queue they were on
+ * */
+typedef struct WorkPool {
+    int numWorkers;
+    TaskQueue* queues;
+    sem_t available;
+    unsigned int nextQueue;
+    long numQueued;
+    long maxQueued;
+    long numRun;
+    long numSteals;
+} WorkPool;
+
+/* default_pool_size
+ * -----------------
+ * Returns the number of workers a pool should have by default: one per
+ * online core.
+ * */
+int default_pool_size(void);
+
+/* pool_init
+ * ---------
+ * Initialises a pool of the given number of workers. The workers don't
+ * start until start_pool() is called, but tasks may be submitted before
+ * then.
+ *
+ * numWorkers - number of worker threads
+ *
+ * Returns:
+ *      the newly created WorkPool structure
+ *
+ * */
+WorkPool* pool_init(int numWorkers);
+
+/* start_pool
+ * ----------
+ * Starts the given pool's worker threads.
+ * */
+void start_pool(WorkPool* pool);
+
+/* pool_submit
+ * -----------
+ * Queues the given function to be run (with the given argument) by one of
+ * the pool's workers.
+ *
+ * pool - pool to run it
+ * run - function to run
+ * arg - argument to give it
+ *
+ * */
+void pool_submit(WorkPool* pool, void (*run)(void* arg), void* arg);
+
+/* print_pool_stats
+ * ----------------
+ * Prints the given pool's queue depth (now and at its deepest), and how
+ * many tasks it has run and stolen, as a single line, ie: 
+ * "Worker pool workers:N queued:N max_queued:N run:N steals:N".
+ *
+ * pool - pool to print
+ * out - stream to print to
+ *
+ * */
+void print_pool_stats(WorkPool* pool, FILE* out);
+
+#endif //POOL
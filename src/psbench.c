@@ -0,0 +1,484 @@
+//psbench.c//
+//-----------//
+//This file is a load generator for psserver: it runs a number of publisher
+//and subscriber connections against it and reports throughput and
+//end-to-end latency
+//-----------//
+
+#include "shared.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define USAGE "Usage: psbench [host:]portnum [pubs=n] [subs=n] [topics=n] " \
+        "[fanout=n] [size=bytes] [messages=n] [rate=msgs/sec]\n"
+#define PORT_INDEX 1
+#define MIN_NUM_ARGS 2
+#define LOCALHOST "localhost"
+#define PUBS_OPT "pubs"
+#define SUBS_OPT "subs"
+#define TOPICS_OPT "topics"
+#define FANOUT_OPT "fanout"
+#define SIZE_OPT "size"
+#define MESSAGES_OPT "messages"
+#define RATE_OPT "rate"
+#define DEFAULT_PUBS 1
+#define DEFAULT_SUBS 1
+#define DEFAULT_TOPICS 1
+#define DEFAULT_FANOUT 1
+#define DEFAULT_SIZE 64
+#define DEFAULT_MESSAGES 100000
+//0 means publish as fast as possible
+#define DEFAULT_RATE 0
+//room a value needs for its timestamp and the space after it
+#define MIN_SIZE 21
+//how long (ms) a subscriber waits for another message before giving up
+#define IDLE_TIMEOUT 2000
+#define TOPIC_FORMAT "bench%d"
+#define SYNC_TOPIC_FORMAT "psbench.sync.%d"
+#define MAX_TOPIC_LEN 32
+#define NS_PER_SEC 1000000000L
+#define NS_PER_US 1000.0
+#define MS_PER_SEC 1000
+#define US_PER_MS 1000
+
+/* Defines the Config structure which holds the load to generate, given by
+ * psbench's command line options:
+ *
+ *      host - host psserver is on
+ *      service - port psserver is listening on
+ *      numPubs - number of publisher connections
+ *      numSubs - number of subscriber connections
+ *      numTopics - number of topics published to (round robin by each
+ *                  publisher)
+ *      fanout - number of subscribers each topic has (at most numSubs)
+ *      size - size (in bytes) of each value published
+ *      numMessages - number of messages each publisher publishes
+ *      rate - messages per second each publisher publishes at (0 for as
+ *             fast as possible)
+ * */
+typedef struct {
+    char* host;
+    char* service;
+    int numPubs;
+    int numSubs;
+    int numTopics;
+    int fanout;
+    int size;
+    int numMessages;
+    int rate;
+} Config;
+
+/* Defines the Subscriber structure passed to each subscriber thread:
+ *
+ *      config - load being generated
+ *      index - subscriber's number
+ *      fromServer - read end of its connection
+ *      toServer - write end of its connection
+ *      numExpected - number of messages it should receive
+ *      latencies - end-to-end latency (ns) of each message received
+ *      numReceived - number of messages received
+ *      numBytes - number of bytes received
+ *      lastAt - time (ns) the last message was received
+ * */
+typedef struct {
+    Config* config;
+    int index;
+    FILE* fromServer;
+    FILE* toServer;
+    long numExpected;
+    long* latencies;
+    long numReceived;
+    long numBytes;
+    long lastAt;
+} Subscriber;
+
+/* Defines the Publisher structure passed to each publisher thread:
+ *
+ *      config - load being generated
+ *      index - publisher's number
+ *      toServer - write end of its connection
+ * */
+typedef struct {
+    Config* config;
+    int index;
+    FILE* toServer;
+} Publisher;
+
+/* now_ns
+ * ------
+ * Returns the current (monotonic) time in nanoseconds.
+ *
+ * NOTE: latencies are measured by comparing publishers' and subscribers'
+ * clocks, so psbench's connections must all run on the same host (psserver
+ * itself may be anywhere)
+ * */
+long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* usage_error
+ * -----------
+ * Prints psbench's usage message and exits with status 1.
+ * */
+void usage_error(void) {
+    fprintf(stderr, USAGE);
+    exit(1);
+}
+
+/* parse_command_line
+ * ------------------
+ * Parses psbench's command line into the load to generate.
+ *
+ * argc - number of command line arguments
+ * argv - command line arguments
+ *
+ * Returns:
+ *      the load to generate (exits if the command line is invalid)
+ *
+ * */
+Config parse_command_line(int argc, char** argv) {
+    if (argc < MIN_NUM_ARGS) {
+        usage_error();
+    }
+    Config config = {LOCALHOST, argv[PORT_INDEX], DEFAULT_PUBS, DEFAULT_SUBS,
+            DEFAULT_TOPICS, DEFAULT_FANOUT, DEFAULT_SIZE, DEFAULT_MESSAGES,
+            DEFAULT_RATE};
+    char* colon = strrchr(argv[PORT_INDEX], ':');
+    if (colon) {
+        config.host = strndup(argv[PORT_INDEX], colon - argv[PORT_INDEX]);
+        config.service = colon + 1;
+    }
+
+    struct {
+        char* name;
+        int* value;
+        int min;
+    } opts[] = {
+        {PUBS_OPT, &config.numPubs, 1},
+        {SUBS_OPT, &config.numSubs, 0},
+        {TOPICS_OPT, &config.numTopics, 1},
+        {FANOUT_OPT, &config.fanout, 0},
+        {SIZE_OPT, &config.size, MIN_SIZE},
+        {MESSAGES_OPT, &config.numMessages, 1},
+        {RATE_OPT, &config.rate, 0}
+    };
+    int numOpts = sizeof(opts) / sizeof(opts[0]);
+    for (int i = PORT_INDEX + 1; i < argc; i++) {
+        char* optValue = NULL;
+        int j;
+        for (j = 0; j < numOpts &&
+                !(optValue = option_value(argv[i], opts[j].name)); j++) {
+        }
+        if (!optValue) {
+            usage_error();
+        }
+        *opts[j].value = string_to_int(optValue);
+        if (*opts[j].value < opts[j].min) {
+            usage_error();
+        }
+    }
+    //a topic can't have more subscribers than there are
+    if (config.fanout > config.numSubs) {
+        config.fanout = config.numSubs;
+    }
+    return config;
+}
+
+/* open_connection
+ * ---------------
+ * Connects to psserver and names the connection.
+ *
+ * config - load being generated
+ * name - name to give the connection
+ * toServer - set to the write end of the connection
+ *
+ * Returns:
+ *      the read end of the connection (exits if it can't be made)
+ *
+ * */
+FILE* open_connection(Config* config, char* name, FILE** toServer) {
+    int fd = connect_to_host(config->host, config->service);
+    if (fd < 0) {
+        fprintf(stderr, "psbench: unable to connect to %s\n",
+                config->service);
+        exit(1);
+    }
+    *toServer = fdopen(dup(fd), "w");
+    fprintf(*toServer, "name %s\n", name);
+    return fdopen(fd, "r");
+}
+
+/* is_subscribed
+ * -------------
+ * Returns true iff the given subscriber is one of the given topic's (topic
+ * t is subscribed to by the fanout subscribers from t * fanout onwards,
+ * wrapping around).
+ * */
+bool is_subscribed(Config* config, int subscriber, int topic) {
+    int first = (int)(((long)topic * config->fanout) % config->numSubs);
+    int offset = (subscriber - first + config->numSubs) % config->numSubs;
+    return offset < config->fanout;
+}
+
+/* expected_messages
+ * -----------------
+ * Returns the number of messages the given subscriber should receive, ie:
+ * the number published to each of its topics over all publishers.
+ * */
+long expected_messages(Config* config, int subscriber) {
+    long numExpected = 0;
+    for (int topic = 0; topic < config->numTopics; topic++) {
+        if (is_subscribed(config, subscriber, topic)) {
+            //publishers go round robin over the topics from their own index
+            for (int pub = 0; pub < config->numPubs; pub++) {
+                int first = (topic - pub % config->numTopics +
+                        config->numTopics) % config->numTopics;
+                if (first < config->numMessages) {
+                    numExpected += (config->numMessages - first - 1) /
+                            config->numTopics + 1;
+                }
+            }
+        }
+    }
+    return numExpected;
+}
+
+/* subscribe
+ * ---------
+ * Subscribes the given subscriber to its topics, and waits until the
+ * subscriptions are in place (by publishing to a topic of its own and
+ * waiting to receive it back, since psserver handles a connection's
+ * commands in order).
+ *
+ * sub - subscriber to subscribe
+ *
+ * */
+void subscribe(Subscriber* sub) {
+    Config* config = sub->config;
+    for (int topic = 0; topic < config->numTopics; topic++) {
+        if (is_subscribed(config, sub->index, topic)) {
+            fprintf(sub->toServer, "sub " TOPIC_FORMAT "\n", topic);
+        }
+    }
+    fprintf(sub->toServer, "sub " SYNC_TOPIC_FORMAT "\npub "
+            SYNC_TOPIC_FORMAT " ready\n", sub->index, sub->index);
+    fflush(sub->toServer);
+    char* line = NULL;
+    size_t lineLen = 0;
+    getline(&line, &lineLen, sub->fromServer);
+    free(line);
+}
+
+/* subscriber_thread
+ * -----------------
+ * Thread that reads messages from a subscriber's connection until it has
+ * received every message it expects (or none arrive for IDLE_TIMEOUT),
+ * noting each one's end-to-end latency from the timestamp at the start of
+ * its value (ie: "name:topic:<timestamp> <padding>").
+ *
+ * arg - Subscriber structure
+ *
+ * */
+void* subscriber_thread(void* arg) {
+    Subscriber* sub = (Subscriber*)arg;
+    struct timeval timeout = {IDLE_TIMEOUT / MS_PER_SEC,
+            (IDLE_TIMEOUT % MS_PER_SEC) * US_PER_MS};
+    setsockopt(fileno(sub->fromServer), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(struct timeval));
+    char* line = NULL;
+    size_t lineLen = 0;
+    ssize_t numRead;
+    while (sub->numReceived < sub->numExpected &&
+            (numRead = getline(&line, &lineLen, sub->fromServer)) > 0) {
+        long receivedAt = now_ns();
+        char* value = strchr(line, ':');
+        value = value ? strchr(value + 1, ':') : NULL;
+        if (!value) {
+            continue;
+        }
+        sub->latencies[sub->numReceived++] = receivedAt - atol(value + 1);
+        sub->numBytes += numRead;
+        sub->lastAt = receivedAt;
+    }
+    free(line);
+    return NULL;
+}
+
+/* wait_until
+ * ----------
+ * Sleeps until the given (monotonic) time.
+ * */
+void wait_until(long ns) {
+    struct timespec due = {ns / NS_PER_SEC, ns % NS_PER_SEC};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL)) {
+    }
+}
+
+/* publisher_thread
+ * ----------------
+ * Thread that publishes a publisher's messages, round robin over the topics
+ * (starting from its own index), at the configured rate. Each value starts
+ * with the time it was published at, padded out to the configured size.
+ *
+ * arg - Publisher structure
+ *
+ * */
+void* publisher_thread(void* arg) {
+    Publisher* pub = (Publisher*)arg;
+    Config* config = pub->config;
+    char* padding = malloc(sizeof(char) * (config->size + 1));
+    memset(padding, 'x', config->size);
+    long interval = config->rate ? NS_PER_SEC / config->rate : 0;
+    long nextAt = now_ns();
+    for (int i = 0; i < config->numMessages; i++) {
+        if (interval) {
+            wait_until(nextAt);
+            nextAt += interval;
+        }
+        int topic = (pub->index + i) % config->numTopics;
+        long sentAt = now_ns();
+        //pad the value (timestamp, space, padding) out to exactly size bytes
+        int timestampLen = snprintf(NULL, 0, "%ld ", sentAt);
+        padding[config->size - timestampLen] = '\0';
+        fprintf(pub->toServer, "pub " TOPIC_FORMAT " %ld %s\n", topic, sentAt,
+                padding);
+        padding[config->size - timestampLen] = 'x';
+        //unless rate limited, let stdio batch the messages up
+        if (interval) {
+            fflush(pub->toServer);
+        }
+    }
+    fflush(pub->toServer);
+    free(padding);
+    return NULL;
+}
+
+/* compare_longs
+ * -------------
+ * qsort() comparison function for longs.
+ * */
+int compare_longs(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+/* percentile_us
+ * -------------
+ * Returns the given percentile (0-1) of the given sorted latencies, in
+ * microseconds.
+ * */
+double percentile_us(long* latencies, long numLatencies, double percentile) {
+    if (!numLatencies) {
+        return 0;
+    }
+    long index = (long)(numLatencies * percentile);
+    if (index >= numLatencies) {
+        index = numLatencies - 1;
+    }
+    return latencies[index] / NS_PER_US;
+}
+
+/* report
+ * ------
+ * Prints the results of a run as a single line of key=value pairs, so runs
+ * can be compared by scripts.
+ *
+ * config - load generated
+ * subs - subscribers (once finished)
+ * start - time (ns) publishing started
+ *
+ * */
+void report(Config* config, Subscriber* subs, long start) {
+    long numExpected = 0;
+    long numReceived = 0;
+    long numBytes = 0;
+    long end = start;
+    for (int i = 0; i < config->numSubs; i++) {
+        numExpected += subs[i].numExpected;
+        numReceived += subs[i].numReceived;
+        numBytes += subs[i].numBytes;
+        if (subs[i].lastAt > end) {
+            end = subs[i].lastAt;
+        }
+    }
+    //merge every subscriber's latencies
+    long* latencies = malloc(sizeof(long) * (numReceived + 1));
+    long numLatencies = 0;
+    for (int i = 0; i < config->numSubs; i++) {
+        memcpy(latencies + numLatencies, subs[i].latencies,
+                sizeof(long) * subs[i].numReceived);
+        numLatencies += subs[i].numReceived;
+    }
+    qsort(latencies, numLatencies, sizeof(long), compare_longs);
+
+    double secs = end > start ? (double)(end - start) / NS_PER_SEC : 0;
+    printf("pubs=%d subs=%d topics=%d fanout=%d size=%d rate=%d "
+            "published=%ld expected=%ld delivered=%ld lost=%ld secs=%.3f "
+            "msgs_per_sec=%.0f bytes_per_sec=%.0f lat_p50_us=%.1f "
+            "lat_p90_us=%.1f lat_p99_us=%.1f lat_p999_us=%.1f "
+            "lat_max_us=%.1f\n", config->numPubs, config->numSubs,
+            config->numTopics, config->fanout, config->size, config->rate,
+            (long)config->numPubs * config->numMessages, numExpected,
+            numReceived, numExpected - numReceived, secs,
+            secs ? numReceived / secs : 0, secs ? numBytes / secs : 0,
+            percentile_us(latencies, numLatencies, 0.5),
+            percentile_us(latencies, numLatencies, 0.9),
+            percentile_us(latencies, numLatencies, 0.99),
+            percentile_us(latencies, numLatencies, 0.999),
+            percentile_us(latencies, numLatencies, 1));
+    free(latencies);
+}
+
+int main(int argc, char** argv) {
+    Config config = parse_command_line(argc, argv);
+    char name[MAX_TOPIC_LEN];
+
+    //connect and subscribe every subscriber before publishing anything
+    Subscriber* subs = calloc(config.numSubs + 1, sizeof(Subscriber));
+    pthread_t* subThreads = malloc(sizeof(pthread_t) * (config.numSubs + 1));
+    for (int i = 0; i < config.numSubs; i++) {
+        subs[i].config = &config;
+        subs[i].index = i;
+        snprintf(name, MAX_TOPIC_LEN, "sub%d", i);
+        subs[i].fromServer = open_connection(&config, name,
+                &subs[i].toServer);
+        subs[i].numExpected = expected_messages(&config, i);
+        subs[i].latencies = malloc(sizeof(long) *
+                (subs[i].numExpected + 1));
+        subscribe(&subs[i]);
+    }
+    Publisher* pubs = calloc(config.numPubs, sizeof(Publisher));
+    pthread_t* pubThreads = malloc(sizeof(pthread_t) * config.numPubs);
+    for (int i = 0; i < config.numPubs; i++) {
+        pubs[i].config = &config;
+        pubs[i].index = i;
+        snprintf(name, MAX_TOPIC_LEN, "pub%d", i);
+        fclose(open_connection(&config, name, &pubs[i].toServer));
+    }
+
+    long start = now_ns();
+    for (int i = 0; i < config.numSubs; i++) {
+        pthread_create(&subThreads[i], NULL, subscriber_thread, &subs[i]);
+    }
+    for (int i = 0; i < config.numPubs; i++) {
+        pthread_create(&pubThreads[i], NULL, publisher_thread, &pubs[i]);
+    }
+    for (int i = 0; i < config.numPubs; i++) {
+        pthread_join(pubThreads[i], NULL);
+    }
+    for (int i = 0; i < config.numSubs; i++) {
+        pthread_join(subThreads[i], NULL);
+    }
+    report(&config, subs, start);
+    return 0;
+}
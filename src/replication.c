@@ -0,0 +1,387 @@
+//replication.c//
+//----------------------//
+//This file abstracts away replicating psserver's retained topic state
+//from a leader node to its followers
+//----------------------//
+
+#include "replication.h"
+#include "lock.h"
+#include "shared.h"
+#include "csse2310a3.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LOCALHOST "localhost"
+//how long (us) to wait before retrying to connect to the leader
+#define RETRY_INTERVAL 200000
+//how long (ms) the leader holds a fetch open when there are no new updates
+#define FETCH_WAIT 500
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define NS_PER_SEC 1000000000
+#define FOLLOW_CMD "follow"
+#define FETCH_CMD "fetch"
+#define END_PREFIX "end "
+#define INVALID_LINE ":invalid"
+
+Replication* replication_init(char* id, bool isSemiSync, StringMap* topics,
+        RwLock* topicsLock) {
+    Replication* replication = calloc(1, sizeof(Replication));
+    replication->id = id;
+    replication->log = calloc(REPLICATION_LOG_SIZE, sizeof(LogEntry));
+    replication->isSemiSync = isSemiSync;
+    init_lock(&replication->appended, 0);
+    init_lock(&replication->fetched, 0);
+    init_mutex(&replication->lock, "replicationLock");
+    replication->topics = topics;
+    replication->topicsLock = topicsLock;
+    return replication;
+}
+
+/* deadline_after
+ * --------------
+ * Returns the (absolute) time the given number of milliseconds from now, in
+ * the form sem_timedwait() takes.
+ * */
+struct timespec deadline_after(int ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / MS_PER_SEC;
+    deadline.tv_nsec += (long)(ms % MS_PER_SEC) * NS_PER_MS;
+    if (deadline.tv_nsec >= NS_PER_SEC) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NS_PER_SEC;
+    }
+    return deadline;
+}
+
+/* wait_for_change
+ * ---------------
+ * Releases the replication lock and waits for the given lock to be posted
+ * (see wake_waiters()) or the given deadline to pass, then retakes the
+ * replication lock.
+ *
+ * NOTE: the replication lock must be held by the caller. Being woken only
+ * means something may have changed, so callers re-check what they're
+ * waiting for.
+ *
+ * replication - this node's replication
+ * changed - lock to wait on
+ * numWaiters - number of waiters on that lock
+ * deadline - time to give up waiting at
+ *
+ * Returns:
+ *      true iff woken before the deadline, false otherwise
+ *
+ * */
+bool wait_for_change(Replication* replication, sem_t* changed,
+        int* numWaiters, struct timespec* deadline) {
+    (*numWaiters)++;
+    release_mutex(&replication->lock);
+    int result;
+    while ((result = sem_timedwait(changed, deadline)) && errno == EINTR) {
+    }
+    take_mutex(&replication->lock);
+    //timed out: either a wake counted us after all (so take its post, or 
+    //it'd wake a later waiter for nothing) or we're still counted
+    if (result && sem_trywait(changed)) {
+        (*numWaiters)--;
+    }
+    return !result;
+}
+
+/* wake_waiters
+ * ------------
+ * Wakes everyone waiting on the given lock (see wait_for_change()).
+ *
+ * NOTE: the replication lock must be held by the caller
+ *
+ * changed - lock being waited on
+ * numWaiters - number of waiters on that lock
+ *
+ * */
+void wake_waiters(sem_t* changed, int* numWaiters) {
+    for (; *numWaiters > 0; (*numWaiters)--) {
+        release_lock(changed);
+    }
+}
+
+long retain_and_replicate(Replication* replication, TopicEntry* entry,
+        char* key, char* frame) {
+    take_mutex(&replication->lock);
+    set_retained_value(entry, key, strdup(frame));
+    long offset = replication->end++;
+    LogEntry* slot = &replication->log[offset % REPLICATION_LOG_SIZE];
+    //the slot's old update is freed outside the lock
+    LogEntry old = *slot;
+    slot->key = strdup(key);
+    slot->frame = strdup(frame);
+    if (replication->end - replication->start > REPLICATION_LOG_SIZE) {
+        replication->start++;
+    }
+    wake_waiters(&replication->appended, &replication->numFetchWaiters);
+    release_mutex(&replication->lock);
+    free(old.key);
+    free(old.frame);
+    return offset;
+}
+
+/* is_fetched
+ * ----------
+ * Helper function for wait_for_followers() that checks whether a publish
+ * can stop waiting for its update to be fetched.
+ *
+ * NOTE: the replication lock must be held by the caller
+ *
+ * replication - this node's replication
+ * offset - offset of the update
+ *
+ * Returns:
+ *      true iff a connected follower has fetched the update, or there are
+ *      no connected followers
+ *
+ * */
+bool is_fetched(Replication* replication, long offset) {
+    bool hasFollowers = false;
+    Follower* follower = replication->followers;
+    while (follower) {
+        if (follower->isConnected) {
+            if (follower->offset > offset) {
+                return true;
+            }
+            hasFollowers = true;
+        }
+        follower = follower->next;
+    }
+    return !hasFollowers;
+}
+
+void wait_for_followers(Replication* replication, long offset) {
+    if (!replication->isSemiSync) {
+        return;
+    }
+    struct timespec deadline = deadline_after(SYNC_TIMEOUT);
+    take_mutex(&replication->lock);
+    while (!is_fetched(replication, offset) && wait_for_change(replication,
+            &replication->fetched, &replication->numSyncWaiters, &deadline)) {
+    }
+    release_mutex(&replication->lock);
+}
+
+bool register_follower(Replication* replication, Client* client, char* id) {
+    take_mutex(&replication->lock);
+    Follower* follower = replication->followers;
+    while (follower && strcmp(follower->id, id)) {
+        follower = follower->next;
+    }
+    if (follower && follower->isConnected) {
+        release_mutex(&replication->lock);
+        return false;
+    }
+    //first time the follower has connected
+    if (!follower) {
+        follower = calloc(1, sizeof(Follower));
+        follower->id = strdup(id);
+        follower->next = replication->followers;
+        replication->followers = follower;
+    }
+    follower->isConnected = true;
+    client->follower = follower;
+    release_mutex(&replication->lock);
+    return true;
+}
+
+void unregister_follower(Replication* replication, Client* client) {
+    if (!client->follower) {
+        return;
+    }
+    take_mutex(&replication->lock);
+    client->follower->isConnected = false;
+    //publishes waiting on this follower may no longer need to
+    wake_waiters(&replication->fetched, &replication->numSyncWaiters);
+    release_mutex(&replication->lock);
+    client->follower = NULL;
+}
+
+/* write_snapshot
+ * --------------
+ * Helper function for send_fetch_batch() that writes the whole retained
+ * state of every topic to the given stream, in the same form as updates
+ * (ie: "key:name:topic:value\n").
+ *
+ * replication - this node's replication
+ * out - stream to write to
+ *
+ * */
+void write_snapshot(Replication* replication, FILE* out) {
+    StringMapItem* currItem = NULL;
+    take_read_lock(replication->topicsLock);
+    while ((currItem = stringmap_iterate(replication->topics, currItem))) {
+        write_retained(currItem->item, out);
+    }
+    release_read_lock(replication->topicsLock);
+}
+
+void send_fetch_batch(Replication* replication, Client* client,
+        long offset) {
+    struct timespec deadline = deadline_after(FETCH_WAIT);
+    take_mutex(&replication->lock);
+    //the fetch tells us the follower has everything before the offset
+    client->follower->offset = offset;
+    wake_waiters(&replication->fetched, &replication->numSyncWaiters);
+
+    //hold the fetch open until there's something new
+    while (offset == replication->end && wait_for_change(replication,
+            &replication->appended, &replication->numFetchWaiters,
+            &deadline)) {
+    }
+
+    //build the batch in memory so the socket isn't written to under a lock
+    char* batch;
+    size_t batchLen;
+    FILE* batchStream = open_memstream(&batch, &batchLen);
+    long nextOffset = replication->end;
+    if (offset < replication->start || offset > replication->end) {
+        //fallen out of the log - send the whole retained state instead. Any
+        //update made while it's written out is fetched again next time.
+        release_mutex(&replication->lock);
+        write_snapshot(replication, batchStream);
+    } else {
+        if (nextOffset - offset > MAX_FETCH_BATCH) {
+            nextOffset = offset + MAX_FETCH_BATCH;
+        }
+        for (long i = offset; i < nextOffset; i++) {
+            LogEntry* entry = &replication->log[i % REPLICATION_LOG_SIZE];
+            fprintf(batchStream, "%s:%s", entry->key, entry->frame);
+        }
+        release_mutex(&replication->lock);
+    }
+    fprintf(batchStream, "%s%ld\n", END_PREFIX, nextOffset);
+    fclose(batchStream);
+
+    fwrite(batch, sizeof(char), batchLen, client->serverToClient);
+    fflush(client->serverToClient);
+    free(batch);
+}
+
+/* apply_update
+ * ------------
+ * Helper function for follower_thread() that applies an update fetched from
+ * the leader (ie: "key:name:topic:value") to this node's retained state,
+ * appending it to this node's own log.
+ *
+ * replication - this node's replication
+ * line - line read from the leader
+ *
+ * */
+void apply_update(Replication* replication, char* line) {
+    char* frameStart = strchr(line, ':');
+    if (!frameStart) {
+        return;
+    }
+    char* key = strndup(line, frameStart - line);
+    char* frame = malloc(sizeof(char) * (strlen(frameStart + 1) + 2));
+    sprintf(frame, "%s\n", frameStart + 1);
+    char* topic = get_frame_topic(frame);
+    if (topic) {
+        TopicEntry* entry = find_or_add_topic(replication->topics,
+                replication->topicsLock, topic);
+        retain_and_replicate(replication, entry, key, frame);
+    }
+    free(topic);
+    free(frame);
+    free(key);
+}
+
+/* follower_thread
+ * ---------------
+ * The thread spawned by follow_leader() (see replication.h).
+ *
+ * arg - Replication structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* follower_thread(void* arg) {
+    Replication* replication = (Replication*)arg;
+    //offset of the leader's next update
+    long offset = 0;
+    while (true) {
+        int fd = connect_to_host(replication->leaderHost,
+                replication->leaderService);
+        if (fd < 0) {
+            usleep(RETRY_INTERVAL);
+            continue;
+        }
+        FILE* fromLeader = fdopen(fd, "r");
+        FILE* toLeader = fdopen(dup(fd), "w");
+        fprintf(toLeader, "%s %s\n%s %ld\n", FOLLOW_CMD, replication->id,
+                FETCH_CMD, offset);
+        fflush(toLeader);
+
+        char* line;
+        while ((line = read_line(fromLeader))) {
+            if (!strcmp(line, INVALID_LINE)) {
+                //leader didn't accept us (eg: our ID is already following)
+                free(line);
+                break;
+            }
+            if (!strncmp(line, END_PREFIX, strlen(END_PREFIX))) {
+                //end of the batch - fetch the next one
+                offset = atol(line + strlen(END_PREFIX));
+                fprintf(toLeader, "%s %ld\n", FETCH_CMD, offset);
+                fflush(toLeader);
+            } else {
+                apply_update(replication, line);
+            }
+            free(line);
+        }
+
+        //leader went away - reconnect
+        fclose(toLeader);
+        fclose(fromLeader);
+        usleep(RETRY_INTERVAL);
+    }
+}
+
+void follow_leader(Replication* replication, char* address) {
+    char* colon = strrchr(address, ':');
+    replication->leaderHost = colon ? strndup(address, colon - address) :
+            LOCALHOST;
+    replication->leaderService = colon ? colon + 1 : address;
+
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, follower_thread, replication);
+    pthread_detach(threadId);
+}
+
+void print_replication_lag(Replication* replication) {
+    take_mutex(&replication->lock);
+    Follower* follower = replication->followers;
+    while (follower) {
+        fprintf(stderr, "Follower %s lag:%ld%s\n", follower->id,
+                replication->end - follower->offset,
+                follower->isConnected ? "" : " (disconnected)");
+        follower = follower->next;
+    }
+    release_mutex(&replication->lock);
+}
+
+long get_log_end(Replication* replication) {
+    take_mutex(&replication->lock);
+    long end = replication->end;
+    release_mutex(&replication->lock);
+    return end;
+}
+
+void restore_log_end(Replication* replication, long offset) {
+    take_mutex(&replication->lock);
+    replication->start = replication->end = offset;
+    release_mutex(&replication->lock);
+}
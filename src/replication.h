@@ -0,0 +1,247 @@
+//replication.h//
+//----------------------//
+//replication.c abstracts away replicating psserver's retained topic state
+//from a leader node to its followers
+//----------------------//
+
+#ifndef REPLICATION
+#define REPLICATION
+
+#include "clientList.h"
+#include "topic.h"
+#include "stringmap.h"
+#include "lock.h"
+#include <stdio.h>
+#include <semaphore.h>
+
+/* How replication works:
+ *
+ * Every update to a topic's retained state (ie: each "retain=1" or
+ * "key=<key>" publish) is appended to the node's replication log, where it
+ * is given the next offset. The log is kept in memory and holds the most
+ * recent REPLICATION_LOG_SIZE updates.
+ *
+ * A node started with "follow=[host:]port" connects to that node (its
+ * leader) as an ordinary client, sends "follow <id>" and then repeatedly
+ * "fetch <offset>", to which the leader replies with every update from that
+ * offset onwards (up to MAX_FETCH_BATCH of them), one per line as
+ * "key:name:topic:value", followed by "end <nextOffset>". If there's
+ * nothing new the leader holds the fetch open for a while first. A follower
+ * that has fallen out of the log (or whose leader has restarted) is sent
+ * the leader's whole retained state instead.
+ *
+ * Each fetch tells the leader how far the follower has got, which is how
+ * the leader tracks each follower's lag. Followers append what they fetch
+ * to their own log, so after a failover, clients and other followers can
+ * carry on from a follower.
+ *
+ * By default replication is asynchronous. With "replication=semi", a
+ * retained publish isn't passed on to subscribers (nor is the publisher
+ * read from again) until at least one connected follower has fetched it,
+ * or SYNC_TIMEOUT has passed.
+ * */
+
+//number of updates the replication log holds
+#define REPLICATION_LOG_SIZE 65536
+//max number of updates sent in reply to one fetch
+#define MAX_FETCH_BATCH 4096
+//how long (ms) a semi-synchronous publish waits for a follower
+#define SYNC_TIMEOUT 1000
+
+/* Defines the LogEntry structure, which holds one update in the replication
+ * log:
+ *
+ *      key - key the frame is retained under (NO_KEY if unkeyed)
+ *      frame - retained message frame (ie: "name:topic:value\n")
+ * */
+typedef struct {
+    char* key;
+    char* frame;
+} LogEntry;
+
+/* Defines the Follower structure, which is the leader's record of one of its
+ * followers:
+ *
+ *      id - ID the follower gave itself
+ *      offset - offset the follower last fetched from (ie: it has every
+ *               update before this)
+ *      isConnected - true iff the follower is currently connected
+ *      next - next follower
+ * */
+typedef struct Follower {
+    char* id;
+    long offset;
+    bool isConnected;
+    struct Follower* next;
+} Follower;
+
+/* Defines the Replication structure, which holds everything to do with
+ * replication on this node:
+ *
+ *      id - ID this node gives itself when following a leader
+ *      log - ring buffer of the last REPLICATION_LOG_SIZE updates (the
+ *            update at offset i is stored at index
+ *            i % REPLICATION_LOG_SIZE)
+ *      start - offset of the oldest update still in the log
+ *      end - offset the next update will be given
+ *      isSemiSync - true iff publishes wait for a follower (see above)
+ *      followers - leader's records of its followers
+ *      numFetchWaiters - number of fetches waiting for a new update
+ *      appended - lock waiting fetches wait on
+ *      numSyncWaiters - number of publishes waiting for a follower
+ *      fetched - lock waiting publishes wait on
+ *      lock - lock protecting all of the above
+ *      leaderHost - host the leader is on (NULL if not following)
+ *      leaderService - port the leader is listening on
+ *      topics - psserver's string map of topics
+ *      topicsLock - lock for the string map
+ * */
+typedef struct Replication {
+    char* id;
+    LogEntry* log;
+    long start;
+    long end;
+    bool isSemiSync;
+    Follower* followers;
+    int numFetchWaiters;
+    sem_t appended;
+    int numSyncWaiters;
+    sem_t fetched;
+    Mutex lock;
+    char* leaderHost;
+    char* leaderService;
+    StringMap* topics;
+    RwLock* topicsLock;
+} Replication;
+
+/* replication_init
+ * ----------------
+ * Initialises a Replication structure with an empty log and no followers.
+ *
+ * id - ID this node gives itself when following a leader
+ * isSemiSync - true iff publishes are to wait for a follower
+ * topics - psserver's string map of topics
+ * topicsLock - lock for the string map
+ *
+ * Returns:
+ *      the newly created Replication structure
+ *
+ * */
+Replication* replication_init(char* id, bool isSemiSync, StringMap* topics,
+        RwLock* topicsLock);
+
+/* retain_and_replicate
+ * --------------------
+ * Replaces the frame retained under the given key of the given topic (see
+ * set_retained_value() in topic.h) and appends the update to the
+ * replication log.
+ *
+ * NOTE: both happen under the log's lock, so the log holds updates in the
+ * same order they were applied
+ *
+ * replication - this node's replication
+ * entry - topic to update
+ * key - key to retain the frame under (NO_KEY for a plain retained value)
+ * frame - frame to retain (copied)
+ *
+ * Returns:
+ *      the offset the update was given
+ *
+ * */
+long retain_and_replicate(Replication* replication, TopicEntry* entry,
+        char* key, char* frame);
+
+/* wait_for_followers
+ * ------------------
+ * Blocks until at least one connected follower has fetched the update at
+ * the given offset, or SYNC_TIMEOUT has passed. Returns straight away if
+ * replication isn't semi-synchronous or there are no connected followers.
+ *
+ * replication - this node's replication
+ * offset - offset of the update (see retain_and_replicate())
+ *
+ * */
+void wait_for_followers(Replication* replication, long offset);
+
+/* register_follower
+ * -----------------
+ * Marks the given client as a follower of this node (reusing the record of
+ * a follower that reconnects under the same ID).
+ *
+ * replication - this node's replication
+ * client - client who sent "follow"
+ * id - ID the follower gave
+ *
+ * Returns:
+ *      true iff registered, false if a follower with that ID is already
+ *      connected
+ *
+ * */
+bool register_follower(Replication* replication, Client* client, char* id);
+
+/* unregister_follower
+ * -------------------
+ * Marks the given (disconnecting) client's follower record as disconnected.
+ * Does nothing if the client isn't a follower.
+ *
+ * replication - this node's replication
+ * client - client who is disconnecting
+ *
+ * */
+void unregister_follower(Replication* replication, Client* client);
+
+/* send_fetch_batch
+ * ----------------
+ * Replies to a follower's "fetch <offset>" with the updates from that
+ * offset onwards (or the whole retained state if the follower has fallen
+ * out of the log), waiting a while first if there are none yet.
+ *
+ * replication - this node's replication
+ * client - follower who sent the fetch
+ * offset - offset to fetch from
+ *
+ * */
+void send_fetch_batch(Replication* replication, Client* client, long offset);
+
+/* follow_leader
+ * -------------
+ * Makes this node a follower of the node at the given address, spawning the
+ * thread which connects to it (retrying until it's up) and keeps fetching
+ * its updates.
+ *
+ * replication - this node's replication
+ * address - "<host>:<port>" or just "<port>" (on localhost)
+ *
+ * */
+void follow_leader(Replication* replication, char* address);
+
+/* print_replication_lag
+ * ---------------------
+ * Prints (to stderr) how many updates each of this node's followers is
+ * behind by, along with the statistics psserver emits on SIGHUP.
+ *
+ * replication - this node's replication
+ *
+ * */
+void print_replication_lag(Replication* replication);
+
+/* get_log_end
+ * -----------
+ * Returns the offset the next update to this node's retained state will be
+ * given.
+ * */
+long get_log_end(Replication* replication);
+
+/* restore_log_end
+ * ---------------
+ * Carries on this node's (empty) log from the given offset, eg: the offset
+ * saved in a snapshot (see snapshot.h). Followers behind that offset are 
+ * sent the whole retained state.
+ *
+ * replication - this node's replication
+ * offset - offset to give the next update
+ *
+ * */
+void restore_log_end(Replication* replication, long offset);
+
+#endif //REPLICATION
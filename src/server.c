@@ -4,54 +4,63 @@
 //------------//
 
 //our own source files
-#include "clientList.h"
+#include "broker.h"
+#include "handoff.h"
+#include "snapshot.h"
 #include "shared.h"
-#include "stringmap.h"
 #include "stats.h"
-#include "lock.h"
 
 //normal libraries
 // #include "csse2310a4.h"
 // #include "csse2310a3.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <signal.h>
-#include <limits.h>
 
 //useful constants
 #define INVALID_NUM -1
 #define MIN_NUM_ARGS 2
-#define MAX_NUM_ARGS 3
 #define CONNECTIONS_INDEX 1
 #define PORTNUM_INDEX 2
 #define MIN_PORT 1024
 #define MAX_PORT 65535
+#define MAX_PORT_STR "65535"
 #define TCP 0
 #define DEFAULT_PORT 0
 #define HOST_IP "localhost"
-#define SPACE ' '
-#define NAME_CMD "name"
-#define SUB_CMD "sub"
-#define UNSUB_CMD "unsub"
-#define PUB_CMD "pub"
-#define INVALID_MSG ":invalid\n"
-#define MAX_CMD_FIELDS 3
-#define EMPTY_STRING ""
+#define PEER_OPT "peer"
+#define FOLLOW_OPT "follow"
+#define REPLICATION_OPT "replication"
+#define UNIX_OPT "unix"
+#define HANDOFF_OPT "handoff"
+#define SNAPSHOT_OPT "snapshot"
+#define SNAPSHOT_MS_OPT "snapshotms"
+#define FANOUT_OPT "fanout"
+#define IDLE_OPT "idle"
+#define KEEPALIVE_OPT "keepalive"
+#define RESERVE_OPT "reserve"
+#define PRIORITY_OPT "priority"
+#define REDIRECT_OPT "redirect"
+//fan-out threshold before (or without) the "fanout=<n>" option
+#define FANOUT_UNSET -1
+#define ASYNC "async"
+#define SEMI_SYNC "semi"
+#define OPTION_CHAR '='
 
 //server error codes
 enum ErrorCodes {
     SUCCESS,
     USAGE_ERROR,
-    PORTNUM_ERROR
+    PORTNUM_ERROR,
+    HANDOFF_ERROR
 };
 
 /* Defines the Parameters structure which holds the following command line
@@ -61,34 +70,61 @@ enum ErrorCodes {
  *                    permitted
  *      portnum - indicates which localhost port psserver is listening on
  *      service - string version of portnum
+ *      peers - addresses of the other psserver nodes to link to, given by
+ *              "peer=[host:]port" options (see federation.h)
+ *      leader - address of the node to follow, given by the 
+ *               "follow=[host:]port" option (NULL if not following)
+ *      isSemiSync - true iff "replication=semi" was given (see 
+ *                   replication.h)
+ *      unixPath - path of the Unix domain socket to also listen on, given
+ *                 by the "unix=<path>" option (NULL if not given)
+ *      handoffPath - path of the Unix domain socket hot restarts happen 
+ *                    over (see handoff.h), given by the "handoff=<path>"
+ *                    option (NULL if not given)
+ *      snapshotPath - path of the snapshot of the topic registry (see
+ *                     snapshot.h), given by the "snapshot=<path>" option
+ *                     (NULL if not given)
+ *      snapshotMs - time (ms) between snapshots, given by the
+ *                   "snapshotms=<ms>" option (0 if only taken on SIGUSR1)
+ *      fanoutThreshold - number of subscribers a topic needs for its fan-out
+ *                        to be split between worker threads, given by the
+ *                        "fanout=<n>" option (0 never splits it, FANOUT_UNSET
+ *                        if not given, leaving the broker's default)
+ *      idleMs - time (ms) a client may send nothing for before it's 
+ *               disconnected, given by the "idle=<ms>" option (0 if not
+ *               given, leaving idle clients connected)
+ *      keepaliveMs - time (ms) a client may send nothing for before it's
+ *                    pinged, given by the "keepalive=<ms>" option (half of
+ *                    idleMs if not given)
+ *      reserved - number of connections kept for priority clients, given
+ *                 by the "reserve=<n>" option (must be less than 
+ *                 maxConnections)
+ *      priorityHosts - addresses whose clients are priority clients (as
+ *                      are Unix domain socket clients), given by 
+ *                      "priority=<address>" options
+ *      redirect - address clients turned away (as psserver is full) are
+ *                 pointed to, given by the "redirect=[host:]port" option
+ *                 (NULL if not given)
  * */
 typedef struct { 
     int maxConnections;
     int portnum;
     char* service;
+    char** peers;
+    char* leader;
+    bool isSemiSync;
+    char* unixPath;
+    char* handoffPath;
+    char* snapshotPath;
+    int snapshotMs;
+    int fanoutThreshold;
+    int idleMs;
+    int keepaliveMs;
+    int reserved;
+    char** priorityHosts;
+    char* redirect;
 } Parameters;
 
-/* Defines the ClientThreadArgs structure which holds all arguments we
- * wish to pass to a client thread. The arguments are as follows:
- *
- *      fd - network socket
- *      stringMap - stringMap storing mappings from topic keys to linked lists
- *                  of clients subscribing to them
- *      stringMapLock - lock for the stringMap (which is shared between 
- *                      threads)
- *      stats - Stats structure storing psserver's statistics (see Stats.h)
- *      statsLock - lock for the stats data (which is shared between threads)
- *      accessLock - connection-limiting lock
- * */
-typedef struct {
-    int fd;
-    StringMap* stringMap;
-    sem_t* stringMapLock;
-    Stats* stats;
-    sem_t* statsLock;
-    sem_t* accessLock;
-} ClientThreadArgs;
-
 /* general_error
  * -------------
  * For a given error (encoded by 'errorCode'), print out a descrptive message
@@ -99,15 +135,91 @@ typedef struct {
 void general_error(int errorCode) {
     switch (errorCode) {
         case USAGE_ERROR:
-            fprintf(stderr, "Usage: psserver connections [portnum]\n");
+            fprintf(stderr, "Usage: psserver connections [portnum] "
+                    "[peer=[host:]port ...] [follow=[host:]port] "
+                    "[replication=async|semi] [unix=path] "
+                    "[handoff=path] [snapshot=path] [snapshotms=ms] "
+                    "[fanout=n] [idle=ms] [keepalive=ms] [reserve=n] "
+                    "[priority=address ...] [redirect=[host:]port]\n");
             exit(USAGE_ERROR);
         case PORTNUM_ERROR:
             fprintf(stderr, "psserver: unable to open socket for listening\n");
             exit(PORTNUM_ERROR);
+        case HANDOFF_ERROR:
+            fprintf(stderr, "psserver: unable to take over from running "
+                    "psserver\n");
+            exit(HANDOFF_ERROR);
     }
     return;
 }
 
+/* parse_server_options
+ * --------------------
+ * Helper function for parse_command_line() that retreives the options (of
+ * the form "name=value") given to psserver after its positional arguments.
+ *
+ * argc - number of command line arguments
+ * argv - array of command line arguments
+ * optIndex - index of the first option in argv
+ * cmdArgs - Parameters structure to populate
+ *
+ * Exits with:
+ *      1 - unknown or invalid option
+ * */
+void parse_server_options(int argc, char** argv, int optIndex,
+        Parameters* cmdArgs) {
+    cmdArgs->peers = calloc(argc + 1, sizeof(char*));
+    int numPeers = 0;
+    cmdArgs->priorityHosts = calloc(argc + 1, sizeof(char*));
+    int numPriorityHosts = 0;
+    char* optValue;
+    for (int i = optIndex; i < argc; i++) {
+        if ((optValue = option_value(argv[i], PEER_OPT)) && optValue[0]) {
+            cmdArgs->peers[numPeers++] = optValue;
+        } else if ((optValue = option_value(argv[i], FOLLOW_OPT)) && 
+                optValue[0] && !cmdArgs->leader) {
+            cmdArgs->leader = optValue;
+        } else if ((optValue = option_value(argv[i], REPLICATION_OPT)) &&
+                (!strcmp(optValue, ASYNC) || !strcmp(optValue, SEMI_SYNC))) {
+            cmdArgs->isSemiSync = !strcmp(optValue, SEMI_SYNC);
+        } else if ((optValue = option_value(argv[i], UNIX_OPT)) && 
+                optValue[0] && !cmdArgs->unixPath) {
+            cmdArgs->unixPath = optValue;
+        } else if ((optValue = option_value(argv[i], HANDOFF_OPT)) &&
+                optValue[0] && !cmdArgs->handoffPath) {
+            cmdArgs->handoffPath = optValue;
+        } else if ((optValue = option_value(argv[i], SNAPSHOT_OPT)) &&
+                optValue[0] && !cmdArgs->snapshotPath) {
+            cmdArgs->snapshotPath = optValue;
+        } else if ((optValue = option_value(argv[i], SNAPSHOT_MS_OPT)) &&
+                string_to_int(optValue) > 0 && !cmdArgs->snapshotMs) {
+            cmdArgs->snapshotMs = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], FANOUT_OPT)) &&
+                string_to_int(optValue) >= 0 && 
+                cmdArgs->fanoutThreshold == FANOUT_UNSET) {
+            cmdArgs->fanoutThreshold = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], IDLE_OPT)) &&
+                string_to_int(optValue) > 0 && !cmdArgs->idleMs) {
+            cmdArgs->idleMs = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], KEEPALIVE_OPT)) &&
+                string_to_int(optValue) > 0 && !cmdArgs->keepaliveMs) {
+            cmdArgs->keepaliveMs = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], RESERVE_OPT)) &&
+                string_to_int(optValue) > 0 && !cmdArgs->reserved &&
+                string_to_int(optValue) < cmdArgs->maxConnections) {
+            cmdArgs->reserved = string_to_int(optValue);
+        } else if ((optValue = option_value(argv[i], PRIORITY_OPT)) && 
+                optValue[0]) {
+            cmdArgs->priorityHosts[numPriorityHosts++] = optValue;
+        } else if ((optValue = option_value(argv[i], REDIRECT_OPT)) &&
+                optValue[0] && !cmdArgs->redirect) {
+            cmdArgs->redirect = optValue;
+        } else {
+            general_error(USAGE_ERROR);
+        }
+    }
+}
+
 /* parse_command_line
  * ------------------
  * Retreives the command line arguments given to psserver and populates 
@@ -123,11 +235,11 @@ void general_error(int errorCode) {
  * 
  * Exits with:
  *      1 - incorrect number of args received, connections arg not 
- *          non-negative integer or port number out of range
+ *          non-negative integer, port number out of range or invalid option
  * */
 Parameters parse_command_line(int argc, char** argv) {
     //check number of args given is valid
-    if (!(argc >= MIN_NUM_ARGS && argc <= MAX_NUM_ARGS)) {
+    if (argc < MIN_NUM_ARGS) {
         general_error(USAGE_ERROR); 
     }
 
@@ -141,8 +253,10 @@ Parameters parse_command_line(int argc, char** argv) {
         general_error(USAGE_ERROR); 
     }
 
-    //check portnum is valid
-    if (argc == MAX_NUM_ARGS) {
+    //check portnum is valid (if given - options all contain '=')
+    int optIndex = PORTNUM_INDEX;
+    if (argc > PORTNUM_INDEX && !strchr(argv[PORTNUM_INDEX], OPTION_CHAR)) {
+        optIndex++;
         service = argv[PORTNUM_INDEX];
         portnum = string_to_int(argv[PORTNUM_INDEX]);
         //not a non-negative integer
@@ -161,8 +275,10 @@ Parameters parse_command_line(int argc, char** argv) {
     memset(&cmdArgs, 0, sizeof(Parameters));
     cmdArgs.maxConnections = maxConnections;
     cmdArgs.portnum = portnum;
+    cmdArgs.fanoutThreshold = FANOUT_UNSET;
     //if portnum is 0, service should be NULL
     cmdArgs.service = portnum ? service : NULL;
+    parse_server_options(argc, argv, optIndex, &cmdArgs);
 
     return cmdArgs;
 }
@@ -223,372 +339,194 @@ int open_socket(Parameters cmdArgs) {
     return listeningFd;
 }
 
-/* handle_name_cmd
- * ---------------
- * Handles psserver receiving a 'name' command from a client.
- *
- * client - client who sent the command
- * name - name client has assigned with the command
- *
- * NOTE: all error checking completed in handle_client_msg() (see below)
- *
- * */
-void handle_name_cmd(Client* client, char* name) { 
-    //ignore duplicate name
-    if (client->name) {
-        return; 
-    } 
-    client->name = name;
-    return;
-}
-
-/* handle_sub_cmd
- * --------------
- * Handles psserver receiving a 'sub' command from a client
+/* open_unix_socket
+ * ----------------
+ * Creates a Unix domain socket listening at the given path, for clients on
+ * the same host to connect to instead of going through TCP. Clients speak
+ * exactly the same protocol over it. Any stale socket left at the path is
+ * replaced.
  *
- * client - client who sent the command
- * cta - ClientThreadArgs structure passed to the client thread
- * topic - topic which the client wishes to subscribe to
+ * cmdArgs - command line arguments given by user
  *
  * Returns:
- *      true iff client is successfully subscribed, false otherwise
- *
- * */
-bool handle_sub_cmd(Client* client, ClientThreadArgs* cta, char* topic) { 
-    //ignore if client not named already
-    if (!client->name) {
-        return false;
-    }
-    StringMapItem* currItem = NULL;
-    take_lock(cta->stringMapLock);
-    
-    //loop through list of topics and add client to the linked list of clients 
-    //subscribed to the given topic
-    while ((currItem = stringmap_iterate(cta->stringMap, currItem))) {
-        if (!strcmp(currItem->key, topic)) { 
-            //ignore request if client already subbed
-            if (search(currItem->item, client)) {
-                release_lock(cta->stringMapLock);
-                return false;
-            }
-            //add client to list of clients subbed to given topic
-            add_client(currItem->item, client);            
-            release_lock(cta->stringMapLock);
-            //log a successful sub request
-            update_stat(cta->stats, INC_SUB, cta->statsLock); 
-            return true;
-        }
-    }
-    release_lock(cta->stringMapLock);
-    //topic doesn't exist - create it
-    ClientListItem* head = init_client_list(client, false);
-    int result = stringmap_add(cta->stringMap, topic, head);
-    if (result) {
-        //log successful sub request (only if topic validly added)
-        update_stat(cta->stats, INC_SUB, cta->statsLock); 
-    }
-    return result;
-}
-
-/* handle_unsub_cmd
- * ----------------
- * Handles psserver receiving an 'unsub' command from a client.
- *
- * client - client who sent the command
- * cta - ClientThreadArgs structure that was passed to the client thread
- * topic - topic which the client wishes to unsubscribe from
- * isDisconnecting - true iff client is unsubscribing because they are 
- *                   disconnecting, false if they are just normally 
- *                   unsubscribing
- * Returns: 
- *      true iff client is successfully unsubscribed, false otherwise
+ *      fd of the socket
  *
+ * Exits with:
+ *      2 - psserver unable to listen at the given path
  * */
-bool handle_unsub_cmd(Client* client, ClientThreadArgs* cta, char* topic, 
-        bool isDisconnecting) { 
-
-    //ignore if client not named already
-    if (!client->name) {
-        return false;
+int open_unix_socket(Parameters cmdArgs) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    if (strlen(cmdArgs.unixPath) >= sizeof(addr.sun_path)) {
+        general_error(PORTNUM_ERROR); //exits here
     }
+    strcpy(addr.sun_path, cmdArgs.unixPath);
+    unlink(cmdArgs.unixPath);
 
-    StringMapItem* currItem = NULL;
-    take_lock(cta->stringMapLock);
-
-    //loop through list of topics and remove the client from the linked list
-    //of clients subscribed to the given topic
-    while ((currItem = stringmap_iterate(cta->stringMap, currItem))) {
-        if (!strcmp(currItem->key, topic)) {
-            //remove the client (returns new linked list of clients)
-            ClientListItem* newHead = remove_client(currItem->item, client);
-            if (newHead) {
-                //replace linked list of clients with new version
-                currItem->item = newHead; 
-            }
-            release_lock(cta->stringMapLock);
-
-            //log a successful sub request
-            //successful if: not disconnecting and client was in the list
-            if (!isDisconnecting && newHead) {
-                update_stat(cta->stats, INC_UNSUB, cta->statsLock);
-            }
-            return newHead;
-        }
+    int listeningFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (bind(listeningFd, (struct sockaddr*)&addr, 
+            sizeof(struct sockaddr_un)) ||
+            listen(listeningFd, cmdArgs.maxConnections) < 0) {
+        general_error(PORTNUM_ERROR); //exits here
     }
-    release_lock(cta->stringMapLock);
-    //topic doesn't exist
-    return false;
+    return listeningFd;
 }
 
-/* handle_pub_cmd
- * --------------
- * Handles psserver receiving a publish request from a client.
+/* node_id
+ * -------
+ * Retreives the ID this node identifies itself to other psserver nodes by,
+ * which is the port it's listening on.
  *
- * client - structure representing client who sent the command
- * cta - arguments given to the thread 
- * toks - tokenised form of the sent command
+ * listenFd - socket psserver is listening on
  *
  * Returns:
- *      true iff successful, false otherwise
- *      NOTE: fails if the topic specified doesn't exist
- * */
-bool handle_pub_cmd(Client* client, ClientThreadArgs* cta, char** toks) {
-
-    //ignore if client not named already 
-    if (!client->name) {
-        return false;
-    }
-    
-    StringMapItem* mapItem = NULL;
-    char* topic = toks[1]; //topic to publish to 
-    char* value = toks[2]; //value/msg to publish
-
-    //log successful pub command
-    update_stat(cta->stats, INC_PUB, cta->statsLock);
-
-    //loop through list of topics and publish the given value/msg to every 
-    //client subscribed to the given topic
-    take_lock(cta->stringMapLock);
-    while ((mapItem = stringmap_iterate(cta->stringMap, mapItem))) {
-        if (!strcmp(mapItem->key, topic)) {
-            //loop through the linked list of clients subed to the topic
-            ClientListItem* clientItem = mapItem->item;
-            Client* currClient;
-            while (clientItem) {
-                currClient = clientItem->client;
-                //NOTE: a topic with no clients is represented by a placeholder
-                //client, which is just the head of an otherwise-empty list
-                if (!clientItem->isPlaceholder) { 
-                    fprintf(currClient->serverToClient, "%s:%s:%s\n",
-                            client->name, topic, value);
-                    fflush(currClient->serverToClient);
-                }
-                clientItem = clientItem->next;
-            }
-            release_lock(cta->stringMapLock);
-            return true;
-        }
-    }
-    release_lock(cta->stringMapLock);
-    //topic doesn't exist
-    return false;
-}
-
-/* handle_client_msg
- * -----------------
- * Processes the user-given command and handles it accordingly. 
- *
- * msg - command sent by user
- * client - structure representing client who sent the command
- * cta - arguments given to the client thread
+ *      the malloc'd ID
  *
  * */
-void handle_client_msg(char* msg, Client* client, ClientThreadArgs* cta) {
-    //tokenised form of given message
-    char** rawToks = split_line(strdup(msg), SPACE);
-    //tokenised form with maximum three strings
-    char** toks = split_line_max(rawToks, MAX_CMD_FIELDS);
-    int toksLen = string_array_length(toks);
-
-    //invalid number of fields
-    if (toksLen < 2) {
-        fprintf(client->serverToClient, INVALID_MSG);
-        fflush(client->serverToClient);
-        return;
-    }
-
-    //handle each of the command types
-    char* cmd = toks[0];
-    //name 
-    if (!strcmp(cmd, NAME_CMD) && toksLen == 2 &&
-            !has_space_colon_newline(toks[1])) {
-
-        handle_name_cmd(client, toks[1]);
-        fflush(client->serverToClient);
-    //sub
-    } else if (!strcmp(cmd, SUB_CMD) && toksLen == 2 && 
-            !has_space_colon_newline(toks[1])) {
-
-        handle_sub_cmd(client, cta, toks[1]); 
-        fflush(client->serverToClient);
-
-    //unsub
-    } else if (!strcmp(cmd, UNSUB_CMD) && toksLen == 2 &&
-            !has_space_colon_newline(toks[1])) {
-
-        handle_unsub_cmd(client, cta, toks[1], false);
-        fflush(client->serverToClient);
-
-    //pub
-    } else if (!strcmp(cmd, PUB_CMD) && toksLen >= 3 && 
-            !has_space_colon_newline(toks[1]) && 
-            strcmp(toks[2], EMPTY_STRING)) {
-
-        handle_pub_cmd(client, cta, toks);
-        fflush(client->serverToClient);
-
-    //invalid command type
-    } else {
-        fprintf(client->serverToClient, INVALID_MSG);
-        fflush(client->serverToClient);
-    }
+char* node_id(int listenFd) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    socklen_t addrLen = sizeof(struct sockaddr_in);
+    getsockname(listenFd, (struct sockaddr*) &addr, &addrLen);
+    char* id = malloc(sizeof(char) * (strlen(MAX_PORT_STR) + 1));
+    sprintf(id, "%u", ntohs(addr.sin_port));
+    return id;
 }
 
-/* init_client_thread_args
- * -----------------------
- * Initialises a ClientThreadArgs structure to pass to a client thread.
+/* init_federation
+ * ---------------
+ * Adds links to the peers given on the command line (see federation.h), 
+ * which are started along with the broker (see broker_start()).
  *
- * stringMap - psserver's string map
- * stats - psserver's statistics
- * numAllowed - max number of connections allowed (as specified on command
- *              line)
- * 
- * Returns:
- *      the newly created ClientThreadArgs structure
+ * cmdArgs - command line arguments given by user
+ * broker - psserver's broker
  *
  * */
-ClientThreadArgs* init_client_thread_args(StringMap* stringMap, Stats* stats, 
-        int numAllowed) {
-
-    ClientThreadArgs* cta = malloc(sizeof(ClientThreadArgs));
-    memset(cta, 0, sizeof(ClientThreadArgs));
-    cta->stringMap = stringMap;
-    cta->stats = stats;
-
-    //stringMap lock
-    sem_t* smLock = malloc(sizeof(sem_t));
-    init_lock(smLock, 1);
-    cta->stringMapLock = smLock;
-
-    //stats lock
-    sem_t* statsLock = malloc(sizeof(sem_t));
-    init_lock(statsLock, 1);
-    cta->statsLock = statsLock;
-
-    //access lock
-    sem_t* accessLock = malloc(sizeof(sem_t));
-    if (numAllowed == 0) {
-        init_lock(accessLock, INT_MAX);
-    } else {
-        init_lock(accessLock, numAllowed);
+void init_federation(Parameters cmdArgs, Broker* broker) {
+    for (int i = 0; cmdArgs.peers[i]; i++) {
+        add_peer_link(broker->federation, cmdArgs.peers[i]);
     }
-
-    cta->accessLock = accessLock;
-    return cta;
 }
 
-/* handle_client_thread
+/* unix_listener_thread
  * --------------------
- * Every time a new client joins, we spawn off a new thread which calls this
- * function. Here, we handle commands sent by the client and update the 
- * universal stats depending on what they give us.
+ * The thread spawned by start_unix_listener() which runs a second 
+ * server_infinite_loop() accepting clients on the Unix domain socket.
  *
- * arg - ClientThreadArgs structure 
+ * arg - ClientThreadArgs structure whose fd is the Unix domain socket
  *
  * Exits:
- *      -when EOF read from the client (client disconnects)
+ *      when psserver exits
  *
  * */
-void* handle_client_thread(void* arg) {
+void* unix_listener_thread(void* arg) {
     ClientThreadArgs* cta = (ClientThreadArgs*)arg;
-    //log a connected client
-    update_stat(cta->stats, INC_CLIENTS_CURR, cta->statsLock);
-    
-    int fd = cta->fd;
-    int fd2 = dup(fd);
-
-    FILE* clientToServer = fdopen(fd, "r");
-    FILE* serverToClient = fdopen(fd2, "w");
-    Client* client = create_client(NULL, clientToServer, serverToClient);
-
-
-    char* line;
-    while ((line = read_line(clientToServer))) {
-        handle_client_msg(line, client, cta);
-    }
-
-    //decrement number of current clients
-    update_stat(cta->stats, DEC_CLIENTS_CURR, cta->statsLock); 
-    //increment number of total clients ever connected
-    update_stat(cta->stats, INC_CLIENTS_ALL, cta->statsLock); 
-
-    //allows another waiting client to connect
-    release_lock(cta->accessLock);
-
-    fflush(stdout);
-    pthread_exit(NULL);
+    server_infinite_loop(cta->fd, cta);
+    return NULL;
 }
 
-/* server_infinite_loop
- * --------------------
- * This is psserver's main loop. It continually:
+/* start_unix_listener
+ * -------------------
+ * Starts accepting clients on the Unix domain socket given by the "unix="
+ * option (if given) alongside the TCP socket. Both share the same limit on
+ * the number of connections.
  *
- *      -waits for a new client connection
- *      -creates a new socket with which to communicate to the client
- *      -spawns off a new client thread (see handle_client_thread()) to deal
- *       with said client
- * 
- * listenFd - socket on which to listen for new client connections
+ * unixFd - Unix domain socket to accept clients on (-1 if none)
  * cta - ClientThreadArgs structure to pass to client threads
  *
  * */
-void server_infinite_loop(int listenFd, ClientThreadArgs* cta) {
-    while (true) {
-        //only accept new clients once max number of connections isn't exceeded
-        take_lock(cta->accessLock);
-
-        //Block waiting for a new connection
-        int fd = accept(listenFd, 0, 0); 
-
-        //set new thread's network socket fd
-        cta->fd = fd;
-
-        //spawn new thread
-        pthread_t threadId;
-
-        pthread_create(&threadId, NULL, handle_client_thread, cta);
-
-        //ensures thread will give resouces back once terminated
-        pthread_detach(threadId);
+void start_unix_listener(int unixFd, ClientThreadArgs* cta) {
+    if (unixFd < 0) {
+        return;
     }
+    ClientThreadArgs* listenerArgs = malloc(sizeof(ClientThreadArgs));
+    *listenerArgs = *cta;
+    listenerArgs->fd = unixFd;
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, unix_listener_thread, listenerArgs);
+    pthread_detach(threadId);
 }
 
 int main(int argc, char** argv) {
     //get command line args
     Parameters cmdArgs = parse_command_line(argc, argv);
+    //writing to a disconnected client mustn't kill the server
+    signal(SIGPIPE, SIG_IGN);
+    //take over the sockets and state of the psserver already running (if
+    //there is one, see handoff.h)
+    Takeover* takeover = cmdArgs.handoffPath ? 
+            take_over(cmdArgs.handoffPath) : NULL;
+    if (takeover && takeover->listenFd < 0) {
+        general_error(HANDOFF_ERROR);
+    }
     //network socket we accept connections on
-    int listeningFd = open_socket(cmdArgs);
-    //initialise shared string map
-    StringMap* stringMap = stringmap_init(); 
-    //initialise shared statistics structure
-    Stats* stats = stats_init(); 
-    //initialise structure we pass to each client thread
-    ClientThreadArgs* cta = init_client_thread_args(stringMap, stats, 
-            cmdArgs.maxConnections);
+    int listeningFd = takeover ? takeover->listenFd : open_socket(cmdArgs);
+    //ID we give other psserver nodes
+    char* id = node_id(listeningFd);
+    if (takeover) {
+        //print the port we're (still) listening on, as open_socket() does
+        fprintf(stderr, "%s\n", id);
+    }
+    //Unix domain socket we also accept connections on (if any)
+    int unixFd = takeover && takeover->unixFd >= 0 ? takeover->unixFd :
+            cmdArgs.unixPath ? open_unix_socket(cmdArgs) : -1;
+    //initialise the broker (topics, clients, replication and federation),
+    //which is the structure we pass to each client thread
+    Broker* cta = broker_init(cmdArgs.maxConnections, id, 
+            cmdArgs.isSemiSync);
+    if (cmdArgs.fanoutThreshold != FANOUT_UNSET) {
+        cta->fanoutThreshold = cmdArgs.fanoutThreshold;
+    }
+    //ping quiet clients (by default half way to their idle timeout) and
+    //disconnect idle ones
+    cta->idleMs = cmdArgs.idleMs;
+    cta->keepaliveMs = cmdArgs.keepaliveMs ? cmdArgs.keepaliveMs : 
+            cmdArgs.idleMs / 2;
+    //turn clients away once full (keeping some connections for priority
+    //clients) rather than leave them waiting
+    cta->reservedConnections = cmdArgs.reserved;
+    cta->priorityHosts = cmdArgs.priorityHosts;
+    cta->redirect = cmdArgs.redirect;
+    if (cmdArgs.handoffPath) {
+        cta->handoff = handoff_init(cmdArgs.handoffPath, listeningFd, unixFd);
+    }
+    //rebuild the topic registry from the last snapshot (unless it's being
+    //taken over, which carries the newest state)
+    if (cmdArgs.snapshotPath && !takeover) {
+        restore_snapshot(cta, cmdArgs.snapshotPath);
+    }
+    //block SIGUSR1 before any other thread starts, leaving it to the
+    //snapshot thread
+    SnapshotArgs* snapArgs = cmdArgs.snapshotPath ? init_snapshot_args(cta, 
+            cmdArgs.snapshotPath, cmdArgs.snapshotMs) : NULL;
     //initialise structure we pass to our separate SIGHUP/stats thread
-    StatsThreadArgs* sta = init_stats_thread_args(cta->stats, cta->statsLock);
-    //start SIGHUP/stats thread
+    StatsThreadArgs* sta = init_stats_thread_args(cta->stats, cta->statsLock,
+            cta->replication, cta->pool);
+    //start SIGHUP/stats thread (before any other thread, so that they all
+    //inherit its signal mask)
     start_statistics_thread(sta);
+    if (snapArgs) {
+        start_snapshot_thread(snapArgs);
+    }
+    //carry on serving the clients taken over
+    if (takeover) {
+        finish_take_over(takeover, cta);
+    }
+    //link to other psserver nodes
+    init_federation(cmdArgs, cta);
+    //start the broker's own threads
+    broker_start(cta);
+    //replicate the retained state of the node we're following
+    if (cmdArgs.leader) {
+        follow_leader(cta->replication, cmdArgs.leader);
+    }
+    //accept same-host clients on a Unix domain socket too
+    start_unix_listener(unixFd, cta);
+    //wait for the next hot restart
+    if (cta->handoff && !start_handoff_listener(cta->handoff, cta)) {
+        general_error(HANDOFF_ERROR);
+    }
     //main loop of server
     server_infinite_loop(listeningFd, cta);
 }
@@ -598,15 +536,121 @@ int main(int argc, char** argv) {
  * NOTE: kept track of this for own purposes
  *
  * server.c:
- *      -ClientThreadArgs
+ *      -parse_server_options()
+ *          -lists of peers and priority hosts (kept for the lifetime of the
+ *           server)
+ *      -start_unix_listener()
+ *          -the Unix listener's copy of cta (kept for the lifetime of the
+ *           server)
+ * handoff.c:
+ *      -handoff_init()
+ *          -Handoff (shared, like ClientThreadArgs)
+ *      -park()
+ *          -ParkedClient and its replay (free'd if the hot restart fails)
+ *      -take_over()/receive_record()
+ *          -Takeover and the records received (free'd by 
+ *           finish_take_over())
+ * snapshot.c:
+ *      -init_snapshot_args()
+ *          -SnapshotArgs (kept for the lifetime of the server)
+ *      -save_snapshot()
+ *          -snapshot built in memory (free'd once written)
+ *      -restore_snapshot()/read_topic()
+ *          -restored topics (kept in the string map, like any other)
+ * broker.c:
+ *      -spawn_client_thread()
+ *          -each client thread's copy of cta (free'd when the thread exits)
+ *      -broker_restore_client()
+ *          -restored Client (free'd when its thread exits, like any other)
+ *      -broker_subscribe()
+ *          -in-process subscriber's Client (free'd by broker_unsubscribe())
+ *      -message_frame()/message_parts()
+ *          -frame built for/parts split out of a message (free'd once
+ *           published)
+ *      -handle_pub_cmd()
+ *          -message frame (free'd once published)
+ *      -parse_pub_options()
+ *          -PubOptions key (free'd once published)
+ *      -broker_init()/init_client_thread_args()
  *          -all malloc'd memory in threadArgs is shared 
- *           (sm, stats, smLock, statsLock, accessLock)
+ *           (sm, stats, smLock, statsLock, accessLock, pool, timers)
  *          -therefore, only free once SERVER terminates
+ *      -handle_client_thread()
+ *          -the client's CommandQueue (free'd once its commands have run
+ *           and the client has disconnected)
+ *      -track_liveness()
+ *          -the client's Liveness (free'd once its timer is cancelled, when
+ *           the client disconnects)
+ *      -parse_command()
+ *          -tokenised command
+ *      -fan_out_parallel()
+ *          -FanOut and its chunks (free'd by whichever of the publisher and
+ *           its helper tasks finishes last)
+ * pool.c:
+ *      -pool_init()
+ *          -WorkPool and its queues (shared, like ClientThreadArgs)
+ *      -start_pool()
+ *          -each worker's WorkerArgs (free'd once the worker has started)
+ * timerwheel.c:
+ *      -timer_wheel_init()
+ *          -TimerWheel (shared, like ClientThreadArgs)
  * shared.c:
  *      -add_new_line()
  *          -string we return is malloc'd
  *      -split_line_max()
  *          -array of tokens we return
+ * topic.c:
+ *      -init_topic_entry()
+ *          -TopicEntry we return (stored in the string map)
+ *      -build_message_frame()
+ *          -frame we return
+ *      -set_retained_value()
+ *          -the retained frame (owned by the TopicEntry)
+ *      -get_frame_topic()
+ *          -topic we return
+ *      -find_or_add_group()
+ *          -ConsumerGroup we return (stored in the TopicEntry)
+ * session.c:
+ *      -session_table_init()
+ *          -SessionTable we return (shared, like ClientThreadArgs)
+ *      -attach_session()
+ *          -Session (kept for the lifetime of the server)
+ *      -send_frame()
+ *          -InFlightMsg and its copy of the frame (free'd once acked)
+ *      -outbound_writer_init()
+ *          -OutboundWriter (shared, like ClientThreadArgs)
+ *      -outbound_init()
+ *          -client's Outbound (free'd once the client is dropped and its
+ *           writer is done with it)
+ *      -new_out_frame()
+ *          -OutFrame copy of a frame/reply (free'd once written, discarded
+ *           or dropped)
+ * shmring.c:
+ *      -ring_create()
+ *          -ShmRing and its shared memory (kept for the lifetime of the
+ *           server, like the TopicEntry it belongs to)
+ * federation.c:
+ *      -federation_init()
+ *          -Federation (shared, like ClientThreadArgs)
+ *      -add_peer_link()
+ *          -PeerLink (kept for the lifetime of the server)
+ *      -advertise_interest()
+ *          -Interest of each topic (stored in the interest set)
+ *      -take_interest_changes()
+ *          -commands sent to the peers (free'd once sent)
+ * replication.c:
+ *      -replication_init()
+ *          -Replication and its log (shared, like ClientThreadArgs)
+ *      -retain_and_replicate()
+ *          -key and frame copies in the log (free'd once overwritten)
+ *      -register_follower()
+ *          -Follower (kept so lag is reported after a disconnect)
+ *      -send_fetch_batch()
+ *          -batch (free'd once sent)
+ * credit.c:
+ *      -credit_init()
+ *          -Credit we return (free'd once the publisher and all messages 
+ *           charged to it are gone)
  * stats.c:
  *      -stats_init()
  *          -what we return
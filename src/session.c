@@ -0,0 +1,730 @@
+//session.c//
+//----------------------//
+//This file abstracts away acknowledged (at-least-once) delivery to clients
+//----------------------//
+
+#include "session.h"
+#include "lock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+//how often (ms) the redelivery thread checks for timed out deliveries
+#define REDELIVERY_INTERVAL 100
+//replies to 'ackmode', telling the client whether delivery IDs carry on
+//from a previous connection (see attach_session())
+#define SESSION_NEW_MSG ":session new\n"
+#define SESSION_RESUMED_MSG ":session resumed\n"
+//notice telling a client how many messages were dropped (see queue_frame())
+#define DROPPED_MSG ":dropped %ld\n"
+//initial size of the redelivery thread's list of sessions
+#define MIN_SESSION_LIST 16
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define US_PER_MS 1000
+#define NS_PER_SEC 1000000000L
+//max number of batches a worker writes to one outbound queue before 
+//requeueing it (so a busy client can't keep a worker to itself)
+#define OUTBOUND_ROUNDS 16
+//max number of full sockets handed back to the pool per wake of the poller
+#define POLL_EVENTS 64
+
+SessionTable* session_table_init(void) {
+    SessionTable* table = calloc(1, sizeof(SessionTable));
+    table->sessions = stringmap_init();
+    init_mutex(&table->lock, "sessionsLock");
+    return table;
+}
+
+/* now_ms
+ * ------
+ * Returns the current (monotonic) time in milliseconds.
+ * */
+long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * MS_PER_SEC + now.tv_nsec / NS_PER_MS;
+}
+
+/* new_out_frame
+ * -------------
+ * Returns a newly allocated OutFrame with room for a frame of the given
+ * length (and its terminator), charged to nobody.
+ * */
+OutFrame* new_out_frame(size_t length) {
+    OutFrame* outFrame = malloc(sizeof(OutFrame) + length + 1);
+    outFrame->credit = NULL;
+    outFrame->length = length;
+    return outFrame;
+}
+
+OutboundWriter* outbound_writer_init(WorkPool* pool, Stats* stats, 
+        Mutex* statsLock) {
+    OutboundWriter* writer = malloc(sizeof(OutboundWriter));
+    writer->pool = pool;
+    writer->stats = stats;
+    writer->statsLock = statsLock;
+    writer->pollFd = epoll_create1(EPOLL_CLOEXEC);
+    return writer;
+}
+
+Outbound* outbound_init(OutboundWriter* writer, int fd) {
+    Outbound* outbound = mpsc_alloc(sizeof(Outbound));
+    mpsc_init(&outbound->frames);
+    outbound->writer = writer;
+    outbound->fd = dup(fd);
+    outbound->refs = 1;
+    return outbound;
+}
+
+/* release_outbound
+ * ----------------
+ * Drops a reference to the given outbound queue, freeing it (and closing 
+ * its descriptor for the socket) once it's no longer referenced.
+ * */
+void release_outbound(Outbound* outbound) {
+    if (__atomic_sub_fetch(&outbound->refs, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    //(the socket stays in the epoll instance while any descriptor for it
+    //is open, eg: the client's own)
+    if (outbound->isPolled) {
+        epoll_ctl(outbound->writer->pollFd, EPOLL_CTL_DEL, outbound->fd, 
+                NULL);
+    }
+    close(outbound->fd);
+    free(outbound);
+}
+
+/* retire_frame
+ * ------------
+ * Frees the given frame once it has left its outbound queue (written or 
+ * discarded), refunding its publisher.
+ * */
+void retire_frame(Outbound* outbound, OutFrame* outFrame) {
+    __atomic_sub_fetch(&outbound->numBytes, outFrame->length, 
+            __ATOMIC_RELAXED);
+    refund_credit(outFrame->credit, outFrame->length);
+    free(outFrame);
+}
+
+/* send_batch
+ * ----------
+ * Writes as much of the writer's batch as the given queue's socket has room
+ * for, in one non-blocking write. If the write fails (eg: the client has 
+ * gone) the queue is marked broken and the batch is discarded instead.
+ *
+ * Returns:
+ *      the number of frames finished with, or -1 if the socket is full
+ *
+ * */
+int send_batch(Outbound* outbound) {
+    int numFrames = outbound->batchEnd - outbound->batchStart;
+    if (!outbound->isBroken) {
+        struct iovec iov[OUTBOUND_BATCH];
+        for (int i = 0; i < numFrames; i++) {
+            OutFrame* outFrame = outbound->batch[outbound->batchStart + i];
+            size_t skip = i ? 0 : outbound->offset;
+            iov[i].iov_base = outFrame->frame + skip;
+            iov[i].iov_len = outFrame->length - skip;
+        }
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = numFrames;
+        ssize_t numBytes;
+        while ((numBytes = sendmsg(outbound->fd, &msg, 
+                MSG_DONTWAIT | MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+        }
+        if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return -1;
+        }
+        if (numBytes >= 0) {
+            //finish the frames written in full, and note how far into the
+            //next one the write got
+            int numDone = 0;
+            while (numDone < numFrames && 
+                    numBytes >= (ssize_t)iov[numDone].iov_len) {
+                numBytes -= iov[numDone++].iov_len;
+            }
+            outbound->offset = numDone ? numBytes : 
+                    outbound->offset + numBytes;
+            numFrames = numDone;
+        } else {
+            outbound->isBroken = true;
+        }
+    }
+    for (int i = 0; i < numFrames; i++) {
+        retire_frame(outbound, outbound->batch[outbound->batchStart++]);
+    }
+    return numFrames;
+}
+
+/* count_written
+ * -------------
+ * Counts the given number of frames as written from the given outbound 
+ * queue, waking anyone flushing it.
+ *
+ * Returns:
+ *      true iff there are frames still queued (so the writer carries on)
+ *
+ * */
+bool count_written(Outbound* outbound, int numFrames) {
+    if (!numFrames) {
+        return true;
+    }
+    __atomic_add_fetch(&outbound->numWritten, numFrames, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&outbound->written, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&outbound->numFlushers, __ATOMIC_SEQ_CST)) {
+        futex_wake(&outbound->written, INT_MAX);
+    }
+    return __atomic_sub_fetch(&outbound->numQueued, numFrames, 
+            __ATOMIC_ACQ_REL);
+}
+
+/* poll_outbound
+ * -------------
+ * Has the given queue (whose socket is full) written again once its socket
+ * has room (see outbound_poll_thread()).
+ *
+ * Returns:
+ *      true iff the socket is being waited on
+ *
+ * */
+bool poll_outbound(Outbound* outbound) {
+    struct epoll_event event;
+    event.events = EPOLLOUT | EPOLLONESHOT;
+    event.data.ptr = outbound;
+    int op = outbound->isPolled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    outbound->isPolled = true;
+    return !epoll_ctl(outbound->writer->pollFd, op, outbound->fd, &event);
+}
+
+/* push_frame
+ * ----------
+ * Adds the given frame (already counted in the queue's numBytes) to the 
+ * given outbound queue, which takes it over.
+ *
+ * Returns:
+ *      true iff the queue was idle, in which case the caller must hand it 
+ *      to the worker pool to write (see write_outbound())
+ *
+ * */
+bool push_frame(Outbound* outbound, OutFrame* outFrame) {
+    //counted before it's queued, so the count never runs behind the queue
+    __atomic_add_fetch(&outbound->numSent, 1, __ATOMIC_RELAXED);
+    bool isWriter = !__atomic_fetch_add(&outbound->numQueued, 1, 
+            __ATOMIC_ACQ_REL);
+    if (isWriter) {
+        __atomic_add_fetch(&outbound->refs, 1, __ATOMIC_RELAXED);
+    }
+    mpsc_push(&outbound->frames, &outFrame->node);
+    return isWriter;
+}
+
+/* report_dropped
+ * --------------
+ * Queues a ":dropped <n>" notice telling the client how many messages have
+ * been dropped from the given outbound queue since the last notice, if any
+ * were and the queue has room again.
+ *
+ * NOTE: only called by the queue's writer (so the queue isn't idle)
+ * */
+void report_dropped(Outbound* outbound) {
+    if (!__atomic_load_n(&outbound->numDropped, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&outbound->numBytes, __ATOMIC_RELAXED) >= 
+            MAX_OUTBOUND_BYTES) {
+        return;
+    }
+    long numDropped = __atomic_exchange_n(&outbound->numDropped, 0, 
+            __ATOMIC_ACQ_REL);
+    int length = snprintf(NULL, 0, DROPPED_MSG, numDropped);
+    OutFrame* outFrame = new_out_frame(length);
+    sprintf(outFrame->frame, DROPPED_MSG, numDropped);
+    __atomic_add_fetch(&outbound->numBytes, length, __ATOMIC_RELAXED);
+    push_frame(outbound, outFrame);
+}
+
+/* write_outbound
+ * --------------
+ * Worker pool task writing the given outbound queue (void*) to its socket 
+ * (OUTBOUND_BATCH frames at a time, each batch in one write) until it's 
+ * empty, the socket is full (see poll_outbound()) or it has written 
+ * OUTBOUND_ROUNDS batches (when it's requeued). Only ever run for the queue
+ * once at a time: started by the sender who found the queue idle, and
+ * handing the queue on until it's empty again.
+ * */
+void write_outbound(void* arg) {
+    Outbound* outbound = (Outbound*)arg;
+    for (int round = 0; round < OUTBOUND_ROUNDS; round++) {
+        if (outbound->batchStart == outbound->batchEnd) {
+            int numFrames;
+            //yield while the next frame's sender is part way through 
+            //queueing it
+            while (!(numFrames = mpsc_pop_batch(&outbound->frames, 
+                    (MpscNode**)outbound->batch, OUTBOUND_BATCH))) {
+                sched_yield();
+            }
+            outbound->batchStart = 0;
+            outbound->batchEnd = numFrames;
+            outbound->offset = 0;
+        }
+        int numFrames = send_batch(outbound);
+        if (numFrames < 0) {
+            if (poll_outbound(outbound)) {
+                return;
+            }
+            //can't be waited on, so give up on the socket
+            outbound->isBroken = true;
+            continue;
+        }
+        report_dropped(outbound);
+        //NOTE: the queue may be handed to a new writer once it's empty
+        if (!count_written(outbound, numFrames)) {
+            release_outbound(outbound);
+            return;
+        }
+    }
+    pool_submit(outbound->writer->pool, write_outbound, outbound);
+}
+
+/* queue_frame
+ * -----------
+ * Queues the given frame (see new_out_frame()) on the given client's 
+ * outbound queue, which takes it over, handing the queue to the worker pool
+ * to write if it was idle. A droppable frame (ie: a message from a publisher
+ * without credit, or a delivery that will be resent) is dropped instead if
+ * the queue already holds MAX_OUTBOUND_BYTES, so a client that has stopped
+ * reading can't use up psserver's memory.
+ *
+ * Returns:
+ *      true iff the frame was queued
+ *
+ * */
+bool queue_frame(Client* client, OutFrame* outFrame, bool isDroppable) {
+    Outbound* outbound = client->outbound;
+    if (__atomic_add_fetch(&outbound->numBytes, outFrame->length, 
+            __ATOMIC_RELAXED) > MAX_OUTBOUND_BYTES && isDroppable) {
+        retire_frame(outbound, outFrame);
+        return false;
+    }
+    if (push_frame(outbound, outFrame)) {
+        pool_submit(outbound->writer->pool, write_outbound, outbound);
+    }
+    return true;
+}
+
+/* count_dropped
+ * -------------
+ * Counts a message dropped from the given outbound queue (see queue_frame())
+ * in the statistics, and towards the client's next ":dropped" notice (see 
+ * report_dropped()).
+ * */
+void count_dropped(Outbound* outbound) {
+    __atomic_add_fetch(&outbound->numDropped, 1, __ATOMIC_RELAXED);
+    update_stat(outbound->writer->stats, INC_MSGS_DROPPED, 
+            outbound->writer->statsLock);
+}
+
+bool flush_outbound(Client* client, struct timespec* deadline) {
+    Outbound* outbound = client->outbound;
+    if (!outbound) {
+        return true;
+    }
+    long numSent = __atomic_load_n(&outbound->numSent, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&outbound->numFlushers, 1, __ATOMIC_SEQ_CST);
+    bool isFlushed = false;
+    while (true) {
+        //(read before the count, so a write in between changes it)
+        int written = __atomic_load_n(&outbound->written, __ATOMIC_SEQ_CST);
+        if ((isFlushed = __atomic_load_n(&outbound->numWritten, 
+                __ATOMIC_SEQ_CST) >= numSent)) {
+            break;
+        }
+        if (futex_wait(&outbound->written, written, deadline) && 
+                errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    __atomic_sub_fetch(&outbound->numFlushers, 1, __ATOMIC_SEQ_CST);
+    return isFlushed;
+}
+
+void close_outbound(Client* client) {
+    Outbound* outbound = client->outbound;
+    if (!outbound) {
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += OUTBOUND_CLOSE_TIMEOUT / MS_PER_SEC;
+    deadline.tv_nsec += (long)(OUTBOUND_CLOSE_TIMEOUT % MS_PER_SEC) * 
+            NS_PER_MS;
+    if (deadline.tv_nsec >= NS_PER_SEC) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NS_PER_SEC;
+    }
+    //the writer's next write fails, so it discards the rest of the queue
+    if (!flush_outbound(client, &deadline)) {
+        shutdown(outbound->fd, SHUT_RDWR);
+    }
+    client->outbound = NULL;
+    release_outbound(outbound);
+}
+
+/* write_delivery
+ * --------------
+ * Sends the given message to the client attached to the given session,
+ * prefixed with its delivery ID. It's only queued on the client's outbound
+ * queue (see queue_frame()), so this never blocks on the client's socket.
+ * A delivery dropped as the client's queue is full is simply redelivered
+ * once it times out.
+ *
+ * NOTE: the session's lock must be held by the caller
+ *
+ * session - session the message belongs to
+ * msg - message to write
+ *
+ * */
+void write_delivery(Session* session, InFlightMsg* msg) {
+    Client* client = session->client;
+    msg->sentAt = now_ms();
+    if (!client->outbound) {
+        fprintf(client->serverToClient, "%d:%s", msg->id, msg->frame);
+        fflush(client->serverToClient);
+        return;
+    }
+    int length = snprintf(NULL, 0, "%d:%s", msg->id, msg->frame);
+    OutFrame* outFrame = new_out_frame(length);
+    sprintf(outFrame->frame, "%d:%s", msg->id, msg->frame);
+    queue_frame(client, outFrame, true);
+}
+
+/* take_pending
+ * ------------
+ * Unlinks the oldest pending message from the given session (which must 
+ * have one) and returns it, no longer charged to its publisher.
+ *
+ * NOTE: the session's lock must be held by the caller
+ * */
+InFlightMsg* take_pending(Session* session) {
+    InFlightMsg* msg = session->pending;
+    session->pending = msg->next;
+    if (!session->pending) {
+        session->pendingTail = NULL;
+    }
+    session->numPending--;
+    msg->next = NULL;
+    refund_credit(msg->credit, strlen(msg->frame));
+    msg->credit = NULL;
+    return msg;
+}
+
+/* drop_uncharged
+ * --------------
+ * Drops the oldest pending message of the given session that isn't charged
+ * to a publisher's credit, if it has one, counting it as dropped (see 
+ * count_dropped()). Messages charged to credit are skipped, as the credit
+ * already bounds them.
+ *
+ * NOTE: the session's lock must be held by the caller
+ *
+ * session - session to drop from
+ * client - client attached to the session
+ *
+ * */
+void drop_uncharged(Session* session, Client* client) {
+    InFlightMsg* prev = NULL;
+    InFlightMsg* msg = session->pending;
+    while (msg && msg->credit) {
+        prev = msg;
+        msg = msg->next;
+    }
+    if (!msg) {
+        return;
+    }
+    if (prev) {
+        prev->next = msg->next;
+    } else {
+        session->pending = msg->next;
+    }
+    if (session->pendingTail == msg) {
+        session->pendingTail = prev;
+    }
+    session->numPending--;
+    free(msg->frame);
+    free(msg);
+    if (client->outbound) {
+        count_dropped(client->outbound);
+    }
+}
+
+/* fill_window
+ * -----------
+ * Moves pending messages into flight (sending them) until either the
+ * session's window is full or there are no more pending messages.
+ *
+ * NOTE: the session's lock must be held by the caller
+ *
+ * session - session to fill the window of
+ *
+ * */
+void fill_window(Session* session) {
+    while (session->client && session->pending &&
+            session->numInFlight < session->window) {
+        InFlightMsg* msg = take_pending(session);
+
+        //append it to the in flight messages
+        InFlightMsg** end = &session->inFlight;
+        while (*end) {
+            end = &(*end)->next;
+        }
+        *end = msg;
+        session->numInFlight++;
+        write_delivery(session, msg);
+    }
+}
+
+bool attach_session(SessionTable* table, Client* client, int window,
+        int timeout, int maxPending) {
+    //find or create the session under the client's name
+    take_mutex(&table->lock);
+    Session* session = stringmap_search(table->sessions, client->name);
+    bool isNew = !session;
+    if (isNew) {
+        session = calloc(1, sizeof(Session));
+        session->name = strdup(client->name);
+        session->nextId = 1;
+        init_ticket_lock(&session->lock, NULL);
+        stringmap_add(table->sessions, client->name, session);
+    }
+    release_mutex(&table->lock);
+
+    take_ticket_lock(&session->lock);
+    if (session->client && session->client != client) {
+        release_ticket_lock(&session->lock);
+        return false;
+    }
+    session->client = client;
+    session->window = window;
+    session->timeout = timeout;
+    session->maxPending = maxPending;
+    client->session = session;
+    //(ahead of any delivery)
+    send_reply(client, isNew ? SESSION_NEW_MSG : SESSION_RESUMED_MSG);
+
+    //redeliver whatever a previous connection left unacknowledged
+    InFlightMsg* msg = session->inFlight;
+    while (msg) {
+        write_delivery(session, msg);
+        msg = msg->next;
+    }
+    fill_window(session);
+    release_ticket_lock(&session->lock);
+    return true;
+}
+
+void detach_session(Client* client) {
+    Session* session = client->session;
+    if (!session) {
+        return;
+    }
+    take_ticket_lock(&session->lock);
+    if (session->client == client) {
+        session->client = NULL;
+        //stop charging the pending messages to their publishers
+        InFlightMsg* msg = session->pending;
+        while (msg) {
+            refund_credit(msg->credit, strlen(msg->frame));
+            msg->credit = NULL;
+            msg = msg->next;
+        }
+    }
+    release_ticket_lock(&session->lock);
+    client->session = NULL;
+}
+
+bool ack_delivery(Client* client, int id) {
+    Session* session = client->session;
+    if (!session) {
+        return false;
+    }
+    take_ticket_lock(&session->lock);
+    //find and unlink the delivery
+    InFlightMsg** curr = &session->inFlight;
+    while (*curr && (*curr)->id != id) {
+        curr = &(*curr)->next;
+    }
+    InFlightMsg* msg = *curr;
+    if (msg) {
+        *curr = msg->next;
+        session->numInFlight--;
+        fill_window(session);
+    }
+    release_ticket_lock(&session->lock);
+
+    if (msg) {
+        free(msg->frame);
+        free(msg);
+    }
+    return msg;
+}
+
+void send_reply(Client* client, char* reply) {
+    if (client->outbound && !client->isPeer) {
+        size_t length = strlen(reply);
+        OutFrame* outFrame = new_out_frame(length);
+        memcpy(outFrame->frame, reply, length + 1);
+        queue_frame(client, outFrame, false);
+        return;
+    }
+    fputs(reply, client->serverToClient);
+    if (!client->isPeer) {
+        fflush(client->serverToClient);
+    }
+}
+
+void send_frame(Client* client, char* frame, Credit* credit) {
+    Session* session = client->session;
+    //fire and forget (frames to linked peers are batched up and flushed
+    //periodically instead)
+    if (!session && client->outbound && !client->isPeer) {
+        size_t length = strlen(frame);
+        OutFrame* outFrame = new_out_frame(length);
+        memcpy(outFrame->frame, frame, length + 1);
+        //charged until it's written, so never dropped (the publisher is
+        //held back instead)
+        outFrame->credit = credit;
+        charge_credit(credit, length);
+        if (!queue_frame(client, outFrame, !credit)) {
+            count_dropped(client->outbound);
+        }
+        return;
+    }
+    if (!session) {
+        fputs(frame, client->serverToClient);
+        //frames to linked peers are batched up and flushed periodically
+        if (!client->isPeer) {
+            fflush(client->serverToClient);
+        }
+        return;
+    }
+
+    InFlightMsg* msg = calloc(1, sizeof(InFlightMsg));
+    msg->frame = strdup(frame);
+    take_ticket_lock(&session->lock);
+    msg->id = session->nextId;
+    session->nextId = session->nextId == INT_MAX ? 1 : session->nextId + 1;
+    //queue the message, then send it straight away if there's room
+    if (session->pendingTail) {
+        session->pendingTail->next = msg;
+    } else {
+        session->pending = msg;
+    }
+    session->pendingTail = msg;
+    //charge the publisher while the message waits for room in the window
+    //(unless it's for themself - their acks aren't read while they wait)
+    if (session->client == client && credit != client->credit) {
+        msg->credit = credit;
+        charge_credit(credit, strlen(frame));
+    }
+    //a client that stops acking can only hold so many uncharged messages
+    if (++session->numPending > session->maxPending) {
+        drop_uncharged(session, client);
+    }
+    fill_window(session);
+    release_ticket_lock(&session->lock);
+}
+
+/* outbound_poll_thread
+ * --------------------
+ * The thread spawned by start_outbound_writer() (see session.h). Each 
+ * socket waited on (see poll_outbound()) is only reported once, and its 
+ * queue is handed straight back to the worker pool.
+ *
+ * arg - OutboundWriter structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* outbound_poll_thread(void* arg) {
+    OutboundWriter* writer = (OutboundWriter*)arg;
+    struct epoll_event events[POLL_EVENTS];
+    while (true) {
+        int numEvents = epoll_wait(writer->pollFd, events, POLL_EVENTS, -1);
+        for (int i = 0; i < numEvents; i++) {
+            pool_submit(writer->pool, write_outbound, events[i].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+void start_outbound_writer(OutboundWriter* writer) {
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, outbound_poll_thread, writer);
+    pthread_detach(threadId);
+}
+
+/* redelivery_thread
+ * -----------------
+ * The thread spawned by start_redelivery_thread() (see session.h). The 
+ * sessions are listed under the table's lock, then each is checked under
+ * its own lock alone (sessions are never freed), so new clients attaching
+ * don't wait on a whole pass. Redeliveries are only queued on the client's
+ * outbound queue, so no lock is held while writing to a socket.
+ *
+ * arg - SessionTable structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* redelivery_thread(void* arg) {
+    SessionTable* table = (SessionTable*)arg;
+    Session** sessions = NULL;
+    int capacity = 0;
+    while (true) {
+        usleep(REDELIVERY_INTERVAL * US_PER_MS);
+        long now = now_ms();
+
+        int numSessions = 0;
+        StringMapItem* currItem = NULL;
+        take_mutex(&table->lock);
+        while ((currItem = stringmap_iterate(table->sessions, currItem))) {
+            if (numSessions == capacity) {
+                capacity = capacity ? capacity * 2 : MIN_SESSION_LIST;
+                sessions = realloc(sessions, capacity * sizeof(Session*));
+            }
+            sessions[numSessions++] = currItem->item;
+        }
+        release_mutex(&table->lock);
+
+        for (int i = 0; i < numSessions; i++) {
+            Session* session = sessions[i];
+            take_ticket_lock(&session->lock);
+            InFlightMsg* msg = session->client ? session->inFlight : NULL;
+            while (msg) {
+                if (now - msg->sentAt >= session->timeout) {
+                    write_delivery(session, msg);
+                }
+                msg = msg->next;
+            }
+            release_ticket_lock(&session->lock);
+        }
+    }
+}
+
+void start_redelivery_thread(SessionTable* table) {
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, redelivery_thread, table);
+    pthread_detach(threadId);
+}
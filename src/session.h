@@ -0,0 +1,348 @@
+//session.h//
+//----------------------//
+//session.c abstracts away acknowledged (at-least-once) delivery to clients
+//----------------------//
+
+#ifndef SESSION
+#define SESSION
+
+#include "clientList.h"
+#include "credit.h"
+#include "stringmap.h"
+#include "lock.h"
+#include "mpsc.h"
+#include "pool.h"
+#include "stats.h"
+#include <time.h>
+
+//how long (ms) a delivery may go unacknowledged before it is redelivered
+#define DEFAULT_ACK_TIMEOUT 5000
+//max number of messages a session holds back for room in its window 
+//without charging them to a publisher's credit, unless the client asks for
+//another limit (see send_frame())
+#define DEFAULT_MAX_PENDING 10000
+//how long (ms) a disconnecting client's outbound queue has to be written
+#define OUTBOUND_CLOSE_TIMEOUT 5000
+
+/* Defines the InFlightMsg structure, which holds a message frame delivered
+ * to (or waiting to be delivered to) a client in acknowledged mode:
+ *
+ *      id - ID the client acknowledges the delivery with
+ *      frame - message frame (ie: "name:topic:value\n")
+ *      sentAt - time (ms) the frame was last sent, 0 if not sent yet
+ *      credit - credit of the publisher the message is charged to while 
+ *               it's pending (NULL if it isn't charged)
+ *      next - next message in the list
+ * */
+typedef struct InFlightMsg {
+    int id;
+    char* frame;
+    long sentAt;
+    Credit* credit;
+    struct InFlightMsg* next;
+} InFlightMsg;
+
+//max number of frames taken off an outbound queue for each write
+#define OUTBOUND_BATCH 64
+//max number of bytes a client's outbound queue may hold (see queue_frame())
+#define MAX_OUTBOUND_BYTES (4 * 1024 * 1024)
+
+/* Defines the OutFrame structure, which holds a frame waiting in a client's
+ * outbound queue (see Outbound below):
+ *
+ *      node - links the frame into the queue (see mpsc.h)
+ *      credit - credit of the publisher the frame is charged to until it's
+ *               written (NULL if it isn't charged)
+ *      length - length of the frame
+ *      frame - copy of the frame
+ * */
+typedef struct {
+    MpscNode node;
+    Credit* credit;
+    size_t length;
+    char frame[];
+} OutFrame;
+
+/* Defines the OutboundWriter structure, shared by every outbound queue, 
+ * which writes the queues out:
+ *
+ *      pool - worker pool the queues are written by
+ *      pollFd - epoll instance watching the sockets that were full when 
+ *               last written to, so their queue is written again once they
+ *               have room (see outbound_poll_thread() in session.c)
+ *      stats - psserver's statistics, which count the messages dropped
+ *      statsLock - lock protecting the statistics
+ * */
+typedef struct {
+    WorkPool* pool;
+    int pollFd;
+    Stats* stats;
+    Mutex* statsLock;
+} OutboundWriter;
+
+/* Defines the Outbound structure, which holds everything waiting to be 
+ * written to a socket client: frames, acknowledged deliveries and replies.
+ * Senders queue their frame (without ever blocking or touching the socket),
+ * and whichever of them finds the queue idle hands it to the worker pool,
+ * which writes it out (batches of frames in a single non-blocking write) 
+ * until it's empty again. If the socket fills up the queue waits for room
+ * in the writer's epoll instance rather than holding up a worker.
+ *
+ * Once the queue holds MAX_OUTBOUND_BYTES, messages from publishers without
+ * credit (see credit.h) are dropped, counted in the statistics and reported
+ * to the client as ":dropped <n>" once it catches up (ahead of the next 
+ * frame queued, or once the queue empties). Messages charged to a
+ * publisher's credit are never dropped, as the credit already bounds them 
+ * (and pushes back on the publisher), and neither are replies. Acknowledged
+ * deliveries are dropped silently, as they're resent. It holds the 
+ * following:
+ *
+ *      frames - frames not yet taken by the writer, oldest first
+ *      writer - writer of the queue (see OutboundWriter above)
+ *      fd - the queue's own descriptor for the socket (so it stays open 
+ *           until the queue is done with it)
+ *      refs - number of references to the queue (the client, plus the
+ *             writer while the queue isn't empty)
+ *      numQueued - number of frames queued (or about to be) and not yet 
+ *                  written. The sender taking it from 0 starts the writer,
+ *                  which stops once it's back to 0.
+ *      numBytes - number of bytes queued and not yet written
+ *      numSent - number of frames ever queued
+ *      numWritten - number of frames ever written (or discarded once the 
+ *                   socket has failed)
+ *      numDropped - number of messages dropped and not yet reported
+ *      written - futex word bumped each time frames are written, which 
+ *                flush_outbound() sleeps on
+ *      numFlushers - number of threads in flush_outbound()
+ *      batch - frames taken off the queue by the writer, not yet written
+ *      batchStart - index of the first frame in batch not yet written
+ *      batchEnd - number of frames in batch
+ *      offset - how much of the first frame in batch has been written
+ *      isPolled - true iff the socket has been added to the writer's epoll
+ *                 instance
+ *      isBroken - true iff writing to the socket has failed (so the rest of
+ *                 the queue is discarded)
+ *
+ * NOTE: batch onwards are only touched by the writer
+ * */
+typedef struct Outbound {
+    MpscQueue frames;
+    OutboundWriter* writer;
+    int fd;
+    int refs;
+    long numQueued;
+    long numBytes;
+    long numSent;
+    long numWritten;
+    long numDropped;
+    int written;
+    int numFlushers;
+    OutFrame* batch[OUTBOUND_BATCH];
+    int batchStart;
+    int batchEnd;
+    size_t offset;
+    bool isPolled;
+    bool isBroken;
+} Outbound;
+
+/* Defines the Session structure, which holds the acknowledged delivery state
+ * of a client. Sessions are identified by client name and outlive the
+ * client's connection, so a client reconnecting under the same name has its
+ * unacknowledged messages redelivered. It holds the following:
+ *
+ *      name - name of the client the session belongs to
+ *      client - client currently attached to the session (NULL if they've
+ *               disconnected)
+ *      window - max number of unacknowledged deliveries at any one time
+ *      timeout - time (ms) after which an unacknowledged delivery is resent
+ *      nextId - ID to give the next delivery
+ *      numInFlight - number of unacknowledged deliveries
+ *      inFlight - list of unacknowledged deliveries (oldest first)
+ *      pending - list of messages waiting for room in the window (oldest
+ *                first)
+ *      pendingTail - last message in the pending list
+ *      numPending - number of messages in the pending list
+ *      maxPending - max number of pending messages, beyond which the 
+ *                   oldest one not charged to a publisher's credit is 
+ *                   dropped (see send_frame())
+ *      lock - lock protecting the session. A ticket lock, so the
+ *             client's acks and the redelivery thread take their turn
+ *             rather than being starved by a stream of publishers
+ * */
+typedef struct Session {
+    char* name;
+    Client* client;
+    int window;
+    int timeout;
+    int nextId;
+    int numInFlight;
+    InFlightMsg* inFlight;
+    InFlightMsg* pending;
+    InFlightMsg* pendingTail;
+    int numPending;
+    int maxPending;
+    TicketLock lock;
+} Session;
+
+/* Defines the SessionTable structure, which holds all of psserver's
+ * sessions:
+ *
+ *      sessions - string map from client names to Session structures
+ *      lock - lock protecting the string map
+ * */
+typedef struct {
+    StringMap* sessions;
+    Mutex lock;
+} SessionTable;
+
+/* session_table_init
+ * ------------------
+ * Initialises an empty SessionTable and returns a pointer to it.
+ *
+ * NOTE: structure is dynamically allocated and thus must be free()'d
+ * */
+SessionTable* session_table_init(void);
+
+/* attach_session
+ * --------------
+ * Puts the given client into acknowledged mode by attaching them to the
+ * session under their name (creating it if need be). The client is told 
+ * whether the session is new (":session new", delivery IDs start again from
+ * 1) or resumed (":session resumed", IDs carry on from the previous 
+ * connection). Any messages left unacknowledged by a previous connection 
+ * are then redelivered.
+ *
+ * table - psserver's sessions
+ * client - client to attach (must be named)
+ * window - max number of unacknowledged deliveries
+ * timeout - time (ms) after which an unacknowledged delivery is resent
+ * maxPending - max number of messages held back for room in the window 
+ *              (see send_frame())
+ *
+ * Returns:
+ *      true iff attached, false if another connected client already holds
+ *      the session
+ *
+ * */
+bool attach_session(SessionTable* table, Client* client, int window,
+        int timeout, int maxPending);
+
+/* detach_session
+ * --------------
+ * Detaches a disconnecting client from their session (if they have one).
+ * Their unacknowledged messages are kept for when they reconnect, but are
+ * no longer charged to their publishers' credit (so a client that never 
+ * comes back can't hold up publishers).
+ *
+ * client - client who is disconnecting
+ *
+ * */
+void detach_session(Client* client);
+
+/* ack_delivery
+ * ------------
+ * Acknowledges the delivery with the given ID, which frees up room in the
+ * client's window for the next pending message.
+ *
+ * client - client acknowledging the delivery
+ * id - ID of the delivery
+ *
+ * Returns:
+ *      true iff the delivery was in flight, false otherwise
+ *
+ * */
+bool ack_delivery(Client* client, int id);
+
+/* send_frame
+ * ----------
+ * Sends the given message frame to the given client. If the client is in
+ * acknowledged mode, the frame is prefixed with its delivery ID (ie:
+ * "id:name:topic:value\n") and kept until acknowledged, or held back until
+ * there is room in the client's window. Frames held back are charged to the
+ * publisher's credit until they are sent, so a client that stops acking 
+ * holds back credited publishers and their frames are never dropped. Past
+ * the session's maxPending frames held back, the oldest frame that isn't 
+ * charged (from a publisher without credit, or the client themself) is 
+ * dropped instead (and reported). Otherwise the frame goes through
+ * the client's outbound queue, if it has one (see Outbound above), charged
+ * to the publisher's credit until it's written. If the publisher has no 
+ * credit and the queue is full, the frame is dropped (and reported).
+ *
+ * client - client to send to
+ * frame - message frame (see build_message_frame() in topic.h)
+ * credit - credit of the publisher (NULL if they have none)
+ *
+ * */
+void send_frame(Client* client, char* frame, Credit* credit);
+
+/* send_reply
+ * ----------
+ * Sends the given reply (eg: ":invalid\n") to the given client, after 
+ * anything already sent to them. Unlike frames, replies are never dropped.
+ * */
+void send_reply(Client* client, char* reply);
+
+/* outbound_writer_init
+ * --------------------
+ * Returns a newly created OutboundWriter, writing queues with the given
+ * worker pool and counting dropped messages in the given statistics. 
+ * Sockets aren't waited on for room until start_outbound_writer() is 
+ * called.
+ * */
+OutboundWriter* outbound_writer_init(WorkPool* pool, Stats* stats, 
+        Mutex* statsLock);
+
+/* start_outbound_writer
+ * ---------------------
+ * Spawns the thread waiting for full sockets to have room again, which 
+ * hands their queues back to the worker pool to carry on writing.
+ * */
+void start_outbound_writer(OutboundWriter* writer);
+
+/* outbound_init
+ * -------------
+ * Returns a newly created (empty) outbound queue for the client on the 
+ * given socket, written by the given writer.
+ * */
+Outbound* outbound_init(OutboundWriter* writer, int fd);
+
+/* flush_outbound
+ * --------------
+ * Waits until every frame queued for the given client so far has been 
+ * written, so anything written straight to the client afterwards can't 
+ * overtake them. Returns straight away if the client has no outbound queue.
+ *
+ * NOTE: must not be called by a worker (the pool may be busy with tasks
+ * waiting on it)
+ *
+ * client - client to flush
+ * deadline - time (CLOCK_REALTIME) to give up at, NULL to never give up
+ *
+ * Returns:
+ *      true iff everything was written before the deadline
+ *
+ * */
+bool flush_outbound(Client* client, struct timespec* deadline);
+
+/* close_outbound
+ * --------------
+ * Drops a disconnecting client's outbound queue. What's still queued is 
+ * given a little while (OUTBOUND_CLOSE_TIMEOUT) to be written; after that
+ * the socket is shut down, so a client that has stopped reading can't keep
+ * it open. The queue is freed once its writer is done with it.
+ *
+ * NOTE: no one may send to the client once this is called
+ * */
+void close_outbound(Client* client);
+
+/* start_redelivery_thread
+ * -----------------------
+ * Spawns a thread which periodically resends every delivery that has gone
+ * unacknowledged for longer than its session's timeout.
+ *
+ * table - psserver's sessions
+ *
+ * */
+void start_redelivery_thread(SessionTable* table);
+
+#endif //SESSION
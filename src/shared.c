@@ -9,9 +9,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #define EMPTY_STRING ""
 #define INVALID_NUM -1
+#define TCP 0
 
 bool has_space_colon_newline(char* str) {
     //is the empty string
@@ -29,13 +34,15 @@ bool has_space_colon_newline(char* str) {
 }
 
 char* add_new_line(char* str) {
-    char* buffer = malloc(sizeof(char) * (strlen(str) + 1));
+    //room for the newline and the terminator
+    char* buffer = malloc(sizeof(char) * (strlen(str) + 2));
     int i = 0;
     while (str[0]) {
         buffer[i++] = str[0];
         str++;
     }
-    buffer[i] = '\n';
+    buffer[i++] = '\n';
+    buffer[i] = '\0';
     return buffer;
 }
 
@@ -69,12 +76,13 @@ char** split_line_max(char** toks, int maxToks) {
     int arrLen = string_array_length(toks);
     int combinedStrLen = 0;
     for (int i = maxToks - 1; i < arrLen; i++) {
-        combinedStrLen += strlen(toks[i]);
+        //plus the space joining it to the next string
+        combinedStrLen += strlen(toks[i]) + 1;
     }
     //build up string made up of the extra strings
     char* combinedStr = calloc((combinedStrLen + 1), sizeof(char));
     for (int i = maxToks - 1; i < arrLen; i++) {
-        strcat(combinedStr, strdup(toks[i]));
+        strcat(combinedStr, toks[i]);
         if (i != arrLen - 1) {
             strcat(combinedStr, " ");
         }
@@ -92,3 +100,53 @@ char** split_line_max(char** toks, int maxToks) {
     free(toks);
     return newToks;
 }
+
+char* option_value(char* tok, char* optName) {
+    int nameLen = strlen(optName);
+    //must begin with "<optName>="
+    if (strncmp(tok, optName, nameLen) || tok[nameLen] != '=') {
+        return NULL;
+    }
+    return tok + nameLen + 1;
+}
+
+char* pop_option(char** str, char* optName) {
+    char* optValue = option_value(*str, optName);
+    if (!optValue) {
+        return NULL;
+    }
+    //option value runs up to the next space, which must be followed by
+    //something
+    char* end = strchr(optValue, ' ');
+    if (!end || !end[1]) {
+        return NULL;
+    }
+    *str = end + 1;
+    return strndup(optValue, end - optValue);
+}
+
+int connect_to_host(char* host, char* service) {
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET; //IPv4
+    hints.ai_socktype = SOCK_STREAM; //byte stream (TCP)
+    if (getaddrinfo(host, service, &hints, &ai)) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, TCP);
+    if (connect(fd, (struct sockaddr*)ai->ai_addr, sizeof(struct sockaddr))) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+bool has_buffered_input(FILE* stream) {
+#ifdef __GLIBC__
+    return stream->_IO_read_ptr < stream->_IO_read_end;
+#else
+    return true;
+#endif
+}
@@ -9,6 +9,7 @@
 #define SHARED_FUNCTIONS
 
 #include <stdbool.h>
+#include <stdio.h>
 
 /* has_space_colon_newline
  * ----------------------------
@@ -29,7 +30,7 @@ bool has_space_colon_newline(char* str);
  *
  * str - given string
  *
- * Returns: string with newline char appended
+ * Returns: (malloc'd) copy of the string with newline char appended
  * */
 char* add_new_line(char* str);
 
@@ -76,4 +77,80 @@ int string_to_int(char* str);
  * */
 char** split_line_max(char** toks, int maxToks);
 
+/* option_value
+ * ------------
+ * Checks whether the given token is an option of the form 
+ * "<optName>=<optValue>" and if so, returns its value.
+ *
+ *  For example, if:
+ *      tok = "group=workers"
+ *      optName = "group"
+ *
+ *  Then:
+ *      output = "workers"
+ *
+ * tok - token to check
+ * optName - name of the option to look for
+ *
+ * Returns:
+ *      pointer to the option value inside the token, or NULL if the token
+ *      isn't the given option
+ * */
+char* option_value(char* tok, char* optName);
+
+/* pop_option
+ * ----------
+ * Checks whether the given string begins with an option of the form
+ * "<optName>=<optValue> ". If so, the option is removed from the front of 
+ * the string and its value is returned.
+ *
+ *  For example, if:
+ *      *str = "retain=1 big govamint"
+ *      optName = "retain"
+ *
+ *  Then:
+ *      output = "1"
+ *      *str = "big govamint"
+ *
+ * NOTE: an option with nothing after it isn't popped (it is the value)
+ *
+ * str - pointer to the string to pop the option from (modified in place)
+ * optName - name of the option to look for
+ *
+ * Returns:
+ *      the (malloc'd) option value, or NULL if the string doesn't begin with
+ *      the given option
+ * */
+char* pop_option(char** str, char* optName);
+
+/* connect_to_host
+ * ---------------
+ * Opens a TCP connection to the given host and port.
+ *
+ * host - host to connect to
+ * service - port to connect to (in string form)
+ *
+ * Returns:
+ *      the connected socket, or -1 if it can't be connected to
+ *
+ * */
+int connect_to_host(char* host, char* service);
+
+/* has_buffered_input
+ * ------------------
+ * Determines whether the given stream has input buffered that hasn't been
+ * read yet (ie: whether reading from it may be done without reading from 
+ * the underlying file).
+ *
+ * NOTE: without glibc this can't be found out, so it's always assumed 
+ * there is
+ *
+ * stream - stream to check
+ *
+ * Returns:
+ *      true iff the stream has buffered input
+ *
+ * */
+bool has_buffered_input(FILE* stream);
+
 #endif //SHARED_FUNCTIONS
@@ -0,0 +1,260 @@
+//shmring.c//
+//----------------------//
+//This file abstracts away the shared memory rings psserver writes topics'
+//message frames into for subscribers on the same host
+//----------------------//
+
+#include "shmring.h"
+#include "lock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+//size of the shared memory holding a ring
+#define RING_SIZE (sizeof(RingHeader) + RING_CAPACITY)
+//size of the length prefixing each record
+#define LENGTH_SIZE sizeof(uint32_t)
+//number of times a reader checks for a new record before sleeping
+#define SPIN_LIMIT 2000
+//max length of the path a ring is opened by
+#define MAX_PATH_LEN 64
+
+ShmRing* ring_create(char* name) {
+    int fd = syscall(SYS_memfd_create, name, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, RING_SIZE)) {
+        close(fd);
+        return NULL;
+    }
+    ShmRing* ring = ring_adopt(fd);
+    if (!ring) {
+        close(fd);
+    }
+    return ring;
+}
+
+ShmRing* ring_adopt(int fd) {
+    void* memory = mmap(NULL, RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    ShmRing* ring = calloc(1, sizeof(ShmRing));
+    ring->header = memory;
+    ring->data = (char*)memory + sizeof(RingHeader);
+    ring->fd = fd;
+    ring->path = malloc(sizeof(char) * MAX_PATH_LEN);
+    snprintf(ring->path, MAX_PATH_LEN, "/proc/%d/fd/%d", getpid(), fd);
+    init_mutex(&ring->lock, NULL);
+    return ring;
+}
+
+/* copy_in
+ * -------
+ * Copies the given bytes into the ring at the given offset, wrapping around
+ * the end of the ring.
+ *
+ * data - ring's records
+ * offset - offset (in bytes ever written) to copy to
+ * bytes - bytes to copy
+ * numBytes - number of bytes to copy
+ *
+ * */
+void copy_in(char* data, uint64_t offset, const void* bytes,
+        uint32_t numBytes) {
+    uint32_t start = offset & (RING_CAPACITY - 1);
+    uint32_t firstPart = RING_CAPACITY - start;
+    if (numBytes <= firstPart) {
+        memcpy(data + start, bytes, numBytes);
+    } else {
+        memcpy(data + start, bytes, firstPart);
+        memcpy(data, (const char*)bytes + firstPart, numBytes - firstPart);
+    }
+}
+
+/* copy_out
+ * --------
+ * Copies bytes out of the ring from the given offset, wrapping around the
+ * end of the ring.
+ *
+ * data - ring's records
+ * offset - offset (in bytes ever written) to copy from
+ * bytes - buffer to copy to
+ * numBytes - number of bytes to copy
+ *
+ * */
+void copy_out(char* data, uint64_t offset, void* bytes, uint32_t numBytes) {
+    uint32_t start = offset & (RING_CAPACITY - 1);
+    uint32_t firstPart = RING_CAPACITY - start;
+    if (numBytes <= firstPart) {
+        memcpy(bytes, data + start, numBytes);
+    } else {
+        memcpy(bytes, data + start, firstPart);
+        memcpy((char*)bytes + firstPart, data, numBytes - firstPart);
+    }
+}
+
+void ring_write(ShmRing* ring, char* frame) {
+    uint32_t frameLen = strlen(frame);
+    uint32_t length = frameLen > RING_MAX_FRAME ? RING_OVERSIZED : frameLen;
+    uint32_t payloadLen = length == RING_OVERSIZED ? 0 : frameLen;
+
+    take_mutex(&ring->lock);
+    RingHeader* header = ring->header;
+    uint64_t start = header->committed;
+    uint64_t end = start + LENGTH_SIZE + payloadLen;
+    //tell readers which bytes are about to be overwritten before doing so
+    __atomic_store_n(&header->reserved, end, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    copy_in(ring->data, start, &length, LENGTH_SIZE);
+    copy_in(ring->data, start + LENGTH_SIZE, frame, payloadLen);
+    __atomic_store_n(&header->committed, end, __ATOMIC_RELEASE);
+
+    //only make the syscall if a reader is actually asleep
+    __atomic_add_fetch(&header->wakeups, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->numSleeping, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &header->wakeups, FUTEX_WAKE, INT32_MAX, NULL,
+                NULL, 0);
+    }
+    release_mutex(&ring->lock);
+}
+
+RingReader* ring_attach(char* path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    //readers need write access to the header to sleep on it
+    void* memory = mmap(NULL, RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    RingReader* reader = calloc(1, sizeof(RingReader));
+    reader->header = memory;
+    reader->data = (char*)memory + sizeof(RingHeader);
+    reader->position = __atomic_load_n(&reader->header->committed,
+            __ATOMIC_ACQUIRE);
+    return reader;
+}
+
+/* wait_for_record
+ * ---------------
+ * Helper function for ring_read() that blocks until a record has been
+ * written past the reader's position, spinning briefly before sleeping.
+ *
+ * reader - reader waiting
+ *
+ * */
+void wait_for_record(RingReader* reader) {
+    RingHeader* header = reader->header;
+    for (int i = 0; i < SPIN_LIMIT; i++) {
+        if (__atomic_load_n(&header->committed, __ATOMIC_ACQUIRE) !=
+                reader->position) {
+            return;
+        }
+    }
+    while (true) {
+        uint32_t wakeups = __atomic_load_n(&header->wakeups,
+                __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&header->numSleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->committed, __ATOMIC_SEQ_CST) ==
+                reader->position) {
+            //sleeps unless a record was written since wakeups was read
+            syscall(SYS_futex, &header->wakeups, FUTEX_WAIT, wakeups, NULL,
+                    NULL, 0);
+        }
+        __atomic_sub_fetch(&header->numSleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->committed, __ATOMIC_ACQUIRE) !=
+                reader->position) {
+            return;
+        }
+    }
+}
+
+/* is_overwritten
+ * --------------
+ * Helper function for ring_read() that checks whether the bytes from the
+ * reader's position onwards may have been overwritten by the writer (since
+ * they were copied out).
+ *
+ * reader - reader to check
+ *
+ * Returns:
+ *      true iff the reader has lagged too far behind the writer
+ *
+ * */
+bool is_overwritten(RingReader* reader) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t reserved = __atomic_load_n(&reader->header->reserved,
+            __ATOMIC_RELAXED);
+    return reserved - reader->position > RING_CAPACITY;
+}
+
+/* skip_to_newest
+ * --------------
+ * Helper function for ring_read() that moves a lagging reader on to the
+ * next record to be written.
+ *
+ * reader - reader that lagged
+ * numSkipped - set to the number of bytes skipped
+ *
+ * Returns:
+ *      RING_LAGGED
+ *
+ * */
+int skip_to_newest(RingReader* reader, uint64_t* numSkipped) {
+    uint64_t committed = __atomic_load_n(&reader->header->committed,
+            __ATOMIC_ACQUIRE);
+    *numSkipped = committed - reader->position;
+    reader->position = committed;
+    return RING_LAGGED;
+}
+
+int ring_read(RingReader* reader, uint64_t* numSkipped) {
+    wait_for_record(reader);
+
+    //read the record's length, making sure it wasn't overwritten first
+    uint32_t length;
+    copy_out(reader->data, reader->position, &length, LENGTH_SIZE);
+    if (is_overwritten(reader)) {
+        return skip_to_newest(reader, numSkipped);
+    }
+    if (length == RING_OVERSIZED) {
+        reader->position += LENGTH_SIZE;
+        return RING_OVERSIZED_FRAME;
+    }
+
+    //then the frame itself
+    if (length + 1 > reader->frameSize) {
+        reader->frameSize = length + 1;
+        reader->frame = realloc(reader->frame, reader->frameSize);
+    }
+    copy_out(reader->data, reader->position + LENGTH_SIZE, reader->frame,
+            length);
+    if (is_overwritten(reader)) {
+        return skip_to_newest(reader, numSkipped);
+    }
+    reader->frame[length] = '\0';
+    reader->position += LENGTH_SIZE + length;
+    return RING_FRAME;
+}
+
+bool ring_has_frame(RingReader* reader) {
+    return __atomic_load_n(&reader->header->committed, __ATOMIC_ACQUIRE) !=
+            reader->position;
+}
+
+void ring_detach(RingReader* reader) {
+    munmap(reader->header, RING_SIZE);
+    free(reader->frame);
+    free(reader);
+}
@@ -0,0 +1,183 @@
+//shmring.h//
+//----------------------//
+//shmring.c abstracts away the shared memory rings psserver writes topics'
+//message frames into for subscribers on the same host
+//----------------------//
+
+#ifndef SHM_RING
+#define SHM_RING
+
+#include "lock.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* How shared memory rings work:
+ *
+ * A client subscribing with "sub <topic> shm=1" is replied to with
+ * ":shm <topic> <path>" rather than being added to the topic's subscribers.
+ * <path> names the topic's ring (a memfd, opened through /proc), which
+ * psserver writes every message frame published to the topic into exactly
+ * once, however many clients are reading it. Clients on the same host map
+ * the ring and read frames straight out of it, so fan-out to them costs no
+ * syscalls or copies on psserver's side. The socket is still used for
+ * control (sub/unsub) and for retained values.
+ *
+ * The ring holds records of the form [length][frame], wrapping around at
+ * RING_CAPACITY bytes. psserver never waits for readers, so a reader that
+ * falls more than RING_CAPACITY bytes behind has had its unread frames
+ * overwritten. Readers detect this and skip ahead to the newest frame.
+ *
+ * Readers spin briefly when they catch up, then sleep on a futex in the
+ * ring's header, which psserver only wakes (a syscall) if someone is
+ * actually asleep.
+ * */
+
+//number of bytes of frames a ring holds (a power of two)
+#define RING_CAPACITY (1 << 22)
+//records longer than this are replaced by an oversized marker
+#define RING_MAX_FRAME (RING_CAPACITY / 4)
+//length of the marker left in place of an oversized frame
+#define RING_OVERSIZED UINT32_MAX
+
+/* Defines the RingHeader structure, which sits at the start of a ring's
+ * shared memory (followed by the RING_CAPACITY bytes of records):
+ *
+ *      reserved - offset (in bytes ever written) the record being written
+ *                 ends at. Bytes before reserved - RING_CAPACITY may have
+ *                 been overwritten.
+ *      committed - offset every fully written record ends before
+ *      wakeups - futex word, bumped after each record is committed
+ *      numSleeping - number of readers asleep on wakeups
+ * */
+typedef struct {
+    uint64_t reserved;
+    uint64_t committed;
+    uint32_t wakeups;
+    uint32_t numSleeping;
+} RingHeader;
+
+/* Defines the ShmRing structure, which is psserver's (the writer's) handle
+ * on a ring:
+ *
+ *      header - ring's shared header
+ *      data - ring's records
+ *      fd - memfd holding the ring
+ *      path - path readers open the ring by
+ *      lock - lock serialising writers (publishers of the topic)
+ * */
+typedef struct ShmRing {
+    RingHeader* header;
+    char* data;
+    int fd;
+    char* path;
+    Mutex lock;
+} ShmRing;
+
+/* Defines the RingReader structure, which is a client's handle on a ring:
+ *
+ *      header - ring's shared header
+ *      data - ring's records
+ *      position - offset of the next record to read
+ *      frame - buffer the last frame read is copied into
+ *      frameSize - size of the buffer
+ * */
+typedef struct {
+    RingHeader* header;
+    char* data;
+    uint64_t position;
+    char* frame;
+    uint32_t frameSize;
+} RingReader;
+
+/* Each of these constants encodes the outcome of ring_read():
+ *
+ *      RING_FRAME - a frame was read
+ *      RING_LAGGED - the reader fell behind and frames were skipped
+ *      RING_OVERSIZED_FRAME - a frame was too large for the ring
+ * */
+enum RingReadCodes {
+    RING_FRAME,
+    RING_LAGGED,
+    RING_OVERSIZED_FRAME
+};
+
+/* ring_create
+ * -----------
+ * Creates an empty ring in a new memfd.
+ *
+ * name - name to give the memfd (for debugging)
+ *
+ * Returns:
+ *      the newly created ring, or NULL if it can't be created
+ *
+ * */
+ShmRing* ring_create(char* name);
+
+/* ring_adopt
+ * ----------
+ * Maps the ring held by the given memfd for writing, carrying on from
+ * wherever its last writer left off (eg: a ring handed over by a hot 
+ * restart, see handoff.h). Readers already attached are unaffected.
+ *
+ * fd - memfd holding the ring (owned by the ring from now on)
+ *
+ * Returns:
+ *      the ring, or NULL if it can't be mapped
+ *
+ * */
+ShmRing* ring_adopt(int fd);
+
+/* ring_write
+ * ----------
+ * Appends the given frame to the ring, waking any sleeping readers.
+ *
+ * ring - ring to write to
+ * frame - message frame (ie: "name:topic:value\n")
+ *
+ * */
+void ring_write(ShmRing* ring, char* frame);
+
+/* ring_attach
+ * -----------
+ * Maps the ring at the given path (see ":shm" above) for reading, starting
+ * from the newest frame.
+ *
+ * path - path of the ring
+ *
+ * Returns:
+ *      a reader for the ring, or NULL if it can't be mapped
+ *
+ * */
+RingReader* ring_attach(char* path);
+
+/* ring_read
+ * ---------
+ * Blocks until the next frame is written to the ring, then copies it into
+ * the reader's frame buffer.
+ *
+ * reader - reader to read with
+ * numSkipped - set to the number of bytes skipped if the reader lagged
+ *
+ * Returns:
+ *      one of the RingReadCodes (see above)
+ *
+ * */
+int ring_read(RingReader* reader, uint64_t* numSkipped);
+
+/* ring_has_frame
+ * --------------
+ * Returns true iff a frame has been written to the ring that the given 
+ * reader hasn't read yet (ie: ring_read() wouldn't block). Never blocks.
+ * */
+bool ring_has_frame(RingReader* reader);
+
+/* ring_detach
+ * -----------
+ * Unmaps a ring and frees the reader.
+ *
+ * reader - reader to free
+ *
+ * */
+void ring_detach(RingReader* reader);
+
+#endif //SHM_RING
@@ -0,0 +1,310 @@
+//snapshot.c//
+//----------------------//
+//This file abstracts away saving psserver's topic registry to a file and
+//restoring it when psserver starts
+//----------------------//
+
+#include "snapshot.h"
+#include "topic.h"
+#include "replication.h"
+#include "lock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define TMP_SUFFIX ".tmp"
+#define MAGIC_SIZE sizeof(SNAPSHOT_MAGIC)
+
+/* Defines the SnapshotReader structure, which holds where a restore is up
+ * to in a mapped snapshot:
+ *
+ *      pos - next byte to read
+ *      end - end of the snapshot
+ *      isValid - false once anything read ran past the end
+ * */
+typedef struct {
+    char* pos;
+    char* end;
+    bool isValid;
+} SnapshotReader;
+
+/* write_u32
+ * ---------
+ * Writes a uint32 to the given stream.
+ * */
+void write_u32(FILE* out, uint32_t value) {
+    fwrite(&value, sizeof(uint32_t), 1, out);
+}
+
+/* write_string
+ * ------------
+ * Writes a string (its length, then its bytes) to the given stream.
+ * */
+void write_string(FILE* out, char* str) {
+    uint32_t len = strlen(str);
+    write_u32(out, len);
+    fwrite(str, sizeof(char), len, out);
+}
+
+/* write_topic
+ * -----------
+ * Writes the given topic's retained values and consumer groups to the
+ * given stream.
+ *
+ * out - stream to write to
+ * topic - name of the topic
+ * entry - topic to write
+ *
+ * */
+void write_topic(FILE* out, char* topic, TopicEntry* entry) {
+    write_string(out, topic);
+    StringMapItem* keyItem = NULL;
+    uint32_t numRetained = 0;
+    uint32_t numGroups = 0;
+    take_mutex(&entry->retainedLock);
+    take_mutex(&entry->groupsLock);
+    while ((keyItem = stringmap_iterate(entry->retained, keyItem))) {
+        numRetained++;
+    }
+    for (ConsumerGroup* group = entry->groups; group; group = group->next) {
+        numGroups++;
+    }
+    write_u32(out, numRetained);
+    write_u32(out, numGroups);
+    while ((keyItem = stringmap_iterate(entry->retained, keyItem))) {
+        write_string(out, keyItem->key);
+        write_string(out, keyItem->item);
+    }
+    for (ConsumerGroup* group = entry->groups; group; group = group->next) {
+        write_string(out, group->name);
+        write_u32(out, group->balance);
+    }
+    release_mutex(&entry->groupsLock);
+    release_mutex(&entry->retainedLock);
+}
+
+bool save_snapshot(Broker* broker, char* path) {
+    //built in memory, so the topics are only locked while copying them
+    char* snapshot;
+    size_t snapshotLen;
+    FILE* out = open_memstream(&snapshot, &snapshotLen);
+    fwrite(SNAPSHOT_MAGIC, sizeof(char), MAGIC_SIZE, out);
+    //read first: the retained values saved may be newer, never older
+    int64_t logEnd = get_log_end(broker->replication);
+    fwrite(&logEnd, sizeof(int64_t), 1, out);
+    //number of topics, filled in once counted
+    long numTopicsAt = ftell(out);
+    write_u32(out, 0);
+
+    uint32_t numTopics = 0;
+    StringMapItem* topicItem = NULL;
+    take_read_lock(broker->stringMapLock);
+    while ((topicItem = stringmap_iterate(broker->stringMap, topicItem))) {
+        write_topic(out, topicItem->key, topicItem->item);
+        numTopics++;
+    }
+    release_read_lock(broker->stringMapLock);
+    fclose(out);
+    memcpy(snapshot + numTopicsAt, &numTopics, sizeof(uint32_t));
+
+    //written alongside, then renamed over the old snapshot
+    char* tmpPath = malloc(strlen(path) + strlen(TMP_SUFFIX) + 1);
+    sprintf(tmpPath, "%s%s", path, TMP_SUFFIX);
+    FILE* file = fopen(tmpPath, "w");
+    bool isSaved = file &&
+            fwrite(snapshot, sizeof(char), snapshotLen, file) == snapshotLen;
+    isSaved = file && !fflush(file) && !fsync(fileno(file)) && isSaved;
+    isSaved = file && !fclose(file) && isSaved;
+    isSaved = isSaved && !rename(tmpPath, path);
+    if (!isSaved) {
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+    free(snapshot);
+    return isSaved;
+}
+
+/* read_bytes
+ * ----------
+ * Reads the given number of bytes from the snapshot.
+ *
+ * Returns:
+ *      a pointer to the bytes (in the mapped snapshot), or NULL if there
+ *      aren't that many left
+ *
+ * */
+char* read_bytes(SnapshotReader* reader, size_t numBytes) {
+    if (!reader->isValid || (size_t)(reader->end - reader->pos) < numBytes) {
+        reader->isValid = false;
+        return NULL;
+    }
+    char* bytes = reader->pos;
+    reader->pos += numBytes;
+    return bytes;
+}
+
+/* read_u32
+ * --------
+ * Reads a uint32 from the snapshot (0 if there isn't one left).
+ * */
+uint32_t read_u32(SnapshotReader* reader) {
+    uint32_t value = 0;
+    char* bytes = read_bytes(reader, sizeof(uint32_t));
+    if (bytes) {
+        memcpy(&value, bytes, sizeof(uint32_t));
+    }
+    return value;
+}
+
+/* read_string
+ * -----------
+ * Reads a string from the snapshot.
+ *
+ * Returns:
+ *      a malloc'd copy of the string, or NULL if there isn't one left
+ *
+ * */
+char* read_string(SnapshotReader* reader) {
+    uint32_t len = read_u32(reader);
+    char* bytes = read_bytes(reader, len);
+    return bytes ? strndup(bytes, len) : NULL;
+}
+
+/* read_topic
+ * ----------
+ * Reads a topic from the snapshot and builds its TopicEntry.
+ *
+ * reader - where the restore is up to
+ * topic - set to the (malloc'd) name of the topic
+ *
+ * Returns:
+ *      the topic's entry, or NULL if the snapshot is cut short
+ *
+ * */
+TopicEntry* read_topic(SnapshotReader* reader, char** topic) {
+    *topic = read_string(reader);
+    uint32_t numRetained = read_u32(reader);
+    uint32_t numGroups = read_u32(reader);
+    TopicEntry* entry = init_topic_entry(init_client_list(NULL, true));
+    for (uint32_t i = 0; i < numRetained && reader->isValid; i++) {
+        char* key = read_string(reader);
+        char* frame = read_string(reader);
+        if (key && frame) {
+            //the entry takes ownership of the frame
+            set_retained_value(entry, key, frame);
+        } else {
+            free(frame);
+        }
+        free(key);
+    }
+    for (uint32_t i = 0; i < numGroups && reader->isValid; i++) {
+        char* name = read_string(reader);
+        uint32_t balance = read_u32(reader);
+        if (name && (balance == BALANCE_ROUND_ROBIN ||
+                balance == BALANCE_LEAST_QUEUED)) {
+            find_or_add_group(entry, name, balance);
+        }
+        free(name);
+    }
+    //NOTE: an entry cut short is leaked, as is one for a topic that was
+    //already restored (neither happens with a snapshot we wrote)
+    return reader->isValid ? entry : NULL;
+}
+
+int restore_snapshot(Broker* broker, char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) || (size_t)info.st_size < MAGIC_SIZE) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    char* snapshot = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snapshot == MAP_FAILED) {
+        return -1;
+    }
+    SnapshotReader reader = {snapshot, snapshot + info.st_size, true};
+    char* magic = read_bytes(&reader, MAGIC_SIZE);
+    int64_t logEnd = 0;
+    char* logEndBytes = read_bytes(&reader, sizeof(int64_t));
+    uint32_t numTopics = read_u32(&reader);
+    if (!reader.isValid || memcmp(magic, SNAPSHOT_MAGIC, MAGIC_SIZE)) {
+        munmap(snapshot, info.st_size);
+        return -1;
+    }
+    memcpy(&logEnd, logEndBytes, sizeof(int64_t));
+    restore_log_end(broker->replication, logEnd);
+
+    //the whole registry is rebuilt under one hold of the string map lock
+    int numRestored = 0;
+    take_write_lock(broker->stringMapLock);
+    for (uint32_t i = 0; i < numTopics && reader.isValid; i++) {
+        char* topic;
+        TopicEntry* entry = read_topic(&reader, &topic);
+        if (entry && topic && stringmap_add(broker->stringMap, topic, entry)) {
+            numRestored++;
+        }
+        free(topic);
+    }
+    release_write_lock(broker->stringMapLock);
+    munmap(snapshot, info.st_size);
+    return numRestored;
+}
+
+SnapshotArgs* init_snapshot_args(Broker* broker, char* path, int intervalMs) {
+    SnapshotArgs* args = calloc(1, sizeof(SnapshotArgs));
+    args->broker = broker;
+    args->path = path;
+    args->intervalMs = intervalMs;
+    sigemptyset(&args->signalMask);
+    sigaddset(&args->signalMask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &args->signalMask, NULL);
+    return args;
+}
+
+/* snapshot_thread
+ * ---------------
+ * The thread started by start_snapshot_thread(), which takes a snapshot
+ * every interval and whenever SIGUSR1 is received.
+ *
+ * arg - SnapshotArgs structure (void*)
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* snapshot_thread(void* arg) {
+    SnapshotArgs* args = (SnapshotArgs*)arg;
+    struct timespec interval = {args->intervalMs / MS_PER_SEC,
+            (long)(args->intervalMs % MS_PER_SEC) * NS_PER_MS};
+    while (true) {
+        int result = args->intervalMs ?
+                sigtimedwait(&args->signalMask, NULL, &interval) :
+                sigwaitinfo(&args->signalMask, NULL);
+        //interrupted by another signal
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (!save_snapshot(args->broker, args->path)) {
+            fprintf(stderr, "psserver: unable to write snapshot\n");
+        }
+    }
+}
+
+void start_snapshot_thread(SnapshotArgs* args) {
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, snapshot_thread, args);
+    pthread_detach(threadId);
+}
@@ -0,0 +1,112 @@
+//snapshot.h//
+//----------------------//
+//snapshot.c abstracts away saving psserver's topic registry to a file and
+//restoring it when psserver starts
+//----------------------//
+
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+#include "broker.h"
+#include <stdbool.h>
+#include <signal.h>
+
+/* How snapshots work:
+ *
+ * psserver given "snapshot=<path>" writes its topic registry to <path>:
+ * every topic, its retained values (one per key), its consumer groups (name
+ * and balancing) and the replication log's next offset. A snapshot is
+ * taken every "snapshotms=<ms>" (if given), and whenever psserver is sent
+ * SIGUSR1. It's written to "<path>.tmp" first and renamed over <path>, so a
+ * crash mid-write leaves the previous snapshot intact.
+ *
+ * When psserver starts it maps the snapshot and rebuilds the registry from
+ * it in one go, before accepting clients, so reconnecting clients find their
+ * topics, retained values and groups already there. Clients themselves
+ * aren't part of the snapshot (they resubscribe when they reconnect).
+ *
+ * The file is binary, in the host's byte order:
+ *
+ *      header:  magic ("PSSNAP1\0"), next offset (int64),
+ *               number of topics (uint32)
+ *      topic:   topic (string), number of retained values (uint32),
+ *               number of groups (uint32), then the retained values and
+ *               groups
+ *      retained value: key (string), frame (string)
+ *      group:   name (string), balance (uint32)
+ *
+ * where each string is a uint32 length followed by that many bytes.
+ * */
+
+//magic bytes a snapshot starts with
+#define SNAPSHOT_MAGIC "PSSNAP1"
+
+/* Defines the SnapshotArgs structure, which holds the arguments given to
+ * the snapshot thread:
+ *
+ *      broker - broker whose topic registry is saved
+ *      path - path of the snapshot
+ *      intervalMs - time (ms) between snapshots (0 if only taken on SIGUSR1)
+ *      signalMask - set of signals the thread waits for (just SIGUSR1)
+ * */
+typedef struct {
+    Broker* broker;
+    char* path;
+    int intervalMs;
+    sigset_t signalMask;
+} SnapshotArgs;
+
+/* save_snapshot
+ * -------------
+ * Saves the given broker's topic registry to the given path.
+ *
+ * broker - broker to save
+ * path - path of the snapshot
+ *
+ * Returns:
+ *      true iff the snapshot was saved
+ *
+ * */
+bool save_snapshot(Broker* broker, char* path);
+
+/* restore_snapshot
+ * ----------------
+ * Rebuilds the given (empty) broker's topic registry from the snapshot at
+ * the given path.
+ *
+ * broker - broker to restore into
+ * path - path of the snapshot
+ *
+ * Returns:
+ *      the number of topics restored, or -1 if there's no valid snapshot at
+ *      the path
+ *
+ * */
+int restore_snapshot(Broker* broker, char* path);
+
+/* init_snapshot_args
+ * ------------------
+ * Initialises the arguments given to the snapshot thread, blocking SIGUSR1
+ * in the calling thread (and so in every thread it starts from now on) so
+ * that only the snapshot thread receives it.
+ *
+ * broker - broker whose topic registry is saved
+ * path - path of the snapshot
+ * intervalMs - time (ms) between snapshots (0 if only taken on SIGUSR1)
+ *
+ * Returns:
+ *      the newly created SnapshotArgs structure
+ *
+ * */
+SnapshotArgs* init_snapshot_args(Broker* broker, char* path, int intervalMs);
+
+/* start_snapshot_thread
+ * ---------------------
+ * Starts the thread taking a snapshot every interval and on each SIGUSR1.
+ *
+ * args - arguments given to the thread (see init_snapshot_args())
+ *
+ * */
+void start_snapshot_thread(SnapshotArgs* args);
+
+#endif //SNAPSHOT
@@ -5,6 +5,8 @@
 
 #include "stats.h"
 #include "lock.h"
+#include "replication.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <semaphore.h>
@@ -19,8 +21,8 @@
 
 #define SUCCESS 0
 
-void update_stat(Stats* stats, int statType, sem_t* statsLock) {
-    take_lock(statsLock);
+void update_stat(Stats* stats, int statType, Mutex* statsLock) {
+    take_mutex(statsLock);
     switch (statType) {
         case INC_CLIENTS_CURR:
             stats->clientsCurr++;
@@ -40,8 +42,21 @@ void update_stat(Stats* stats, int statType, sem_t* statsLock) {
         case INC_UNSUB:
             stats->unsub++;
             break;
+        case INC_IDLE_DROPPED:
+            stats->idleDropped++;
+            break;
+        case INC_REJECTED:
+            stats->rejected++;
+            break;
+        case INC_REJECTED_PRIORITY:
+            stats->rejected++;
+            stats->rejectedPriority++;
+            break;
+        case INC_MSGS_DROPPED:
+            stats->msgsDropped++;
+            break;
     }
-    release_lock(statsLock);
+    release_mutex(statsLock);
 }
 
 Stats* stats_init() {
@@ -56,14 +71,21 @@ void print_statistics(Stats* stats) {
     fprintf(stderr, "pub operations:%d\n", stats->pub);
     fprintf(stderr, "sub operations:%d\n", stats->sub);
     fprintf(stderr, "unsub operations:%d\n", stats->unsub);
+    fprintf(stderr, "Idle clients dropped:%d\n", stats->idleDropped);
+    fprintf(stderr, "Rejected clients:%d (priority:%d)\n", stats->rejected,
+            stats->rejectedPriority);
+    fprintf(stderr, "Messages dropped:%d\n", stats->msgsDropped);
 }
 
-StatsThreadArgs* init_stats_thread_args(Stats* stats, sem_t* statsLock) {
+StatsThreadArgs* init_stats_thread_args(Stats* stats, Mutex* statsLock,
+        struct Replication* replication, struct WorkPool* pool) {
     //initialise struct itself
     StatsThreadArgs* sta = malloc(sizeof(StatsThreadArgs));  
     memset(sta, 0, sizeof(StatsThreadArgs));
     sta->stats = stats;
     sta->statsLock = statsLock;
+    sta->replication = replication;
+    sta->pool = pool;
 
     //REFERENCE:
     //  the following 7 lines of code are based off the example provided 
@@ -89,9 +111,12 @@ void* statistics_thread(void* arg) {
         if (result != SUCCESS) {
             //handle error
         }
-        take_lock(sta->statsLock);
+        take_mutex(sta->statsLock);
         print_statistics(sta->stats);
-        release_lock(sta->statsLock);
+        release_mutex(sta->statsLock);
+        print_replication_lag(sta->replication);
+        print_pool_stats(sta->pool, stderr);
+        print_lock_profiles(stderr);
     }
 }
 
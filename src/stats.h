@@ -6,9 +6,12 @@
 #ifndef STATS
 #define STATS
 
-#include <semaphore.h>
+#include "lock.h"
 #include <signal.h>
 
+struct Replication;
+struct WorkPool;
+
 /* Defines the Stats structure which holds various statistics of psserver 
  * and its clients. It holds the following variables:
  *
@@ -17,6 +20,14 @@
  *      pub - number of successful pub commands sent to psserver
  *      sub - number of successful sub commands sent to psserver
  *      unsub - number of successful unsub commands sent to psserver
+ *      idleDropped - number of clients disconnected for being idle (see
+ *                    check_liveness() in broker.c)
+ *      rejected - number of clients turned away as psserver was full (see 
+ *                 broker_admit_client() in broker.h)
+ *      rejectedPriority - how many of those were PRIORITY_HIGH clients
+ *      msgsDropped - number of messages dropped as the subscriber's 
+ *                    outbound queue was full (see queue_frame() in 
+ *                    session.c)
  * */
 typedef struct {
     int clientsCurr;
@@ -24,6 +35,10 @@ typedef struct {
     int pub;
     int sub;
     int unsub;
+    int idleDropped;
+    int rejected;
+    int rejectedPriority;
+    int msgsDropped;
 } Stats;
 
 /* Defines the StatsThreadArgs structure we pass the statistics thread we 
@@ -32,12 +47,18 @@ typedef struct {
  *      stats - Stats structure to hold psserver's current statistics
  *      signalMask - set of signals to block (just SIGHUP in our case)
  *      statsLock - lock to access the stats structure
+ *      replication - psserver's replication (see replication.h), whose
+ *                    followers' lag is printed with the statistics
+ *      pool - broker's worker pool (see pool.h), whose queue depth and
+ *             steals are printed with the statistics
  *
  * */
 typedef struct {
     Stats* stats; 
     sigset_t* signalMask;
-    sem_t* statsLock;
+    Mutex* statsLock;
+    struct Replication* replication;
+    struct WorkPool* pool;
 } StatsThreadArgs;
 
 /* Each of these constants encodes a certain type of stat update one may
@@ -52,12 +73,16 @@ enum StatChangeCodes {
     INC_CLIENTS_ALL,
     INC_PUB,
     INC_SUB,
-    INC_UNSUB
+    INC_UNSUB,
+    INC_IDLE_DROPPED,
+    INC_REJECTED,
+    INC_REJECTED_PRIORITY,
+    INC_MSGS_DROPPED
 };
 
 /* update_stat
  * -----------
- * This is a general method to update any of psserver's 5 stats it keeps 
+ * This is a general method to update any of psserver's stats it keeps 
  * track of. 
  *
  * stats - pointer to psserver's Stats structure
@@ -66,7 +91,7 @@ enum StatChangeCodes {
  * statsLock - lock on psserver's Stats structure
  *
  * */
-void update_stat(Stats* stats, int statType, sem_t* statsLock);
+void update_stat(Stats* stats, int statType, Mutex* statsLock);
 
 /* stats_init
  * ----------
@@ -92,17 +117,22 @@ void print_statistics(Stats* stats);
  *
  * stats - Stats structure to hold the psserver's current statistics
  * statsLock - lock to access the stats structure
+ * replication - psserver's replication
+ * pool - broker's worker pool
  *
  * Returns:
  *      the newly formed StatsThreadArgs structure
  * */
-StatsThreadArgs* init_stats_thread_args(Stats* stats, sem_t* statsLock);
+StatsThreadArgs* init_stats_thread_args(Stats* stats, Mutex* statsLock,
+        struct Replication* replication, struct WorkPool* pool);
 
 /* statistics_thread
  * -----------------
  * This is a thread that is spawned at the beginning of psserver's run-time.
  * It sits in an infinite loop until SIGHUP is detected, at which point, 
- * psserver's current statistics are printed out.
+ * psserver's current statistics (and its followers' replication lag, the
+ * worker pool's figures and the profiled locks' figures, see lock.h) are 
+ * printed out.
  *
  * arg - StatsThreadArgs structure 
  *
@@ -5,30 +5,27 @@
 
 /* This defines the Topic structure. This is a structure to be held
  * in a linked list that stores the StringMapItem corresponding to the topic 
- * and a pointer to the next in the list.
+ * and a pointer to the next in the list. The StringMapItem is stored first,
+ * in place, so the Topic holding an item handed out by stringmap_iterate()
+ * is found without searching the list.
  * */
 typedef struct Topic { 
-    StringMapItem* item;
+    StringMapItem item;
     struct Topic* next;
 } Topic;
 
-/* This is a structure to define the StringMap. It simply holds the head of 
- * a linked list of Topic structures.
+/* This is a structure to define the StringMap. It simply holds the head and
+ * tail of a linked list of Topic structures (both NULL if it's empty).
  * */
 struct StringMap { 
     Topic* head;
+    Topic* tail;
 };
 
 StringMap* stringmap_init() {
     //Our stringmap is a linked list of Topic structures, each of which stores
     //a StringMapItem and a next pointer
-    StringMap* sm = calloc(1, sizeof(StringMap));
-    //initialise head of linked list
-    Topic* head = calloc(1, sizeof(Topic));
-    head->item = NULL;
-    head->next = NULL;
-    sm->head = head;
-    return sm;
+    return calloc(1, sizeof(StringMap));
 }
 
 /* free_topic_mem
@@ -40,18 +37,14 @@ StringMap* stringmap_init() {
  *
  * */
 void free_topic_mem(Topic* topic) {
-    if (topic && topic->item && topic->item->key) {
-        free(topic->item->key);
-    }
-    if (topic && topic->item) {
-        free(topic->item);
-    }
-    if (topic) {
-        free(topic);
-    }
+    free(topic->item.key);
+    free(topic);
 }
 
 void stringmap_free(StringMap* sm) {
+    if (!sm) {
+        return;
+    }
     Topic* currTopic = sm->head;
     Topic* nextTopic;
     while (currTopic) {
@@ -63,7 +56,7 @@ void stringmap_free(StringMap* sm) {
     free(sm);
 }
 
-void* stringmap_search(StringMap* sm, char* key) {
+StringMapItem* stringmap_find(StringMap* sm, char* key) {
     //stringMap or key is NULL
     if (!sm || !key) {
         return NULL;
@@ -71,8 +64,8 @@ void* stringmap_search(StringMap* sm, char* key) {
 
     Topic* currTopic = sm->head;
     while (currTopic) {
-        if (currTopic->item && !strcmp(currTopic->item->key, key)) {
-            return currTopic->item->item;
+        if (!strcmp(currTopic->item.key, key)) {
+            return &currTopic->item;
         }
         currTopic = currTopic->next;
     }
@@ -80,6 +73,11 @@ void* stringmap_search(StringMap* sm, char* key) {
     return NULL;
 }
 
+void* stringmap_search(StringMap* sm, char* key) {
+    StringMapItem* smi = stringmap_find(sm, key);
+    return smi ? smi->item : NULL;
+}
+
 int stringmap_add(StringMap* sm, char* key, void* item) {
     //check no arguments are NULL
     if (!sm || !key || !item) {
@@ -87,32 +85,23 @@ int stringmap_add(StringMap* sm, char* key, void* item) {
     }
 
     //check item not alreay present
-    if (stringmap_search(sm, key)) {
+    if (stringmap_find(sm, key)) {
         return 0;
     }
 
-    //create StringMapItem for given key and item
-    StringMapItem* smi = calloc(1, sizeof(StringMapItem));
-    smi->key = strdup(key);
-    smi->item = item;
-
     //create new Topic structure to store this item in the StringMap
     Topic* topicToAdd = calloc(1, sizeof(Topic));
-    topicToAdd->item = smi;
+    topicToAdd->item.key = strdup(key);
+    topicToAdd->item.item = item;
     topicToAdd->next = NULL;
 
-    //add topic as head
-    Topic* currTopic = sm->head; 
-    if (!currTopic->item) {
-        currTopic->item = smi;
-        currTopic->next = NULL;
-        free(topicToAdd);
-        return 1;
+    //add topic at the tail
+    if (sm->tail) {
+        sm->tail->next = topicToAdd;
+    } else {
+        sm->head = topicToAdd;
     }
-    while (currTopic->next) {
-        currTopic = currTopic->next;
-    }
-    currTopic->next = topicToAdd;
+    sm->tail = topicToAdd;
     return 1;
 }
 
@@ -123,24 +112,23 @@ int stringmap_remove(StringMap* sm, char* key) {
     //iterate through ourselves because we need the previous Topic
     Topic* currTopic = sm->head;
     Topic* prev = NULL;
-    Topic* temp = NULL;
 
     while (currTopic) {
-        if (currTopic->item && !strcmp(currTopic->item->key, key)) {
-            //remove head
-            if (currTopic == sm->head) {
+        if (!strcmp(currTopic->item.key, key)) {
+            //unlink the Topic, then clean it up
+            if (prev) {
+                prev->next = currTopic->next;
+            } else {
                 sm->head = currTopic->next;
-                free_topic_mem(currTopic);
-                return 1;
             }
-            //remove any other Topic
-            prev->next = currTopic->next;
-            //cleanup removed Topic
+            if (currTopic == sm->tail) {
+                sm->tail = prev;
+            }
             free_topic_mem(currTopic);
+            return 1;
         }
-        temp = currTopic;
+        prev = currTopic;
         currTopic = currTopic->next;
-        prev = temp;
     }
     //not found
     return 0;
@@ -152,23 +140,10 @@ StringMapItem* stringmap_iterate(StringMap* sm, StringMapItem* prev) {
         return NULL;
     }
     //return first entry
-    if (!prev && sm->head) {
-        return sm->head->item;
+    if (!prev) {
+        return sm->head ? &sm->head->item : NULL;
     }
-    //return next entry
-    Topic* currTopic = sm->head;
-    while (currTopic) {
-        if (currTopic->item == prev) {
-            return currTopic->next ? currTopic->next->item : NULL;
-        }
-        currTopic = currTopic->next;
-    }
-    //not found
-    return NULL;
+    //return next entry - prev is the start of its Topic
+    Topic* prevTopic = (Topic*)prev;
+    return prevTopic->next ? &prevTopic->next->item : NULL;
 }
-
-
-
-
- 
-
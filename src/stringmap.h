@@ -15,6 +15,10 @@ void stringmap_free(StringMap *sm);
 // Search a stringmap for a given key, returning a pointer to the entry
 // if found, else NULL. If not found or sm is NULL or key is NULL then returns NULL.
 void *stringmap_search(StringMap *sm, char *key);
+// Search a stringmap for a given key, returning its StringMapItem if found
+// (so the item can be replaced in place), else NULL. Returns NULL if sm or
+// key is NULL.
+StringMapItem *stringmap_find(StringMap *sm, char *key);
 // Add an item into the stringmap, return 1 if success else 0 (e.g. an item
 // with that key is already present or any one of the arguments is NULL)
 // The 'key' string is copied before being stored in the stringmap.
@@ -31,6 +35,8 @@ int stringmap_remove(StringMap *sm, char *key);
 // and the "next" entry will be returned.
 // This operation is not thread-safe - any changes to the stringmap between successive
 // calls to stringmap_iterate may result in undefined behaviour.
+// Each call takes constant time, so iterating through the whole stringmap is
+// linear in its size.
 // Returns NULL if no more items to examine or sm is NULL.
 // There is no expectation that items are returned in a particular order (i.e.
 // the order does not have to be the same order in which items were added).
@@ -0,0 +1,207 @@
+//timerwheel.c//
+//----------------------//
+//This file abstracts away psserver's timers (eg: for idle connections), kept
+//in a hierarchical timer wheel ticked by a single thread (see timerwheel.h)
+//----------------------//
+
+#include "timerwheel.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+//mask taking a slot's index from a tick
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+//furthest ahead (in ticks) a timer can be armed
+#define MAX_DELAY_TICKS ((1L << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1)
+
+/* wheel_clock_ms
+ * --------------
+ * Returns the current time (CLOCK_MONOTONIC) in milliseconds.
+ * */
+long wheel_clock_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * MS_PER_SEC + now.tv_nsec / NS_PER_MS;
+}
+
+TimerWheel* timer_wheel_init(void) {
+    TimerWheel* wheel = calloc(1, sizeof(TimerWheel));
+    wheel->start = wheel_clock_ms();
+    init_mutex(&wheel->lock, "timerWheelLock");
+    return wheel;
+}
+
+void init_timer(Timer* timer, long (*fire)(void* arg), void* arg) {
+    timer->next = NULL;
+    timer->link = NULL;
+    timer->expiresAt = 0;
+    timer->fire = fire;
+    timer->arg = arg;
+}
+
+/* place_timer
+ * -----------
+ * Links the given timer into the slot its expiry falls in: the lowest level
+ * whose range covers it. A timer already due goes in the current slot of
+ * level 0. The wheel's lock must be held.
+ * */
+void place_timer(TimerWheel* wheel, Timer* timer) {
+    long delta = timer->expiresAt - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+            delta >= 1L << (WHEEL_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    Timer** slot = &wheel->slots[level][(timer->expiresAt >>
+            (WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->link = &timer->next;
+    }
+    *slot = timer;
+    timer->link = slot;
+}
+
+/* unlink_timer
+ * ------------
+ * Takes the given (armed) timer out of its slot. The wheel's lock must be
+ * held.
+ * */
+void unlink_timer(Timer* timer) {
+    *timer->link = timer->next;
+    if (timer->next) {
+        timer->next->link = timer->link;
+    }
+    timer->next = NULL;
+    timer->link = NULL;
+}
+
+/* schedule_timer
+ * --------------
+ * Arms the given timer to fire the given number of milliseconds from now
+ * (at least one tick). The wheel's lock must be held.
+ * */
+void schedule_timer(TimerWheel* wheel, Timer* timer, long delayMs) {
+    long ticks = (delayMs + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > MAX_DELAY_TICKS) {
+        ticks = MAX_DELAY_TICKS;
+    }
+    timer->expiresAt = wheel->now + ticks;
+    place_timer(wheel, timer);
+}
+
+void arm_timer(TimerWheel* wheel, Timer* timer, long delayMs) {
+    take_mutex(&wheel->lock);
+    if (timer->link) {
+        unlink_timer(timer);
+    }
+    schedule_timer(wheel, timer, delayMs);
+    release_mutex(&wheel->lock);
+}
+
+void cancel_timer(TimerWheel* wheel, Timer* timer) {
+    take_mutex(&wheel->lock);
+    if (timer->link) {
+        unlink_timer(timer);
+    }
+    release_mutex(&wheel->lock);
+}
+
+long timer_wheel_now(TimerWheel* wheel) {
+    return __atomic_load_n(&wheel->now, __ATOMIC_RELAXED) * WHEEL_TICK_MS;
+}
+
+/* cascade_slot
+ * ------------
+ * Empties the given slot of the given level down into the levels below it
+ * (now that the wheel has reached the range the slot covers). The wheel's
+ * lock must be held.
+ * */
+void cascade_slot(TimerWheel* wheel, int level, int index) {
+    Timer* timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer) {
+        Timer* next = timer->next;
+        place_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+/* turn_wheel
+ * ----------
+ * Advances the given wheel by one tick: cascading down any level that has
+ * turned over, then firing the timers in the new current slot of level 0
+ * (rearming any whose fire function asks to be). The wheel's lock must be
+ * held.
+ * */
+void turn_wheel(TimerWheel* wheel) {
+    long now = __atomic_add_fetch(&wheel->now, 1, __ATOMIC_RELAXED);
+    //each level turns over when every level below it has
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (now & ((1L << (WHEEL_SLOT_BITS * level)) - 1)) {
+            break;
+        }
+        cascade_slot(wheel, level,
+                (now >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+    }
+
+    //detached first, so timers rearmed as they fire land in a later slot
+    Timer* timer = wheel->slots[0][now & SLOT_MASK];
+    wheel->slots[0][now & SLOT_MASK] = NULL;
+    while (timer) {
+        Timer* next = timer->next;
+        timer->next = NULL;
+        timer->link = NULL;
+        long delayMs = timer->fire(timer->arg);
+        if (delayMs != TIMER_DONE) {
+            schedule_timer(wheel, timer, delayMs);
+        }
+        timer = next;
+    }
+}
+
+/* timer_wheel_thread
+ * ------------------
+ * Turns the given wheel once every WHEEL_TICK_MS, catching up on any ticks
+ * missed (eg: while the thread wasn't scheduled) so the wheel keeps to the
+ * clock.
+ *
+ * arg - TimerWheel structure
+ *
+ * Exits:
+ *      when psserver exits
+ *
+ * */
+void* timer_wheel_thread(void* arg) {
+    TimerWheel* wheel = (TimerWheel*)arg;
+    struct timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    while (true) {
+        wake.tv_nsec += WHEEL_TICK_MS * NS_PER_MS;
+        if (wake.tv_nsec >= MS_PER_SEC * NS_PER_MS) {
+            wake.tv_sec++;
+            wake.tv_nsec -= MS_PER_SEC * NS_PER_MS;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL)
+                == EINTR) {
+        }
+        long dueTicks = (wheel_clock_ms() - wheel->start) / WHEEL_TICK_MS;
+        take_mutex(&wheel->lock);
+        while (wheel->now < dueTicks) {
+            turn_wheel(wheel);
+        }
+        release_mutex(&wheel->lock);
+    }
+    return NULL;
+}
+
+void start_timer_wheel(TimerWheel* wheel) {
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, timer_wheel_thread, wheel);
+    pthread_detach(threadId);
+}
@@ -0,0 +1,124 @@
+//timerwheel.h//
+//----------------------//
+//timerwheel.c abstracts away psserver's timers (eg: for idle connections),
+//kept in a hierarchical timer wheel ticked by a single thread
+//----------------------//
+
+#ifndef TIMER_WHEEL
+#define TIMER_WHEEL
+
+#include "lock.h"
+#include <stdbool.h>
+
+//length of one tick of the wheel (ie: the resolution of its timers)
+#define WHEEL_TICK_MS 10
+//number of levels, and the number of slots in each level (a power of 2)
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+//returned by a timer's fire function to leave it unarmed
+#define TIMER_DONE -1
+
+/* How the wheel works:
+ *
+ * Each level is a ring of WHEEL_SLOTS slots, each a list of timers. A slot
+ * of level 0 covers one tick, a slot of level 1 covers a whole turn of
+ * level 0 (WHEEL_SLOTS ticks), and so on, so 4 levels of 64 slots cover
+ * 64^4 ticks (about 2 days) with only 256 lists. A timer goes in the lowest
+ * level whose range covers its expiry, so arming or cancelling one is O(1)
+ * however many are armed. Each tick the wheel fires the timers in the
+ * current slot of level 0, and each time a level turns over the next slot
+ * of the level above is emptied down into the levels below it (a timer is
+ * only moved once per level on its way down).
+ *
+ * Timers are intrusive (embedded in whatever they time) and are fired by
+ * the wheel's thread while holding the wheel's lock, so once cancel_timer()
+ * returns the timer isn't firing and won't again. Fire functions must
+ * therefore be quick and mustn't block (or arm/cancel timers themselves -
+ * they rearm their own timer by returning a delay instead).
+ * */
+
+/* Defines the Timer structure, which is embedded in anything timed:
+ *
+ *      next - next timer in the same slot
+ *      link - pointer to the pointer to this timer (the slot's head or the
+ *             previous timer's next), NULL if the timer isn't armed
+ *      expiresAt - tick the timer fires on
+ *      fire - function called when the timer fires (with arg), returning
+ *             how many milliseconds later to fire it again, or TIMER_DONE
+ *      arg - argument given to fire
+ * */
+typedef struct Timer {
+    struct Timer* next;
+    struct Timer** link;
+    long expiresAt;
+    long (*fire)(void* arg);
+    void* arg;
+} Timer;
+
+/* Defines the TimerWheel structure, which holds every armed timer:
+ *
+ *      slots - each level's ring of slots (lists of timers)
+ *      now - number of ticks the wheel has turned since it was created
+ *      start - time the wheel was created (CLOCK_MONOTONIC, milliseconds)
+ *      lock - lock protecting the wheel
+ * */
+typedef struct {
+    Timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    long now;
+    long start;
+    Mutex lock;
+} TimerWheel;
+
+/* timer_wheel_init
+ * ----------------
+ * Initialises a wheel with no timers armed. It doesn't turn until
+ * start_timer_wheel() is called.
+ *
+ * Returns:
+ *      the newly created TimerWheel structure
+ *
+ * */
+TimerWheel* timer_wheel_init(void);
+
+/* start_timer_wheel
+ * -----------------
+ * Starts the thread turning the given wheel (one tick every WHEEL_TICK_MS).
+ * */
+void start_timer_wheel(TimerWheel* wheel);
+
+/* init_timer
+ * ----------
+ * Initialises the given (unarmed) timer to call the given function with the
+ * given argument when it fires.
+ * */
+void init_timer(Timer* timer, long (*fire)(void* arg), void* arg);
+
+/* arm_timer
+ * ---------
+ * Arms the given timer to fire once the given delay has passed (rounded up
+ * to a whole tick), rearming it if it's already armed.
+ *
+ * wheel - wheel to arm the timer on
+ * timer - timer to arm (see init_timer())
+ * delayMs - delay in milliseconds
+ *
+ * */
+void arm_timer(TimerWheel* wheel, Timer* timer, long delayMs);
+
+/* cancel_timer
+ * ------------
+ * Disarms the given timer (if it's armed). Once this returns the timer's
+ * fire function isn't running and won't be called again.
+ * */
+void cancel_timer(TimerWheel* wheel, Timer* timer);
+
+/* timer_wheel_now
+ * ---------------
+ * Retreives the wheel's time, ie: the milliseconds it has turned since it
+ * was created. This is only as fine as a tick, but costs a single load, so
+ * it can be read on every command.
+ * */
+long timer_wheel_now(TimerWheel* wheel);
+
+#endif //TIMER_WHEEL
@@ -0,0 +1,316 @@
+//topic.c//
+//----------------------//
+//This file abstracts away the per-topic state the server keeps in its
+//string map (subscribers, consumer groups, retained values)
+//----------------------//
+
+#include "topic.h"
+#include "lock.h"
+#include "session.h"
+#include <stdlib.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+//number of chars a frame adds to the message: two colons and a newline
+#define FRAME_OVERHEAD 3
+//max number of publishes a sequencer's owner delivers at a time
+#define SEQUENCE_BATCH 32
+
+TopicEntry* init_topic_entry(ClientListItem* subscribers) {
+    TopicEntry* entry = mpsc_alloc(sizeof(TopicEntry));
+    entry->subscribers = subscribers;
+    entry->groups = NULL;
+    init_mutex(&entry->groupsLock, NULL);
+    entry->retained = stringmap_init();
+    init_mutex(&entry->retainedLock, NULL);
+    mpsc_init(&entry->sequencer.queue);
+    init_mutex(&entry->sequencer.lock, NULL);
+    return entry;
+}
+
+TopicEntry* find_or_add_topic(StringMap* topics, RwLock* topicsLock, 
+        char* topic) {
+    //topics nearly always exist already, so look for it as a reader first
+    take_read_lock(topicsLock);
+    TopicEntry* entry = stringmap_search(topics, topic);
+    release_read_lock(topicsLock);
+    if (entry) {
+        return entry;
+    }
+    //search again, in case it was added while the lock was free
+    take_write_lock(topicsLock);
+    entry = stringmap_search(topics, topic);
+    if (!entry) {
+        entry = init_topic_entry(init_client_list(NULL, true));
+        stringmap_add(topics, topic, entry);
+    }
+    release_write_lock(topicsLock);
+    return entry;
+}
+
+char* build_message_frame(char* name, char* topic, char* value) {
+    int frameLen = strlen(name) + strlen(topic) + strlen(value) +
+            FRAME_OVERHEAD;
+    char* frame = malloc(sizeof(char) * (frameLen + 1));
+    sprintf(frame, "%s:%s:%s\n", name, topic, value);
+    return frame;
+}
+
+char* get_frame_topic(char* frame) {
+    //the topic sits between the first two colons
+    char* topicStart = strchr(frame, ':');
+    char* topicEnd = topicStart ? strchr(topicStart + 1, ':') : NULL;
+    if (!topicEnd) {
+        return NULL;
+    }
+    return strndup(topicStart + 1, topicEnd - topicStart - 1);
+}
+
+void set_retained_value(TopicEntry* entry, char* key, char* frame) {
+    //swap the frames while holding the lock, but free the old one outside it
+    char* oldFrame = NULL;
+    take_mutex(&entry->retainedLock);
+    StringMapItem* keyItem = stringmap_find(entry->retained, key);
+    if (keyItem) {
+        oldFrame = keyItem->item;
+        keyItem->item = frame;
+    } else {
+        //key not retained yet
+        stringmap_add(entry->retained, key, frame);
+    }
+    release_mutex(&entry->retainedLock);
+    free(oldFrame);
+}
+
+char* get_retained_value(TopicEntry* entry) {
+    StringMapItem* currItem = NULL;
+    int framesLen = 0;
+    char* frames = NULL;
+    take_mutex(&entry->retainedLock);
+    while ((currItem = stringmap_iterate(entry->retained, currItem))) {
+        framesLen += strlen(currItem->item);
+    }
+    if (framesLen) {
+        frames = calloc(framesLen + 1, sizeof(char));
+        char* end = frames;
+        while ((currItem = stringmap_iterate(entry->retained, currItem))) {
+            end = stpcpy(end, currItem->item);
+        }
+    }
+    release_mutex(&entry->retainedLock);
+    return frames;
+}
+
+void write_retained(TopicEntry* entry, FILE* out) {
+    StringMapItem* currItem = NULL;
+    take_mutex(&entry->retainedLock);
+    while ((currItem = stringmap_iterate(entry->retained, currItem))) {
+        fprintf(out, "%s:%s", currItem->key, (char*)currItem->item);
+    }
+    release_mutex(&entry->retainedLock);
+}
+
+ConsumerGroup* find_group(TopicEntry* entry, char* name) {
+    take_mutex(&entry->groupsLock);
+    ConsumerGroup* group = entry->groups;
+    while (group && strcmp(group->name, name)) {
+        group = group->next;
+    }
+    release_mutex(&entry->groupsLock);
+    return group;
+}
+
+ConsumerGroup* find_or_add_group(TopicEntry* entry, char* name, int balance) {
+    take_mutex(&entry->groupsLock);
+    ConsumerGroup* group = entry->groups;
+    ConsumerGroup* last = NULL;
+    while (group && strcmp(group->name, name)) {
+        last = group;
+        group = group->next;
+    }
+    //group doesn't exist - create it at the end of the list
+    if (!group) {
+        group = calloc(1, sizeof(ConsumerGroup));
+        group->name = strdup(name);
+        group->members = init_client_list(NULL, true);
+        group->balance = balance;
+        init_mutex(&group->lock, NULL);
+        if (last) {
+            last->next = group;
+        } else {
+            entry->groups = group;
+        }
+    }
+    release_mutex(&entry->groupsLock);
+    return group;
+}
+
+bool join_group(ConsumerGroup* group, Client* client) {
+    take_mutex(&group->lock);
+    //ignore if client already a member
+    if (search(group->members, client)) {
+        release_mutex(&group->lock);
+        return false;
+    }
+    add_client(group->members, client);
+    release_mutex(&group->lock);
+    return true;
+}
+
+bool leave_group(ConsumerGroup* group, Client* client) {
+    take_mutex(&group->lock);
+    ClientListItem* newHead = remove_client(group->members, client);
+    if (newHead) {
+        group->members = newHead;
+        //the removed member may have been next in line, so start again
+        group->nextMember = NULL;
+    }
+    release_mutex(&group->lock);
+    return newHead;
+}
+
+void leave_all_groups(TopicEntry* entry, Client* client) {
+    take_mutex(&entry->groupsLock);
+    ConsumerGroup* group = entry->groups;
+    while (group) {
+        leave_group(group, client);
+        group = group->next;
+    }
+    release_mutex(&entry->groupsLock);
+}
+
+bool has_local_subscribers(TopicEntry* entry) {
+    if (entry->ring) {
+        return true;
+    }
+    ClientListItem* currItem = entry->subscribers;
+    while (currItem) {
+        if (!currItem->isPlaceholder && !currItem->client->isPeer) {
+            return true;
+        }
+        currItem = currItem->next;
+    }
+    //any non-empty consumer group counts
+    bool hasMembers = false;
+    take_mutex(&entry->groupsLock);
+    ConsumerGroup* group = entry->groups;
+    while (group && !hasMembers) {
+        take_mutex(&group->lock);
+        hasMembers = !group->members->isPlaceholder;
+        release_mutex(&group->lock);
+        group = group->next;
+    }
+    release_mutex(&entry->groupsLock);
+    return hasMembers;
+}
+
+/* queued_bytes
+ * ------------
+ * Helper function for pick_member() that retreives the number of bytes 
+ * still queued (ie: not yet sent) on the given client's socket.
+ *
+ * client - client to check
+ *
+ * Returns:
+ *      number of queued bytes (INT_MAX if it can't be determined)
+ *
+ * */
+int queued_bytes(Client* client) {
+    int numQueued;
+    if (ioctl(fileno(client->serverToClient), SIOCOUTQ, &numQueued)) {
+        return INT_MAX;
+    }
+    return numQueued;
+}
+
+/* pick_member
+ * -----------
+ * Helper function for publish_to_groups() that chooses which member of the
+ * given group a message is sent to.
+ *
+ * NOTE: the group's lock must be held by the caller
+ *
+ * group - group to pick from
+ *
+ * Returns:
+ *      the chosen member, or NULL if the group has no members
+ *
+ * */
+Client* pick_member(ConsumerGroup* group) {
+    //an empty group is represented by a placeholder head
+    if (group->members->isPlaceholder) {
+        return NULL;
+    }
+    if (group->balance == BALANCE_LEAST_QUEUED) {
+        ClientListItem* currItem = group->members;
+        Client* leastQueued = currItem->client;
+        int leastNumQueued = queued_bytes(leastQueued);
+        while ((currItem = currItem->next)) {
+            int numQueued = queued_bytes(currItem->client);
+            if (numQueued < leastNumQueued) {
+                leastQueued = currItem->client;
+                leastNumQueued = numQueued;
+            }
+        }
+        return leastQueued;
+    }
+    //round robin - take the next member in line, wrapping around to the head
+    ClientListItem* chosen = group->nextMember ? group->nextMember : 
+            group->members;
+    group->nextMember = chosen->next;
+    return chosen->client;
+}
+
+void publish_to_groups(TopicEntry* entry, char* frame, Credit* credit) {
+    take_mutex(&entry->groupsLock);
+    ConsumerGroup* group = entry->groups;
+    while (group) {
+        //the member is written to while holding the group's lock so they
+        //can't leave (and be cleaned up) part way through
+        take_mutex(&group->lock);
+        Client* member = pick_member(group);
+        if (member) {
+            send_frame(member, frame, credit);
+        }
+        release_mutex(&group->lock);
+        group = group->next;
+    }
+    release_mutex(&entry->groupsLock);
+}
+
+/* take_sequenced
+ * --------------
+ * Takes the oldest publish off the given sequencer's queue, which the 
+ * caller knows is there (from numPending), yielding while its publisher is
+ * still part way through queueing it.
+ * */
+SequencedItem* take_sequenced(Sequencer* sequencer) {
+    MpscNode* node;
+    while (!(node = mpsc_pop(&sequencer->queue))) {
+        sched_yield();
+    }
+    return (SequencedItem*)node;
+}
+
+bool queue_in_sequence(Sequencer* sequencer, SequencedItem* item) {
+    //counted before it's queued, so the count never runs behind the queue
+    bool isOwner = !__atomic_fetch_add(&sequencer->numPending, 1, 
+            __ATOMIC_ACQ_REL);
+    mpsc_push(&sequencer->queue, &item->node);
+    return isOwner;
+}
+
+bool deliver_sequence(Sequencer* sequencer, void (*deliver)(void* item)) {
+    for (int i = 0; i < SEQUENCE_BATCH; i++) {
+        //NOTE: the item is freed by deliver
+        deliver(take_sequenced(sequencer)->item);
+        if (!__atomic_sub_fetch(&sequencer->numPending, 1, __ATOMIC_ACQ_REL)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,345 @@
+//topic.h//
+//----------------------//
+//topic.c abstracts away the per-topic state the server keeps in its
+//string map (subscribers, consumer groups, retained values)
+//----------------------//
+
+#ifndef TOPIC
+#define TOPIC
+
+#include "clientList.h"
+#include "stringmap.h"
+#include "shmring.h"
+#include "lock.h"
+#include "mpsc.h"
+#include <semaphore.h>
+
+//key the (unkeyed) retained value of a topic is stored under
+#define NO_KEY ""
+
+/* Each of these constants encodes a way a consumer group may balance the
+ * messages published to its topic between its members:
+ *
+ *      BALANCE_ROUND_ROBIN - each member takes a turn
+ *      BALANCE_LEAST_QUEUED - the member with the fewest bytes still queued
+ *                             on its socket is chosen
+ * */
+enum BalanceCodes {
+    BALANCE_ROUND_ROBIN,
+    BALANCE_LEAST_QUEUED
+};
+
+/* Defines the ConsumerGroup structure, which represents a named group of
+ * clients sharing a topic such that each message published to the topic 
+ * goes to exactly one of them. It holds the following:
+ *
+ *      name - name of the group
+ *      members - linked list of clients in the group 
+ *      nextMember - member who is next in line (round robin balancing)
+ *      balance - one of the BalanceCodes (see above)
+ *      lock - lock protecting the group's members
+ *      next - next group of the same topic
+ * */
+typedef struct ConsumerGroup {
+    char* name;
+    ClientListItem* members;
+    ClientListItem* nextMember;
+    int balance;
+    Mutex lock;
+    struct ConsumerGroup* next;
+} ConsumerGroup;
+
+/* Defines the SequencedItem structure, which is a publish waiting its turn
+ * in a topic's sequencer (see queue_in_sequence()). It's allocated along 
+ * with the publish, which the sequencer's deliver function frees:
+ *
+ *      node - links the item into the sequencer's queue (see mpsc.h)
+ *      item - publish to deliver (given to the sequencer's deliver function)
+ * */
+typedef struct {
+    MpscNode node;
+    void* item;
+} SequencedItem;
+
+/* Defines the Sequencer structure, which puts the publishes to a topic into
+ * a single order. Publishers queue their publish and carry on, and whoever
+ * owns the sequencer delivers the queue in order, so every subscriber sees
+ * the same order however many threads publish at once:
+ *
+ *      queue - publishes not yet delivered, oldest first
+ *      numPending - number of publishes queued (or about to be) and not yet
+ *                   delivered. The publisher taking it from 0 owns the 
+ *                   sequencer until it's back to 0.
+ *      lock - lock held by publishers who must do something in the same 
+ *             order their publish is queued in (eg: retaining it)
+ * */
+typedef struct {
+    MpscQueue queue;
+    int numPending;
+    Mutex lock;
+} Sequencer;
+
+/* Defines the TopicEntry structure, which is the item stored against each
+ * topic key in psserver's string map. It holds the following:
+ *
+ *      subscribers - linked list of clients subscribed to the topic (see
+ *                    clientList.h)
+ *      numSubscribers - number of clients in subscribers
+ *      groups - linked list of the topic's consumer groups
+ *      groupsLock - lock protecting the list of consumer groups
+ *      retained - string map from keys to the newest message frame
+ *                 (ie: "name:topic:value\n") retained under that key. The 
+ *                 plain "retain=1" value is stored under NO_KEY. 
+ *      retainedLock - lock protecting the retained frames
+ *      ring - shared memory ring every frame published to the topic is
+ *             written into (see shmring.h), NULL until a client first 
+ *             subscribes with "shm=1". Once created it's kept for the 
+ *             lifetime of the server.
+ *      sequencer - orders the publishes to the topic (see 
+ *                  queue_in_sequence())
+ *
+ * NOTE: keyed publishes compact the topic down to one frame per key, so 
+ * replaying a topic's state to a new subscriber is bounded by the number of
+ * keys rather than the number of publishes.
+ *
+ * NOTE: the retained frames and consumer groups have their own locks so 
+ * that reading/updating them never happens while holding the string map lock
+ * */
+typedef struct {
+    ClientListItem* subscribers;
+    int numSubscribers;
+    ConsumerGroup* groups;
+    Mutex groupsLock;
+    StringMap* retained;
+    Mutex retainedLock;
+    ShmRing* ring;
+    Sequencer sequencer;
+} TopicEntry;
+
+/* init_topic_entry
+ * ----------------
+ * Initialises a new TopicEntry with the given list of subscribers and no
+ * retained value.
+ *
+ * subscribers - head of the topic's linked list of clients
+ *
+ * Returns:
+ *      the newly created TopicEntry
+ *
+ * */
+TopicEntry* init_topic_entry(ClientListItem* subscribers);
+
+/* find_or_add_topic
+ * -----------------
+ * Retreives the TopicEntry of the given topic, creating it (with an empty,
+ * placeholder list of subscribers) if it doesn't exist yet.
+ *
+ * NOTE: the search and add happen under the same hold of the string map 
+ * lock, so two clients can't race to create the same topic
+ *
+ * topics - psserver's string map of topics
+ * topicsLock - lock for the string map
+ * topic - topic to find or add
+ *
+ * Returns:
+ *      the topic's TopicEntry
+ *
+ * */
+TopicEntry* find_or_add_topic(StringMap* topics, RwLock* topicsLock, 
+        char* topic);
+
+/* build_message_frame
+ * -------------------
+ * Builds the message frame psserver sends to subscribers when a value is
+ * published to a topic, ie: "name:topic:value\n".
+ *
+ * name - name of the publishing client
+ * topic - topic published to
+ * value - value published
+ *
+ * Returns:
+ *      the malloc'd frame
+ *
+ * */
+char* build_message_frame(char* name, char* topic, char* value);
+
+/* get_frame_topic
+ * ---------------
+ * Retreives the topic of the given message frame (ie: the "topic" of 
+ * "name:topic:value").
+ *
+ * frame - message frame
+ *
+ * Returns:
+ *      a malloc'd copy of the topic, or NULL if the frame is malformed
+ *
+ * */
+char* get_frame_topic(char* frame);
+
+/* set_retained_value
+ * ------------------
+ * Replaces the frame retained under the given key of the given topic with 
+ * the given frame. The topic takes ownership of the frame and the old frame
+ * (if any) is free()'d.
+ *
+ * entry - topic to update
+ * key - key to retain the frame under (NO_KEY for a plain retained value)
+ * frame - new retained frame (see build_message_frame())
+ *
+ * */
+void set_retained_value(TopicEntry* entry, char* key, char* frame);
+
+/* get_retained_value
+ * ------------------
+ * Retreives a copy of all the frames retained by the given topic (ie: the
+ * newest frame for each key), concatenated together.
+ *
+ * entry - topic to query
+ *
+ * Returns:
+ *      a malloc'd copy of the retained frames, or NULL if the topic has no
+ *      retained values
+ *
+ * */
+char* get_retained_value(TopicEntry* entry);
+
+/* write_retained
+ * --------------
+ * Writes each frame retained by the given topic to the given stream, 
+ * prefixed by the key it's retained under (ie: "key:name:topic:value\n").
+ *
+ * entry - topic to write out
+ * out - stream to write to
+ *
+ * */
+void write_retained(TopicEntry* entry, FILE* out);
+
+/* find_or_add_group
+ * -----------------
+ * Retreives the consumer group with the given name from the given topic,
+ * creating it if it doesn't exist yet.
+ *
+ * entry - topic the group belongs to
+ * name - name of the group
+ * balance - one of the BalanceCodes, used only if the group is created
+ *
+ * Returns:
+ *      the consumer group
+ *
+ * */
+ConsumerGroup* find_or_add_group(TopicEntry* entry, char* name, int balance);
+
+/* find_group
+ * ----------
+ * Retreives the consumer group with the given name from the given topic.
+ *
+ * entry - topic the group belongs to
+ * name - name of the group
+ *
+ * Returns:
+ *      the consumer group, or NULL if the topic has no such group
+ *
+ * */
+ConsumerGroup* find_group(TopicEntry* entry, char* name);
+
+/* join_group
+ * ----------
+ * Adds the given client to the given consumer group.
+ *
+ * group - group to join
+ * client - client joining the group
+ *
+ * Returns:
+ *      true iff the client joined, false if they were already a member
+ *
+ * */
+bool join_group(ConsumerGroup* group, Client* client);
+
+/* leave_group
+ * -----------
+ * Removes the given client from the given consumer group.
+ *
+ * group - group to leave
+ * client - client leaving the group
+ *
+ * Returns:
+ *      true iff the client left, false if they weren't a member
+ *
+ * */
+bool leave_group(ConsumerGroup* group, Client* client);
+
+/* leave_all_groups
+ * ----------------
+ * Removes the given client from every consumer group of the given topic.
+ *
+ * entry - topic whose groups the client is leaving
+ * client - client leaving the groups
+ *
+ * */
+void leave_all_groups(TopicEntry* entry, Client* client);
+
+/* has_local_subscribers
+ * ---------------------
+ * Checks whether the given topic has any subscribers or consumer group 
+ * members that aren't linked peers (see federation.h). A topic with a
+ * shared memory ring always counts, as its readers aren't tracked.
+ *
+ * NOTE: the string map lock must be held by the caller
+ *
+ * entry - topic to check
+ *
+ * Returns:
+ *      true iff the topic has local subscribers, false otherwise
+ *
+ * */
+bool has_local_subscribers(TopicEntry* entry);
+
+/* publish_to_groups
+ * -----------------
+ * Sends the given message frame to exactly one member of each of the given
+ * topic's consumer groups, chosen as per the group's balancing.
+ *
+ * entry - topic published to
+ * frame - message frame to send (see build_message_frame())
+ * credit - credit of the publisher (see credit.h), NULL if they have none
+ *
+ * */
+void publish_to_groups(TopicEntry* entry, char* frame, struct Credit* credit);
+
+/* queue_in_sequence
+ * -----------------
+ * Queues the given publish in a topic's sequencer, after every publish 
+ * queued before it. Never blocks: if someone already owns the sequencer, 
+ * they deliver the publish in turn.
+ *
+ * sequencer - sequencer of the topic published to
+ * item - publish to queue (dynamically allocated)
+ *
+ * Returns:
+ *      true iff the caller now owns the sequencer, in which case they must
+ *      deliver its queue (see deliver_sequence())
+ *
+ * */
+bool queue_in_sequence(Sequencer* sequencer, SequencedItem* item);
+
+/* deliver_sequence
+ * ----------------
+ * Delivers (in order) up to SEQUENCE_BATCH of the publishes queued in the 
+ * given sequencer, which the caller owns. Publishers therefore deliver a 
+ * batch at a time, however many publishes are queued behind theirs, and 
+ * different topics are delivered to in parallel.
+ *
+ * NOTE: the caller holds the string map lock (for reading) throughout, so 
+ * the topic's subscribers only change between publishes
+ *
+ * sequencer - sequencer to deliver the queue of
+ * deliver - function delivering (and freeing) a publish
+ *
+ * Returns:
+ *      true iff publishes are still queued, in which case the caller still
+ *      owns the sequencer and must carry on delivering (or hand that on)
+ *
+ * */
+bool deliver_sequence(Sequencer* sequencer, void (*deliver)(void* item));
+
+#endif //TOPIC
@@ -0,0 +1,277 @@
+//transportbench.c//
+//-----------//
+//This file benchmarks psserver's TCP transport against its Unix domain
+//socket transport (see the "unix=" option of psserver)
+//-----------//
+
+#include "shared.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define USAGE "Usage: transportbench portnum socketpath [messages] [size]\n"
+#define PORT_INDEX 1
+#define PATH_INDEX 2
+#define MESSAGES_INDEX 3
+#define SIZE_INDEX 4
+#define MIN_NUM_ARGS 3
+#define DEFAULT_MESSAGES 100000
+#define DEFAULT_SIZE 64
+//number of round trips timed for the latency test
+#define ROUND_TRIPS 10000
+#define LOCALHOST "localhost"
+#define NS_PER_SEC 1000000000L
+#define NS_PER_US 1000.0
+#define BYTES_PER_MB (1024.0 * 1024.0)
+#define PERCENTILE_50 0.5
+#define PERCENTILE_99 0.99
+
+/* Defines the Connection structure, which holds the two ends of a
+ * connection to psserver:
+ *
+ *      fromServer - read end
+ *      toServer - write end
+ * */
+typedef struct {
+    FILE* fromServer;
+    FILE* toServer;
+} Connection;
+
+/* Defines the Transport structure, which describes one of the transports
+ * being benchmarked:
+ *
+ *      name - name it's reported under
+ *      address - port (TCP) or socket path (Unix)
+ *      isUnix - true iff it's a Unix domain socket
+ * */
+typedef struct {
+    char* name;
+    char* address;
+    bool isUnix;
+} Transport;
+
+/* Defines the ReaderArgs structure passed to the subscriber's reader
+ * thread:
+ *
+ *      conn - subscriber's connection
+ *      numMessages - number of messages to read
+ *      doneAt - time (ns) the last message was read
+ * */
+typedef struct {
+    Connection* conn;
+    int numMessages;
+    long doneAt;
+} ReaderArgs;
+
+/* now_ns
+ * ------
+ * Returns the current (monotonic) time in nanoseconds.
+ * */
+long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* open_connection
+ * ---------------
+ * Connects to psserver over the given transport and names the connection.
+ *
+ * transport - transport to connect over
+ * name - name to give the connection
+ *
+ * Returns:
+ *      the connection (exits if it can't be made)
+ *
+ * */
+Connection open_connection(Transport* transport, char* name) {
+    int fd;
+    if (transport->isUnix) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(struct sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, transport->address,
+                sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*)&addr,
+                sizeof(struct sockaddr_un))) {
+            fd = -1;
+        }
+    } else {
+        fd = connect_to_host(LOCALHOST, transport->address);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "transportbench: unable to connect to %s\n",
+                transport->address);
+        exit(1);
+    }
+    Connection conn;
+    conn.fromServer = fdopen(fd, "r");
+    conn.toServer = fdopen(dup(fd), "w");
+    fprintf(conn.toServer, "name %s\n", name);
+    return conn;
+}
+
+/* close_connection
+ * ----------------
+ * Closes both ends of the given connection.
+ * */
+void close_connection(Connection* conn) {
+    fclose(conn->toServer);
+    fclose(conn->fromServer);
+}
+
+/* subscribe_and_sync
+ * ------------------
+ * Subscribes the given connection to the given topic and waits until the
+ * subscription is in place (by publishing to the topic and waiting to
+ * receive it back).
+ *
+ * conn - connection to subscribe
+ * topic - topic to subscribe to
+ *
+ * */
+void subscribe_and_sync(Connection* conn, char* topic) {
+    fprintf(conn->toServer, "sub %s\npub %s ready\n", topic, topic);
+    fflush(conn->toServer);
+    char* line = NULL;
+    size_t lineLen = 0;
+    getline(&line, &lineLen, conn->fromServer);
+    free(line);
+}
+
+/* reader_thread
+ * -------------
+ * Thread that reads the given number of messages from the subscriber's
+ * connection, noting when the last one arrived.
+ *
+ * arg - ReaderArgs structure
+ *
+ * */
+void* reader_thread(void* arg) {
+    ReaderArgs* args = (ReaderArgs*)arg;
+    int numRead = 0;
+    int c;
+    while (numRead < args->numMessages &&
+            (c = getc_unlocked(args->conn->fromServer)) != EOF) {
+        numRead += c == '\n';
+    }
+    args->doneAt = now_ns();
+    return NULL;
+}
+
+/* bench_throughput
+ * ----------------
+ * Publishes the given number of messages through psserver as fast as
+ * possible from one connection to a subscriber on another, and reports the
+ * rate they arrive at.
+ *
+ * transport - transport to benchmark
+ * numMessages - number of messages to publish
+ * value - value to publish
+ *
+ * */
+void bench_throughput(Transport* transport, int numMessages, char* value) {
+    Connection sub = open_connection(transport, "benchsub");
+    Connection pub = open_connection(transport, "benchpub");
+    subscribe_and_sync(&sub, "bench");
+
+    ReaderArgs args = {&sub, numMessages, 0};
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_thread, &args);
+    long start = now_ns();
+    for (int i = 0; i < numMessages; i++) {
+        fprintf(pub.toServer, "pub bench %s\n", value);
+    }
+    fflush(pub.toServer);
+    pthread_join(reader, NULL);
+
+    double secs = (double)(args.doneAt - start) / NS_PER_SEC;
+    //bytes delivered to the subscriber, ie: "benchpub:bench:<value>\n"
+    double numBytes = (double)numMessages *
+            (strlen("benchpub:bench:\n") + strlen(value));
+    printf("transport=%s test=throughput messages=%d size=%zu "
+            "msgs_per_sec=%.0f mb_per_sec=%.2f\n", transport->name,
+            numMessages, strlen(value), numMessages / secs,
+            numBytes / BYTES_PER_MB / secs);
+    close_connection(&pub);
+    close_connection(&sub);
+}
+
+/* compare_longs
+ * -------------
+ * qsort() comparison function for longs.
+ * */
+int compare_longs(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+/* bench_latency
+ * -------------
+ * Times round trips of a message published by a connection to a topic it
+ * is itself subscribed to, and reports the round trip time percentiles.
+ *
+ * transport - transport to benchmark
+ * value - value to publish
+ *
+ * */
+void bench_latency(Transport* transport, char* value) {
+    Connection conn = open_connection(transport, "benchrtt");
+    subscribe_and_sync(&conn, "rtt");
+    long* rtts = malloc(sizeof(long) * ROUND_TRIPS);
+    char* line = NULL;
+    size_t lineLen = 0;
+    for (int i = 0; i < ROUND_TRIPS; i++) {
+        long start = now_ns();
+        fprintf(conn.toServer, "pub rtt %s\n", value);
+        fflush(conn.toServer);
+        getline(&line, &lineLen, conn.fromServer);
+        rtts[i] = now_ns() - start;
+    }
+    qsort(rtts, ROUND_TRIPS, sizeof(long), compare_longs);
+    printf("transport=%s test=latency round_trips=%d size=%zu "
+            "rtt_p50_us=%.1f rtt_p99_us=%.1f\n", transport->name,
+            ROUND_TRIPS, strlen(value),
+            rtts[(int)(ROUND_TRIPS * PERCENTILE_50)] / NS_PER_US,
+            rtts[(int)(ROUND_TRIPS * PERCENTILE_99)] / NS_PER_US);
+    free(line);
+    free(rtts);
+    close_connection(&conn);
+}
+
+int main(int argc, char** argv) {
+    if (argc < MIN_NUM_ARGS) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    int numMessages = argc > MESSAGES_INDEX ?
+            atoi(argv[MESSAGES_INDEX]) : DEFAULT_MESSAGES;
+    int size = argc > SIZE_INDEX ? atoi(argv[SIZE_INDEX]) : DEFAULT_SIZE;
+    if (numMessages <= 0 || size <= 0) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    char* value = malloc(sizeof(char) * (size + 1));
+    memset(value, 'x', size);
+    value[size] = '\0';
+
+    Transport transports[] = {
+        {"tcp", argv[PORT_INDEX], false},
+        {"unix", argv[PATH_INDEX], true}
+    };
+    for (int i = 0; i < sizeof(transports) / sizeof(Transport); i++) {
+        bench_throughput(&transports[i], numMessages, value);
+        bench_latency(&transports[i], value);
+    }
+    free(value);
+    return 0;
+}